@@ -172,6 +172,23 @@ void handleCmdLine()
     const QCommandLineOption textureOutputDirOpt("out-dir","Directory for the textures computed","output directory",".");
     const QCommandLineOption saveResultAsRadianceOpt("radiance","Save result as radiance instead of XYZW components");
     const QCommandLineOption textureSavePrecisionOpt("texture-save-precision","Number of bits of precision when saving 3D textures, from 1 to 24. Smaller number improves compressibility. Too small destroys fidelity.","bits");
+    const QCommandLineOption layersPerDrawCallOpt("layers-per-draw-call","Number of 3D texture layers rendered by one draw call, 0 meaning all at once (default: 8). "
+                                                                         "Larger batches are faster, but may trigger GPU watchdog on slow hardware.","count");
+    const QCommandLineOption functionTablePointsOpt("tabulate-functions","Tabulate number densities and phase functions of the scatterers into tables of the given "
+                                                                         "number of points, and look them up instead of evaluating them in the integration loops. "
+                                                                         "Maximum lookup errors are reported. Saved rendering shaders still use the original functions.","points");
+    const QCommandLineOption convergenceThresholdOpt("convergence-threshold","Stop computing scattering orders once the relative contribution of the last order "
+                                                                             "to multiple scattering is below this value, even if fewer orders than requested "
+                                                                             "have been computed (default: 0, meaning compute all orders).","value");
+    const QCommandLineOption textureMemoryBudgetOpt("texture-memory-budget","Limit video memory used by all the textures to this amount. Accumulators of "
+                                                                            "the results are then kept in scratch files and updated in chunks of altitude layers, "
+                                                                            "which is slower, but lets larger textures be computed.","MiB");
+    const QCommandLineOption rebuildAllOpt("rebuild-all","Recompute all the textures, even those whose inputs are unchanged since the previous run "
+                                                        "according to the dependency manifest in the output directory");
+    const QCommandLineOption estimateOpt("estimate","Print texture memory used at each stage, sizes of the output files and amount of computation "
+                                                    "for the atmosphere model, and quit without computing anything");
+    const QCommandLineOption estimateBenchmarkOpt("estimate-benchmark","Like --estimate, but also time one layer of each expensive stage on the GPU "
+                                                                      "and extrapolate the wall time of the whole computation");
     const QCommandLineOption dbgNoSaveTexturesOpt("no-save-tex","Don't save textures, only save shaders and other fast-to-compute data; don't run the long 4D "
                                                                 "textures computations (for debugging)");
     const QCommandLineOption dbgNoEDSTexturesOpt("no-eds-tex","Don't compute/save eclipsed double scattering textures (for debugging)");
@@ -187,6 +204,13 @@ void handleCmdLine()
                         textureOutputDirOpt,
                         saveResultAsRadianceOpt,
                         textureSavePrecisionOpt,
+                        layersPerDrawCallOpt,
+                        functionTablePointsOpt,
+                        convergenceThresholdOpt,
+                        textureMemoryBudgetOpt,
+                        rebuildAllOpt,
+                        estimateOpt,
+                        estimateBenchmarkOpt,
                         dbgNoEDSTexturesOpt,
                         dbgNoSaveTexturesOpt,
                         printOpenGLInfoAndQuit,
@@ -244,6 +268,12 @@ void handleCmdLine()
         opts.openglDebugFull=true;
     if(parser.isSet(printOpenGLInfoAndQuit))
         opts.printOpenGLInfoAndQuit=true;
+    if(parser.isSet(rebuildAllOpt))
+        opts.rebuildAll=true;
+    if(parser.isSet(estimateOpt))
+        opts.estimateCosts=true;
+    if(parser.isSet(estimateBenchmarkOpt))
+        opts.estimateCosts=opts.estimateWithBenchmark=true;
     if(parser.isSet(textureSavePrecisionOpt))
     {
         bool ok=false;
@@ -259,6 +289,51 @@ void handleCmdLine()
             throw MustQuit{};
         }
     }
+    if(parser.isSet(layersPerDrawCallOpt))
+    {
+        bool ok=false;
+        opts.layersPerDrawCall=parser.value(layersPerDrawCallOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Failed to parse number of layers per draw call\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(functionTablePointsOpt))
+    {
+        bool ok=false;
+        opts.functionTablePoints=parser.value(functionTablePointsOpt).toUInt(&ok);
+        if(!ok)
+        {
+            std::cerr << "Failed to parse number of function table points\n";
+            throw MustQuit{};
+        }
+        if(opts.functionTablePoints < 2)
+        {
+            std::cerr << "Function tables must have at least 2 points.\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(convergenceThresholdOpt))
+    {
+        bool ok=false;
+        opts.scatteringConvergenceThreshold=parser.value(convergenceThresholdOpt).toDouble(&ok);
+        if(!ok || !(opts.scatteringConvergenceThreshold>=0))
+        {
+            std::cerr << "Failed to parse convergence threshold, it must be a nonnegative number\n";
+            throw MustQuit{};
+        }
+    }
+    if(parser.isSet(textureMemoryBudgetOpt))
+    {
+        bool ok=false;
+        opts.textureMemoryBudgetMiB=parser.value(textureMemoryBudgetOpt).toUInt(&ok);
+        if(!ok || opts.textureMemoryBudgetMiB==0)
+        {
+            std::cerr << "Failed to parse texture memory budget, it must be a positive number of MiB\n";
+            throw MustQuit{};
+        }
+    }
 
     const auto posArgs=parser.positionalArguments();
     if(posArgs.size()>1)
@@ -26,6 +26,9 @@ enum FBOId
     FBO_MULTIPLE_SCATTERING,
     FBO_ECLIPSED_DOUBLE_SCATTERING,
     FBO_LIGHT_POLLUTION,
+    FBO_FUNCTION_TABLES,
+    FBO_CONVERGENCE_CHECK,
+    FBO_ACCUMULATION_CHUNK,
 
     FBO_COUNT
 };
@@ -42,7 +45,10 @@ enum TextureId
     TEX_LIGHT_POLLUTION_SCATTERING,
     TEX_LIGHT_POLLUTION_DELTA_SCATTERING,
     TEX_LIGHT_POLLUTION_SCATTERING_LUMINANCE,
-    TEX_LIGHT_POLLUTION_SCATTERING_PREV_ORDER,
+    TEX_LIGHT_POLLUTION_DELTA_SCATTERING_EVEN_ORDER, // odd orders are in TEX_LIGHT_POLLUTION_DELTA_SCATTERING
+    TEX_FUNCTION_TABLES,
+    TEX_DELTA_SCATTERING_LAYERS_AVERAGE,
+    TEX_ACCUMULATION_CHUNK,
 
     TEX_COUNT
 };
@@ -53,9 +59,16 @@ inline std::map<QString/*scatterer name*/, GLuint> accumulatedSingleScatteringTe
 struct Options
 {
     unsigned textureSavePrecision = 0; // 0 means not reduced
+    unsigned layersPerDrawCall = 8; // 0 means all layers at once
+    unsigned functionTablePoints = 0; // 0 means no tabulation, functions are evaluated directly
+    double scatteringConvergenceThreshold = 0; // 0 means all the scattering orders requested are computed
+    unsigned textureMemoryBudgetMiB = 0; // 0 means all 4D textures are kept in VRAM
     bool openglDebug=false;
     bool openglDebugFull=false;
     bool printOpenGLInfoAndQuit=false;
+    bool estimateCosts=false;
+    bool estimateWithBenchmark=false;
+    bool rebuildAll=false;
     bool saveResultAsRadiance=false;
     bool dbgNoSaveTextures=false;
     bool dbgNoEDSTextures=false;
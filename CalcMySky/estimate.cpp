@@ -0,0 +1,416 @@
+#include "estimate.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <functional>
+#include <QRegularExpression>
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+#include "out-of-core.hpp"
+#include "function-tables.hpp"
+#include "../common/timing.hpp"
+
+namespace
+{
+
+constexpr double TEXEL_SIZE=sizeof(glm::vec4);
+
+std::string formatSize(double bytes)
+{
+    const char*const units[]={"B", "KiB", "MiB", "GiB", "TiB"};
+    unsigned unit=0;
+    while(bytes>=1024 && unit+1<std::size(units))
+    {
+        bytes/=1024;
+        ++unit;
+    }
+    std::ostringstream ss;
+    ss << std::setprecision(3) << bytes << ' ' << units[unit];
+    return ss.str();
+}
+
+std::string formatCount(const double count)
+{
+    std::ostringstream ss;
+    ss << std::setprecision(3) << count;
+    return ss.str();
+}
+
+std::string formatSeconds(const double seconds)
+{
+    using namespace std::chrono;
+    const auto t0=steady_clock::now();
+    return formatDeltaTime(t0, t0+duration_cast<steady_clock::duration>(duration<double>(seconds)));
+}
+
+double texture2DSize(const double width, const double height)
+{
+    return width*height*TEXEL_SIZE;
+}
+
+double scatteringLayerSize()
+{
+    return texture2DSize(atmo.scatTexWidth(), atmo.scatTexHeight());
+}
+
+double scatteringTextureSize()
+{
+    return scatteringLayerSize()*atmo.scatTexDepth();
+}
+
+// Scatterers with the general phase function get a separate single scattering texture for each wavelength set
+bool hasGeneralPhaseFunction(AtmosphereParameters::Scatterer const& scatterer)
+{
+    return opts.saveResultAsRadiance || scatterer.phaseFunctionType==PhaseFunctionType::General;
+}
+
+unsigned multipleScatteringOrderCount()
+{
+    return atmo.scatteringOrdersToCompute>=2 ? atmo.scatteringOrdersToCompute-1 : 0;
+}
+
+// Scattering density of order 2 is computed by one pass for radiation from the ground plus one pass per scatterer
+double scatteringDensityPassCount()
+{
+    if(atmo.scatteringOrdersToCompute<2) return 0;
+    return 1+atmo.scatterers.size() + (atmo.scatteringOrdersToCompute-2);
+}
+
+// Indirect irradiance of order 2 is computed in one pass per scatterer
+double indirectIrradiancePassCount()
+{
+    if(atmo.scatteringOrdersToCompute<2) return 0;
+    return atmo.scatterers.size() + (atmo.scatteringOrdersToCompute-2);
+}
+
+bool eclipsedDoubleScatteringIsComputed()
+{
+    return !atmo.noEclipsedDoubleScatteringTextures && !opts.dbgNoEDSTextures;
+}
+
+double eclipsedDoubleScatteringSampleCount()
+{
+    // Coarse grid of directions: azimuth pairs times elevation pairs, above and below horizon, for each SZA and altitude
+    return 4.*atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample*atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample*
+              atmo.eclipsedDoubleScatteringTextureSize[2]*atmo.eclipsedDoubleScatteringTextureSize[3];
+}
+
+void printMemoryEstimates()
+{
+    const auto transmittance=texture2DSize(atmo.transmittanceTexW, atmo.transmittanceTexH);
+    const auto irradiance=2*texture2DSize(atmo.irradianceTexW, atmo.irradianceTexH); // delta and accumulated
+    const auto scattering=scatteringTextureSize(); // delta scattering or scattering density
+    const auto accumulator = outOfCoreMode() ? scatteringLayerSize()*altitudeLayersPerChunk() : scattering;
+    double singleScatteringAccumulators=0;
+    if(!outOfCoreMode())
+    {
+        for(const auto& scatterer : atmo.scatterers)
+            if(!hasGeneralPhaseFunction(scatterer))
+                singleScatteringAccumulators += scattering;
+    }
+    const auto lightPollution=4*texture2DSize(atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+    const auto eclipsed=texture2DSize(atmo.eclipseAngularIntegrationPoints, atmo.radialIntegrationPoints);
+    const auto allocatedAtStart=transmittance+irradiance+2*scattering+accumulator+lightPollution+eclipsed+auxiliaryTexturesSize();
+
+    std::cerr << "Texture memory used by stage of computation:\n";
+    const auto printStage=[](const char*const stage, const double size)
+    {
+        std::cerr << "  " << std::left << std::setw(45) << stage << formatSize(size) << "\n";
+    };
+    printStage("transmittance and direct irradiance", transmittance+irradiance);
+    printStage("light pollution", transmittance+lightPollution);
+    printStage("single scattering and order 2 density", transmittance+irradiance+2*scattering+
+                                                        (outOfCoreMode() ? accumulator : singleScatteringAccumulators));
+    printStage("multiple scattering", transmittance+irradiance+2*scattering+accumulator);
+    printStage("eclipsed double scattering", transmittance+eclipsed);
+    std::cerr << "Textures allocated at start: " << formatSize(allocatedAtStart)
+              << ", at peak: " << formatSize(allocatedAtStart+singleScatteringAccumulators) << "\n";
+    if(eclipsedDoubleScatteringIsComputed())
+    {
+        std::cerr << "Host memory for eclipsed double scattering samples: "
+                  << formatSize(2*eclipsedDoubleScatteringSampleCount()*TEXEL_SIZE) << "\n";
+    }
+}
+
+void printOutputFileEstimates()
+{
+    struct OutputFiles
+    {
+        std::string name;
+        double count;
+        double size;
+    };
+    const double wlSetCount=atmo.allWavelengths.size();
+    // Some final textures are saved for each wavelength set in radiance mode, and only once otherwise
+    const double finalTexCount = opts.saveResultAsRadiance ? wlSetCount : 1;
+    const auto finalTexSuffix = opts.saveResultAsRadiance ? "-wlset*.f32" : "-xyzw.f32";
+    const auto& sizes=atmo.scatteringTextureSize;
+    const double header2D=2*sizeof(uint16_t), header4D=4*sizeof(uint16_t);
+    const double scattering=header4D+scatteringTextureSize();
+    // Guides represent points between rows, so there's one less of them than rows
+    const double guides01=header4D+double(sizes[0])*(sizes[1]-1)*sizes[2]*sizes[3]*sizeof(int16_t);
+    const double guides02=header4D+double(sizes[0])*sizes[1]*(sizes[2]-1)*sizes[3]*sizeof(int16_t);
+
+    std::vector<OutputFiles> files;
+    files.push_back({"transmittance-wlset*.f32", wlSetCount,
+                     header2D+texture2DSize(atmo.transmittanceTexW, atmo.transmittanceTexH)});
+    files.push_back({"irradiance-wlset*.f32", wlSetCount,
+                     header2D+texture2DSize(atmo.irradianceTexW, atmo.irradianceTexH)});
+    for(const auto& scatterer : atmo.scatterers)
+    {
+        const bool perWLSet=hasGeneralPhaseFunction(scatterer);
+        const auto base = perWLSet ? "single-scattering/*/"+scatterer.name.toStdString()
+                                   : "single-scattering/"+scatterer.name.toStdString()+"-xyzw";
+        const auto count = perWLSet ? wlSetCount : 1;
+        files.push_back({base+".f32", count, scattering});
+        if(scatterer.needsInterpolationGuides)
+        {
+            files.push_back({base+"-dims01.guides2d", count, guides01});
+            files.push_back({base+"-dims02.guides2d", count, guides02});
+        }
+    }
+    if(atmo.scatteringOrdersToCompute>=2)
+        files.push_back({std::string("multiple-scattering")+finalTexSuffix, finalTexCount, scattering});
+    if(eclipsedDoubleScatteringIsComputed())
+    {
+        files.push_back({std::string("eclipsed-double-scattering")+finalTexSuffix, finalTexCount,
+                         sizeof(uint16_t)+eclipsedDoubleScatteringSampleCount()*TEXEL_SIZE});
+    }
+    files.push_back({std::string("light-pollution")+finalTexSuffix, finalTexCount,
+                     header2D+texture2DSize(atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1])});
+
+    std::cerr << "Output files (shaders and params.atmo not included):\n";
+    double total=0;
+    for(const auto& file : files)
+    {
+        std::cerr << "  " << std::left << std::setw(45) << file.name << file.count << " x " << formatSize(file.size) << "\n";
+        total += file.count*file.size;
+    }
+    std::cerr << "Total size of output files: " << formatSize(total) << "\n";
+}
+
+void printComputationEstimates()
+{
+    struct Stage
+    {
+        const char* name;
+        double passesPerWLSet;
+        double invocationsPerPass;
+        double pointsPerInvocation;
+    };
+    const double scatTexelCount=double(atmo.scatTexWidth())*atmo.scatTexHeight()*atmo.scatTexDepth();
+    const double irradianceTexelCount=double(atmo.irradianceTexW)*atmo.irradianceTexH;
+    const double lightPollutionTexelCount=double(atmo.lightPollutionTextureSize[0])*atmo.lightPollutionTextureSize[1];
+    const Stage stages[]={
+        {"transmittance", 1, double(atmo.transmittanceTexW)*atmo.transmittanceTexH, double(atmo.numTransmittanceIntegrationPoints)},
+        {"single scattering", double(atmo.scatterers.size()), scatTexelCount, double(atmo.radialIntegrationPoints)},
+        {"scattering density", scatteringDensityPassCount(), scatTexelCount, double(atmo.angularIntegrationPoints)},
+        {"indirect irradiance", indirectIrradiancePassCount(), irradianceTexelCount, atmo.angularIntegrationPoints/2.},
+        {"multiple scattering", double(multipleScatteringOrderCount()), scatTexelCount, double(atmo.radialIntegrationPoints)},
+        {"eclipsed double scattering", eclipsedDoubleScatteringIsComputed() ? 1. : 0.,
+            eclipsedDoubleScatteringSampleCount()*atmo.eclipseAngularIntegrationPoints*atmo.radialIntegrationPoints,
+            double(atmo.radialIntegrationPoints)},
+        {"light pollution single scattering", 1, lightPollutionTexelCount,
+            double(atmo.radialIntegrationPoints)*atmo.lightPollutionAngularIntegrationPoints},
+        {"light pollution multiple scattering", double(multipleScatteringOrderCount()), lightPollutionTexelCount,
+            double(atmo.radialIntegrationPoints)*atmo.lightPollutionAngularIntegrationPoints},
+    };
+
+    const double wlSetCount=atmo.allWavelengths.size();
+    std::cerr << "Computation for " << wlSetCount << " wavelength sets (passes x shader invocations x integration points):\n";
+    double total=0;
+    for(const auto& stage : stages)
+    {
+        const auto passes=stage.passesPerWLSet*wlSetCount;
+        const auto points=passes*stage.invocationsPerPass*stage.pointsPerInvocation;
+        std::cerr << "  " << std::left << std::setw(45) << stage.name << passes << " x " << formatCount(stage.invocationsPerPass)
+                  << " x " << stage.pointsPerInvocation << " = " << formatCount(points) << "\n";
+        total += points;
+    }
+    std::cerr << "Total integration points: " << formatCount(total) << "\n";
+}
+
+// The first draw may include lazy work of the driver like final compilation of the shaders, so it's not timed
+double timeOfDraw(std::function<void()> const& draw)
+{
+    draw();
+    gl.glFinish();
+    const auto t0=std::chrono::steady_clock::now();
+    draw();
+    gl.glFinish();
+    const auto t1=std::chrono::steady_clock::now();
+    OPENGL_DEBUG_CHECK_ERROR("Benchmark draw FAILED");
+    return std::chrono::duration<double>(t1-t0).count();
+}
+
+}
+
+void printCostEstimates()
+{
+    printMemoryEstimates();
+    printOutputFileEstimates();
+    printComputationEstimates();
+}
+
+void runEstimationBenchmark()
+{
+    if(atmo.scatterers.empty())
+    {
+        std::cerr << "No scatterers in the model, nothing to benchmark\n";
+        return;
+    }
+
+    std::cerr << "Benchmarking one layer of each stage for the first wavelength set...\n";
+    OutputIndentIncrease incr;
+
+    const auto& scatterer=atmo.scatterers.front();
+    const auto& wavelengths=atmo.allWavelengths.front();
+    initConstHeader(wavelengths);
+    virtualSourceFiles[COMPUTE_TRANSMITTANCE_SHADER_FILENAME]=makeTransmittanceComputeFunctionsSrc(wavelengths);
+    virtualSourceFiles[TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME]=makeTotalScatteringCoefSrc();
+    virtualHeaderFiles[RADIANCE_TO_LUMINANCE_HEADER_FILENAME]="const mat4 radianceToLuminance=" +
+                                                              toString(radianceToLuminance(0, atmo.allWavelengths)) + ";\n";
+    // These sources have what all the benchmarked passes need, the single scattering ones being for the first scatterer
+    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc()+
+                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
+                    "vec4 scatteringCrossSection() { return "+toString(scatterer.scatteringCrossSection(wavelengths))+"; }\n";
+    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
+        "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
+    virtualSourceFiles[COMPUTE_SCATTERING_DENSITY_FILENAME]=getShaderSrc(COMPUTE_SCATTERING_DENSITY_FILENAME,IgnoreCache{})
+                                         .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false");
+    if(opts.functionTablePoints)
+        computeFunctionTables();
+
+    gl.glDisable(GL_BLEND);
+    // Uninitialized textures might contain NaNs or denormals, which could make sampling them unrepresentatively slow
+    gl.glClearColor(0,0,0,0);
+    for(const auto tex : {TEX_DELTA_SCATTERING, TEX_DELTA_SCATTERING_DENSITY, TEX_DELTA_IRRADIANCE})
+    {
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_DELTA_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[tex],0);
+        checkFramebufferStatus("framebuffer for clearing of benchmark textures");
+        gl.glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // Layers at mid-altitude have view rays of typical length
+    const GLsizei layer=atmo.scatTexDepth()/2;
+    const auto renderLayer=[layer](QOpenGLShaderProgram& program)
+    {
+        program.setUniformValue("firstLayer", layer);
+        program.setUniformValue("chunkFirstLayer", layer);
+        renderQuad(1);
+    };
+
+    std::cerr << indentOutput() << "Transmittance... ";
+    double transmittanceTime;
+    {
+        const auto program=compileShaderProgram("compute-transmittance.frag", "transmittance computation shader program");
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_TRANSMITTANCE]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_TRANSMITTANCE],0);
+        checkFramebufferStatus("framebuffer for transmittance texture");
+        gl.glViewport(0, 0, atmo.transmittanceTexW, atmo.transmittanceTexH);
+        program->bind();
+        transmittanceTime=timeOfDraw([]{ renderQuad(); });
+    }
+    std::cerr << formatSeconds(transmittanceTime) << "\n";
+
+    gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
+
+    std::cerr << indentOutput() << "Single scattering layer... ";
+    double singleScatteringLayerTime;
+    {
+        const auto program=compileShaderProgram("compute-single-scattering.frag",
+                                                "single scattering computation shader program", UseGeomShader{});
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_DELTA_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING],0);
+        checkFramebufferStatus("framebuffer for first scattering");
+        program->bind();
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
+        singleScatteringLayerTime=timeOfDraw([&]{ renderLayer(*program); });
+    }
+    std::cerr << formatSeconds(singleScatteringLayerTime) << "\n";
+
+    std::cerr << indentOutput() << "Scattering density layer... ";
+    double scatteringDensityLayerTime;
+    {
+        const auto program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                                "scattering density computation shader program", UseGeomShader{});
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING_DENSITY],0);
+        checkFramebufferStatus("framebuffer for scattering density");
+        program->bind();
+        // Orders above 2 take both the ground and the atmosphere into account, so they are the most expensive ones
+        program->setUniformValue("scatteringOrder", 3);
+        setScatteringSamplerUnits(*program);
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,UNIT_TRANSMITTANCE      ,"transmittanceTexture");
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,UNIT_IRRADIANCE         ,"irradianceTexture");
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_MULTIPLE_SCATTERING,"multipleScatteringTexture");
+        scatteringDensityLayerTime=timeOfDraw([&]{ renderLayer(*program); });
+    }
+    std::cerr << formatSeconds(scatteringDensityLayerTime) << "\n";
+
+    std::cerr << indentOutput() << "Multiple scattering layer... ";
+    double multipleScatteringLayerTime;
+    {
+        const auto program=compileShaderProgram("compute-multiple-scattering.frag",
+                                                "multiple scattering computation shader program", UseGeomShader{});
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING],0);
+        checkFramebufferStatus("framebuffer for delta multiple scattering");
+        program->bind();
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING_DENSITY,1,"scatteringDensityTexture");
+        multipleScatteringLayerTime=timeOfDraw([&]{ renderLayer(*program); });
+    }
+    std::cerr << formatSeconds(multipleScatteringLayerTime) << "\n";
+
+    std::cerr << indentOutput() << "Indirect irradiance... ";
+    double indirectIrradianceTime;
+    {
+        const auto program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+                                                "indirect irradiance computation shader program");
+        gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_IRRADIANCE]);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_IRRADIANCE],0);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,textures[TEX_IRRADIANCE],0);
+        checkFramebufferStatus("framebuffer for irradiance texture");
+        setDrawBuffers({GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1});
+        gl.glViewport(0, 0, atmo.irradianceTexW, atmo.irradianceTexH);
+        program->bind();
+        program->setUniformValue("scatteringOrder", 3);
+        setScatteringSamplerUnits(*program);
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_MULTIPLE_SCATTERING,"multipleScatteringTexture");
+        indirectIrradianceTime=timeOfDraw([]{ renderQuad(); });
+    }
+    std::cerr << formatSeconds(indirectIrradianceTime) << "\n";
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+    const double depth=atmo.scatTexDepth();
+    const double wlSetCount=atmo.allWavelengths.size();
+    struct Stage
+    {
+        const char* name;
+        double seconds;
+    };
+    const Stage stages[]={
+        {"transmittance", wlSetCount*transmittanceTime},
+        {"single scattering", wlSetCount*atmo.scatterers.size()*depth*singleScatteringLayerTime},
+        {"scattering density", wlSetCount*scatteringDensityPassCount()*depth*scatteringDensityLayerTime},
+        {"indirect irradiance", wlSetCount*indirectIrradiancePassCount()*indirectIrradianceTime},
+        {"multiple scattering", wlSetCount*multipleScatteringOrderCount()*depth*multipleScatteringLayerTime},
+    };
+    std::cerr << "Extrapolated wall time (eclipsed double scattering, light pollution, accumulation and saving not included):\n";
+    double total=0;
+    for(const auto& stage : stages)
+    {
+        std::cerr << "  " << std::left << std::setw(45) << stage.name << formatSeconds(stage.seconds) << "\n";
+        total += stage.seconds;
+    }
+    std::cerr << "Total extrapolated wall time: " << formatSeconds(total) << "\n";
+}
@@ -0,0 +1,15 @@
+#ifndef INCLUDE_ONCE_80166F48_36F0_4FEA_BDB4_D625D4804CF4
+#define INCLUDE_ONCE_80166F48_36F0_4FEA_BDB4_D625D4804CF4
+
+/*
+ * Prints, for the parsed atmosphere model, texture memory used at each stage of computation, sizes of the output
+ * files, and the number of shader invocations and integration points of each stage. Doesn't need OpenGL.
+ */
+void printCostEstimates();
+/*
+ * Times computation of a single layer of each expensive stage for the first wavelength set, and extrapolates it to
+ * the wall time of the whole computation. Needs the OpenGL context and textures to be initialized.
+ */
+void runEstimationBenchmark();
+
+#endif
@@ -0,0 +1,256 @@
+#include "function-tables.hpp"
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <QStringList>
+#include <glm/glm.hpp>
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+
+namespace
+{
+
+constexpr char FUNCTION_TABLES_SHADER_FILENAME[]="compute-function-tables.frag";
+
+bool tablesComputed=false;
+
+struct TabulatedFunction
+{
+    QString name;
+    QStringList sourceFileNames; // the virtual files where the analytic function is defined
+    QString analyticSrc;
+    // Arguments: function name, row in the table
+    QString (*makeTabulatedSrc)(QString const&, int);
+    // GLSL expression mapping the table coordinate u in [0,1] to the argument of the function
+    QString argumentFromCoordinate;
+};
+
+QString makeLookupSrc(const int row, QString const& coordinate, const char*const swizzle)
+{
+    const auto lastPoint=QString::number(opts.functionTablePoints-1);
+    const auto rowStr=QString::number(row);
+    // Interpolating manually, because hardware filtering may use low-precision weights
+    return "    CONST float x="+coordinate+"*"+lastPoint+";\n"
+           "    CONST int i=clamp(int(x), 0, "+lastPoint+"-1);\n"
+           "    return mix(texelFetch("+FUNCTION_TABLES_UNIFORM_NAME+", ivec2(i  ,"+rowStr+"), 0)"+swizzle+",\n"
+           "               texelFetch("+FUNCTION_TABLES_UNIFORM_NAME+", ivec2(i+1,"+rowStr+"), 0)"+swizzle+", x-i);\n";
+}
+
+QString makeTabulatedDensitySrc(QString const& functionName, const int row)
+{
+    return "float "+functionName+"(float altitude)\n"
+           "{\n"
+           +makeLookupSrc(row, "clamp(altitude/atmosphereHeight, 0., 1.)", ".x")+
+           "}\n";
+}
+
+QString makeTabulatedPhaseFunctionSrc(QString const& functionName, const int row)
+{
+    // Sampling uniformly in scattering angle rather than in its cosine resolves forward scattering peaks better
+    return "vec4 "+functionName+"(float dotViewSun)\n"
+           "{\n"
+           +makeLookupSrc(row, "acos(clamp(dotViewSun, -1., 1.))/PI", "")+
+           "}\n";
+}
+
+std::vector<TabulatedFunction> functionsToTabulate()
+{
+    // The transmittance computation source has its own copy of the density functions
+    const QStringList densitiesSourceFileNames{DENSITIES_SHADER_FILENAME, COMPUTE_TRANSMITTANCE_SHADER_FILENAME};
+    std::vector<TabulatedFunction> functions;
+    for(auto const& scatterer : atmo.scatterers)
+    {
+        functions.push_back({"scattererNumberDensity_"+scatterer.name, densitiesSourceFileNames,
+                             makeScattererDensityFunctionSrc(scatterer), makeTabulatedDensitySrc, "u*atmosphereHeight"});
+    }
+    for(auto const& absorber : atmo.absorbers)
+    {
+        functions.push_back({"absorberNumberDensity_"+absorber.name, densitiesSourceFileNames,
+                             makeAbsorberDensityFunctionSrc(absorber), makeTabulatedDensitySrc, "u*atmosphereHeight"});
+    }
+    for(auto const& scatterer : atmo.scatterers)
+    {
+        functions.push_back({"phaseFunction_"+scatterer.name, {PHASE_FUNCTIONS_SHADER_FILENAME},
+                             makePhaseFunctionSrc(scatterer), makeTabulatedPhaseFunctionSrc, "cos(u*PI)"});
+    }
+    return functions;
+}
+
+QString makeFunctionTablesComputationSrc(std::vector<TabulatedFunction> const& functions)
+{
+    QString src=1+R"(
+#version 330
+#include "version.h.glsl"
+#include "const.h.glsl"
+
+uniform sampler2D )"+QString(FUNCTION_TABLES_UNIFORM_NAME)+R"(;
+uniform bool validate;
+out vec4 result;
+
+)";
+    for(unsigned row=0; row<functions.size(); ++row)
+    {
+        src += functions[row].analyticSrc;
+        src += functions[row].makeTabulatedSrc(functions[row].name+"_tabulated", row);
+    }
+    src += R"(
+void main()
+{
+    // When validating, sample midway between the table points, where the interpolation error is the largest
+    CONST float u = (validate ? gl_FragCoord.x : gl_FragCoord.x-0.5) / )"+QString::number(opts.functionTablePoints-1)+R"(;
+    CONST int row = int(gl_FragCoord.y);
+)";
+    for(unsigned row=0; row<functions.size(); ++row)
+    {
+        const auto& name=functions[row].name;
+        src += QString(row==0 ? "    if" : "    else if")+"(row=="+QString::number(row)+")\n"
+               "    {\n"
+               "        CONST float arg = "+functions[row].argumentFromCoordinate+";\n"
+               "        result = validate ? abs(vec4("+name+"(arg)-"+name+"_tabulated(arg))) : vec4("+name+"(arg));\n"
+               "    }\n";
+    }
+    src += "}\n";
+    return src;
+}
+
+std::vector<glm::vec4> readTexture(const GLuint texture, const GLsizei width, const GLsizei height)
+{
+    std::vector<glm::vec4> data(width*height);
+    gl.glBindTexture(GL_TEXTURE_2D, texture);
+    gl.glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data.data());
+    gl.glBindTexture(GL_TEXTURE_2D, 0);
+    return data;
+}
+
+void setupTableTexture(const GLuint texture, const GLsizei width, const GLsizei height)
+{
+    gl.glBindTexture(GL_TEXTURE_2D, texture);
+    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width,height,0,GL_RGBA,GL_FLOAT,nullptr);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    gl.glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    gl.glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+}
+
+unsigned tabulatedFunctionCount()
+{
+    return functionsToTabulate().size();
+}
+
+void computeFunctionTables()
+{
+    const auto functions=functionsToTabulate();
+    if(functions.empty()) return;
+
+    const GLsizei width=opts.functionTablePoints, height=functions.size();
+    GLint maxTextureSize=0;
+    gl.glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if(width>maxTextureSize)
+    {
+        std::cerr << "Function table size of " << width << " points is too large: GL_MAX_TEXTURE_SIZE is " << maxTextureSize << "\n";
+        throw MustQuit{};
+    }
+
+    std::cerr << indentOutput() << "Tabulating number densities and phase functions... ";
+
+    virtualSourceFiles[FUNCTION_TABLES_SHADER_FILENAME]=makeFunctionTablesComputationSrc(functions);
+    const auto program=compileShaderProgram(FUNCTION_TABLES_SHADER_FILENAME, "function tabulation shader program");
+    program->bind();
+
+    // Tables of the previous wavelength set must not be bound while being overwritten
+    gl.glActiveTexture(GL_TEXTURE0+UNIT_FUNCTION_TABLES);
+    gl.glBindTexture(GL_TEXTURE_2D, 0);
+    gl.glActiveTexture(GL_TEXTURE0);
+    setupTableTexture(textures[TEX_FUNCTION_TABLES], width, height);
+
+    gl.glDisable(GL_BLEND);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_FUNCTION_TABLES]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_FUNCTION_TABLES],0);
+    checkFramebufferStatus("framebuffer for function tables");
+    gl.glViewport(0, 0, width, height);
+    program->setUniformValue("validate", false);
+    renderQuad();
+
+    gl.glActiveTexture(GL_TEXTURE0+UNIT_FUNCTION_TABLES);
+    gl.glBindTexture(GL_TEXTURE_2D, textures[TEX_FUNCTION_TABLES]);
+    gl.glActiveTexture(GL_TEXTURE0);
+    std::cerr << "done\n";
+
+    // Errors are computed at the midpoints between the table points, so there's one point less in each row
+    const GLsizei errorsWidth=width-1;
+    GLuint errorsTexture;
+    gl.glGenTextures(1, &errorsTexture);
+    setupTableTexture(errorsTexture, errorsWidth, height);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,errorsTexture,0);
+    checkFramebufferStatus("framebuffer for function table errors");
+    gl.glViewport(0, 0, errorsWidth, height);
+    program->setUniformValue("validate", true);
+    renderQuad();
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,0,0);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+    const auto values=readTexture(textures[TEX_FUNCTION_TABLES], width, height);
+    const auto errors=readTexture(errorsTexture, errorsWidth, height);
+    gl.glDeleteTextures(1, &errorsTexture);
+    OPENGL_DEBUG_CHECK_ERROR("Failed to compute function tables");
+
+    std::cerr << indentOutput() << "Maximum errors of lookup in the tables of " << width << " points:\n";
+    OutputIndentIncrease incr;
+    for(int row=0; row<height; ++row)
+    {
+        float maxValue=0, maxError=0;
+        for(int i=0; i<width; ++i)
+        {
+            const auto v=glm::abs(values[row*width+i]);
+            maxValue=std::max({maxValue, v[0], v[1], v[2], v[3]});
+        }
+        for(int i=0; i<errorsWidth; ++i)
+        {
+            const auto e=errors[row*errorsWidth+i];
+            maxError=std::max({maxError, e[0], e[1], e[2], e[3]});
+        }
+        std::cerr << indentOutput() << functions[row].name.toStdString() << ": " << maxError;
+        if(maxValue>0)
+            std::cerr << " (" << 100*maxError/maxValue << "% of maximum value)";
+        std::cerr << "\n";
+        if(!std::isfinite(maxError))
+        {
+            std::cerr << "Function " << functions[row].name.toStdString() << " can't be tabulated: it has non-finite values\n";
+            throw MustQuit{};
+        }
+    }
+
+    tablesComputed=true;
+}
+
+QString withTabulatedFunctions(QString const& filename, QString source)
+{
+    if(!tablesComputed) return source;
+    if(filename!=DENSITIES_SHADER_FILENAME && filename!=COMPUTE_TRANSMITTANCE_SHADER_FILENAME &&
+       filename!=PHASE_FUNCTIONS_SHADER_FILENAME)
+        return source;
+
+    bool samplerDeclared=false;
+    const auto functions=functionsToTabulate();
+    for(unsigned row=0; row<functions.size(); ++row)
+    {
+        const auto& function=functions[row];
+        if(!function.sourceFileNames.contains(filename)) continue;
+        const auto pos=source.indexOf(function.analyticSrc);
+        if(pos<0) continue;
+        auto tabulatedSrc=function.makeTabulatedSrc(function.name, row);
+        if(!samplerDeclared)
+        {
+            tabulatedSrc = "uniform sampler2D "+QString(FUNCTION_TABLES_UNIFORM_NAME)+";\n"+tabulatedSrc;
+            samplerDeclared=true;
+        }
+        source.replace(pos, function.analyticSrc.size(), tabulatedSrc);
+    }
+    return source;
+}
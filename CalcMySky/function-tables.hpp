@@ -0,0 +1,22 @@
+#ifndef INCLUDE_ONCE_EE9515CD_1EDF_483B_B4C0_CAD23DD92913
+#define INCLUDE_ONCE_EE9515CD_1EDF_483B_B4C0_CAD23DD92913
+
+#include <QString>
+
+constexpr char FUNCTION_TABLES_UNIFORM_NAME[]="functionTables";
+
+/*
+ * Evaluates number densities of the scatterers and absorbers and phase functions of the scatterers into tables for
+ * the current wavelength set, and reports the maximum error of the lookup relative to the analytic functions.
+ */
+void computeFunctionTables();
+// Number of rows of the function tables texture
+unsigned tabulatedFunctionCount();
+/*
+ * If the tables have been computed, replaces the analytic number density and phase functions in the sources
+ * of densities, transmittance computation or phase functions with lookups into the tables. Other sources are
+ * returned unchanged.
+ */
+QString withTabulatedFunctions(QString const& filename, QString source);
+
+#endif
@@ -3,6 +3,7 @@
 #include <iostream>
 #include "util.hpp"
 #include "data.hpp"
+#include "out-of-core.hpp"
 
 void initBuffers()
 {
@@ -49,13 +50,19 @@ void initTexturesAndFramebuffers()
         gl.glTexParameteri(GL_TEXTURE_3D,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
         setupTexture(tex,width,height,depth);
     }
-    setupTexture(TEX_MULTIPLE_SCATTERING,width,height,depth);
+    // In out-of-core mode the accumulators live in scratch files, and only a chunk of their layers is rendered at a time
+    if(outOfCoreMode())
+        setupTexture(TEX_ACCUMULATION_CHUNK,width,height,altitudeLayersPerChunk());
+    else
+        setupTexture(TEX_MULTIPLE_SCATTERING,width,height,depth);
+    if(opts.scatteringConvergenceThreshold>0)
+        setupTexture(TEX_DELTA_SCATTERING_LAYERS_AVERAGE,width,height);
     // XXX: keep in sync with its use in GLSL computeDoubleScatteringEclipsedDensitySample() and EclipsedDoubleScatteringPrecomputer's constructor
     setupTexture(TEX_ECLIPSED_DOUBLE_SCATTERING, atmo.eclipseAngularIntegrationPoints, atmo.radialIntegrationPoints);
 
-    setupTexture(TEX_LIGHT_POLLUTION_SCATTERING           , atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
-    setupTexture(TEX_LIGHT_POLLUTION_DELTA_SCATTERING     , atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
-    setupTexture(TEX_LIGHT_POLLUTION_SCATTERING_PREV_ORDER, atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+    setupTexture(TEX_LIGHT_POLLUTION_SCATTERING                 , atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+    setupTexture(TEX_LIGHT_POLLUTION_DELTA_SCATTERING           , atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+    setupTexture(TEX_LIGHT_POLLUTION_DELTA_SCATTERING_EVEN_ORDER, atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
 
     gl.glGenFramebuffers(FBO_COUNT,fbos);
 }
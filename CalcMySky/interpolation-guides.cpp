@@ -3,8 +3,13 @@
 #include <cmath>
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
 #include <sstream>
 #include <iostream>
+#include <exception>
+#include <condition_variable>
 #include <QFile>
 #include "util.hpp"
 #include "../common/util.hpp"
@@ -23,6 +28,9 @@
 namespace
 {
 
+// Serializes writes to std::cerr from the worker threads and the progress reporter
+std::mutex cerrMutex;
+
 // v2v = vector to value
 inline float v2v(glm::vec4 const& v)
 {
@@ -280,6 +288,118 @@ float calcAngle(const int guideOrigin, const float guideTarget, const GuideType
     return std::atan(guideType==GuideType::TopDown ? guideTarget-guideOrigin : guideOrigin-guideTarget);
 }
 
+void reportLayerProgress(const int layersDone, const int layerCount)
+{
+    const std::lock_guard lock(cerrMutex);
+    // Clear previous status and reset cursor position
+    if(layersDone > 1)
+    {
+        std::ostringstream prev;
+        prev << layersDone-1 << " of " << layerCount << " layers done ";
+        const auto statusWidth=prev.tellp();
+        std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
+                  << std::string(statusWidth, '\b');
+    }
+    if(layersDone == layerCount) return;
+    std::cerr << layersDone << " of " << layerCount << " layers done ";
+}
+
+/*!
+ * Generates guides for all altitude layers on a pool of worker threads. Each layer gets its own output buffer
+ * of layerSize elements, filled by computeLayer(altIndex, buffer). The finished buffers are passed to
+ * writeLayer(altIndex, buffer) on the calling thread strictly in order of altIndex, so that the output file
+ * has the same layout as if the layers were processed serially. Workers are not allowed to run too far
+ * ahead of the writer to keep memory consumption bounded.
+ */
+template<typename ComputeLayer, typename WriteLayer>
+void processAltitudeLayers(const int altLayerCount, const size_t layerSize,
+                           ComputeLayer computeLayer, WriteLayer writeLayer)
+{
+    const int threadCount = std::max(1, std::min(int(std::thread::hardware_concurrency()), altLayerCount));
+    const int maxLayersInFlight = 2*threadCount;
+
+    std::mutex mutex;
+    std::condition_variable layerDone, layerWritten;
+    std::vector<std::vector<int16_t>> finishedLayers(altLayerCount);
+    std::vector<bool> layerReady(altLayerCount);
+    int nextLayerToCompute = 0, layersWritten = 0;
+    bool aborted = false;
+    std::exception_ptr error;
+
+    const auto worker = [&]
+    {
+        for(;;)
+        {
+            int altIndex;
+            {
+                std::unique_lock lock(mutex);
+                layerWritten.wait(lock, [&]{ return aborted || nextLayerToCompute-layersWritten < maxLayersInFlight; });
+                if(aborted || nextLayerToCompute == altLayerCount)
+                    return;
+                altIndex = nextLayerToCompute++;
+            }
+
+            std::vector<int16_t> angles(layerSize, 0);
+            try
+            {
+                computeLayer(altIndex, angles.data());
+            }
+            catch(...)
+            {
+                const std::lock_guard lock(mutex);
+                if(!error) error = std::current_exception();
+                aborted = true;
+                layerDone.notify_all();
+                layerWritten.notify_all();
+                return;
+            }
+
+            const std::lock_guard lock(mutex);
+            finishedLayers[altIndex] = std::move(angles);
+            layerReady[altIndex] = true;
+            layerDone.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int n = 0; n < threadCount; ++n)
+        threads.emplace_back(worker);
+
+    try
+    {
+        for(int altIndex = 0; altIndex < altLayerCount; ++altIndex)
+        {
+            std::vector<int16_t> angles;
+            {
+                std::unique_lock lock(mutex);
+                layerDone.wait(lock, [&]{ return aborted || layerReady[altIndex]; });
+                if(aborted) break;
+                angles = std::move(finishedLayers[altIndex]);
+            }
+
+            writeLayer(altIndex, angles);
+
+            {
+                const std::lock_guard lock(mutex);
+                ++layersWritten;
+            }
+            layerWritten.notify_all();
+        }
+    }
+    catch(...)
+    {
+        const std::lock_guard lock(mutex);
+        if(!error) error = std::current_exception();
+        aborted = true;
+        layerWritten.notify_all();
+    }
+
+    for(auto& thread : threads)
+        thread.join();
+    if(error)
+        std::rethrow_exception(error);
+}
+
 }
 
 /*
@@ -313,6 +433,7 @@ void generateInterpolationGuides2D(glm::vec4 const*const data,
                 // One single-pixel dip usually doesn't create much problems, so don't report this case of multiple maxima.
                 if(numMaxima == 2 && !minimumIsSinglePoint(rowData,numCols))
                 {
+                    const std::lock_guard lock(cerrMutex);
                     std::cerr << "\nwarning: " << numMaxima << " maxima instead of supported 1 in row " << row
                               << " at altitude index " << altIndex << ", " << secondDimName << " index " << secondDimIndex
                               << ".\n";
@@ -387,7 +508,7 @@ void generateInterpolationGuides2D(glm::vec4 const*const data,
     }
 }
 
-void generateInterpolationGuidesForScatteringTexture(const std::string_view filePath, std::vector<glm::vec4> const& pixels,
+void generateInterpolationGuidesForScatteringTexture(const std::string_view filePath, glm::vec4 const*const pixels,
                                                      std::vector<int> const& sizes)
 {
     std::cerr << indentOutput() << "Generating interpolation guides:\n";
@@ -425,32 +546,28 @@ void generateInterpolationGuidesForScatteringTexture(const std::string_view file
             }
         }
 
-        uint16_t rowStride = vzaPointCount, height = dVSLayerCount;
-        std::vector<int16_t> angles(rowStride*(height-1));
-        for(int altIndex = 0; altIndex < altLayerCount; ++altIndex)
-        {
-            std::ostringstream ss;
-            ss << altIndex << " of " << altLayerCount << " layers done ";
-            std::cerr << ss.str();
-
-            for(int szaIndex = 0; szaIndex < szaLayerCount; ++szaIndex)
+        const uint16_t rowStride = vzaPointCount, height = dVSLayerCount;
+        const size_t sliceSize = rowStride*(height-1);
+        processAltitudeLayers(altLayerCount, sliceSize*szaLayerCount,
+            [&](const int altIndex, int16_t*const angles)
+            {
+                for(int szaIndex = 0; szaIndex < szaLayerCount; ++szaIndex)
+                {
+                    const int altSliceOffset = altIndex*szaLayerCount*dVSLayerCount*vzaPointCount;
+                    const int szaSubsliceOffset = szaIndex*vzaPointCount*dVSLayerCount;
+                    const int aboveHorizonHalfSpaceOffset = vzaPointCount/2 + 1; // +1 skips zenith point, because it may have an extraneous maximum
+                    const int aboveHorizonHalfSpaceSize = vzaPointCount/2 - 1;   // -1 takes into account the +1 in the offset
+                    generateInterpolationGuides2D(&pixels[altSliceOffset + szaSubsliceOffset + aboveHorizonHalfSpaceOffset],
+                                                  aboveHorizonHalfSpaceSize, height, rowStride,
+                                                  angles + szaIndex*sliceSize + aboveHorizonHalfSpaceOffset,
+                                                  altIndex, szaIndex, "SZA", true);
+                }
+            },
+            [&](const int altIndex, std::vector<int16_t> const& angles)
             {
-                const int altSliceOffset = altIndex*szaLayerCount*dVSLayerCount*vzaPointCount;
-                const int szaSubsliceOffset = szaIndex*vzaPointCount*dVSLayerCount;
-                const int aboveHorizonHalfSpaceOffset = vzaPointCount/2 + 1; // +1 skips zenith point, because it may have an extraneous maximum
-                const int aboveHorizonHalfSpaceSize = vzaPointCount/2 - 1;   // -1 takes into account the +1 in the offset
-                std::fill(angles.begin(), angles.end(), 0.f);
-                generateInterpolationGuides2D(&pixels[altSliceOffset + szaSubsliceOffset + aboveHorizonHalfSpaceOffset],
-                                              aboveHorizonHalfSpaceSize, height, rowStride,
-                                              angles.data()+aboveHorizonHalfSpaceOffset, altIndex, szaIndex, "SZA", true);
                 out.write(reinterpret_cast<const char*>(angles.data()), angles.size()*sizeof angles[0]);
-            }
-
-            // Clear previous status and reset cursor position
-            const auto statusWidth=ss.tellp();
-            std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
-                      << std::string(statusWidth, '\b');
-        }
+                reportLayerProgress(altIndex+1, altLayerCount);
+            });
         std::cerr << "done\n";
         std::cerr << indentOutput() << "Saving interpolation guides to \"" << outputFilePath.toStdString() << "\"... ";
 
@@ -484,33 +601,27 @@ void generateInterpolationGuidesForScatteringTexture(const std::string_view file
             }
         }
 
-        uint16_t rowStride = vzaPointCount*dVSLayerCount, height = szaLayerCount;
-        std::vector<int16_t> angles(rowStride*(height-1));
-        for(int altIndex = 0; altIndex < altLayerCount; ++altIndex)
-        {
-            std::ostringstream ss;
-            ss << altIndex << " of " << altLayerCount << " layers done ";
-            std::cerr << ss.str();
-
-            std::fill(angles.begin(), angles.end(), 0.f);
-            for(int dVSIndex = 0; dVSIndex < dVSLayerCount; ++dVSIndex)
+        const uint16_t rowStride = vzaPointCount*dVSLayerCount, height = szaLayerCount;
+        processAltitudeLayers(altLayerCount, rowStride*(height-1),
+            [&](const int altIndex, int16_t*const angles)
             {
-                const int altSliceOffset = altIndex*szaLayerCount*dVSLayerCount*vzaPointCount;
-                const int dVSSubsliceOffset = vzaPointCount*dVSIndex;
-                const int aboveHorizonHalfSpaceOffset = vzaPointCount/2 + 1; // +1 skips zenith point, because it may have an extraneous maximum
-                const int aboveHorizonHalfSpaceSize = vzaPointCount/2 - 1;   // -1 takes into account the +1 in the offset
-                generateInterpolationGuides2D(&pixels[altSliceOffset + dVSSubsliceOffset + aboveHorizonHalfSpaceOffset],
-                                              aboveHorizonHalfSpaceSize, height, rowStride,
-                                              angles.data() + dVSSubsliceOffset + aboveHorizonHalfSpaceOffset,
-                                              altIndex, dVSIndex, "dotViewSun", false/*same rows, no need to recheck*/);
-            }
-            out.write(reinterpret_cast<const char*>(angles.data()), angles.size()*sizeof angles[0]);
-
-            // Clear previous status and reset cursor position
-            const auto statusWidth=ss.tellp();
-            std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
-                      << std::string(statusWidth, '\b');
-        }
+                for(int dVSIndex = 0; dVSIndex < dVSLayerCount; ++dVSIndex)
+                {
+                    const int altSliceOffset = altIndex*szaLayerCount*dVSLayerCount*vzaPointCount;
+                    const int dVSSubsliceOffset = vzaPointCount*dVSIndex;
+                    const int aboveHorizonHalfSpaceOffset = vzaPointCount/2 + 1; // +1 skips zenith point, because it may have an extraneous maximum
+                    const int aboveHorizonHalfSpaceSize = vzaPointCount/2 - 1;   // -1 takes into account the +1 in the offset
+                    generateInterpolationGuides2D(&pixels[altSliceOffset + dVSSubsliceOffset + aboveHorizonHalfSpaceOffset],
+                                                  aboveHorizonHalfSpaceSize, height, rowStride,
+                                                  angles + dVSSubsliceOffset + aboveHorizonHalfSpaceOffset,
+                                                  altIndex, dVSIndex, "dotViewSun", false/*same rows, no need to recheck*/);
+                }
+            },
+            [&](const int altIndex, std::vector<int16_t> const& angles)
+            {
+                out.write(reinterpret_cast<const char*>(angles.data()), angles.size()*sizeof angles[0]);
+                reportLayerProgress(altIndex+1, altLayerCount);
+            });
         std::cerr << "done\n";
         std::cerr << indentOutput() << "Saving interpolation guides to \"" << outputFilePath.toStdString() << "\"... ";
 
@@ -6,5 +6,5 @@ void generateInterpolationGuides2D(glm::vec4 const* data, unsigned vecIndex,
                                    unsigned width, unsigned height, unsigned rowStride,
                                    bool detailedSideIsWidth, uint8_t* angles);
 void generateInterpolationGuidesForScatteringTexture(std::string_view filePath,
-                                                     std::vector<glm::vec4> const& pixels,
+                                                     glm::vec4 const* pixels,
                                                      std::vector<int> const& sizes);
@@ -6,6 +6,7 @@
 #include <memory>
 #include <random>
 #include <chrono>
+#include <deque>
 #include <cmath>
 #include <map>
 #include <set>
@@ -24,6 +25,10 @@
 #include "cmdline.hpp"
 #include "shaders.hpp"
 #include "interpolation-guides.hpp"
+#include "function-tables.hpp"
+#include "out-of-core.hpp"
+#include "estimate.hpp"
+#include "rebuild-manifest.hpp"
 #include "../common/EclipsedDoubleScatteringPrecomputer.hpp"
 #include "../common/TextureAverageComputer.hpp"
 #include "../common/timing.hpp"
@@ -34,14 +39,20 @@ using glm::vec2;
 using glm::vec4;
 std::vector<glm::vec4> eclipsedDoubleScatteringAccumulatorTexture;
 
+// Highest scattering order computed for each wavelength set, which may be lower than requested if convergence is checked
+std::vector<unsigned> scatteringOrdersComputed;
+
+void saveTotalIrradiance(const unsigned texIndex)
+{
+    saveTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
+                atmo.textureOutputDir+"/irradiance-wlset"+std::to_string(texIndex)+".f32",
+                {atmo.irradianceTexW, atmo.irradianceTexH});
+}
+
 void saveIrradiance(const unsigned scatteringOrder, const unsigned texIndex)
 {
     if(scatteringOrder==atmo.scatteringOrdersToCompute)
-    {
-        saveTexture(GL_TEXTURE_2D,textures[TEX_IRRADIANCE],"irradiance texture",
-                    atmo.textureOutputDir+"/irradiance-wlset"+std::to_string(texIndex)+".f32",
-                    {atmo.irradianceTexW, atmo.irradianceTexH});
-    }
+        saveTotalIrradiance(texIndex);
 
     if(!opts.dbgSaveGroundIrradiance) return;
 
@@ -63,7 +74,14 @@ void saveScatteringDensity(const unsigned scatteringOrder, const unsigned texInd
                 {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
 }
 
-void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view whatIsBeingDone)
+/*
+ * The layers are rendered in batches of opts.layersPerDrawCall by instanced draws, each instance going into its own
+ * layer (see shader.geom). Instead of draining the pipeline after each batch, we put a fence after it and only wait
+ * when too many batches are in flight. This keeps the GPU busy, while still letting us report progress and keeping
+ * each submission short enough to not trigger GPU watchdogs.
+ * Only the layers of the chunk are rendered, and the target texture must hold exactly these layers.
+ */
+void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view whatIsBeingDone, LayerChunk const& chunk)
 {
     if(opts.dbgNoSaveTextures) return; // don't take time to do useless computations
 
@@ -74,22 +92,63 @@ void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view wha
     }
 
     std::cerr << indentOutput() << whatIsBeingDone << "... ";
-    for(GLsizei layer=0; layer<atmo.scatTexDepth(); ++layer)
+    const GLsizei layerCount=chunk.count;
+    const GLsizei layersPerBatch = opts.layersPerDrawCall ? std::min(GLsizei(opts.layersPerDrawCall), layerCount) : layerCount;
+    constexpr size_t maxBatchesInFlight=2;
+
+    std::deque<std::pair<GLsync, GLsizei/*layers done when signaled*/>> fences;
+    GLsizei layersDone=0;
+    std::streamoff statusWidth=0;
+    const auto waitForOldestBatch=[&](const GLuint64 timeout)
+    {
+        const auto status=gl.glClientWaitSync(fences.front().first, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if(status==GL_WAIT_FAILED)
+        {
+            std::cerr << "glClientWaitSync() FAILED in render3DTexLayers(): " << openglErrorString(gl.glGetError()) << "\n";
+            throw MustQuit{};
+        }
+        if(status==GL_TIMEOUT_EXPIRED)
+            return false;
+        gl.glDeleteSync(fences.front().first);
+        layersDone=fences.front().second;
+        fences.pop_front();
+        return true;
+    };
+    const auto updateStatus=[&]
     {
-        std::ostringstream ss;
-        ss << layer << " of " << atmo.scatTexDepth() << " layers done ";
-        std::cerr << ss.str();
-
-        program.setUniformValue("layer",layer);
-        renderQuad();
-        gl.glFinish();
-        OPENGL_DEBUG_CHECK_ERROR("glFinish() FAILED in render3DTexLayers()");
-
         // Clear previous status and reset cursor position
-        const auto statusWidth=ss.tellp();
         std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
                   << std::string(statusWidth, '\b');
+        std::ostringstream ss;
+        ss << layersDone << " of " << layerCount << " layers done ";
+        std::cerr << ss.str();
+        statusWidth=ss.tellp();
+    };
+
+    program.setUniformValue("chunkFirstLayer",chunk.first);
+    updateStatus();
+    for(GLsizei firstLayer=0; firstLayer<layerCount; firstLayer+=layersPerBatch)
+    {
+        const auto batchSize=std::min(layersPerBatch, layerCount-firstLayer);
+        program.setUniformValue("firstLayer",chunk.first+firstLayer);
+        renderQuad(batchSize);
+        fences.emplace_back(gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), firstLayer+batchSize);
+        OPENGL_DEBUG_CHECK_ERROR("Rendering of layers FAILED in render3DTexLayers()");
+
+        // Collect the batches already done without blocking, and block only if the GPU is too far behind
+        while(!fences.empty() && waitForOldestBatch(0));
+        while(fences.size() > maxBatchesInFlight)
+            waitForOldestBatch(GL_TIMEOUT_IGNORED);
+        updateStatus();
+    }
+    while(!fences.empty())
+    {
+        waitForOldestBatch(GL_TIMEOUT_IGNORED);
+        updateStatus();
     }
+    std::cerr << std::string(statusWidth, '\b') << std::string(statusWidth, ' ')
+              << std::string(statusWidth, '\b');
+
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         std::cerr << "FAILED: " << openglErrorString(err) << "\n";
@@ -98,6 +157,11 @@ void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view wha
     std::cerr << "done\n";
 }
 
+void render3DTexLayers(QOpenGLShaderProgram& program, const std::string_view whatIsBeingDone)
+{
+    render3DTexLayers(program, whatIsBeingDone, {0, atmo.scatTexDepth()});
+}
+
 void computeTransmittance(const unsigned texIndex)
 {
     const auto program=compileShaderProgram("compute-transmittance.frag", "transmittance computation shader program");
@@ -466,8 +530,78 @@ void saveLightPollutionRenderingShader(const unsigned texIndex)
 }
 
 
+// Accumulators of single and multiple scattering in out-of-core mode
+std::map<QString/*scatterer name*/, ScratchAccumulator> singleScatteringScratchAccumulators;
+std::unique_ptr<ScratchAccumulator> multipleScatteringScratchAccumulator;
+
+/*
+ * Renders the layers with the currently bound program chunk by chunk, adding them to the accumulator in a scratch
+ * file instead of blending them into a full texture in VRAM.
+ */
+void accumulateInChunks(QOpenGLShaderProgram& program, ScratchAccumulator& accumulator,
+                        const AddToExisting add, std::string const& whatIsBeingDone)
+{
+    if(opts.dbgNoSaveTextures) return; // nothing is rendered, so there's nothing to accumulate
+
+    gl.glDisable(GL_BLEND);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_ACCUMULATION_CHUNK]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_ACCUMULATION_CHUNK],0);
+    checkFramebufferStatus("framebuffer for accumulation chunks");
+
+    std::vector<glm::vec4> texels(size_t(atmo.scatTexWidth())*atmo.scatTexHeight()*altitudeLayersPerChunk());
+    const auto chunks=altitudeChunks();
+    for(unsigned n=0; n<chunks.size(); ++n)
+    {
+        render3DTexLayers(program, whatIsBeingDone+" (chunk "+std::to_string(n+1)+" of "+std::to_string(chunks.size())+")", chunks[n]);
+
+        // The source texture is bound to the active unit, so restore it after reading the chunk
+        GLint sourceTexture=0;
+        gl.glGetIntegerv(GL_TEXTURE_BINDING_3D, &sourceTexture);
+        gl.glBindTexture(GL_TEXTURE_3D, textures[TEX_ACCUMULATION_CHUNK]);
+        gl.glGetTexImage(GL_TEXTURE_3D, 0, GL_RGBA, GL_FLOAT, texels.data());
+        gl.glBindTexture(GL_TEXTURE_3D, sourceTexture);
+        OPENGL_DEBUG_CHECK_ERROR("Failed to read accumulation chunk");
+
+        accumulator.accumulate(chunks[n], texels.data(), add);
+    }
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
 void accumulateSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
 {
+    const auto program=compileShaderProgram("accumulate-single-scattering-texture.frag",
+                                            "single scattering accumulation shader program",
+                                            UseGeomShader{});
+    const auto setUpProgram=[&]
+    {
+        program->bind();
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
+        program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex, atmo.allWavelengths)));
+        program->setUniformValue("embedPhaseFunction", scatterer.phaseFunctionType==PhaseFunctionType::Smooth);
+    };
+
+    const auto filePath = atmo.textureOutputDir+"/single-scattering/"+scatterer.name.toStdString()+"-xyzw.f32";
+    const std::vector<int> sizes{atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1],
+                                 atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]};
+    if(outOfCoreMode())
+    {
+        const auto [it, isNew]=singleScatteringScratchAccumulators.try_emplace(scatterer.name,
+                                                                               "single-scattering-"+scatterer.name.toStdString());
+        auto& accumulator=it->second;
+        setUpProgram();
+        accumulateInChunks(*program, accumulator, AddToExisting{!isNew}, "Accumulating single scattering layers");
+
+        if(texIndex+1==atmo.allWavelengths.size() && !opts.dbgNoSaveTextures)
+        {
+            const auto data=accumulator.readAll();
+            saveTexture(data, "single scattering texture", filePath, sizes);
+            if(scatterer.needsInterpolationGuides)
+                generateInterpolationGuidesForScatteringTexture(filePath, data.get(), sizes);
+            accumulator.remove();
+        }
+        return;
+    }
+
     gl.glBlendFunc(GL_ONE, GL_ONE);
     gl.glEnable(GL_BLEND);
     auto& targetTexture=accumulatedSingleScatteringTextures[scatterer.name];
@@ -486,13 +620,7 @@ void accumulateSingleScattering(const unsigned texIndex, AtmosphereParameters::S
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, targetTexture,0);
     checkFramebufferStatus("framebuffer for accumulation of single scattering radiance");
 
-    const auto program=compileShaderProgram("accumulate-single-scattering-texture.frag",
-                                            "single scattering accumulation shader program",
-                                            UseGeomShader{});
-    program->bind();
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
-    program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex, atmo.allWavelengths)));
-    program->setUniformValue("embedPhaseFunction", scatterer.phaseFunctionType==PhaseFunctionType::Smooth);
+    setUpProgram();
     render3DTexLayers(*program, "Blending single scattering layers into accumulator texture");
 
     gl.glDisable(GL_BLEND);
@@ -500,16 +628,32 @@ void accumulateSingleScattering(const unsigned texIndex, AtmosphereParameters::S
 
     if(texIndex+1==atmo.allWavelengths.size())
     {
-        const auto filePath = atmo.textureOutputDir+"/single-scattering/"+scatterer.name.toStdString()+"-xyzw.f32";
-        const std::vector<int> sizes{atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1],
-                                     atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]};
         const auto data = saveTexture(GL_TEXTURE_3D,targetTexture, "single scattering texture",
                                       filePath, sizes, ReturnTextureData{true});
         if(scatterer.needsInterpolationGuides && !opts.dbgNoSaveTextures)
-            generateInterpolationGuidesForScatteringTexture(filePath, data, sizes);
+            generateInterpolationGuidesForScatteringTexture(filePath, data.get(), sizes);
     }
 }
 
+// Makes the densities and phase functions sources refer to the given scatterer as the current one
+void setCurrentScatterer(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+{
+    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc()+
+                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
+                    "vec4 scatteringCrossSection() { return "+toString(scatterer.scatteringCrossSection(atmo.allWavelengths[texIndex]))+"; }\n";
+    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
+        "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
+}
+
+void saveSingleScatteringShaders(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
+{
+    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
+    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
+    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
+    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
+    saveEclipsedSingleScatteringComputationShader(texIndex, scatterer);
+}
+
 void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scatterer const& scatterer)
 {
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_DELTA_SCATTERING]);
@@ -518,12 +662,7 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
 
     gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
 
-    const auto src=makeScattererDensityFunctionsSrc()+
-                    "float scattererDensity(float alt) { return scattererNumberDensity_"+scatterer.name+"(alt); }\n"+
-                    "vec4 scatteringCrossSection() { return "+toString(scatterer.scatteringCrossSection(atmo.allWavelengths[texIndex]))+"; }\n";
-    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=src;
-    virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
-        "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
+    setCurrentScatterer(texIndex, scatterer);
     const auto program=compileShaderProgram("compute-single-scattering.frag",
                                             "single scattering computation shader program",
                                             UseGeomShader{});
@@ -545,7 +684,7 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
         const auto data = saveTexture(GL_TEXTURE_3D,textures[TEX_DELTA_SCATTERING], "single scattering texture",
                                       filePath, sizes, ReturnTextureData{true});
         if(scatterer.needsInterpolationGuides && !opts.dbgNoSaveTextures)
-            generateInterpolationGuidesForScatteringTexture(filePath, data, sizes);
+            generateInterpolationGuidesForScatteringTexture(filePath, data.get(), sizes);
         break;
     }
     case PhaseFunctionType::Achromatic:
@@ -554,46 +693,81 @@ void computeSingleScattering(const unsigned texIndex, AtmosphereParameters::Scat
         break;
     }
 
-    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
-    saveSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
-    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_ON_THE_FLY);
-    saveEclipsedSingleScatteringRenderingShader(texIndex, scatterer, SSRM_PRECOMPUTED);
-    saveEclipsedSingleScatteringComputationShader(texIndex, scatterer);
+    saveSingleScatteringShaders(texIndex, scatterer);
+}
+
+DEFINE_EXPLICIT_BOOL(ApplyPhaseFunction);
+/*
+ * Average of the delta scattering texture over all its texels. Single scattering textures don't include the phase
+ * function, so it has to be applied to get radiance comparable to that of the higher orders.
+ */
+glm::vec4 averageDeltaScattering(TextureAverageComputer& averager, const ApplyPhaseFunction applyPhaseFunction)
+{
+    // First average the layers of the 3D texture into a 2D one, then let the averager reduce that
+    gl.glDisable(GL_BLEND);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_CONVERGENCE_CHECK]);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING_LAYERS_AVERAGE],0);
+    checkFramebufferStatus("framebuffer for averaging of delta scattering layers");
+    gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
+
+    auto& program=getOrCompileShaderProgram("average-scattering-texture-layers.frag",
+                                            "scattering texture layers averaging shader program");
+    program.bind();
+    setUniformTexture(program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
+    program.setUniformValue("applyPhaseFunction", bool(applyPhaseFunction));
+    renderQuad();
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+    const auto average=averager.getTextureAverage(textures[TEX_DELTA_SCATTERING_LAYERS_AVERAGE], 0);
+    gl.glActiveTexture(GL_TEXTURE0);
+    return average;
+}
+
+// Largest over the channels of the ratio of the contribution of an order to the total, which includes this order
+float relativeContribution(glm::vec4 const& delta, glm::vec4 const& total)
+{
+    float ratio=0;
+    for(int i=0; i<4; ++i)
+    {
+        if(total[i]>0)
+            ratio=std::max(ratio, delta[i]/total[i]);
+    }
+    return ratio;
 }
 
 void computeIndirectIrradianceOrder1(unsigned scattererIndex);
-void computeScatteringOrder1AndScatteringDensityOrder2(const unsigned texIndex)
+// Returns the average of single scattering of all the scatterers if the averager is given, otherwise zero
+glm::vec4 computeScatteringOrder1AndScatteringDensityOrder2(const unsigned texIndex, TextureAverageComputer*const averager)
 {
     constexpr unsigned scatteringOrder=2;
 
     virtualSourceFiles[DENSITIES_SHADER_FILENAME]=makeScattererDensityFunctionsSrc();
-    std::unique_ptr<QOpenGLShaderProgram> program;
+    QOpenGLShaderProgram* program;
     {
         // Make a stub for current phase function. It's not used for ground radiance, but we need it to avoid linking errors.
         virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
             "vec4 currentPhaseFunction(float dotViewSun) { return vec4(3.4028235e38); }\n";
 
-        // Doing replacements instead of using uniforms is meant to
-        //  1) Improve performance by statically avoiding branching
-        //  2) Ease debugging by clearing the list of really-used uniforms (this can be printed by dumpActiveUniforms())
+        // Doing replacement instead of using a uniform is meant to statically avoid branching in the integration loop.
+        // Scattering order is a uniform though, so that the program can be reused for all the orders.
         virtualSourceFiles[COMPUTE_SCATTERING_DENSITY_FILENAME]=getShaderSrc(COMPUTE_SCATTERING_DENSITY_FILENAME,IgnoreCache{})
-                                               .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "true")
-                                               .replace(QRegularExpression("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder));
-        // recompile the program
-        program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
-                                     "scattering density computation shader program", UseGeomShader{});
+                                               .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "true");
+        program=&getOrCompileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                           "scattering density computation shader program", UseGeomShader{});
     }
 
     gl.glViewport(0, 0, atmo.scatTexWidth(), atmo.scatTexHeight());
 
     program->bind();
+    program->setUniformValue("scatteringOrder", int(scatteringOrder));
+    setScatteringSamplerUnits(*program);
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING_DENSITY],0);
     checkFramebufferStatus("framebuffer for scattering density");
 
-    setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,0,"transmittanceTexture");
-    setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,1,"irradianceTexture");
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,UNIT_TRANSMITTANCE,"transmittanceTexture");
+    setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,UNIT_IRRADIANCE   ,"irradianceTexture");
 
     // Scattering density is only used to compute multiple scattering at the following stages.
     // If multiple scattering is not requested, don't take the time needlessly.
@@ -611,6 +785,7 @@ void computeScatteringOrder1AndScatteringDensityOrder2(const unsigned texIndex)
     }
 
     gl.glBlendFunc(GL_ONE, GL_ONE);
+    glm::vec4 singleScatteringAverage(0);
     for(unsigned scattererIndex=0; scattererIndex<atmo.scatterers.size(); ++scattererIndex)
     {
         const auto& scatterer=atmo.scatterers[scattererIndex];
@@ -619,20 +794,25 @@ void computeScatteringOrder1AndScatteringDensityOrder2(const unsigned texIndex)
 
         // Current phase function is updated in the single scattering computation while saving the rendering shader
         computeSingleScattering(texIndex, scatterer);
+        if(averager)
+            singleScatteringAverage += averageDeltaScattering(*averager, ApplyPhaseFunction{true});
 
         gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_MULTIPLE_SCATTERING]);
 
         {
             virtualSourceFiles[COMPUTE_SCATTERING_DENSITY_FILENAME]=getShaderSrc(COMPUTE_SCATTERING_DENSITY_FILENAME,IgnoreCache{})
-                                                .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false")
-                                                .replace(QRegularExpression("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder));
-            // recompile the program
-            program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
-                                                        "scattering density computation shader program", UseGeomShader{});
+                                                .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false");
+            program=&getOrCompileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                               "scattering density computation shader program", UseGeomShader{});
         }
         program->bind();
+        program->setUniformValue("scatteringOrder", int(scatteringOrder));
+        setScatteringSamplerUnits(*program);
 
-        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,1,"firstScatteringTexture");
+        // Single scattering computation and saving of its texture rebind texture units
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,UNIT_TRANSMITTANCE   ,"transmittanceTexture");
+        setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,UNIT_IRRADIANCE      ,"irradianceTexture");
+        setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_FIRST_SCATTERING,"firstScatteringTexture");
 
         gl.glEnable(GL_BLEND);
         // Scattering density is only used to compute multiple scattering at the following stages.
@@ -649,6 +829,7 @@ void computeScatteringOrder1AndScatteringDensityOrder2(const unsigned texIndex)
     saveIrradiance(scatteringOrder,texIndex);
     saveScatteringDensity(scatteringOrder,texIndex);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
+    return singleScatteringAverage;
 }
 
 void computeScatteringDensity(const unsigned scatteringOrder, const unsigned texIndex)
@@ -660,19 +841,20 @@ void computeScatteringDensity(const unsigned scatteringOrder, const unsigned tex
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,textures[TEX_DELTA_SCATTERING_DENSITY],0);
 
     virtualSourceFiles[COMPUTE_SCATTERING_DENSITY_FILENAME]=getShaderSrc(COMPUTE_SCATTERING_DENSITY_FILENAME,IgnoreCache{})
-                                         .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false")
-                                         .replace(QRegularExpression("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder));
-    // recompile the program
-    const std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
-                                                                             "scattering density computation shader program",
-                                                                             UseGeomShader{});
-    program->bind();
+                                         .replace(QRegularExpression("\\bRADIATION_IS_FROM_GROUND_ONLY\\b"), "false");
+    // Same sources for all orders, so the program is only compiled once per wavelength set
+    auto& program=getOrCompileShaderProgram(COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                            "scattering density computation shader program",
+                                            UseGeomShader{});
+    program.bind();
+    program.setUniformValue("scatteringOrder", int(scatteringOrder));
+    setScatteringSamplerUnits(program);
 
-    setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,0,"transmittanceTexture");
-    setUniformTexture(*program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,1,"irradianceTexture");
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,2,"multipleScatteringTexture");
+    setUniformTexture(program,GL_TEXTURE_2D,TEX_TRANSMITTANCE   ,UNIT_TRANSMITTANCE      ,"transmittanceTexture");
+    setUniformTexture(program,GL_TEXTURE_2D,TEX_DELTA_IRRADIANCE,UNIT_IRRADIANCE         ,"irradianceTexture");
+    setUniformTexture(program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_MULTIPLE_SCATTERING,"multipleScatteringTexture");
 
-    render3DTexLayers(*program, "Computing scattering density layers");
+    render3DTexLayers(program, "Computing scattering density layers");
     saveScatteringDensity(scatteringOrder,texIndex);
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
@@ -696,12 +878,12 @@ void computeIndirectIrradianceOrder1(const unsigned scattererIndex)
     virtualSourceFiles[PHASE_FUNCTIONS_SHADER_FILENAME]=makePhaseFunctionsSrc()+
         "vec4 currentPhaseFunction(float dotViewSun) { return phaseFunction_"+scatterer.name+"(dotViewSun); }\n";
 
-    virtualSourceFiles[COMPUTE_INDIRECT_IRRADIANCE_FILENAME]=getShaderSrc(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,IgnoreCache{})
-                                           .replace(QRegularExpression("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder-1));
-    std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
-                                                                       "indirect irradiance computation shader program");
-    program->bind();
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"firstScatteringTexture");
+    auto& program=getOrCompileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+                                            "indirect irradiance computation shader program");
+    program.bind();
+    program.setUniformValue("scatteringOrder", int(scatteringOrder));
+    setScatteringSamplerUnits(program);
+    setUniformTexture(program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_FIRST_SCATTERING,"firstScatteringTexture");
 
     std::cerr << indentOutput() << "Computing indirect irradiance... ";
     renderQuad();
@@ -722,12 +904,12 @@ void computeIndirectIrradiance(const unsigned scatteringOrder, const unsigned te
     gl.glDisablei(GL_BLEND, 0); // Overwrite delta-irradiance-texture
     gl.glEnablei(GL_BLEND, 1); // Accumulate total irradiance
 
-    virtualSourceFiles[COMPUTE_INDIRECT_IRRADIANCE_FILENAME]=getShaderSrc(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,IgnoreCache{})
-                                           .replace(QRegularExpression("\\bSCATTERING_ORDER\\b"), QString::number(scatteringOrder-1));
-    std::unique_ptr<QOpenGLShaderProgram> program=compileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
-                                                                       "indirect irradiance computation shader program");
-    program->bind();
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"multipleScatteringTexture");
+    auto& program=getOrCompileShaderProgram(COMPUTE_INDIRECT_IRRADIANCE_FILENAME,
+                                            "indirect irradiance computation shader program");
+    program.bind();
+    program.setUniformValue("scatteringOrder", int(scatteringOrder));
+    setScatteringSamplerUnits(program);
+    setUniformTexture(program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,UNIT_MULTIPLE_SCATTERING,"multipleScatteringTexture");
 
     std::cerr << indentOutput() << "Computing indirect irradiance... ";
     renderQuad();
@@ -739,14 +921,52 @@ void computeIndirectIrradiance(const unsigned scatteringOrder, const unsigned te
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
 }
 
-void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned texIndex)
+DEFINE_EXPLICIT_BOOL(LastScatteringOrder);
+void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned texIndex, const LastScatteringOrder lastOrder)
 {
+    const bool addToPreviousOrders = scatteringOrder>2 || (texIndex>0 && !opts.saveResultAsRadiance);
+    const auto program=compileShaderProgram("copy-scattering-texture-3d.frag",
+                                            "scattering texture copy-blend shader program",
+                                            UseGeomShader{});
+    program->bind();
+    if(!opts.saveResultAsRadiance)
+        program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex, atmo.allWavelengths)));
+    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
+
+    const auto finalFileName = opts.saveResultAsRadiance ?
+        atmo.textureOutputDir+"/multiple-scattering-wlset"+std::to_string(texIndex)+".f32" :
+        atmo.textureOutputDir+"/multiple-scattering-xyzw.f32";
+    const auto intermediateFileName = atmo.textureOutputDir+"/multiple-scattering-to-order"+std::to_string(scatteringOrder)+
+                                                            "-wlset"+std::to_string(texIndex)+".f32";
+    const bool isFinal = lastOrder && (texIndex+1==atmo.allWavelengths.size() || opts.saveResultAsRadiance);
+    const std::vector<int> sizes{atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1],
+                                 atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]};
+
+    if(outOfCoreMode())
+    {
+        if(!multipleScatteringScratchAccumulator)
+            multipleScatteringScratchAccumulator=std::make_unique<ScratchAccumulator>("multiple-scattering");
+        auto& accumulator=*multipleScatteringScratchAccumulator;
+        accumulateInChunks(*program, accumulator, AddToExisting{addToPreviousOrders},
+                           "Accumulating multiple scattering layers");
+        if((opts.dbgSaveAccumScattering || isFinal) && !opts.dbgNoSaveTextures)
+        {
+            const auto data=accumulator.readAll();
+            if(opts.dbgSaveAccumScattering)
+                saveTexture(data, "multiple scattering accumulator texture", intermediateFileName, sizes);
+            if(isFinal)
+                saveTexture(data, "multiple scattering accumulator texture", finalFileName, sizes);
+        }
+        if(isFinal && texIndex+1==atmo.allWavelengths.size())
+            accumulator.remove();
+        return;
+    }
+
     // We didn't render to the accumulating texture when computing delta scattering to avoid holding
     // more than two 4D textures in VRAM at once.
     // Now it's time to do this by only holding the accumulator and delta scattering texture in VRAM.
-    gl.glActiveTexture(GL_TEXTURE0);
     gl.glBlendFunc(GL_ONE, GL_ONE);
-    if(scatteringOrder>2 || (texIndex>0 && !opts.saveResultAsRadiance))
+    if(addToPreviousOrders)
         gl.glEnable(GL_BLEND);
     else
         gl.glDisable(GL_BLEND);
@@ -754,13 +974,6 @@ void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_MULTIPLE_SCATTERING],0);
     checkFramebufferStatus("framebuffer for accumulation of multiple scattering data");
 
-    const auto program=compileShaderProgram("copy-scattering-texture-3d.frag",
-                                            "scattering texture copy-blend shader program",
-                                            UseGeomShader{});
-    program->bind();
-    if(!opts.saveResultAsRadiance)
-        program->setUniformValue("radianceToLuminance", toQMatrix(radianceToLuminance(texIndex, atmo.allWavelengths)));
-    setUniformTexture(*program,GL_TEXTURE_3D,TEX_DELTA_SCATTERING,0,"tex");
     render3DTexLayers(*program, "Blending multiple scattering layers into accumulator texture");
     gl.glDisable(GL_BLEND);
 
@@ -769,18 +982,12 @@ void accumulateMultipleScattering(const unsigned scatteringOrder, const unsigned
     if(opts.dbgSaveAccumScattering)
     {
         saveTexture(GL_TEXTURE_3D,textures[TEX_MULTIPLE_SCATTERING],
-                    "multiple scattering accumulator texture",
-                    atmo.textureOutputDir+"/multiple-scattering-to-order"+std::to_string(scatteringOrder)+"-wlset"+std::to_string(texIndex)+".f32",
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+                    "multiple scattering accumulator texture", intermediateFileName, sizes);
     }
-    if(scatteringOrder==atmo.scatteringOrdersToCompute && (texIndex+1==atmo.allWavelengths.size() || opts.saveResultAsRadiance))
+    if(isFinal)
     {
-        const auto filename = opts.saveResultAsRadiance ?
-            atmo.textureOutputDir+"/multiple-scattering-wlset"+std::to_string(texIndex)+".f32" :
-            atmo.textureOutputDir+"/multiple-scattering-xyzw.f32";
         saveTexture(GL_TEXTURE_3D,textures[TEX_MULTIPLE_SCATTERING],
-                    "multiple scattering accumulator texture", filename,
-                    {atmo.scatteringTextureSize[0], atmo.scatteringTextureSize[1], atmo.scatteringTextureSize[2], atmo.scatteringTextureSize[3]});
+                    "multiple scattering accumulator texture", finalFileName, sizes);
     }
 }
 
@@ -812,24 +1019,50 @@ void computeMultipleScatteringFromDensity(const unsigned scatteringOrder, const
         }
     }
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
-    accumulateMultipleScattering(scatteringOrder, texIndex);
 }
 
 void computeMultipleScattering(const unsigned texIndex)
 {
+    // Without saving textures the computations are skipped, so there's nothing to check convergence of
+    std::unique_ptr<TextureAverageComputer> averager;
+    if(opts.scatteringConvergenceThreshold>0 && !opts.dbgNoSaveTextures)
+        averager=std::make_unique<TextureAverageComputer>(gl, atmo.scatTexWidth(), atmo.scatTexHeight(), GL_RGBA32F, 0);
+    // Average of the scattering of all the orders computed, single scattering included
+    glm::vec4 totalScatteringAverage(0);
+    const auto isLastOrder=[&](const unsigned scatteringOrder)
+    {
+        if(scatteringOrder==atmo.scatteringOrdersToCompute)
+            return true;
+        if(!averager)
+            return false;
+        // Orders contribute linearly to the total, so its average is the sum of the averages of the deltas
+        const auto deltaAverage=averageDeltaScattering(*averager, ApplyPhaseFunction{false});
+        totalScatteringAverage += deltaAverage;
+        const auto contribution=relativeContribution(deltaAverage, totalScatteringAverage);
+        std::cerr << indentOutput() << "Relative contribution of scattering order " << scatteringOrder
+                  << " to total scattering: " << contribution << "\n";
+        return contribution < opts.scatteringConvergenceThreshold;
+    };
+
     // Due to interleaving of calculations of first scattering for each scatterer with the
     // second-order scattering density and irradiance we have to do this iteration separately.
+    unsigned ordersComputed=1;
+    bool converged=false;
     {
         std::cerr << indentOutput() << "Working on scattering orders 1 and 2:\n";
         OutputIndentIncrease incr;
 
-        computeScatteringOrder1AndScatteringDensityOrder2(texIndex);
+        totalScatteringAverage=computeScatteringOrder1AndScatteringDensityOrder2(texIndex, averager.get());
         if(atmo.scatteringOrdersToCompute >= 2)
         {
             computeMultipleScatteringFromDensity(2,texIndex);
+            ordersComputed=2;
+            converged=isLastOrder(2);
+            accumulateMultipleScattering(2,texIndex,LastScatteringOrder{converged});
         }
     }
-    for(unsigned scatteringOrder=3; scatteringOrder<=atmo.scatteringOrdersToCompute; ++scatteringOrder)
+    const auto timeBegin=std::chrono::steady_clock::now();
+    for(unsigned scatteringOrder=3; scatteringOrder<=atmo.scatteringOrdersToCompute && !converged; ++scatteringOrder)
     {
         std::cerr << indentOutput() << "Working on scattering order " << scatteringOrder << ":\n";
         OutputIndentIncrease incr;
@@ -837,6 +1070,68 @@ void computeMultipleScattering(const unsigned texIndex)
         computeScatteringDensity(scatteringOrder,texIndex);
         computeIndirectIrradiance(scatteringOrder,texIndex);
         computeMultipleScatteringFromDensity(scatteringOrder,texIndex);
+        ordersComputed=scatteringOrder;
+        converged=isLastOrder(scatteringOrder);
+        accumulateMultipleScattering(scatteringOrder,texIndex,LastScatteringOrder{converged});
+    }
+    const auto timeEnd=std::chrono::steady_clock::now();
+    scatteringOrdersComputed.push_back(ordersComputed);
+
+    if(ordersComputed<atmo.scatteringOrdersToCompute)
+    {
+        // The irradiance is normally saved when the requested order is reached, but now we've stopped before it
+        saveTotalIrradiance(texIndex);
+        std::cerr << indentOutput() << "Multiple scattering converged at order " << ordersComputed
+                  << " of " << atmo.scatteringOrdersToCompute;
+        if(ordersComputed>2)
+        {
+            // Orders 1 and 2 are computed differently from the rest, so only the later ones are representative
+            const auto timePerOrder=(timeEnd-timeBegin)/(ordersComputed-2);
+            const auto ordersSkipped=atmo.scatteringOrdersToCompute-ordersComputed;
+            std::cerr << ", saving about " << formatDeltaTime(timeEnd, timeEnd+timePerOrder*ordersSkipped);
+        }
+        std::cerr << "\n";
+    }
+}
+
+constexpr char SCATTERING_ORDERS_COMPUTED_RECORD[]="# Scattering orders computed for wavelength sets";
+
+QString readScatteringOrdersComputedRecord(std::string const& paramsPath)
+{
+    QFile file(paramsPath.c_str());
+    if(!file.open(QFile::ReadOnly)) return {};
+    QTextStream in(&file);
+    for(auto line=in.readLine(); !line.isNull(); line=in.readLine())
+        if(line.startsWith(SCATTERING_ORDERS_COMPUTED_RECORD))
+            return line;
+    return {};
+}
+
+// Only a comment is appended, so that the description file is still parsed the same way
+void recordScatteringOrdersComputed()
+{
+    // Multiple scattering wasn't recomputed, so the record of the previous run has been carried over
+    if(scatteringOrdersComputed.empty()) return;
+
+    const auto target=atmo.textureOutputDir+"/params.atmo";
+    QFile file(target.c_str());
+    if(!file.open(QFile::WriteOnly|QFile::Append))
+    {
+        std::cerr << "Failed to open \"" << target << "\" to record scattering orders computed: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream out(&file);
+    out << "\n" << SCATTERING_ORDERS_COMPUTED_RECORD << " with convergence threshold "
+        << opts.scatteringConvergenceThreshold << ":";
+    for(const auto order : scatteringOrdersComputed)
+        out << " " << order;
+    out << "\n";
+    out.flush();
+    file.close();
+    if(file.error())
+    {
+        std::cerr << "Failed to record scattering orders computed to \"" << target << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
     }
 }
 
@@ -902,7 +1197,8 @@ void computeEclipsedDoubleScattering(const unsigned texIndex)
 {
     const auto program=saveEclipsedDoubleScatteringComputationShader(texIndex);
 
-    if(opts.dbgNoEDSTextures || opts.dbgNoSaveTextures) return;
+    if(opts.dbgNoEDSTextures || opts.dbgNoSaveTextures || outputsAreUpToDate(OutputGroup::EclipsedDoubleScattering))
+        return;
 
     std::cerr << indentOutput() << "Computing eclipsed double scattering... ";
     const auto time0=std::chrono::steady_clock::now();
@@ -1033,7 +1329,6 @@ void computeLightPollutionSingleScattering(const unsigned texIndex)
     setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
     renderQuad();
 
-    gl.glFinish();
     std::cerr << "done\n";
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,0);
@@ -1046,53 +1341,72 @@ void computeLightPollutionSingleScattering(const unsigned texIndex)
                 {atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]});
 }
 
+// Delta scattering of consecutive orders alternates between two textures, so that each order reads the previous one without copying it
+TextureId lightPollutionDeltaScatteringTexture(const unsigned scatteringOrder)
+{
+    return scatteringOrder%2 ? TEX_LIGHT_POLLUTION_DELTA_SCATTERING : TEX_LIGHT_POLLUTION_DELTA_SCATTERING_EVEN_ORDER;
+}
+
 void computeLightPollutionMultipleScattering(const unsigned texIndex)
 {
     std::cerr << indentOutput() << "Computing light pollution multiple scattering...\n";
     OutputIndentIncrease incr;
 
-    const auto src=makeScattererDensityFunctionsSrc();
-    virtualSourceFiles[DENSITIES_SHADER_FILENAME]=src;
+    // Densities source has been set up for the single scattering, which is computed right before this
     const auto program=compileShaderProgram("compute-light-pollution-multiple-scattering.frag",
                                             "shader program to compute higher-order scattering of light pollution");
+    program->bind();
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER,fbos[FBO_LIGHT_POLLUTION]);
     gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0, textures[TEX_LIGHT_POLLUTION_SCATTERING],0);
-    gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1, textures[TEX_LIGHT_POLLUTION_DELTA_SCATTERING],0);
-    checkFramebufferStatus("framebuffer for light pollution");
+    setDrawBuffers({GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1});
     gl.glViewport(0, 0, atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
 
+    // Same cutoff as for multiple scattering. The texture is 2D, so it's averaged directly, and it already
+    // includes the phase function, so single scattering is comparable to the higher orders as is.
+    std::unique_ptr<TextureAverageComputer> averager;
+    glm::vec4 totalScatteringAverage(0);
+    if(opts.scatteringConvergenceThreshold>0 && !opts.dbgNoSaveTextures)
+    {
+        averager=std::make_unique<TextureAverageComputer>(gl, atmo.lightPollutionTextureSize[0],
+                                                          atmo.lightPollutionTextureSize[1], GL_RGBA32F, 0);
+        totalScatteringAverage=averager->getTextureAverage(textures[TEX_LIGHT_POLLUTION_DELTA_SCATTERING], 0);
+    }
+
     gl.glBlendFunc(GL_ONE, GL_ONE);
+    gl.glEnablei(GL_BLEND, 0);
     for(unsigned scatteringOrder=2; scatteringOrder<=atmo.scatteringOrdersToCompute; ++scatteringOrder)
     {
         std::cerr << indentOutput() << "Computing light pollution scattering order " << scatteringOrder << "... ";
-        {
-            // Copy the delta scattering texture of the previous scattering order into a separate
-            // texture, because the former will be overwritten with the new scattering order
-            gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT2, textures[TEX_LIGHT_POLLUTION_SCATTERING_PREV_ORDER],0);
-            gl.glReadBuffer(GL_COLOR_ATTACHMENT1);
-            setDrawBuffers({GL_COLOR_ATTACHMENT2});
-            const auto width=atmo.lightPollutionTextureSize[0], height=atmo.lightPollutionTextureSize[1];
-            gl.glBlitFramebuffer(0,0,width,height, 0,0,width,height, GL_COLOR_BUFFER_BIT,GL_NEAREST);
-            gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT2, 0,0);
-        }
-        setDrawBuffers({GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1});
-        gl.glEnablei(GL_BLEND, 0);
-
-        program->bind();
+        const auto deltaScatteringTexture=lightPollutionDeltaScatteringTexture(scatteringOrder);
+        gl.glFramebufferTexture(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1, textures[deltaScatteringTexture],0);
+        checkFramebufferStatus("framebuffer for light pollution");
+        // Saving of the intermediate texture of the previous order rebinds unit 0
         setUniformTexture(*program,GL_TEXTURE_2D,TEX_TRANSMITTANCE,0,"transmittanceTexture");
-        setUniformTexture(*program,GL_TEXTURE_2D,TEX_LIGHT_POLLUTION_SCATTERING_PREV_ORDER,1,"lightPollutionScatteringTexture");
+        setUniformTexture(*program,GL_TEXTURE_2D,lightPollutionDeltaScatteringTexture(scatteringOrder-1),1,
+                          "lightPollutionScatteringTexture");
         renderQuad();
-
-        gl.glFinish();
         std::cerr << "done\n";
 
-        if(!opts.dbgSaveLightPollutionIntermediateTextures)
-            continue;
+        if(opts.dbgSaveLightPollutionIntermediateTextures)
+        {
+            saveTexture(GL_TEXTURE_2D,textures[deltaScatteringTexture],"light pollution delta multiple scattering texture",
+                        atmo.textureOutputDir+"/light-pollution-delta-order"+std::to_string(scatteringOrder)+"-wlset"+std::to_string(texIndex)+".f32",
+                        {atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]});
+        }
 
-        saveTexture(GL_TEXTURE_2D,textures[TEX_LIGHT_POLLUTION_DELTA_SCATTERING],"light pollution delta multiple scattering texture",
-                    atmo.textureOutputDir+"/light-pollution-delta-order"+std::to_string(scatteringOrder)+"-wlset"+std::to_string(texIndex)+".f32",
-                    {atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]});
+        if(!averager || scatteringOrder==atmo.scatteringOrdersToCompute)
+            continue;
+        const auto deltaAverage=averager->getTextureAverage(textures[deltaScatteringTexture], 0);
+        totalScatteringAverage += deltaAverage;
+        const auto contribution=relativeContribution(deltaAverage, totalScatteringAverage);
+        std::cerr << indentOutput() << "Relative contribution of light pollution scattering order " << scatteringOrder
+                  << " to total scattering: " << contribution << "\n";
+        if(contribution < opts.scatteringConvergenceThreshold)
+        {
+            std::cerr << indentOutput() << "Light pollution scattering converged at order " << scatteringOrder << "\n";
+            break;
+        }
     }
     gl.glDisablei(GL_BLEND, 0);
 
@@ -1152,12 +1466,25 @@ int main(int argc, char** argv)
         std::cerr << "Compiled against Qt " << QT_VERSION_MAJOR << "." << QT_VERSION_MINOR << "." << QT_VERSION_PATCH << "\n";
         std::cerr << "Running on " << QSysInfo::prettyProductName().toStdString() << " " << QSysInfo::currentCpuArchitecture() << "\n";
 
+        if(opts.estimateCosts)
+        {
+            printCostEstimates();
+            if(!opts.estimateWithBenchmark)
+                return 0;
+        }
+
         [[maybe_unused]] const auto glCtxAndSfc = initOpenGL();
 
         if(opts.saveResultAsRadiance)
             for(auto& scatterer : atmo.scatterers)
                 scatterer.phaseFunctionType=PhaseFunctionType::General;
 
+        if(opts.estimateWithBenchmark)
+        {
+            runEstimationBenchmark();
+            return 0;
+        }
+
         if(atmo.textureOutputDir.length() && atmo.textureOutputDir.back()=='/')
             atmo.textureOutputDir.pop_back(); // Make the paths a bit nicer (without double slashes)
         for(const auto& scatterer : atmo.scatterers)
@@ -1205,9 +1532,14 @@ int main(int argc, char** argv)
             for(unsigned texIndex=0; texIndex<atmo.allWavelengths.size(); ++texIndex)
                 createDirs(atmo.textureOutputDir+"/shaders/light-pollution/"+std::to_string(texIndex));
 
+        checkRebuildManifest();
+
         {
             std::cerr << "Writing parameters to output description file...";
             const auto target=atmo.textureOutputDir+"/params.atmo";
+            // Multiple scattering that isn't recomputed keeps its record from the previous run
+            const auto scatteringOrdersRecord = outputsAreUpToDate(OutputGroup::Scattering) ?
+                                                    readScatteringOrdersComputedRecord(target) : QString{};
             QFile file(target.c_str());
             if(!file.open(QFile::WriteOnly))
             {
@@ -1226,6 +1558,8 @@ int main(int argc, char** argv)
             out << AtmosphereParameters::SOLAR_IRRADIANCE_AT_TOA_KEY << ": "
                 << AtmosphereParameters::spectrumToString(atmo.solarIrradianceAtTOA) << "\n";
             out << "\n#Copy of original atmosphere description\n" << atmo.descriptionFileText;
+            if(!scatteringOrdersRecord.isEmpty())
+                out << "\n" << scatteringOrdersRecord << "\n";
             out.flush();
             file.close();
             if(file.error())
@@ -1258,6 +1592,8 @@ int main(int argc, char** argv)
             virtualSourceFiles[TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME]=makeTotalScatteringCoefSrc();
             virtualHeaderFiles[RADIANCE_TO_LUMINANCE_HEADER_FILENAME]="const mat4 radianceToLuminance=" +
                                                   toString(radianceToLuminance(texIndex, atmo.allWavelengths)) + ";\n";
+            if(opts.functionTablePoints)
+                computeFunctionTables();
 
             saveZeroOrderScatteringRenderingShader(texIndex);
             saveEclipsedZeroOrderScatteringRenderingShader(texIndex);
@@ -1272,21 +1608,36 @@ int main(int argc, char** argv)
                 computeDirectGroundIrradiance(texIndex);
             }
 
-            computeLightPollutionSingleScattering(texIndex);
-            computeLightPollutionMultipleScattering(texIndex);
-            if(opts.saveResultAsRadiance)
+            if(!outputsAreUpToDate(OutputGroup::LightPollution))
             {
-                saveTexture(GL_TEXTURE_2D,textures[TEX_LIGHT_POLLUTION_SCATTERING],"light pollution texture",
-                            atmo.textureOutputDir+"/light-pollution-wlset"+std::to_string(texIndex)+".f32",
-                            {atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]});
+                computeLightPollutionSingleScattering(texIndex);
+                computeLightPollutionMultipleScattering(texIndex);
+                if(opts.saveResultAsRadiance)
+                {
+                    saveTexture(GL_TEXTURE_2D,textures[TEX_LIGHT_POLLUTION_SCATTERING],"light pollution texture",
+                                atmo.textureOutputDir+"/light-pollution-wlset"+std::to_string(texIndex)+".f32",
+                                {atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]});
+                }
+                else
+                {
+                    accumulateLightPollutionLuminanceTexture(texIndex);
+                }
+            }
+            saveLightPollutionRenderingShader(texIndex);
+
+            if(outputsAreUpToDate(OutputGroup::Scattering))
+            {
+                // Shaders are cheap to generate, and they embed the constants of all the groups, so they are always saved
+                for(const auto& scatterer : atmo.scatterers)
+                {
+                    setCurrentScatterer(texIndex, scatterer);
+                    saveSingleScatteringShaders(texIndex, scatterer);
+                }
             }
             else
             {
-                accumulateLightPollutionLuminanceTexture(texIndex);
+                computeMultipleScattering(texIndex);
             }
-            saveLightPollutionRenderingShader(texIndex);
-
-            computeMultipleScattering(texIndex);
             if(opts.saveResultAsRadiance)
             {
                 saveMultipleScatteringRenderingShader(texIndex);
@@ -1295,14 +1646,23 @@ int main(int argc, char** argv)
 
             computeEclipsedDoubleScattering(texIndex);
 
+            // Constants header is specific to the wavelength set, so the programs compiled for it won't be reused
+            clearShaderProgramCache();
         }
         if(!opts.saveResultAsRadiance)
         {
             saveMultipleScatteringRenderingShader(-1);
             saveEclipsedDoubleScatteringRenderingShader(-1);
         }
+        waitForTextureSaving();
+        if(opts.scatteringConvergenceThreshold>0 && !opts.dbgNoSaveTextures)
+            recordScatteringOrdersComputed();
+        saveRebuildManifest();
 
         const auto timeEnd=std::chrono::steady_clock::now();
+        const auto& cacheStats=getShaderProgramCacheStats();
+        std::cerr << "Shader programs: " << cacheStats.misses << " compiled, " << cacheStats.hits << " reused, saving "
+                  << formatDeltaTime(timeEnd-cacheStats.compilationTimeSaved, timeEnd) << " of compilation\n";
         std::cerr << "Finished in " << formatDeltaTime(timeBegin, timeEnd) << "\n";
     }
     catch(ParsingError const& ex)
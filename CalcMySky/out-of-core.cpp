@@ -0,0 +1,154 @@
+#include "out-of-core.hpp"
+
+#include <iostream>
+#include <filesystem>
+#include <QFile>
+#include "data.hpp"
+#include "function-tables.hpp"
+
+namespace
+{
+
+constexpr size_t MiB=1024*1024;
+
+size_t texture2DSizeInBytes(const GLsizei width, const GLsizei height)
+{
+    return size_t(width)*height*sizeof(glm::vec4);
+}
+
+size_t layerSizeInBytes()
+{
+    return texture2DSizeInBytes(atmo.scatTexWidth(), atmo.scatTexHeight());
+}
+
+// Keep in sync with initTexturesAndFramebuffers()
+size_t residentTexturesSize()
+{
+    // Delta scattering and scattering density textures are sampled along whole view rays, so they can't be chunked
+    const auto scattering=2*layerSizeInBytes()*atmo.scatTexDepth();
+    const auto transmittance=texture2DSizeInBytes(atmo.transmittanceTexW, atmo.transmittanceTexH);
+    const auto irradiance=2*texture2DSizeInBytes(atmo.irradianceTexW, atmo.irradianceTexH); // delta and accumulated
+    // Total, luminance, and deltas of odd and even orders
+    const auto lightPollution=4*texture2DSizeInBytes(atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+    const auto eclipsed=texture2DSizeInBytes(atmo.eclipseAngularIntegrationPoints, atmo.radialIntegrationPoints);
+    return scattering+transmittance+irradiance+lightPollution+eclipsed+auxiliaryTexturesSize();
+}
+
+std::string scratchDir()
+{
+    return atmo.textureOutputDir+"/scratch";
+}
+
+void openOrQuit(QFile& file, const QFile::OpenMode mode, std::string const& path)
+{
+    if(!file.open(mode))
+    {
+        std::cerr << "Failed to open scratch file \"" << path << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+}
+
+void checkIO(QFile const& file, const bool ok, std::string const& path)
+{
+    if(!ok)
+    {
+        std::cerr << "Failed to access scratch file \"" << path << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+}
+
+}
+
+size_t auxiliaryTexturesSize()
+{
+    size_t size=0;
+    if(opts.functionTablePoints)
+        size += texture2DSizeInBytes(opts.functionTablePoints, tabulatedFunctionCount());
+    if(opts.scatteringConvergenceThreshold>0)
+    {
+        // Averaging generates mipmaps, which take up to a third more than the base level. It may also need a
+        // power-of-two copy of the texture, which is no larger than the original.
+        const auto lightPollutionDelta=texture2DSizeInBytes(atmo.lightPollutionTextureSize[0], atmo.lightPollutionTextureSize[1]);
+        size += 2*layerSizeInBytes()*4/3 + 2*lightPollutionDelta/3 + lightPollutionDelta*4/3;
+    }
+    return size;
+}
+
+GLsizei altitudeLayersPerChunk()
+{
+    const auto layerSize=layerSizeInBytes();
+    const auto residentSize=residentTexturesSize();
+    const auto budget=size_t(opts.textureMemoryBudgetMiB)*MiB;
+    if(budget < residentSize+layerSize)
+    {
+        std::cerr << "Texture memory budget of " << opts.textureMemoryBudgetMiB << " MiB is too small for scattering textures of this size. "
+                     "At least " << (residentSize+layerSize+MiB-1)/MiB << " MiB is required.\n";
+        throw MustQuit{};
+    }
+    return std::min(GLsizei((budget-residentSize)/layerSize), atmo.scatTexDepth());
+}
+
+std::vector<LayerChunk> altitudeChunks()
+{
+    const auto depth=atmo.scatTexDepth();
+    if(!outOfCoreMode())
+        return {{0, depth}};
+
+    const auto layersPerChunk=altitudeLayersPerChunk();
+    std::vector<LayerChunk> chunks;
+    for(GLsizei first=0; first<depth; first+=layersPerChunk)
+        chunks.push_back({first, std::min(layersPerChunk, depth-first)});
+    return chunks;
+}
+
+ScratchAccumulator::ScratchAccumulator(std::string const& name)
+    : path(scratchDir()+"/"+name+".f32")
+    , layerSize(size_t(atmo.scatTexWidth())*atmo.scatTexHeight())
+{
+    createDirs(scratchDir());
+}
+
+void ScratchAccumulator::accumulate(LayerChunk const& chunk, glm::vec4 const*const texels, const AddToExisting add)
+{
+    const auto texelCount=layerSize*chunk.count;
+    const auto offset=qint64(layerSize*chunk.first*sizeof(glm::vec4));
+    const auto byteCount=qint64(texelCount*sizeof(glm::vec4));
+
+    QFile file(QString::fromStdString(path));
+    openOrQuit(file, QFile::ReadWrite, path);
+    if(!add)
+    {
+        checkIO(file, file.seek(offset), path);
+        checkIO(file, file.write(reinterpret_cast<const char*>(texels), byteCount)==byteCount, path);
+        return;
+    }
+
+    std::vector<glm::vec4> sum(texelCount);
+    checkIO(file, file.seek(offset), path);
+    checkIO(file, file.read(reinterpret_cast<char*>(sum.data()), byteCount)==byteCount, path);
+    // Same single-precision additions as blending with GL_ONE, GL_ONE would do
+    for(size_t i=0; i<texelCount; ++i)
+        sum[i] += texels[i];
+    checkIO(file, file.seek(offset), path);
+    checkIO(file, file.write(reinterpret_cast<const char*>(sum.data()), byteCount)==byteCount, path);
+}
+
+TextureData ScratchAccumulator::readAll() const
+{
+    const auto texelCount=layerSize*atmo.scatTexDepth();
+    const auto byteCount=qint64(texelCount*sizeof(glm::vec4));
+    const std::shared_ptr<glm::vec4[]> texels(new glm::vec4[texelCount]);
+
+    QFile file(QString::fromStdString(path));
+    openOrQuit(file, QFile::ReadOnly, path);
+    checkIO(file, file.read(reinterpret_cast<char*>(texels.get()), byteCount)==byteCount, path);
+    return texels;
+}
+
+void ScratchAccumulator::remove()
+{
+    std::error_code err;
+    std::filesystem::remove(std::filesystem::u8path(path), err);
+    // Fails harmlessly while other accumulators are still in use
+    std::filesystem::remove(std::filesystem::u8path(scratchDir()), err);
+}
@@ -0,0 +1,44 @@
+#ifndef INCLUDE_ONCE_9540A359_D33F_449D_8F67_056D3AB6E90A
+#define INCLUDE_ONCE_9540A359_D33F_449D_8F67_056D3AB6E90A
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "util.hpp"
+
+// A range of altitude layers of the scattering textures
+struct LayerChunk
+{
+    GLsizei first;
+    GLsizei count;
+};
+
+inline bool outOfCoreMode() { return opts.textureMemoryBudgetMiB!=0; }
+// Function tables and the textures used in convergence checks, which are allocated for the whole computation
+size_t auxiliaryTexturesSize();
+/*
+ * Number of altitude layers of the accumulation chunk texture that fit into the memory budget along with all the
+ * textures that stay resident, including the two 4D ones that can't be chunked. Reports the minimum budget and
+ * quits if even a single layer doesn't fit.
+ */
+GLsizei altitudeLayersPerChunk();
+std::vector<LayerChunk> altitudeChunks();
+
+DEFINE_EXPLICIT_BOOL(AddToExisting);
+/*
+ * A 4D texture accumulated in a scratch file instead of VRAM. Layers are the slowest-varying dimension of the
+ * texture data, so each chunk of layers is a contiguous part of the file. The values are added in single precision
+ * in the same order as the GPU would blend them, so the result matches the in-core accumulator.
+ */
+class ScratchAccumulator
+{
+    std::string path;
+    size_t layerSize; // in texels
+public:
+    explicit ScratchAccumulator(std::string const& name);
+    void accumulate(LayerChunk const& chunk, glm::vec4 const* texels, AddToExisting add);
+    TextureData readAll() const;
+    void remove();
+};
+
+#endif
@@ -0,0 +1,340 @@
+#include "rebuild-manifest.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QStringList>
+#include <QFile>
+#include "data.hpp"
+#include "util.hpp"
+#include "shaders.hpp"
+#include "config.h"
+
+namespace
+{
+
+// Input name -> hex-encoded hash of its value
+using InputHashes=std::map<QString, QByteArray>;
+
+constexpr auto GROUP_COUNT=size_t(OutputGroup::Count);
+const char*const groupNames[]={"scattering", "eclipsed double scattering", "light pollution"};
+static_assert(std::size(groupNames)==GROUP_COUNT);
+
+InputHashes currentInputs[GROUP_COUNT];
+bool upToDate[GROUP_COUNT];
+
+std::string manifestPath()
+{
+    return atmo.textureOutputDir+"/"+REBUILD_MANIFEST_FILENAME;
+}
+
+QByteArray hashOf(QString const& value)
+{
+    return QCryptographicHash::hash(value.toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+QByteArray hashOf(std::vector<glm::vec4> const& spectrum)
+{
+    return hashOf(AtmosphereParameters::spectrumToString(spectrum));
+}
+
+void addShaderInputs(InputHashes& inputs, std::vector<QString> const& mainSrcFileNames)
+{
+    for(const auto& mainSrcFileName : mainSrcFileNames)
+        for(const auto& filename : getShaderFileDependencies(mainSrcFileName))
+            inputs["shader "+filename]=hashOf(getShaderSrc(filename, IgnoreCache{true}));
+}
+
+// Inputs of the transmittance and of the integrals over all the scatterers, which every group depends on
+InputHashes commonInputs()
+{
+    InputHashes inputs;
+    // The generated shader sources and the code driving the computations may change between versions
+    inputs["version"]=hashOf(PROJECT_VERSION);
+    inputs[AtmosphereParameters::WAVELENGTHS_KEY]=hashOf(atmo.allWavelengths);
+    inputs[AtmosphereParameters::SOLAR_IRRADIANCE_AT_TOA_KEY]=hashOf(atmo.solarIrradianceAtTOA);
+    inputs["ground albedo"]=hashOf(atmo.groundAlbedo);
+    inputs["earth radius"]=hashOf(toString(atmo.earthRadius));
+    inputs["atmosphere height"]=hashOf(toString(atmo.atmosphereHeight));
+    inputs["transmittance texture size"]=hashOf(toString(glm::vec2(atmo.transmittanceTexW, atmo.transmittanceTexH)));
+    inputs["transmittance integration points"]=hashOf(toString(atmo.numTransmittanceIntegrationPoints));
+    inputs["radial integration points"]=hashOf(toString(atmo.radialIntegrationPoints));
+    for(const auto& scatterer : atmo.scatterers)
+    {
+        const auto prefix="scatterer "+scatterer.name+" ";
+        inputs[prefix+"number density"]=hashOf(scatterer.numberDensity);
+        inputs[prefix+"phase function"]=hashOf(scatterer.phaseFunction);
+        inputs[prefix+"cross sections"]=hashOf(AtmosphereParameters::spectrumToString(scatterer.scatteringCrossSection_)+";"+
+                                             AtmosphereParameters::spectrumToString(scatterer.extinctionCrossSection_)+";"+
+                                             AtmosphereParameters::spectrumToString(scatterer.singleScatteringAlbedo));
+    }
+    for(const auto& absorber : atmo.absorbers)
+    {
+        const auto prefix="absorber "+absorber.name+" ";
+        inputs[prefix+"number density"]=hashOf(absorber.numberDensity);
+        inputs[prefix+"cross section"]=hashOf(absorber.absorptionCrossSection);
+    }
+    inputs["radiance mode"]=hashOf(toString(int(opts.saveResultAsRadiance)));
+    inputs["texture save precision"]=hashOf(toString(int(opts.textureSavePrecision)));
+    inputs["function table points"]=hashOf(toString(int(opts.functionTablePoints)));
+    addShaderInputs(inputs, {"compute-transmittance.frag"});
+    return inputs;
+}
+
+InputHashes inputsOf(const OutputGroup group)
+{
+    auto inputs=commonInputs();
+    switch(group)
+    {
+    case OutputGroup::Scattering:
+        inputs["irradiance texture size"]=hashOf(toString(glm::vec2(atmo.irradianceTexW, atmo.irradianceTexH)));
+        inputs["scattering texture size"]=hashOf(toString(glm::vec4(atmo.scatteringTextureSize)));
+        inputs["angular integration points"]=hashOf(toString(atmo.angularIntegrationPoints));
+        inputs["scattering orders"]=hashOf(toString(int(atmo.scatteringOrdersToCompute)));
+        inputs["convergence threshold"]=hashOf(toString(opts.scatteringConvergenceThreshold));
+        for(const auto& scatterer : atmo.scatterers)
+        {
+            inputs["scatterer "+scatterer.name+" phase function type"]=hashOf(toString(int(scatterer.phaseFunctionType)));
+            inputs["scatterer "+scatterer.name+" needs interpolation guides"]=hashOf(toString(int(scatterer.needsInterpolationGuides)));
+        }
+        addShaderInputs(inputs, {"compute-direct-irradiance.frag", "compute-single-scattering.frag",
+                                 "accumulate-single-scattering-texture.frag", COMPUTE_SCATTERING_DENSITY_FILENAME,
+                                 COMPUTE_INDIRECT_IRRADIANCE_FILENAME, "compute-multiple-scattering.frag",
+                                 "copy-scattering-texture-3d.frag", "average-scattering-texture-layers.frag"});
+        break;
+    case OutputGroup::EclipsedDoubleScattering:
+        inputs["eclipsed double scattering texture size"]=hashOf(toString(glm::vec4(atmo.eclipsedDoubleScatteringTextureSize)));
+        inputs["eclipsed double scattering number of azimuth pairs to sample"]=
+            hashOf(toString(int(atmo.eclipsedDoubleScatteringNumberOfAzimuthPairsToSample)));
+        inputs["eclipsed double scattering number of elevation pairs to sample"]=
+            hashOf(toString(int(atmo.eclipsedDoubleScatteringNumberOfElevationPairsToSample)));
+        inputs["angular integration points for eclipse"]=hashOf(toString(atmo.eclipseAngularIntegrationPoints));
+        inputs["earth-sun distance"]=hashOf(toString(atmo.earthSunDistance));
+        inputs["earth-moon distance"]=hashOf(toString(atmo.earthMoonDistance));
+        addShaderInputs(inputs, {COMPUTE_ECLIPSED_DOUBLE_SCATTERING_FILENAME});
+        break;
+    case OutputGroup::LightPollution:
+        inputs["light pollution texture size"]=hashOf(toString(glm::vec2(atmo.lightPollutionTextureSize)));
+        inputs["light pollution angular integration points"]=hashOf(toString(atmo.lightPollutionAngularIntegrationPoints));
+        inputs["light pollution relative radiance"]=hashOf(atmo.lightPollutionRelativeRadiance);
+        inputs["scattering orders"]=hashOf(toString(int(atmo.scatteringOrdersToCompute)));
+        addShaderInputs(inputs, {"compute-light-pollution-single-scattering.frag",
+                                 "compute-light-pollution-multiple-scattering.frag",
+                                 "copy-scattering-texture-2d.frag"});
+        break;
+    case OutputGroup::Count:
+        break;
+    }
+    return inputs;
+}
+
+bool isComputed(const OutputGroup group)
+{
+    if(group==OutputGroup::EclipsedDoubleScattering)
+        return !opts.dbgNoEDSTextures;
+    return true;
+}
+
+// Intermediate textures are only saved while computing, so a group whose intermediates are requested can't be skipped
+bool intermediatesRequested(const OutputGroup group)
+{
+    switch(group)
+    {
+    case OutputGroup::Scattering:
+        return opts.dbgSaveGroundIrradiance || opts.dbgSaveScatDensityOrder2FromGround || opts.dbgSaveScatDensity ||
+               opts.dbgSaveDeltaScattering || opts.dbgSaveAccumScattering;
+    case OutputGroup::LightPollution:
+        return opts.dbgSaveLightPollutionIntermediateTextures;
+    default:
+        return false;
+    }
+}
+
+// XXX: keep in sync with the paths the textures are saved to in main.cpp
+std::vector<std::string> outputFiles(const OutputGroup group)
+{
+    const auto& dir=atmo.textureOutputDir;
+    const auto wlSetCount=atmo.allWavelengths.size();
+    std::vector<std::string> files;
+    const auto addFinalTexture=[&](std::string const& name)
+    {
+        if(!opts.saveResultAsRadiance)
+        {
+            files.push_back(dir+"/"+name+"-xyzw.f32");
+            return;
+        }
+        for(unsigned texIndex=0; texIndex<wlSetCount; ++texIndex)
+            files.push_back(dir+"/"+name+"-wlset"+std::to_string(texIndex)+".f32");
+    };
+    switch(group)
+    {
+    case OutputGroup::Scattering:
+        for(unsigned texIndex=0; texIndex<wlSetCount; ++texIndex)
+            files.push_back(dir+"/irradiance-wlset"+std::to_string(texIndex)+".f32");
+        for(const auto& scatterer : atmo.scatterers)
+        {
+            const auto name=scatterer.name.toStdString();
+            if(scatterer.phaseFunctionType!=PhaseFunctionType::General)
+            {
+                files.push_back(dir+"/single-scattering/"+name+"-xyzw.f32");
+                continue;
+            }
+            for(unsigned texIndex=0; texIndex<wlSetCount; ++texIndex)
+                files.push_back(dir+"/single-scattering/"+std::to_string(texIndex)+"/"+name+".f32");
+        }
+        if(atmo.scatteringOrdersToCompute>=2)
+            addFinalTexture("multiple-scattering");
+        break;
+    case OutputGroup::EclipsedDoubleScattering:
+        addFinalTexture("eclipsed-double-scattering");
+        break;
+    case OutputGroup::LightPollution:
+        addFinalTexture("light-pollution");
+        break;
+    case OutputGroup::Count:
+        break;
+    }
+    return files;
+}
+
+std::map<QString/*group name*/, InputHashes> readManifest()
+{
+    std::map<QString, InputHashes> groups;
+    QFile file(manifestPath().c_str());
+    if(!file.open(QFile::ReadOnly))
+        return groups;
+    QTextStream in(&file);
+    InputHashes* currentGroup=nullptr;
+    for(auto line=in.readLine(); !line.isNull(); line=in.readLine())
+    {
+        if(line.isEmpty() || line.startsWith('#'))
+            continue;
+        if(line.startsWith('[') && line.endsWith(']'))
+        {
+            currentGroup=&groups[line.mid(1, line.size()-2)];
+            continue;
+        }
+        // Input names may contain colons, but hashes don't
+        const auto separatorPos=line.lastIndexOf(": ");
+        if(!currentGroup || separatorPos<0)
+        {
+            std::cerr << indentOutput() << "Ignoring malformed manifest \"" << manifestPath() << "\"\n";
+            return {};
+        }
+        (*currentGroup)[line.left(separatorPos)]=line.mid(separatorPos+2).toUtf8();
+    }
+    return groups;
+}
+
+void writeManifest(std::function<bool(OutputGroup)> const& includeGroup)
+{
+    const auto path=manifestPath();
+    QFile file(path.c_str());
+    if(!file.open(QFile::WriteOnly))
+    {
+        std::cerr << "Failed to open \"" << path << "\" for writing: " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+    QTextStream out(&file);
+    out << "# Hashes of the inputs of the outputs computed. Outputs whose inputs are unchanged aren't recomputed.\n";
+    for(size_t g=0; g<GROUP_COUNT; ++g)
+    {
+        if(!includeGroup(OutputGroup(g))) continue;
+        out << "[" << groupNames[g] << "]\n";
+        for(const auto& [name, hash] : currentInputs[g])
+            out << name << ": " << hash << "\n";
+    }
+    out.flush();
+    file.close();
+    if(file.error())
+    {
+        std::cerr << "Failed to write \"" << path << "\": " << file.errorString() << "\n";
+        throw MustQuit{};
+    }
+}
+
+}
+
+void checkRebuildManifest()
+{
+    // Nothing will be saved, so the manifest of the previous run stays valid
+    if(opts.dbgNoSaveTextures) return;
+
+    for(size_t g=0; g<GROUP_COUNT; ++g)
+        currentInputs[g]=inputsOf(OutputGroup(g));
+
+    std::cerr << "Checking which outputs are up to date...\n";
+    OutputIndentIncrease incr;
+    const auto previousInputs = opts.rebuildAll ? std::map<QString, InputHashes>{} : readManifest();
+    for(size_t g=0; g<GROUP_COUNT; ++g)
+    {
+        const auto group=OutputGroup(g);
+        std::cerr << indentOutput() << groupNames[g] << ": ";
+        if(!isComputed(group))
+        {
+            std::cerr << "not requested\n";
+            continue;
+        }
+        if(opts.rebuildAll)
+        {
+            std::cerr << "recomputing as requested\n";
+            continue;
+        }
+        if(intermediatesRequested(group))
+        {
+            std::cerr << "recomputing to save intermediate textures\n";
+            continue;
+        }
+        const auto previous=previousInputs.find(groupNames[g]);
+        if(previous==previousInputs.end())
+        {
+            std::cerr << "no record of previous computation\n";
+            continue;
+        }
+        QStringList changedInputs;
+        for(const auto& [name, hash] : currentInputs[g])
+        {
+            const auto it=previous->second.find(name);
+            if(it==previous->second.end() || it->second!=hash)
+                changedInputs << name;
+        }
+        // Inputs that are gone, like a removed scatterer, are changes too
+        for(const auto& [name, hash] : previous->second)
+            if(!currentInputs[g].count(name))
+                changedInputs << name;
+        if(!changedInputs.isEmpty())
+        {
+            std::cerr << "changed " << changedInputs.join(", ") << "\n";
+            continue;
+        }
+        const auto files=outputFiles(group);
+        const auto missing=std::find_if(files.begin(), files.end(),
+                                        [](std::string const& path){ return !QFile::exists(path.c_str()); });
+        if(missing!=files.end())
+        {
+            std::cerr << "missing \"" << *missing << "\"\n";
+            continue;
+        }
+        std::cerr << "up to date, skipping\n";
+        upToDate[g]=true;
+    }
+
+    writeManifest([](const OutputGroup group){ return upToDate[size_t(group)]; });
+}
+
+bool outputsAreUpToDate(const OutputGroup group)
+{
+    return upToDate[size_t(group)];
+}
+
+void saveRebuildManifest()
+{
+    if(opts.dbgNoSaveTextures) return;
+    writeManifest(isComputed);
+}
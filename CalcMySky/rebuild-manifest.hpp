@@ -0,0 +1,27 @@
+#ifndef INCLUDE_ONCE_FBAFC988_A03A_4EB4_8B3F_624BBB4AF394
+#define INCLUDE_ONCE_FBAFC988_A03A_4EB4_8B3F_624BBB4AF394
+
+// Groups of outputs that only depend on each other via the transmittance, which is always recomputed
+enum class OutputGroup
+{
+    Scattering, // single and multiple scattering, ground irradiance
+    EclipsedDoubleScattering,
+    LightPollution,
+
+    Count
+};
+
+constexpr char REBUILD_MANIFEST_FILENAME[]="dependencies.manifest";
+
+/*
+ * Compares hashes of the inputs of each group of outputs (description keys, spectra, shader files) with those
+ * recorded in the manifest in the output directory by the previous run, and reports what changed. Groups to be
+ * recomputed are removed from the manifest right away, so that an interrupted run doesn't leave partially
+ * overwritten outputs marked as up to date.
+ */
+void checkRebuildManifest();
+bool outputsAreUpToDate(OutputGroup group);
+// Records the inputs of all the groups computed; to be called after all the outputs have been saved
+void saveRebuildManifest();
+
+#endif
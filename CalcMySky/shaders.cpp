@@ -1,20 +1,23 @@
 #include "shaders.hpp"
 
 #include <set>
+#include <map>
+#include <chrono>
+#include <iterator>
 #include <iomanip>
 #include <iostream>
 #include <QRegularExpression>
+#include <QCryptographicHash>
 #include <QApplication>
 #include <QFile>
 #include <QDir>
 
 #include "data.hpp"
 #include "util.hpp"
+#include "function-tables.hpp"
 
 #include "config.h"
 
-QString withHeadersIncluded(QString src, QString const& filename);
-
 void initConstHeader(glm::vec4 const& wavelengths)
 {
     QString header=1+R"(
@@ -56,24 +59,42 @@ const int numTransmittanceIntegrationPoints=)" + toString(atmo.numTransmittanceI
     virtualHeaderFiles[CONSTANTS_HEADER_FILENAME]=header;
 }
 
+QString makeScattererDensityFunctionSrc(AtmosphereParameters::Scatterer const& scatterer)
+{
+    return "float scattererNumberDensity_"+scatterer.name+"(float altitude)\n"
+           "{\n"
+           +scatterer.numberDensity+
+           "}\n";
+}
+
+QString makeAbsorberDensityFunctionSrc(AtmosphereParameters::Absorber const& absorber)
+{
+    return "float absorberNumberDensity_"+absorber.name+"(float altitude)\n"
+           "{\n"
+           +absorber.numberDensity+
+           "}\n";
+}
+
+QString makePhaseFunctionSrc(AtmosphereParameters::Scatterer const& scatterer)
+{
+    return "vec4 phaseFunction_"+scatterer.name+"(float dotViewSun)\n"
+           "{\n"
+           +scatterer.phaseFunction+
+           "}\n";
+}
+
 QString makeDensitiesFunctions()
 {
     QString header;
     QString src;
     for(auto const& scatterer : atmo.scatterers)
     {
-        src += "float scattererNumberDensity_"+scatterer.name+"(float altitude)\n"
-               "{\n"
-               +scatterer.numberDensity+
-               "}\n";
+        src += makeScattererDensityFunctionSrc(scatterer);
         header += "float scattererNumberDensity_"+scatterer.name+"(float altitude);\n";
     }
     for(auto const& absorber : atmo.absorbers)
     {
-        src += "float absorberNumberDensity_"+absorber.name+"(float altitude)\n"
-               "{\n"
-               +absorber.numberDensity+
-               "}\n";
+        src += makeAbsorberDensityFunctionSrc(absorber);
         header += "float absorberNumberDensity_"+absorber.name+"(float altitude);\n";
     }
 
@@ -93,52 +114,46 @@ QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths)
 #include "const.h.glsl"
 #include "common-functions.h.glsl"
 )";
-    const QString opticalDepthFunctionTemplate=R"(
-vec4 opticalDepthToAtmosphereBorder_##agentSpecies(float altitude, float cosZenithAngle, vec4 crossSection)
+    // All the species are integrated in a single loop, so that the geometry of the sample points is computed only
+    // once. Each species still has its own accumulator and the same expression for its optical depth as when it had
+    // its own loop, so the result is unchanged up to the freedom the GLSL compiler has in floating-point contraction.
+    QString accumulatorsInit, accumulation, depthSum;
+    const auto addSpecies=[&](QString const& agent, QString const& species, glm::vec4 const& crossSection)
+    {
+        const auto sum="sum_"+agent+"_"+species;
+        accumulatorsInit += "    float "+sum+"=0;\n";
+        accumulation += "        "+sum+"+="+agent+"NumberDensity_"+species+"(currAlt);\n";
+        depthSum += "        +"+sum+"*dl*"+toString(crossSection)+"\n";
+    };
+    for(auto const& scatterer : atmo.scatterers)
+        addSpecies("scatterer", scatterer.name, scatterer.extinctionCrossSection(wavelengths));
+    for(auto const& absorber : atmo.absorbers)
+        addSpecies("absorber", absorber.name, absorber.crossSection(wavelengths));
+
+    const QString computeFunction = R"(
+// This assumes that ray doesn't intersect Earth
+vec4 computeTransmittanceToAtmosphereBorder(float cosZenithAngle, float altitude)
 {
     CONST float integrInterval=distanceToAtmosphereBorder(cosZenithAngle, altitude);
 
     CONST float R=earthRadius;
     CONST float r1=R+altitude;
-    CONST float l=integrInterval;
     CONST float mu=cosZenithAngle;
     // Using midpoint rule for quadrature
     CONST float dl=integrInterval/numTransmittanceIntegrationPoints;
-    float sum=0;
+)" + accumulatorsInit + R"(
     for(int n=0;n<numTransmittanceIntegrationPoints;++n)
     {
         CONST float dist=(n+0.5)*dl;
         /* From law of cosines: r₂²=r₁²+l²+2r₁lμ */
         CONST float currAlt=-R+safeSqrt(sqr(r1)+sqr(dist)+2*r1*dist*mu);
-        sum+=agent##NumberDensity_##agentSpecies(currAlt);
-    }
-    return sum*dl*crossSection;
-}
-)";
-    QString opticalDepthFunctions;
-    QString computeFunction = R"(
-// This assumes that ray doesn't intersect Earth
-vec4 computeTransmittanceToAtmosphereBorder(float cosZenithAngle, float altitude)
-{
+)" + accumulation + R"(    }
     CONST vec4 depth=
-)";
-    for(auto const& scatterer : atmo.scatterers)
-    {
-        opticalDepthFunctions += QString(opticalDepthFunctionTemplate).replace("##agentSpecies",scatterer.name).replace("agent##","scatterer");
-        computeFunction += "        +opticalDepthToAtmosphereBorder_"+scatterer.name+
-                             "(altitude,cosZenithAngle,"+toString(scatterer.extinctionCrossSection(wavelengths))+")\n";
-    }
-    for(auto const& absorber : atmo.absorbers)
-    {
-        opticalDepthFunctions += QString(opticalDepthFunctionTemplate).replace("##agentSpecies",absorber.name).replace("agent##","absorber");
-        computeFunction += "        +opticalDepthToAtmosphereBorder_"+absorber.name+
-                             "(altitude,cosZenithAngle,"+toString(absorber.crossSection(wavelengths))+")\n";
-    }
-    computeFunction += R"(      ;
+)" + depthSum + R"(      ;
     return depth; // Exponentiation will take place in sampling functions. This way we avoid underflow in texture values.
 }
 )";
-    return head+makeDensitiesFunctions()+opticalDepthFunctions+computeFunction;
+    return head+makeDensitiesFunctions()+computeFunction;
 }
 
 QString makeScattererDensityFunctionsSrc()
@@ -162,10 +177,7 @@ QString makePhaseFunctionsSrc()
     QString header;
     for(auto const& scatterer : atmo.scatterers)
     {
-        src += "vec4 phaseFunction_"+scatterer.name+"(float dotViewSun)\n"
-               "{\n"
-               +scatterer.phaseFunction+
-               "}\n";
+        src += makePhaseFunctionSrc(scatterer);
         header += "vec4 phaseFunction_"+scatterer.name+"(float dotViewSun);\n";
     }
     header+="vec4 currentPhaseFunction(float dotViewSun);\n";
@@ -208,6 +220,11 @@ QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache)
             return it->second;
     }
 
+    // Files on disk don't change during the run, so read each of them only once
+    static std::map<QString, QString> diskFilesCache;
+    if(const auto it=diskFilesCache.find(fileName); it!=diskFilesCache.end())
+        return it->second;
+
     const auto appBinDir=QDir(qApp->applicationDirPath()+"/").canonicalPath();
     QString filePath=appBinDir + "/shaders/" + fileName;
     if(appBinDir==QDir(INSTALL_BINDIR).canonicalPath())
@@ -224,7 +241,7 @@ QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache)
         std::cerr << "Error opening shader file \"" << filePath.toStdString() << "\"\n";
         throw MustQuit{};
     }
-    return file.readAll();
+    return diskFilesCache[fileName]=file.readAll();
 }
 
 void defineDisabledDefinitions(QString& source)
@@ -247,21 +264,17 @@ void defineDisabledDefinitions(QString& source)
     }
 }
 
-std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QString source, QString const& description,
-                                             QString* processedSource = nullptr)
+std::unique_ptr<QOpenGLShader> compilePreprocessedShader(QOpenGLShader::ShaderType type, QString const& source, QString const& description)
 {
     auto shader=std::make_unique<QOpenGLShader>(type);
-    defineDisabledDefinitions(source);
-    source=withHeadersIncluded(source, description);
-    if(processedSource)
-        *processedSource = source;
     if(!shader->compileSourceCode(source))
     {
         std::cerr << "Failed to compile " << description.toStdString() << ":\n"
                   << shader->log().toStdString() << "\n";
         std::cerr << "Source of the shader:\n________________________________________________\n";
         const auto lineCount=source.count(QChar('\n'));
-        QTextStream srcStream(&source);
+        QString sourceCopy=source;
+        QTextStream srcStream(&sourceCopy);
         int lineNumber=1;
         for(auto line=srcStream.readLine(); !line.isNull(); line=srcStream.readLine(), ++lineNumber)
         {
@@ -284,49 +297,101 @@ std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QSt
     return shader;
 }
 
-std::unique_ptr<QOpenGLShader> compileShader(QOpenGLShader::ShaderType type, QString const& filename, QString* processedSource = nullptr)
-{ return compileShader(type, getShaderSrc(filename), filename, processedSource); }
+namespace
+{
+
+constexpr char HEADER_SUFFIX[]=".h.glsl";
 
-QString withHeadersIncluded(QString src, QString const& filename)
+// Result of scanning a source for #include directives. It only depends on the file name and its text.
+struct ScannedShaderSource
 {
+    // Expanded source is chunks[0] + includes[0] + chunks[1] + ... + includes.back() + chunks.back()
+    std::vector<QString> chunks;
+    std::vector<QString> includes;
+};
+// Keyed by file name and its unexpanded text, so that a changed virtual file gets rescanned, but an unchanged one doesn't
+std::map<std::pair<QString, QString>, ScannedShaderSource> scannedSourcesCache;
+
+ScannedShaderSource scanShaderSource(QString src, QString const& filename)
+{
+    defineDisabledDefinitions(src);
+
+    static const QRegularExpression includeLinePattern("^\\s*#include(?: \"|_if\\s*\\()");
+    static const QRegularExpression disabledIncludePattern("^\\s*#include_if\\((?:0\\b[^)]*|[A-Za-z_][A-Za-z0-9_]*)\\)");
+    static const QRegularExpression enabledIncludePattern("^#include(?:_if\\s*\\(\\s*1\\s*(?:/\\*[^)]*\\*/)?\\))? \"([^\"]+)\"$");
+
+    ScannedShaderSource scanned;
     QTextStream srcStream(&src);
     int lineNumber=1;
     int headerNumber=1;
-    QString newSrc;
+    QString chunk;
     for(auto line=srcStream.readLine(); !line.isNull(); line=srcStream.readLine(), ++lineNumber)
     {
-        if(!line.contains(QRegularExpression("^\\s*#include(?: \"|_if\\s*\\()")))
+        if(!line.contains(includeLinePattern))
         {
             // Not an include line, pass it to output
-            newSrc.append(line+'\n');
+            chunk.append(line+'\n');
             continue;
         }
-        if(line.contains(QRegularExpression("^\\s*#include_if\\((?:0\\b[^)]*|[A-Za-z_][A-Za-z0-9_]*)\\)")))
+        if(line.contains(disabledIncludePattern))
         {
             // Disabled include, skip it (enabled one must have the condition be literal 1)
-            newSrc.append('\n');
+            chunk.append('\n');
             continue;
         }
-        const auto includePattern=QRegularExpression("^#include(?:_if\\s*\\(\\s*1\\s*(?:/\\*[^)]*\\*/)?\\))? \"([^\"]+)\"$").match(line);
+        const auto includePattern=enabledIncludePattern.match(line);
         if(!includePattern.hasMatch())
         {
             std::cerr << filename.toStdString() << ":" << lineNumber << ": syntax error in #include directive:\n" << line << "\n";
             throw MustQuit{};
         }
         const auto includeFileName=includePattern.captured(1);
-        static const char headerSuffix[]=".h.glsl";
-        if(!includeFileName.endsWith(headerSuffix))
+        if(!includeFileName.endsWith(HEADER_SUFFIX))
         {
             std::cerr << filename.toStdString() << ":" << lineNumber << ": file to include must have suffix \""
-                      << headerSuffix << "\"\n";
+                      << HEADER_SUFFIX << "\"\n";
             throw MustQuit{};
         }
-        const auto header = getShaderSrc(includeFileName);
-        newSrc.append(QString("#line 1 %1 // %2\n").arg(headerNumber++).arg(includeFileName));
-        newSrc.append(header);
-        newSrc.append(QString("#line %1 0 // %2\n").arg(lineNumber+1).arg(filename));
+        chunk.append(QString("#line 1 %1 // %2\n").arg(headerNumber++).arg(includeFileName));
+        scanned.chunks.push_back(chunk);
+        scanned.includes.push_back(includeFileName);
+        chunk=QString("#line %1 0 // %2\n").arg(lineNumber+1).arg(filename);
+    }
+    scanned.chunks.push_back(chunk);
+    return scanned;
+}
+
+ScannedShaderSource const& getScannedShaderSource(QString const& filename, QString const& unexpandedSource)
+{
+    auto key=std::make_pair(filename, unexpandedSource);
+    if(const auto it=scannedSourcesCache.find(key); it!=scannedSourcesCache.end())
+        return it->second;
+    auto scanned=scanShaderSource(key.second, filename);
+    return scannedSourcesCache.emplace(std::move(key), std::move(scanned)).first->second;
+}
+
+ScannedShaderSource const& getScannedShaderSource(QString const& filename)
+{
+    return getScannedShaderSource(filename, getShaderSrc(filename));
+}
+
+QString preprocessShaderSource(QString const& filename, QString const& unexpandedSource)
+{
+    const auto& scanned=getScannedShaderSource(filename, unexpandedSource);
+    QString source=scanned.chunks.front();
+    for(unsigned i=0; i<scanned.includes.size(); ++i)
+    {
+        source.append(getShaderSrc(scanned.includes[i]));
+        source.append(scanned.chunks[i+1]);
     }
-    return newSrc;
+    return source;
+}
+
+QString preprocessShaderSource(QString const& filename)
+{
+    return preprocessShaderSource(filename, getShaderSrc(filename));
+}
+
 }
 
 std::set<QString> getShaderFileNamesToLinkWith(QString const& filename, int recursionDepth=0)
@@ -338,22 +403,15 @@ std::set<QString> getShaderFileNamesToLinkWith(QString const& filename, int recu
         throw MustQuit{};
     }
     std::set<QString> filenames;
-    auto shaderSrc=getShaderSrc(filename);
-    QTextStream srcStream(&shaderSrc);
-    for(auto line=srcStream.readLine(); !line.isNull(); line=srcStream.readLine())
+    for(const auto& headerFileName : getScannedShaderSource(filename).includes)
     {
-        const auto includePattern=
-            QRegularExpression("^#include(?:_if\\s*\\(\\s*1\\s*(?:/\\*[^)]*\\*/)?\\))? \"([^\"]+)(\\.h\\.glsl)\"$").match(line);
-        if(!includePattern.hasMatch())
-            continue;
-        const auto includeFileBaseName=includePattern.captured(1);
-        const auto headerFileName=includeFileBaseName+includePattern.captured(2);
         if(headerFileName == GLSL_EXTENSIONS_HEADER_FILENAME) // no companion source for extensions header
             continue;
         if(headerFileName == CONSTANTS_HEADER_FILENAME) // no companion source for constants header
             continue;
         if(headerFileName == RADIANCE_TO_LUMINANCE_HEADER_FILENAME) // no companion source for radiance-to-luminance conversion header
             continue;
+        const auto includeFileBaseName=headerFileName.chopped(int(std::size(HEADER_SUFFIX))-1);
         const auto shaderFileNameToLinkWith=includeFileBaseName+".frag";
         filenames.insert(shaderFileNameToLinkWith);
         if(shaderFileNameToLinkWith!=filename)
@@ -365,33 +423,89 @@ std::set<QString> getShaderFileNamesToLinkWith(QString const& filename, int recu
     return filenames;
 }
 
-std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
-                                                           const char* description, const UseGeomShader useGeomShader,
-                                                           std::vector<std::pair<QString, QString>>* sourcesToSave)
+std::set<QString> getShaderFileDependencies(QString const& mainSrcFileName)
+{
+    // These are generated from the atmosphere description, so they aren't files on disk
+    static const std::set<QString> generatedFileNames{DENSITIES_SHADER_FILENAME, PHASE_FUNCTIONS_SHADER_FILENAME,
+                                                      TOTAL_SCATTERING_COEFFICIENT_SHADER_FILENAME,
+                                                      COMPUTE_TRANSMITTANCE_SHADER_FILENAME, CONSTANTS_HEADER_FILENAME,
+                                                      DENSITIES_HEADER_FILENAME, RADIANCE_TO_LUMINANCE_HEADER_FILENAME,
+                                                      PHASE_FUNCTIONS_HEADER_FILENAME, TOTAL_SCATTERING_COEFFICIENT_HEADER_FILENAME};
+    std::set<QString> dependencies;
+    std::vector<QString> filesToScan{mainSrcFileName, "shader.vert", "shader.geom"};
+    while(!filesToScan.empty())
+    {
+        const auto filename=filesToScan.back();
+        filesToScan.pop_back();
+        if(generatedFileNames.count(filename) || !dependencies.insert(filename).second)
+            continue;
+        const auto src=getShaderSrc(filename, IgnoreCache{true});
+        for(const auto& headerFileName : getScannedShaderSource(filename, src).includes)
+        {
+            filesToScan.push_back(headerFileName);
+            // Same companion sources as in getShaderFileNamesToLinkWith()
+            if(headerFileName == GLSL_EXTENSIONS_HEADER_FILENAME || headerFileName == CONSTANTS_HEADER_FILENAME ||
+               headerFileName == RADIANCE_TO_LUMINANCE_HEADER_FILENAME)
+                continue;
+            filesToScan.push_back(headerFileName.chopped(int(std::size(HEADER_SUFFIX))-1)+".frag");
+        }
+    }
+    return dependencies;
+}
+
+namespace
 {
-    auto program=std::make_unique<QOpenGLShaderProgram>();
 
+struct PreprocessedShader
+{
+    QOpenGLShader::ShaderType type;
+    QString filename;
+    QString source;
+};
+
+// Function tables are only used by the programs computing the textures: the renderer loading the saved shaders doesn't have them
+DEFINE_EXPLICIT_BOOL(UseFunctionTables);
+
+std::vector<PreprocessedShader> preprocessShaderProgramSources(QString const& mainSrcFileName, const UseGeomShader useGeomShader,
+                                                               const UseFunctionTables useFunctionTables)
+{
     auto shaderFileNames=getShaderFileNamesToLinkWith(mainSrcFileName);
     shaderFileNames.insert(mainSrcFileName);
 
-    std::vector<std::unique_ptr<QOpenGLShader>> shaders;
+    std::vector<PreprocessedShader> shaders;
     for(const auto& filename : shaderFileNames)
     {
-        QString processedSource;
-        shaders.emplace_back(compileShader(QOpenGLShader::Fragment, filename, &processedSource));
-        program->addShader(shaders.back().get());
-        if(sourcesToSave)
-            sourcesToSave->push_back({filename, processedSource});
+        const auto src = useFunctionTables ? withTabulatedFunctions(filename, getShaderSrc(filename)) : getShaderSrc(filename);
+        shaders.push_back({QOpenGLShader::Fragment, filename, preprocessShaderSource(filename, src)});
     }
 
-    shaders.emplace_back(compileShader(QOpenGLShader::Vertex, "shader.vert"));
-    program->addShader(shaders.back().get());
+    shaders.push_back({QOpenGLShader::Vertex, "shader.vert", preprocessShaderSource("shader.vert")});
 
     if(useGeomShader)
-    {
-        shaders.emplace_back(compileShader(QOpenGLShader::Geometry, "shader.geom"));
-        program->addShader(shaders.back().get());
-    }
+        shaders.push_back({QOpenGLShader::Geometry, "shader.geom", preprocessShaderSource("shader.geom")});
+
+    return shaders;
+}
+
+// Keyed by shader type and preprocessed source. A shader object can be attached to any number of programs.
+std::map<std::pair<int, QString>, std::shared_ptr<QOpenGLShader>> compiledShadersCache;
+
+std::shared_ptr<QOpenGLShader> getOrCompileShader(PreprocessedShader const& src)
+{
+    auto key=std::make_pair(int(src.type), src.source);
+    if(const auto it=compiledShadersCache.find(key); it!=compiledShadersCache.end())
+        return it->second;
+    std::shared_ptr<QOpenGLShader> shader=compilePreprocessedShader(src.type, src.source, src.filename);
+    compiledShadersCache.emplace(std::move(key), shader);
+    return shader;
+}
+
+std::unique_ptr<QOpenGLShaderProgram> linkShaderProgram(std::vector<PreprocessedShader> const& sources, const char* description)
+{
+    auto program=std::make_unique<QOpenGLShaderProgram>();
+
+    for(const auto& src : sources)
+        program->addShader(getOrCompileShader(src).get());
 
     if(!program->link())
     {
@@ -399,6 +513,74 @@ std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSr
         std::cerr << "Failed to link " << description << "\n";
         throw MustQuit{};
     }
+    if(const auto location=program->uniformLocation(FUNCTION_TABLES_UNIFORM_NAME); location>=0)
+    {
+        program->bind();
+        program->setUniformValue(location, UNIT_FUNCTION_TABLES);
+        program->release();
+    }
     return program;
 }
 
+struct CachedShaderProgram
+{
+    std::unique_ptr<QOpenGLShaderProgram> program;
+    std::chrono::steady_clock::duration compilationTime;
+};
+// Keyed by the hash of all the preprocessed sources of the program
+std::map<QByteArray, CachedShaderProgram> shaderProgramCache;
+ShaderProgramCacheStats shaderProgramCacheStats;
+
+}
+
+std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
+                                                           const char* description, const UseGeomShader useGeomShader,
+                                                           std::vector<std::pair<QString, QString>>* sourcesToSave)
+{
+    const auto sources=preprocessShaderProgramSources(mainSrcFileName, useGeomShader, UseFunctionTables{!sourcesToSave});
+    if(sourcesToSave)
+    {
+        for(const auto& src : sources)
+            if(src.type==QOpenGLShader::Fragment)
+                sourcesToSave->push_back({src.filename, src.source});
+    }
+    return linkShaderProgram(sources, description);
+}
+
+QOpenGLShaderProgram& getOrCompileShaderProgram(QString const& mainSrcFileName, const char* description, const UseGeomShader useGeomShader)
+{
+    const auto sources=preprocessShaderProgramSources(mainSrcFileName, useGeomShader, UseFunctionTables{true});
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for(const auto& src : sources)
+    {
+        hash.addData(QByteArray::number(int(src.type)));
+        hash.addData(src.filename.toUtf8());
+        hash.addData(src.source.toUtf8());
+    }
+    const auto key=hash.result();
+
+    if(const auto it=shaderProgramCache.find(key); it!=shaderProgramCache.end())
+    {
+        ++shaderProgramCacheStats.hits;
+        shaderProgramCacheStats.compilationTimeSaved += it->second.compilationTime;
+        return *it->second.program;
+    }
+
+    const auto time0=std::chrono::steady_clock::now();
+    auto program=linkShaderProgram(sources, description);
+    const auto time1=std::chrono::steady_clock::now();
+    ++shaderProgramCacheStats.misses;
+    return *shaderProgramCache.emplace(key, CachedShaderProgram{std::move(program), time1-time0}).first->second.program;
+}
+
+void clearShaderProgramCache()
+{
+    shaderProgramCache.clear();
+    compiledShadersCache.clear();
+}
+
+ShaderProgramCacheStats const& getShaderProgramCacheStats()
+{
+    return shaderProgramCacheStats;
+}
+
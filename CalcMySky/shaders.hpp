@@ -1,21 +1,48 @@
 #ifndef INCLUDE_ONCE_2BE961E4_6CF8_4E2F_B5E5_DE8EEEE510F9
 #define INCLUDE_ONCE_2BE961E4_6CF8_4E2F_B5E5_DE8EEEE510F9
 
+#include <set>
 #include <memory>
+#include <chrono>
 #include <QOpenGLShader>
 #include <glm/glm.hpp>
 #include "../common/util.hpp"
+#include "../common/AtmosphereParameters.hpp"
 
 DEFINE_EXPLICIT_BOOL(IgnoreCache);
 QString getShaderSrc(QString const& fileName, IgnoreCache ignoreCache=IgnoreCache{false});
+/*
+ * Names of the shader files on disk that a program with the given main source is built from, including the vertex and
+ * geometry shaders. Sources generated from the atmosphere description are skipped.
+ */
+std::set<QString> getShaderFileDependencies(QString const& mainSrcFileName);
 DEFINE_EXPLICIT_BOOL(UseGeomShader);
 std::unique_ptr<QOpenGLShaderProgram> compileShaderProgram(QString const& mainSrcFileName,
                                                            const char* description,
                                                            UseGeomShader useGeomShader=UseGeomShader{false},
                                                            std::vector<std::pair<QString, QString>>* sourcesToSave=nullptr);
+/*
+ * Returns a program compiled from the current sources, reusing a previously compiled one if all the preprocessed
+ * sources are the same. Values that change between passes should then be uniforms, not patched into the source.
+ * The program is owned by the cache and stays valid until clearShaderProgramCache() is called.
+ */
+QOpenGLShaderProgram& getOrCompileShaderProgram(QString const& mainSrcFileName, const char* description,
+                                                UseGeomShader useGeomShader=UseGeomShader{false});
+//! Releases the cached programs and compiled shader objects; must be called while the OpenGL context is current
+void clearShaderProgramCache();
+struct ShaderProgramCacheStats
+{
+    unsigned hits=0;
+    unsigned misses=0;
+    std::chrono::steady_clock::duration compilationTimeSaved{};
+};
+ShaderProgramCacheStats const& getShaderProgramCacheStats();
 void initConstHeader(glm::vec4 const& wavelengths);
 QString makeScattererDensityFunctionsSrc();
 QString makeTransmittanceComputeFunctionsSrc(glm::vec4 const& wavelengths);
 QString makeTotalScatteringCoefSrc();
 QString makePhaseFunctionsSrc();
+QString makeScattererDensityFunctionSrc(AtmosphereParameters::Scatterer const& scatterer);
+QString makeAbsorberDensityFunctionSrc(AtmosphereParameters::Absorber const& absorber);
+QString makePhaseFunctionSrc(AtmosphereParameters::Scatterer const& scatterer);
 #endif
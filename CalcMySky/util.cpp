@@ -1,9 +1,17 @@
 #include "util.hpp"
 
+#include <deque>
+#include <mutex>
+#include <limits>
 #include <memory>
+#include <thread>
 #include <cstring>
+#include <numeric>
+#include <utility>
 #include <iostream>
+#include <algorithm>
 #include <filesystem>
+#include <condition_variable>
 #include <QFile>
 
 #include "data.hpp"
@@ -30,6 +38,17 @@ void renderQuad()
     OPENGL_DEBUG_CHECK_ERROR("glBindVertexArray(0) FAILED inside renderQuad()");
 }
 
+void renderQuad(const GLsizei instanceCount)
+{
+    OPENGL_DEBUG_CHECK_ERROR("FAILED on entry to renderQuad(instanceCount)");
+	gl.glBindVertexArray(vao);
+    OPENGL_DEBUG_CHECK_ERROR("glBindVertexArray(vao) FAILED inside renderQuad(instanceCount)");
+	gl.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+    OPENGL_DEBUG_CHECK_ERROR("glDrawArraysInstanced() FAILED inside renderQuad(instanceCount)");
+	gl.glBindVertexArray(0);
+    OPENGL_DEBUG_CHECK_ERROR("glBindVertexArray(0) FAILED inside renderQuad(instanceCount)");
+}
+
 void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString const& message)
 {
     switch(type)
@@ -56,9 +75,267 @@ void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString c
     }
 }
 
-std::vector<glm::vec4> saveTexture(const GLenum target, const GLuint texture, const std::string_view name,
-                                   const std::string_view path, std::vector<int> const& sizes,
-                                   const ReturnTextureData returnTexData)
+namespace
+{
+
+/*
+ * Counts NaN entries and, if dst is not null, copies the data there, rounding to bitsOfPrecision bits if it's
+ * nonzero. The values are handled as integer bit patterns, which lets the compiler vectorize the loops.
+ */
+size_t countNaNsAndRound(GLfloat const*const src, GLfloat*const dst, const size_t size, const unsigned bitsOfPrecision)
+{
+    using FloatAsInt = uint32_t;
+    static_assert(sizeof(FloatAsInt) == sizeof(GLfloat));
+    constexpr unsigned maxPrecision = std::numeric_limits<GLfloat>::digits;
+    constexpr FloatAsInt absMask = 0x7fffffff, infinityBits = 0x7f800000;
+    const FloatAsInt mask = bitsOfPrecision ? ~((1u << (maxPrecision - bitsOfPrecision)) - 1) : ~FloatAsInt(0);
+
+    size_t nanCount = 0;
+    if(!dst)
+    {
+        for(size_t i = 0; i < size; ++i)
+        {
+            FloatAsInt x;
+            std::memcpy(&x, &src[i], sizeof x);
+            nanCount += (x & absMask) > infinityBits;
+        }
+        return nanCount;
+    }
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        FloatAsInt x;
+        std::memcpy(&x, &src[i], sizeof x);
+        nanCount += (x & absMask) > infinityBits;
+        x &= mask;
+        std::memcpy(&dst[i], &x, sizeof x);
+    }
+    return nanCount;
+}
+
+size_t countNaNsAndRoundInParallel(GLfloat const*const src, GLfloat*const dst, const size_t size, const unsigned bitsOfPrecision)
+{
+    constexpr size_t minChunkSize = 1u<<20;
+    const auto threadCount = std::max(size_t(1), std::min(size_t(std::thread::hardware_concurrency()),
+                                                          (size+minChunkSize-1)/minChunkSize));
+    if(threadCount == 1)
+        return countNaNsAndRound(src, dst, size, bitsOfPrecision);
+
+    const auto chunkSize = (size+threadCount-1)/threadCount;
+    std::vector<size_t> nanCounts(threadCount);
+    std::vector<std::thread> threads;
+    for(size_t n = 0; n < threadCount; ++n)
+    {
+        const auto begin = std::min(size, n*chunkSize);
+        const auto end = std::min(size, begin+chunkSize);
+        threads.emplace_back([=,&nanCounts]
+                             { nanCounts[n] = countNaNsAndRound(src+begin, dst ? dst+begin : nullptr, end-begin, bitsOfPrecision); });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    return std::accumulate(nanCounts.begin(), nanCounts.end(), size_t(0));
+}
+
+struct TextureWriteJob
+{
+    std::string name;
+    std::string path;
+    std::vector<int> sizes;
+    size_t subpixelCount;
+    unsigned bitsOfPrecision;
+    // May be shared with the caller of saveTexture(), so must not be modified
+    TextureData data;
+
+    GLfloat const* subpixels() const { return &data[0][0]; }
+};
+
+/*
+ * Checks, rounds and writes the texture data to files on a background thread, so that the GPU can proceed with
+ * computations while the previous results are being saved. The queue is bounded, because each job holds a full copy
+ * of a possibly huge texture. Failures are collected and reported on the main thread by reportTextureSavingErrors().
+ */
+class TextureWriter
+{
+    static constexpr size_t maxQueuedJobs = 1;
+
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<TextureWriteJob> queue;
+    bool jobInProgress = false;
+    bool stopping = false;
+    std::string errors;
+    std::thread thread;
+
+    static std::string write(TextureWriteJob const& job)
+    {
+        QFile out(QByteArray::fromRawData(job.path.data(), job.path.size()));
+        if(!out.open(QFile::WriteOnly))
+            return "Failed to save "+job.name+" to \""+job.path+"\": failed to open file: "+out.errorString().toStdString()+"\n";
+        for(const uint16_t s : job.sizes)
+            out.write(reinterpret_cast<const char*>(&s), sizeof s);
+
+        size_t nanCount = 0;
+        if(job.bitsOfPrecision)
+        {
+            // Round the data in chunks via a staging buffer: the original is not ours to modify, and a full copy would double peak memory
+            constexpr size_t stagingSize = 4u<<20;
+            const std::unique_ptr<GLfloat[]> staging(new GLfloat[std::min(stagingSize, job.subpixelCount)]);
+            for(size_t offset = 0; offset < job.subpixelCount; offset += stagingSize)
+            {
+                const auto count = std::min(stagingSize, job.subpixelCount-offset);
+                nanCount += countNaNsAndRoundInParallel(job.subpixels()+offset, staging.get(), count, job.bitsOfPrecision);
+                out.write(reinterpret_cast<const char*>(staging.get()), count*sizeof staging[0]);
+            }
+        }
+        else
+        {
+            nanCount = countNaNsAndRoundInParallel(job.subpixels(), nullptr, job.subpixelCount, 0);
+            out.write(reinterpret_cast<const char*>(job.subpixels()), job.subpixelCount*sizeof(GLfloat));
+        }
+        out.close();
+        if(out.error())
+            return "Failed to save "+job.name+" to \""+job.path+"\": failed to write file: "+out.errorString().toStdString()+"\n";
+
+        if(nanCount)
+        {
+            return std::to_string(nanCount)+" NaN entries out of "+std::to_string(job.subpixelCount)+" detected while saving "+job.name+"\n"
+                   "The texture was saved for diagnostics, further computation is useless.\n";
+        }
+        return {};
+    }
+
+    void run()
+    {
+        std::unique_lock lock(mutex);
+        for(;;)
+        {
+            queueChanged.wait(lock, [this]{ return stopping || !queue.empty(); });
+            if(queue.empty())
+                return;
+            auto job = std::move(queue.front());
+            queue.pop_front();
+            jobInProgress = true;
+            queueChanged.notify_all();
+
+            lock.unlock();
+            auto error = write(job);
+            job.data.reset();
+            lock.lock();
+
+            errors += error;
+            jobInProgress = false;
+            queueChanged.notify_all();
+        }
+    }
+
+public:
+    ~TextureWriter()
+    {
+        {
+            const std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        if(thread.joinable())
+            thread.join();
+    }
+
+    void enqueue(TextureWriteJob&& job)
+    {
+        std::unique_lock lock(mutex);
+        if(!thread.joinable())
+            thread = std::thread([this]{ run(); });
+        queueChanged.wait(lock, [this]{ return queue.size() < maxQueuedJobs; });
+        queue.emplace_back(std::move(job));
+        queueChanged.notify_all();
+    }
+
+    void waitUntilIdle()
+    {
+        std::unique_lock lock(mutex);
+        queueChanged.wait(lock, [this]{ return queue.empty() && !jobInProgress; });
+    }
+
+    std::string takeErrors()
+    {
+        const std::lock_guard lock(mutex);
+        return std::exchange(errors, std::string{});
+    }
+};
+TextureWriter textureWriter;
+
+// A texture whose contents are being transferred by the GPU into a pixel buffer object
+struct PendingReadback
+{
+    GLuint pbo;
+    GLsync fence;
+    TextureWriteJob job;
+};
+std::deque<PendingReadback> pendingReadbacks;
+
+TextureData completeReadback(PendingReadback& readback)
+{
+    for(;;)
+    {
+        const auto status = gl.glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000/*ns*/);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            break;
+        if(status == GL_WAIT_FAILED)
+        {
+            std::cerr << "Failed to wait for readback of " << readback.job.name << ": " << openglErrorString(gl.glGetError()) << "\n";
+            throw MustQuit{};
+        }
+    }
+    gl.glDeleteSync(readback.fence);
+
+    const auto byteCount = readback.job.subpixelCount*sizeof(GLfloat);
+    static_assert(sizeof(glm::vec4) == 4*sizeof(GLfloat));
+    const std::shared_ptr<glm::vec4[]> pixels(new glm::vec4[readback.job.subpixelCount/4]);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const auto mapped = gl.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, byteCount, GL_MAP_READ_BIT);
+    if(!mapped)
+    {
+        std::cerr << "Failed to map pixel buffer for readback of " << readback.job.name << ": " << openglErrorString(gl.glGetError()) << "\n";
+        throw MustQuit{};
+    }
+    std::memcpy(pixels.get(), mapped, byteCount);
+    gl.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    gl.glDeleteBuffers(1, &readback.pbo);
+    if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
+    {
+        std::cerr << "GL error after readback of " << readback.job.name << ": " << openglErrorString(err) << "\n";
+        throw MustQuit{};
+    }
+    return pixels;
+}
+
+// Moves the oldest readbacks to the writer, leaving at most maxPending of them in flight on the GPU
+void completeReadbacks(const size_t maxPending)
+{
+    while(pendingReadbacks.size() > maxPending)
+    {
+        auto& readback = pendingReadbacks.front();
+        readback.job.data = completeReadback(readback);
+        textureWriter.enqueue(std::move(readback.job));
+        pendingReadbacks.pop_front();
+    }
+}
+
+void reportTextureSavingErrors()
+{
+    if(const auto errors = textureWriter.takeErrors(); !errors.empty())
+    {
+        std::cerr << "\n" << errors;
+        throw MustQuit{};
+    }
+}
+
+}
+
+TextureData saveTexture(const GLenum target, const GLuint texture, const std::string_view name,
+                        const std::string_view path, std::vector<int> const& sizes,
+                        const ReturnTextureData returnTexData)
 {
     if(opts.dbgNoSaveTextures)
     {
@@ -66,6 +343,7 @@ std::vector<glm::vec4> saveTexture(const GLenum target, const GLuint texture, co
         return {};
     }
 
+    reportTextureSavingErrors();
     std::cerr << indentOutput() << "Saving " << name << " to \"" << path << "\"... ";
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
@@ -103,59 +381,86 @@ std::vector<glm::vec4> saveTexture(const GLenum target, const GLuint texture, co
         }
     }
 
+    // Start asynchronous transfer of the texture into a pixel buffer object. We'll wait for it to
+    // complete only when the next texture is being saved, or when the caller needs the data.
     const auto subpixelCount = 4*pixelCount;
-    const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCount]);
-    gl.glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, subpixels.get());
+    GLuint pbo=0;
+    gl.glGenBuffers(1, &pbo);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    gl.glBufferData(GL_PIXEL_PACK_BUFFER, subpixelCount*sizeof(GLfloat), nullptr, GL_STREAM_READ);
+    gl.glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, nullptr);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         std::cerr << "GL error in saveTexture() after glGetTexImage() call: " << openglErrorString(err) << "\n";
         throw MustQuit{};
     }
+    const auto fence = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl.glFlush();
 
-    unsigned nanCount = 0;
-    for(size_t i = 0; i < subpixelCount; ++i)
+    const unsigned bitsOfPrecision = target==GL_TEXTURE_3D ? opts.textureSavePrecision : 0;
+    pendingReadbacks.push_back({pbo, fence, TextureWriteJob{std::string(name), std::string(path), sizes,
+                                                            subpixelCount, bitsOfPrecision, {}}});
+
+    TextureData dataToReturn;
+    if(returnTexData)
     {
-        if(std::isnan(subpixels[i]))
+        // The caller shares the buffer with the writer instead of getting a copy of it
+        completeReadbacks(1);
+        auto& readback = pendingReadbacks.front();
+        dataToReturn = readback.job.data = completeReadback(readback);
+        textureWriter.enqueue(std::move(readback.job));
+        pendingReadbacks.pop_front();
+
+        // The caller is going to use the data right away, so it mustn't get NaNs. If there are any, wait
+        // until the texture is saved for diagnostics, and let the writer report the problem.
+        if(countNaNsAndRoundInParallel(&dataToReturn[0][0], nullptr, subpixelCount, 0))
         {
-            ++nanCount;
+            textureWriter.waitUntilIdle();
+            reportTextureSavingErrors();
         }
     }
-    std::vector<glm::vec4> dataToReturn;
-    if(returnTexData)
-    {
-        static_assert(std::is_trivially_copyable_v<glm::vec4>);
-        dataToReturn.assign(reinterpret_cast<const glm::vec4*>(subpixels.get()),
-                            reinterpret_cast<const glm::vec4*>(subpixels.get()+subpixelCount));
-    }
-    if(target==GL_TEXTURE_3D && opts.textureSavePrecision)
+    else
     {
-        roundTexData(subpixels.get(), subpixelCount, opts.textureSavePrecision);
+        completeReadbacks(1);
     }
 
-    QFile out(QByteArray::fromRawData(path.data(), path.size()));
-    if(!out.open(QFile::WriteOnly))
-    {
-        std::cerr << "failed to open file: " << out.errorString().toStdString() << "\n";
-        throw MustQuit{};
-    }
-    for(const uint16_t s : sizes)
-        out.write(reinterpret_cast<const char*>(&s), sizeof s);
-    out.write(reinterpret_cast<const char*>(subpixels.get()), subpixelCount*sizeof subpixels[0]);
-    out.close();
-    if(out.error())
+    std::cerr << "queued\n";
+
+    return dataToReturn;
+}
+
+void saveTexture(TextureData const& data, const std::string_view name, const std::string_view path, std::vector<int> const& sizes)
+{
+    if(opts.dbgNoSaveTextures)
     {
-        std::cerr << "failed to write file: " << out.errorString().toStdString() << "\n";
-        throw MustQuit{};
+        std::cerr << indentOutput() << "Would save " << name << ", but only shaders are to be saved.\n";
+        return;
     }
-    if(nanCount)
+
+    reportTextureSavingErrors();
+    std::cerr << indentOutput() << "Saving " << name << " to \"" << path << "\"... ";
+    size_t pixelCount=1;
+    for(const size_t s : sizes)
+        pixelCount *= s;
+    textureWriter.enqueue({std::string(name), std::string(path), sizes, 4*pixelCount, opts.textureSavePrecision, data});
+    std::cerr << "queued\n";
+}
+
+void waitForTextureSaving()
+{
+    if(pendingReadbacks.empty())
     {
-        std::cerr << nanCount << " NaN entries out of " << subpixelCount << " detected while saving " << name << "\n";
-        std::cerr << "The texture was saved for diagnostics, further computation is useless.\n";
-        throw MustQuit{};
+        textureWriter.waitUntilIdle();
+        reportTextureSavingErrors();
+        return;
     }
-    std::cerr << "done\n";
 
-    return dataToReturn;
+    std::cerr << indentOutput() << "Waiting for textures to be saved... ";
+    completeReadbacks(0);
+    textureWriter.waitUntilIdle();
+    reportTextureSavingErrors();
+    std::cerr << "done\n";
 }
 
 void setupTexture(TextureId id, const GLsizei width, const GLsizei height)
@@ -2,13 +2,14 @@
 #define INCLUDE_ONCE_C49956E1_F7B6_4759_8745_711BBDFE6FE7
 
 #include <string>
+#include <memory>
 #include <iostream>
 #include <string_view>
 #include <QVector4D>
 #include <QOpenGLFunctions_3_3_Core>
 #include <glm/glm.hpp>
 #include "data.hpp"
-#include "../common/util.hpp"
+#include "../common/gl-util.hpp"
 
 extern QOpenGLFunctions_3_3_Core gl;
 
@@ -44,17 +45,53 @@ inline void setUniformTexture(QOpenGLShaderProgram& program, GLenum target, GLui
 inline void setUniformTexture(QOpenGLShaderProgram& program, GLenum target, TextureId id, GLint sampler, const char* uniformName)
 { setUniformTexture(program, target, textures[id], sampler, uniformName); }
 
+/*
+ * Texture units of the samplers in texture-sampling-functions.frag. Since the scattering order is a uniform, all of
+ * them may be active in the scattering density and indirect irradiance programs, even if the current order doesn't
+ * read some of them. Samplers of different types must not share a unit, so each sampler gets its own one in every
+ * variant of these programs.
+ */
+enum TextureUnit
+{
+    UNIT_TRANSMITTANCE,
+    UNIT_IRRADIANCE,
+    UNIT_FIRST_SCATTERING,
+    UNIT_MULTIPLE_SCATTERING,
+    UNIT_LIGHT_POLLUTION_SCATTERING,
+    // The function tables stay bound to this unit, so the passes using them don't need to bind anything.
+    // Other passes must only use the units above.
+    UNIT_FUNCTION_TABLES,
+};
+
+inline void setScatteringSamplerUnits(QOpenGLShaderProgram& program)
+{
+    program.setUniformValue("transmittanceTexture", UNIT_TRANSMITTANCE);
+    program.setUniformValue("irradianceTexture", UNIT_IRRADIANCE);
+    program.setUniformValue("firstScatteringTexture", UNIT_FIRST_SCATTERING);
+    program.setUniformValue("multipleScatteringTexture", UNIT_MULTIPLE_SCATTERING);
+    program.setUniformValue("lightPollutionScatteringTexture", UNIT_LIGHT_POLLUTION_SCATTERING);
+}
+
 inline void setDrawBuffers(std::vector<GLenum> const& bufs)
 {
     gl.glDrawBuffers(GLsizei(bufs.size()), bufs.data());
 }
 
 void renderQuad();
+//! Renders instanceCount quads, each of which shader.geom sends to its own layer, starting from uniform firstLayer
+void renderQuad(GLsizei instanceCount);
 inline void checkFramebufferStatus(const char*const fboDescription) { return checkFramebufferStatus(gl, fboDescription); }
 void qtMessageHandler(const QtMsgType type, QMessageLogContext const&, QString const& message);
 DEFINE_EXPLICIT_BOOL(ReturnTextureData);
-std::vector<glm::vec4> saveTexture(GLenum target, GLuint texture, std::string_view name, std::string_view path,
-                                   std::vector<int> const& sizes, ReturnTextureData=ReturnTextureData{false});
+// Texture data shared between the caller of saveTexture() and the background writer, to avoid copying
+using TextureData = std::shared_ptr<const glm::vec4[]>;
+// Textures are read back and written to files asynchronously. Failures are reported (by throwing MustQuit)
+// on subsequent calls to saveTexture() or waitForTextureSaving().
+TextureData saveTexture(GLenum target, GLuint texture, std::string_view name, std::string_view path,
+                        std::vector<int> const& sizes, ReturnTextureData=ReturnTextureData{false});
+// Like saveTexture(), but for data of a 3D texture that is already in host memory
+void saveTexture(TextureData const& data, std::string_view name, std::string_view path, std::vector<int> const& sizes);
+void waitForTextureSaving();
 void createDirs(std::string const& path);
 
 class OutputIndentIncrease
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cassert>
 #include <iterator>
@@ -15,7 +16,7 @@
 
 #include "util.hpp"
 #include "../common/const.hpp"
-#include "../common/util.hpp"
+#include "../common/gl-util.hpp"
 #include "../common/EclipsedDoubleScatteringPrecomputer.hpp"
 #include "api/ShowMySky/Settings.hpp"
 
@@ -24,9 +25,62 @@ namespace fs=std::filesystem;
 namespace
 {
 
-auto newTex(QOpenGLTexture::Target target)
+// The texture is unregistered from the memory registry when deleted
+std::shared_ptr<QOpenGLTexture> newTex(std::shared_ptr<GPUMemoryRegistry> const& memory, QOpenGLTexture::Target target)
 {
-    return std::make_unique<QOpenGLTexture>(target);
+    return {new QOpenGLTexture(target), [memory=std::weak_ptr<GPUMemoryRegistry>(memory)](QOpenGLTexture*const tex)
+            {
+                if(const auto registry=memory.lock())
+                    registry->removeTexture(tex->textureId());
+                delete tex;
+            }};
+}
+
+using TextureMemoryMap=std::map<GLuint, GPUMemoryRegistry::Entry>;
+
+// Wraps a texture of another renderer, so that it's registered as shared in our memory registry while we hold it
+std::shared_ptr<QOpenGLTexture> adoptTex(std::shared_ptr<GPUMemoryRegistry> const& memory,
+                                         std::shared_ptr<QOpenGLTexture> const& tex, TextureMemoryMap const& textureMemory)
+{
+    if(const auto it=textureMemory.find(tex->textureId()); it!=textureMemory.end())
+        memory->addSharedTexture(it->first, it->second);
+    // The deleter holds the original pointer, so the texture lives as long as the wrapper
+    return {tex.get(), [memory=std::weak_ptr<GPUMemoryRegistry>(memory), original=tex](QOpenGLTexture*const texture)
+            {
+                if(const auto registry=memory.lock())
+                    registry->removeSharedTexture(texture->textureId());
+            }};
+}
+
+// The old textures are released first, so that unregistering them doesn't remove the entries of the adopted ones
+void adoptTextures(std::vector<std::shared_ptr<QOpenGLTexture>>& ours, std::vector<std::shared_ptr<QOpenGLTexture>> const& theirs,
+                   std::shared_ptr<GPUMemoryRegistry> const& memory, TextureMemoryMap const& textureMemory)
+{
+    ours.clear();
+    for(const auto& tex : theirs)
+        ours.emplace_back(adoptTex(memory, tex, textureMemory));
+}
+
+template<typename Key>
+void adoptTextures(std::map<Key,std::vector<std::shared_ptr<QOpenGLTexture>>>& ours,
+                   std::map<Key,std::vector<std::shared_ptr<QOpenGLTexture>>> const& theirs,
+                   std::shared_ptr<GPUMemoryRegistry> const& memory, TextureMemoryMap const& textureMemory)
+{
+    ours.clear();
+    for(const auto& [key, textures] : theirs)
+        adoptTextures(ours[key], textures, memory, textureMemory);
+}
+
+auto newEclipsedDoubleScatteringPrecomputationTargetTexture(std::shared_ptr<GPUMemoryRegistry> const& memory)
+{
+    auto tex=newTex(memory, QOpenGLTexture::Target3D);
+    // relative azimuth
+    tex->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
+    // cosVZA
+    tex->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::ClampToEdge);
+    // dummy dimension
+    tex->setWrapMode(QOpenGLTexture::DirectionR, QOpenGLTexture::Repeat);
+    return tex;
 }
 
 void oglDebugMessageInsert([[maybe_unused]] const char*const message)
@@ -44,29 +98,153 @@ void oglDebugMessageInsert([[maybe_unused]] const char*const message)
 #endif
 }
 
+// Records the span of the function in the trace, and in debug builds also marks it in the GL debug output
 class OGLTrace
 {
+    TraceRecorder::Span span;
+#ifndef NDEBUG
     std::string action;
+#endif
 public:
-    OGLTrace(const std::string& action)
-        : action(action)
+    OGLTrace(TraceRecorder& recorder, const char*const action)
+        : span(recorder, action)
+#ifndef NDEBUG
+        , action(action)
+#endif
     {
-        oglDebugMessageInsert(("Begin "+action).c_str());
+#ifndef NDEBUG
+        oglDebugMessageInsert(("Begin "+this->action).c_str());
+#endif
     }
     ~OGLTrace()
     {
+#ifndef NDEBUG
         oglDebugMessageInsert(("End "+action).c_str());
+#endif
     }
 };
 
-#ifndef NDEBUG
-# define OGL_TRACE() [[maybe_unused]] OGLTrace t(Q_FUNC_INFO);
-#else
-# define OGL_TRACE()
-#endif
+#define OGL_TRACE() [[maybe_unused]] OGLTrace t(trace_, Q_FUNC_INFO);
+
+// Equirectangular map of the whole sphere of view directions that is projected onto spherical harmonics
+constexpr int skyProjectionMapWidth=64, skyProjectionMapHeight=32;
+constexpr int skyProjectionMaxOrder=3;
+constexpr int skyProjectionMaxCoefCount=(skyProjectionMaxOrder+1)*(skyProjectionMaxOrder+1);
+
+constexpr const char* skyProjectionViewDirFragShaderSrc=1+R"(
+#version 330
+in vec3 position;
+const float PI=3.1415926535897932;
+// XXX: keep in sync with the direction computation in skyProjectionReductionFragShaderSrc
+vec3 calcViewDir()
+{
+    float azimuth=position.x*PI;
+    float elevation=position.y*(PI/2);
+    return vec3(cos(azimuth)*cos(elevation),
+                sin(azimuth)*cos(elevation),
+                sin(elevation));
+}
+)";
+
+constexpr const char* skyProjectionReductionFragShaderSrc=1+R"(
+#version 330
+uniform sampler2DArray skyMap;
+uniform int coefCount;
+out vec4 result;
+const float PI=3.1415926535897932;
+
+// Real spherical harmonics up to l=3, indexed as l*(l+1)+m
+float basis(int index, vec3 d)
+{
+    switch(index)
+    {
+    case 0:  return 0.28209479;
+    case 1:  return 0.48860251*d.y;
+    case 2:  return 0.48860251*d.z;
+    case 3:  return 0.48860251*d.x;
+    case 4:  return 1.09254843*d.x*d.y;
+    case 5:  return 1.09254843*d.y*d.z;
+    case 6:  return 0.31539157*(3*d.z*d.z-1);
+    case 7:  return 1.09254843*d.x*d.z;
+    case 8:  return 0.54627422*(d.x*d.x-d.y*d.y);
+    case 9:  return 0.59004359*d.y*(3*d.x*d.x-d.y*d.y);
+    case 10: return 2.89061144*d.x*d.y*d.z;
+    case 11: return 0.45704580*d.y*(5*d.z*d.z-1);
+    case 12: return 0.37317633*d.z*(5*d.z*d.z-3);
+    case 13: return 0.45704580*d.x*(5*d.z*d.z-1);
+    case 14: return 1.44530572*d.z*(d.x*d.x-d.y*d.y);
+    case 15: return 0.59004359*d.x*(d.x*d.x-3*d.y*d.y);
+    }
+    return 0;
+}
+
+void main()
+{
+    // Column coefCount is the cosine-weighted integral over the upper hemisphere
+    int coefIndex=int(gl_FragCoord.x);
+    int layer=int(gl_FragCoord.y);
+    ivec2 size=textureSize(skyMap,0).xy;
+    vec4 sum=vec4(0);
+    for(int j=0; j<size.y; ++j)
+    {
+        float elevation=PI*((j+0.5)/size.y-0.5);
+        float solidAngle=(2*PI/size.x)*(PI/size.y)*cos(elevation);
+        for(int i=0; i<size.x; ++i)
+        {
+            float azimuth=PI*(2*(i+0.5)/size.x-1);
+            vec3 dir=vec3(cos(azimuth)*cos(elevation),
+                          sin(azimuth)*cos(elevation),
+                          sin(elevation));
+            float weight = coefIndex<coefCount ? basis(coefIndex,dir) : max(dir.z,0.);
+            sum += weight*solidAngle*texelFetch(skyMap, ivec3(i,j,layer), 0);
+        }
+    }
+    result=sum;
+}
+)";
 
 }
 
+// Everything loaded by initDataLoading() that doesn't depend on the view
+struct ShowMySky::AtmosphereRenderer::ModelResources
+{
+    using TexturePtr=::AtmosphereRenderer::TexturePtr;
+    using ShaderProgPtr=::AtmosphereRenderer::ShaderProgPtr;
+    using ScattererName=::AtmosphereRenderer::ScattererName;
+    using ScatteringProgramsMap=::AtmosphereRenderer::ScatteringProgramsMap;
+
+    QString pathToData;
+    QByteArray viewDirVertShaderSrc, viewDirFragShaderSrc;
+    std::vector<std::pair<std::string,GLuint>> viewDirBindAttribLocations;
+
+    std::set<ScattererName> residentScatterers;
+    double altCoord; //!< Altitude slice of the scattering textures
+    int numAltIntervalsIn4DTexture;
+    std::vector<TexturePtr> transmittanceTextures;
+    std::vector<TexturePtr> irradianceTextures;
+    std::vector<TexturePtr> multipleScatteringTextures;
+    std::map<ScattererName,std::vector<TexturePtr>> singleScatteringTextures;
+    std::map<ScattererName,std::vector<TexturePtr>> singleScatteringInterpolationGuidesTextures01;
+    std::map<ScattererName,std::vector<TexturePtr>> singleScatteringInterpolationGuidesTextures02;
+    std::vector<TexturePtr> eclipsedDoubleScatteringTextures;
+    std::vector<TexturePtr> lightPollutionTextures;
+    TextureMemoryMap textureMemory; //!< Memory of the textures above, as registered by the renderer that provided them
+
+    std::shared_ptr<QOpenGLShader> precomputationProgramsVertShader;
+    std::shared_ptr<QOpenGLShader> viewDirVertShader, viewDirFragShader;
+    std::vector<ShaderProgPtr> lightPollutionPrograms;
+    std::vector<ShaderProgPtr> zeroOrderScatteringPrograms;
+    std::vector<ShaderProgPtr> eclipsedZeroOrderScatteringPrograms;
+    std::vector<ShaderProgPtr> multipleScatteringPrograms;
+    std::vector<ScatteringProgramsMap> singleScatteringPrograms;
+    std::vector<ScatteringProgramsMap> eclipsedSingleScatteringPrograms;
+    std::vector<ShaderProgPtr> eclipsedDoubleScatteringPrecomputedPrograms;
+    std::vector<ShaderProgPtr> eclipsedDoubleScatteringPrecomputationPrograms;
+    ScatteringProgramsMap eclipsedSingleScatteringPrecomputationPrograms;
+    ShaderProgPtr viewDirectionGetterProgram;
+    ShaderProgPtr smoothLayersUpsamplingProgram;
+};
+
 void AtmosphereRenderer::loadEclipsedDoubleScatteringTexture(QString const& path, const float altitudeCoord)
 {
     auto log=qDebug().nospace();
@@ -94,6 +272,9 @@ void AtmosphereRenderer::loadEclipsedDoubleScatteringTexture(QString const& path
     const auto texSizeByViewElevation = params_.eclipsedDoubleScatteringTextureSize[1];
     const auto texSizeBySZA = params_.eclipsedDoubleScatteringTextureSize[2];
     const auto texSizeByAltitude = params_.eclipsedDoubleScatteringTextureSize[3];
+    const auto internalFormat = memory_->formatWithinBudget(QString("\"%1\"").arg(path), GL_RGBA32F,
+                                                            qint64(texSizeByViewAzimuth)*texSizeByViewElevation*texSizeBySZA,
+                                                            GPUMemoryRegistry::CanReducePrecision{true});
     EclipsedDoubleScatteringPrecomputer precomputer(gl, params_, texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA, 2);
 
     const auto altTexIndex = altitudeCoord==1 ? numAltIntervalsIn4DTexture_-1 : altitudeCoord*numAltIntervalsIn4DTexture_;
@@ -152,7 +333,7 @@ void AtmosphereRenderer::loadEclipsedDoubleScatteringTexture(QString const& path
         texture[n] = interpolated;
     }
 
-    gl.glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA,
+    gl.glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA,
                     0, GL_RGBA, GL_FLOAT, texture.data());
 
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
@@ -160,12 +341,17 @@ void AtmosphereRenderer::loadEclipsedDoubleScatteringTexture(QString const& path
         throw DataLoadError{QObject::tr("GL error in loadEclipsedDoubleScatteringTexture(\"%1\") after glTexImage3D() call: %2")
                             .arg(path).arg(openglErrorString(err).c_str())};
     }
+    memory_->addBoundTexture(GL_TEXTURE_3D, GPUMemoryCategory::EclipsedDoubleScattering, internalFormat,
+                             texSizeByViewAzimuth, texSizeByViewElevation, texSizeBySZA);
 
     log << "done";
 }
 
-void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitudeCoord, Texture4DType texType)
+void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitudeCoord, const GPUMemoryCategory category,
+                                       const Texture4DType texType)
 {
+    OGL_TRACE();
+
     auto log=qDebug().nospace();
 
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
@@ -199,6 +385,11 @@ void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitude
                             .arg(path).arg(file.size()).arg(sizes[0]).arg(sizes[1]).arg(sizes[2]).arg(sizes[3]).arg(expectedFileSize)};
     }
 
+    const auto internalFormat = memory_->formatWithinBudget(QString("\"%1\"").arg(path),
+                                                            texType==Texture4DType::InterpolationGuides ? GL_R16_SNORM : GL_RGBA32F,
+                                                            qint64(sizes[0])*sizes[1]*sizes[2],
+                                                            GPUMemoryRegistry::CanReducePrecision{true});
+
     numAltIntervalsIn4DTexture_ = sizes[3]-1;
     const auto altTexIndex = altitudeCoord==1 ? numAltIntervalsIn4DTexture_-1 : altitudeCoord*numAltIntervalsIn4DTexture_;
     const auto floorAltIndex = std::floor(altTexIndex);
@@ -237,7 +428,7 @@ void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitude
             std::memcpy(&upper, data.get() + (n+altSliceSize) * pixelSize, pixelSize);
             texData[n] = lower + fractAltIndex*(upper-lower);
         }
-        gl.glTexImage3D(GL_TEXTURE_3D, 0, GL_R16_SNORM, sizes[0], sizes[1], sizes[2], 0, GL_RED, GL_SHORT, texData.get());
+        gl.glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, sizes[0], sizes[1], sizes[2], 0, GL_RED, GL_SHORT, texData.get());
     }
     else
     {
@@ -250,18 +441,19 @@ void AtmosphereRenderer::loadTexture4D(QString const& path, const float altitude
             std::memcpy(&upper, data.get() + (n+altSliceSize) * pixelSize, pixelSize);
             texData[n] = lower + fractAltIndex*(upper-lower);
         }
-        gl.glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, sizes[0], sizes[1], sizes[2], 0, GL_RGBA, GL_FLOAT, texData.get());
+        gl.glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, sizes[0], sizes[1], sizes[2], 0, GL_RGBA, GL_FLOAT, texData.get());
     }
     if(const auto err=gl.glGetError(); err!=GL_NO_ERROR)
     {
         throw DataLoadError{QObject::tr("GL error in loadTexture4D(\"%1\") after glTexImage3D() call: %2")
                             .arg(path).arg(openglErrorString(err).c_str())};
     }
+    memory_->addBoundTexture(GL_TEXTURE_3D, category, internalFormat, sizes[0], sizes[1], sizes[2]);
 
     log << "done";
 }
 
-glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path)
+glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path, const GPUMemoryCategory category)
 {
     auto log=qDebug().nospace();
 
@@ -294,6 +486,9 @@ glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path)
                             .arg(path).arg(file.size()).arg(sizes[0]).arg(sizes[1]).arg(expectedFileSize)};
     }
 
+    // These textures are small, so reducing their precision wouldn't gain much
+    memory_->formatWithinBudget(QString("\"%1\"").arg(path), GL_RGBA32F, qint64(sizes[0])*sizes[1],
+                                GPUMemoryRegistry::CanReducePrecision{false});
     const std::unique_ptr<GLfloat[]> subpixels(new GLfloat[subpixelCount]);
     {
         const qint64 sizeToRead=subpixelCount*sizeof subpixels[0];
@@ -311,6 +506,7 @@ glm::ivec2 AtmosphereRenderer::loadTexture2D(QString const& path)
         throw DataLoadError{QObject::tr("GL error in loadTexture2D(\"%1\") after glTexImage2D() call: %2")
                             .arg(path).arg(openglErrorString(err).c_str())};
     }
+    memory_->addBoundTexture(GL_TEXTURE_2D, category, GL_RGBA32F, sizes[0], sizes[1]);
     log << "done";
     return {sizes[0], sizes[1]};
 }
@@ -334,11 +530,11 @@ void AtmosphereRenderer::loadTextures(const CountStepsOnly countStepsOnly)
         if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
             continue;
 
-        auto& tex=*transmittanceTextures_.emplace_back(newTex(QOpenGLTexture::Target2D));
+        auto& tex=*transmittanceTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target2D));
         tex.setMinificationFilter(QOpenGLTexture::Linear);
         tex.setWrapMode(QOpenGLTexture::ClampToEdge);
         tex.bind();
-        loadTexture2D(QString("%1/transmittance-wlset%2.f32").arg(pathToData_).arg(wlSetIndex));
+        loadTexture2D(QString("%1/transmittance-wlset%2.f32").arg(pathToData_).arg(wlSetIndex), GPUMemoryCategory::Transmittance);
         ++loadingStepsDone_; return;
     }
 
@@ -352,11 +548,11 @@ void AtmosphereRenderer::loadTextures(const CountStepsOnly countStepsOnly)
         if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
             continue;
 
-        auto& tex=*irradianceTextures_.emplace_back(newTex(QOpenGLTexture::Target2D));
+        auto& tex=*irradianceTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target2D));
         tex.setMinificationFilter(QOpenGLTexture::Linear);
         tex.setWrapMode(QOpenGLTexture::ClampToEdge);
         tex.bind();
-        loadTexture2D(QString("%1/irradiance-wlset%2.f32").arg(pathToData_).arg(wlSetIndex));
+        loadTexture2D(QString("%1/irradiance-wlset%2.f32").arg(pathToData_).arg(wlSetIndex), GPUMemoryCategory::Irradiance);
         ++loadingStepsDone_; return;
     }
 
@@ -376,6 +572,8 @@ double AtmosphereRenderer::altitudeUnitRangeTexCoord() const
 
 void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStepsOnly)
 {
+    OGL_TRACE();
+
     const auto texFilter = tools_->textureFilteringEnabled() ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest;
     const auto altCoord = altCoordToLoad_;
 
@@ -396,12 +594,12 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
         }
         else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
         {
-            auto& tex=*multipleScatteringTextures_.emplace_back(newTex(QOpenGLTexture::Target3D));
+            auto& tex=*multipleScatteringTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
             tex.setMinificationFilter(texFilter);
             tex.setMagnificationFilter(texFilter);
             tex.setWrapMode(QOpenGLTexture::ClampToEdge);
             tex.bind();
-            loadTexture4D(filename, altCoord);
+            loadTexture4D(filename, altCoord, GPUMemoryCategory::MultipleScattering);
             ++loadingStepsDone_; return;
         }
     }
@@ -417,12 +615,13 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
             if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
                 continue;
 
-            auto& tex=*multipleScatteringTextures_.emplace_back(newTex(QOpenGLTexture::Target3D));
+            auto& tex=*multipleScatteringTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
             tex.setMinificationFilter(texFilter);
             tex.setMagnificationFilter(texFilter);
             tex.setWrapMode(QOpenGLTexture::ClampToEdge);
             tex.bind();
-            loadTexture4D(QString("%1/multiple-scattering-wlset%2.f32").arg(pathToData_).arg(wlSetIndex), altCoord);
+            loadTexture4D(QString("%1/multiple-scattering-wlset%2.f32").arg(pathToData_).arg(wlSetIndex), altCoord,
+                          GPUMemoryCategory::MultipleScattering);
             ++loadingStepsDone_; return;
         }
     }
@@ -448,170 +647,15 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
         ++loadingStepsDone_; return;
     }
 
+    // Non-resident scatterers are loaded when enabled, see loadScatterers()
     for(const auto& scatterer : params_.scatterers)
     {
-        auto& texturesPerWLSet=singleScatteringTextures_[scatterer.name];
-        switch(scatterer.phaseFunctionType)
-        {
-        case PhaseFunctionType::General:
-        {
-            for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
-            {
-                if(countStepsOnly)
-                {
-                    ++totalLoadingStepsToDo_;
-                    continue;
-                }
-                if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                    continue;
-
-                auto& texture=*texturesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                texture.setMinificationFilter(texFilter);
-                texture.setMagnificationFilter(texFilter);
-                texture.setWrapMode(QOpenGLTexture::ClampToEdge);
-                texture.bind();
-                loadTexture4D(QString("%1/single-scattering/%2/%3.f32").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name), altCoord);
-                ++loadingStepsDone_; return;
-            }
-            for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
-            {
-                const auto filename=QString("%1/single-scattering/%2/%3-dims01.guides2d").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name);
-                if(QFile::exists(filename))
-                {
-                    if(countStepsOnly)
-                    {
-                        ++totalLoadingStepsToDo_;
-                    }
-                    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-                    {
-                        auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures01_[scatterer.name];
-                        auto& tex=*guidesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                        tex.setMinificationFilter(QOpenGLTexture::Linear);
-                        tex.setMagnificationFilter(QOpenGLTexture::Linear);
-                        tex.setWrapMode(QOpenGLTexture::ClampToEdge);
-                        tex.bind();
-                        loadTexture4D(filename, altCoord, Texture4DType::InterpolationGuides);
-                        ++loadingStepsDone_; return;
-                    }
-                }
-            }
-            for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
-            {
-                const auto filename=QString("%1/single-scattering/%2/%3-dims02.guides2d").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name);
-                if(QFile::exists(filename))
-                {
-                    if(countStepsOnly)
-                    {
-                        ++totalLoadingStepsToDo_;
-                    }
-                    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-                    {
-                        auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures02_[scatterer.name];
-                        auto& tex=*guidesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                        tex.setMinificationFilter(QOpenGLTexture::Linear);
-                        tex.setMagnificationFilter(QOpenGLTexture::Linear);
-                        tex.setWrapMode(QOpenGLTexture::ClampToEdge);
-                        tex.bind();
-                        loadTexture4D(filename, altCoord, Texture4DType::InterpolationGuides);
-                        ++loadingStepsDone_; return;
-                    }
-                }
-            }
-            if(countStepsOnly)
-            {
-                ++totalLoadingStepsToDo_;
-            }
-            else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-            {
-                if(singleScatteringInterpolationGuidesTextures02_.size() != singleScatteringInterpolationGuidesTextures01_.size())
-                {
-                    std::cerr << "Warning: interpolation guides inconsistent: dimensions 0-1 have "
-                              << singleScatteringInterpolationGuidesTextures01_.size() << " wavelength sets, while dimensions 0-2 have "
-                              << singleScatteringInterpolationGuidesTextures02_.size() << ". Ignoring the guides.\n";
-                    singleScatteringInterpolationGuidesTextures01_.clear();
-                    singleScatteringInterpolationGuidesTextures02_.clear();
-                }
-                ++loadingStepsDone_; return;
-            }
-            break;
-        }
-        case PhaseFunctionType::Smooth:
-        case PhaseFunctionType::Achromatic:
-        {
-            if(countStepsOnly)
-            {
-                ++totalLoadingStepsToDo_;
-            }
-            else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-            {
-                auto& texture=*texturesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                texture.setMinificationFilter(texFilter);
-                texture.setMagnificationFilter(texFilter);
-                texture.setWrapMode(QOpenGLTexture::ClampToEdge);
-                texture.bind();
-                loadTexture4D(QString("%1/single-scattering/%2-xyzw.f32").arg(pathToData_).arg(scatterer.name), altCoord);
-                ++loadingStepsDone_; return;
-            }
-
-            const auto guidesFilename01 = QString("%1/single-scattering/%2-xyzw-dims01.guides2d").arg(pathToData_).arg(scatterer.name);
-            if(QFile::exists(guidesFilename01))
-            {
-                if(countStepsOnly)
-                {
-                    ++totalLoadingStepsToDo_;
-                }
-                else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-                {
-                    auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures01_[scatterer.name];
-                    auto& texture=*guidesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                    texture.setMinificationFilter(QOpenGLTexture::Linear);
-                    texture.setMagnificationFilter(QOpenGLTexture::Linear);
-                    texture.setWrapMode(QOpenGLTexture::ClampToEdge);
-                    texture.bind();
-                    loadTexture4D(guidesFilename01, altCoord, Texture4DType::InterpolationGuides);
-                    ++loadingStepsDone_; return;
-                }
-            }
-            const auto guidesFilename02 = QString("%1/single-scattering/%2-xyzw-dims02.guides2d").arg(pathToData_).arg(scatterer.name);
-            if(QFile::exists(guidesFilename02))
-            {
-                if(countStepsOnly)
-                {
-                    ++totalLoadingStepsToDo_;
-                }
-                else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-                {
-                    auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures02_[scatterer.name];
-                    auto& texture=*guidesPerWLSet.emplace_back(newTex(QOpenGLTexture::Target3D));
-                    texture.setMinificationFilter(QOpenGLTexture::Linear);
-                    texture.setMagnificationFilter(QOpenGLTexture::Linear);
-                    texture.setWrapMode(QOpenGLTexture::ClampToEdge);
-                    texture.bind();
-                    loadTexture4D(guidesFilename02, altCoord, Texture4DType::InterpolationGuides);
-                    ++loadingStepsDone_; return;
-                }
-            }
-            if(countStepsOnly)
-            {
-                ++totalLoadingStepsToDo_;
-            }
-            else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-            {
-                if(singleScatteringInterpolationGuidesTextures02_.size() != singleScatteringInterpolationGuidesTextures01_.size())
-                {
-                    std::cerr << "Warning: interpolation guides inconsistent: dimensions 0-1 is "
-                              << (singleScatteringInterpolationGuidesTextures01_.empty() ? "lacking" : "present")
-                              << ", while dimensions 0-2 is "
-                              << (singleScatteringInterpolationGuidesTextures02_.empty() ? "lacking" : "present")
-                              << ". Ignoring the guides.\n";
-                    singleScatteringInterpolationGuidesTextures01_.clear();
-                    singleScatteringInterpolationGuidesTextures02_.clear();
-                }
-                ++loadingStepsDone_; return;
-            }
-            break;
-        }
-        }
+        if(!residentScatterers_.count(scatterer.name))
+            continue;
+        const auto stepsDoneBefore=loadingStepsDone_;
+        loadScattererTextures(scatterer, countStepsOnly);
+        if(loadingStepsDone_ != stepsDoneBefore)
+            return;
     }
 
     if(countStepsOnly)
@@ -633,7 +677,7 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
             }
             else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
             {
-                auto& texture=*eclipsedDoubleScatteringTextures_.emplace_back(newTex(QOpenGLTexture::Target3D));
+                auto& texture=*eclipsedDoubleScatteringTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
                 texture.setMinificationFilter(texFilter);
                 texture.setMagnificationFilter(texFilter);
                 // relative azimuth
@@ -662,7 +706,7 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
                 if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
                     continue;
 
-                auto& texture=*eclipsedDoubleScatteringTextures_.emplace_back(newTex(QOpenGLTexture::Target3D));
+                auto& texture=*eclipsedDoubleScatteringTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
                 texture.setMinificationFilter(texFilter);
                 texture.setMagnificationFilter(texFilter);
                 // relative azimuth
@@ -700,13 +744,7 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
         if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
             continue;
 
-        auto& tex=*eclipsedDoubleScatteringPrecomputationTargetTextures_.emplace_back(newTex(QOpenGLTexture::Target3D));
-        // relative azimuth
-        tex.setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
-        // cosVZA
-        tex.setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::ClampToEdge);
-        // dummy dimension
-        tex.setWrapMode(QOpenGLTexture::DirectionR, QOpenGLTexture::Repeat);
+        eclipsedDoubleScatteringPrecomputationTargetTextures_.emplace_back(newEclipsedDoubleScatteringPrecomputationTargetTexture(memory_));
     }
 
     if(countStepsOnly)
@@ -726,12 +764,12 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
         }
         else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
         {
-            auto& tex=*lightPollutionTextures_.emplace_back(newTex(QOpenGLTexture::Target2D));
+            auto& tex=*lightPollutionTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target2D));
             tex.setMinificationFilter(texFilter);
             tex.setMagnificationFilter(texFilter);
             tex.setWrapMode(QOpenGLTexture::ClampToEdge);
             tex.bind();
-            loadTexture2D(filename);
+            loadTexture2D(filename, GPUMemoryCategory::LightPollution);
             ++loadingStepsDone_; return;
         }
     }
@@ -747,201 +785,244 @@ void AtmosphereRenderer::reloadScatteringTextures(const CountStepsOnly countStep
             if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
                 continue;
 
-            auto& tex=*lightPollutionTextures_.emplace_back(newTex(QOpenGLTexture::Target2D));
+            auto& tex=*lightPollutionTextures_.emplace_back(newTex(memory_, QOpenGLTexture::Target2D));
             tex.setMinificationFilter(texFilter);
             tex.setMagnificationFilter(texFilter);
             tex.setWrapMode(QOpenGLTexture::ClampToEdge);
             tex.bind();
-            loadTexture2D(QString("%1/light-pollution-wlset%2.f32").arg(pathToData_).arg(wlSetIndex));
+            loadTexture2D(QString("%1/light-pollution-wlset%2.f32").arg(pathToData_).arg(wlSetIndex), GPUMemoryCategory::LightPollution);
             ++loadingStepsDone_; return;
         }
     }
 }
 
-void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
+void AtmosphereRenderer::loadScattererTextures(AtmosphereParameters::Scatterer const& scatterer, const CountStepsOnly countStepsOnly)
 {
-    if(countStepsOnly)
-    {
-        ++totalLoadingStepsToDo_;
-    }
-    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
-    {
-        viewDirVertShader_.reset(new QOpenGLShader(QOpenGLShader::Vertex));
-        viewDirFragShader_.reset(new QOpenGLShader(QOpenGLShader::Fragment));
-        if(!viewDirVertShader_->compileSourceCode(viewDirVertShaderSrc_))
-            throw DataLoadError{QObject::tr("Failed to compile view direction vertex shader:\n%2").arg(viewDirVertShader_->log())};
-        if(!viewDirFragShader_->compileSourceCode(viewDirFragShaderSrc_))
-            throw DataLoadError{QObject::tr("Failed to compile view direction fragment shader:\n%2").arg(viewDirFragShader_->log())};
-        ++loadingStepsDone_; return;
-    }
-
-    if(countStepsOnly)
-    {
-        ++totalLoadingStepsToDo_;
+    const auto texFilter = tools_->textureFilteringEnabled() ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest;
+    const auto altCoord = altCoordToLoad_;
 
-        // Dummy values so that the loop below doesn't index empty vector
-        singleScatteringPrograms_.clear();
-        for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
-            singleScatteringPrograms_.emplace_back(std::make_unique<std::map<QString,std::vector<ShaderProgPtr>>>());
-    }
-    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+    auto& texturesPerWLSet=singleScatteringTextures_[scatterer.name];
+    switch(scatterer.phaseFunctionType)
     {
-        singleScatteringPrograms_.clear();
-        for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
-            singleScatteringPrograms_.emplace_back(std::make_unique<std::map<QString,std::vector<ShaderProgPtr>>>());
-
-        ++loadingStepsDone_; return;
-    }
-    for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
+    case PhaseFunctionType::General:
     {
-        auto& programsPerScatterer=*singleScatteringPrograms_[renderMode];
+        for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+        {
+            if(countStepsOnly)
+            {
+                ++totalLoadingStepsToDo_;
+                continue;
+            }
+            if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+                continue;
 
-        for(const auto& scatterer : params_.scatterers)
+            auto& texture=*texturesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+            texture.setMinificationFilter(texFilter);
+            texture.setMagnificationFilter(texFilter);
+            texture.setWrapMode(QOpenGLTexture::ClampToEdge);
+            texture.bind();
+            loadTexture4D(QString("%1/single-scattering/%2/%3.f32").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name), altCoord,
+                          GPUMemoryCategory::SingleScattering);
+            ++loadingStepsDone_; return;
+        }
+        for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
         {
-            auto& programs=programsPerScatterer[scatterer.name];
-            if(scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY)
+            const auto filename=QString("%1/single-scattering/%2/%3-dims01.guides2d").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name);
+            if(QFile::exists(filename))
             {
-                for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+                if(countStepsOnly)
                 {
-                    if(countStepsOnly)
-                    {
-                        ++totalLoadingStepsToDo_;
-                        continue;
-                    }
-                    if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                        continue;
-
-                    const auto scatDir=QString("%1/shaders/single-scattering/%2/%3/%4").arg(pathToData_)
-                                                                                       .arg(singleScatteringRenderModeNames[renderMode])
-                                                                                       .arg(wlSetIndex)
-                                                                                       .arg(scatterer.name);
-                    qDebug().nospace() << "Loading shaders from " << scatDir << "...";
-                    auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
-
-                    for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                        addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
-
-                    program.addShader(viewDirFragShader_.get());
-                    program.addShader(viewDirVertShader_.get());
-                    for(const auto& b : viewDirBindAttribLocations_)
-                        program.bindAttributeLocation(b.first.c_str(), b.second);
-
-                    link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                    ++totalLoadingStepsToDo_;
+                }
+                else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+                {
+                    auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures01_[scatterer.name];
+                    auto& tex=*guidesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+                    tex.setMinificationFilter(QOpenGLTexture::Linear);
+                    tex.setMagnificationFilter(QOpenGLTexture::Linear);
+                    tex.setWrapMode(QOpenGLTexture::ClampToEdge);
+                    tex.bind();
+                    loadTexture4D(filename, altCoord, GPUMemoryCategory::InterpolationGuides, Texture4DType::InterpolationGuides);
                     ++loadingStepsDone_; return;
                 }
             }
-            else
+        }
+        for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+        {
+            const auto filename=QString("%1/single-scattering/%2/%3-dims02.guides2d").arg(pathToData_).arg(wlSetIndex).arg(scatterer.name);
+            if(QFile::exists(filename))
             {
                 if(countStepsOnly)
                 {
                     ++totalLoadingStepsToDo_;
-                    continue;
                 }
-                if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                    continue;
-
-                const auto scatDir=QString("%1/shaders/single-scattering/%2/%3").arg(pathToData_)
-                                                                                .arg(singleScatteringRenderModeNames[renderMode])
-                                                                                .arg(scatterer.name);
-                qDebug().nospace() << "Loading shaders from " << scatDir << "...";
-                auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
-                for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
-
-                program.addShader(viewDirFragShader_.get());
-                program.addShader(viewDirVertShader_.get());
-                for(const auto& b : viewDirBindAttribLocations_)
-                    program.bindAttributeLocation(b.first.c_str(), b.second);
-
-                link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
-                ++loadingStepsDone_; return;
+                else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+                {
+                    auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures02_[scatterer.name];
+                    auto& tex=*guidesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+                    tex.setMinificationFilter(QOpenGLTexture::Linear);
+                    tex.setMagnificationFilter(QOpenGLTexture::Linear);
+                    tex.setWrapMode(QOpenGLTexture::ClampToEdge);
+                    tex.bind();
+                    loadTexture4D(filename, altCoord, GPUMemoryCategory::InterpolationGuides, Texture4DType::InterpolationGuides);
+                    ++loadingStepsDone_; return;
+                }
+            }
+        }
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+        }
+        else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+        {
+            if(singleScatteringInterpolationGuidesTextures02_.size() != singleScatteringInterpolationGuidesTextures01_.size())
+            {
+                std::cerr << "Warning: interpolation guides inconsistent: dimensions 0-1 have "
+                          << singleScatteringInterpolationGuidesTextures01_.size() << " wavelength sets, while dimensions 0-2 have "
+                          << singleScatteringInterpolationGuidesTextures02_.size() << ". Ignoring the guides.\n";
+                singleScatteringInterpolationGuidesTextures01_.clear();
+                singleScatteringInterpolationGuidesTextures02_.clear();
             }
+            ++loadingStepsDone_; return;
         }
+        break;
     }
-
-    if(countStepsOnly)
+    case PhaseFunctionType::Smooth:
+    case PhaseFunctionType::Achromatic:
     {
-        ++totalLoadingStepsToDo_;
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+        }
+        else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+        {
+            auto& texture=*texturesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+            texture.setMinificationFilter(texFilter);
+            texture.setMagnificationFilter(texFilter);
+            texture.setWrapMode(QOpenGLTexture::ClampToEdge);
+            texture.bind();
+            loadTexture4D(QString("%1/single-scattering/%2-xyzw.f32").arg(pathToData_).arg(scatterer.name), altCoord,
+                          GPUMemoryCategory::SingleScattering);
+            ++loadingStepsDone_; return;
+        }
 
-        // Dummy values so that the loop below doesn't index empty vector
-        eclipsedSingleScatteringPrograms_.clear();
-        for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
-            eclipsedSingleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>());
+        const auto guidesFilename01 = QString("%1/single-scattering/%2-xyzw-dims01.guides2d").arg(pathToData_).arg(scatterer.name);
+        if(QFile::exists(guidesFilename01))
+        {
+            if(countStepsOnly)
+            {
+                ++totalLoadingStepsToDo_;
+            }
+            else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+            {
+                auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures01_[scatterer.name];
+                auto& texture=*guidesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+                texture.setMinificationFilter(QOpenGLTexture::Linear);
+                texture.setMagnificationFilter(QOpenGLTexture::Linear);
+                texture.setWrapMode(QOpenGLTexture::ClampToEdge);
+                texture.bind();
+                loadTexture4D(guidesFilename01, altCoord, GPUMemoryCategory::InterpolationGuides, Texture4DType::InterpolationGuides);
+                ++loadingStepsDone_; return;
+            }
+        }
+        const auto guidesFilename02 = QString("%1/single-scattering/%2-xyzw-dims02.guides2d").arg(pathToData_).arg(scatterer.name);
+        if(QFile::exists(guidesFilename02))
+        {
+            if(countStepsOnly)
+            {
+                ++totalLoadingStepsToDo_;
+            }
+            else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+            {
+                auto& guidesPerWLSet=singleScatteringInterpolationGuidesTextures02_[scatterer.name];
+                auto& texture=*guidesPerWLSet.emplace_back(newTex(memory_, QOpenGLTexture::Target3D));
+                texture.setMinificationFilter(QOpenGLTexture::Linear);
+                texture.setMagnificationFilter(QOpenGLTexture::Linear);
+                texture.setWrapMode(QOpenGLTexture::ClampToEdge);
+                texture.bind();
+                loadTexture4D(guidesFilename02, altCoord, GPUMemoryCategory::InterpolationGuides, Texture4DType::InterpolationGuides);
+                ++loadingStepsDone_; return;
+            }
+        }
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+        }
+        else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+        {
+            if(singleScatteringInterpolationGuidesTextures02_.size() != singleScatteringInterpolationGuidesTextures01_.size())
+            {
+                std::cerr << "Warning: interpolation guides inconsistent: dimensions 0-1 is "
+                          << (singleScatteringInterpolationGuidesTextures01_.empty() ? "lacking" : "present")
+                          << ", while dimensions 0-2 is "
+                          << (singleScatteringInterpolationGuidesTextures02_.empty() ? "lacking" : "present")
+                          << ". Ignoring the guides.\n";
+                singleScatteringInterpolationGuidesTextures01_.clear();
+                singleScatteringInterpolationGuidesTextures02_.clear();
+            }
+            ++loadingStepsDone_; return;
+        }
+        break;
+    }
+    }
+}
+
+void AtmosphereRenderer::loadShaders(const CountStepsOnly countStepsOnly)
+{
+    OGL_TRACE();
+
+    if(countStepsOnly)
+    {
+        ++totalLoadingStepsToDo_;
     }
     else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
     {
-        eclipsedSingleScatteringPrograms_.clear();
-        for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
-            eclipsedSingleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>());
+        // The clones refer to the programs that are going to be replaced
+        skyProjectionPrograms_.clear();
 
+        viewDirVertShader_.reset(new QOpenGLShader(QOpenGLShader::Vertex));
+        viewDirFragShader_.reset(new QOpenGLShader(QOpenGLShader::Fragment));
+        if(!viewDirVertShader_->compileSourceCode(viewDirVertShaderSrc_))
+            throw DataLoadError{QObject::tr("Failed to compile view direction vertex shader:\n%2").arg(viewDirVertShader_->log())};
+        if(!viewDirFragShader_->compileSourceCode(viewDirFragShaderSrc_))
+            throw DataLoadError{QObject::tr("Failed to compile view direction fragment shader:\n%2").arg(viewDirFragShader_->log())};
         ++loadingStepsDone_; return;
     }
-    for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
-    {
-        auto& programsPerScatterer=*eclipsedSingleScatteringPrograms_[renderMode];
 
-        for(const auto& scatterer : params_.scatterers)
-        {
-            auto& programs=programsPerScatterer[scatterer.name];
-            if(scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY)
-            {
-                for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
-                {
-                    if(countStepsOnly)
-                    {
-                        ++totalLoadingStepsToDo_;
-                        continue;
-                    }
-                    if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                        continue;
-
-                    const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/%2/%3/%4").arg(pathToData_)
-                                                                                                .arg(singleScatteringRenderModeNames[renderMode])
-                                                                                                .arg(wlSetIndex)
-                                                                                                .arg(scatterer.name);
-                    qDebug().nospace() << "Loading shaders from " << scatDir << "...";
-                    auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
-
-                    for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                        addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
-
-                    program.addShader(viewDirFragShader_.get());
-                    program.addShader(viewDirVertShader_.get());
-                    for(const auto& b : viewDirBindAttribLocations_)
-                        program.bindAttributeLocation(b.first.c_str(), b.second);
+    if(countStepsOnly)
+    {
+        ++totalLoadingStepsToDo_;
 
-                    link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
-                    ++loadingStepsDone_; return;
-                }
-            }
-            else
-            {
-                if(countStepsOnly)
-                {
-                    ++totalLoadingStepsToDo_;
-                    continue;
-                }
-                if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                    continue;
+        // Dummy values so that loadScattererShaders() doesn't index empty vector
+        singleScatteringPrograms_.clear();
+        for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
+            singleScatteringPrograms_.emplace_back(std::make_unique<std::map<QString,std::vector<ShaderProgPtr>>>());
+    }
+    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+    {
+        singleScatteringPrograms_.clear();
+        for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
+            singleScatteringPrograms_.emplace_back(std::make_unique<std::map<QString,std::vector<ShaderProgPtr>>>());
 
-                const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/%2/%3").arg(pathToData_)
-                                                                                            .arg(singleScatteringRenderModeNames[renderMode])
-                                                                                            .arg(scatterer.name);
-                qDebug().nospace() << "Loading shaders from " << scatDir << "...";
-                auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+        ++loadingStepsDone_; return;
+    }
 
-                for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+    if(countStepsOnly)
+    {
+        ++totalLoadingStepsToDo_;
 
-                program.addShader(viewDirFragShader_.get());
-                program.addShader(viewDirVertShader_.get());
-                for(const auto& b : viewDirBindAttribLocations_)
-                    program.bindAttributeLocation(b.first.c_str(), b.second);
+        // Dummy values so that loadScattererShaders() doesn't index empty vector
+        eclipsedSingleScatteringPrograms_.clear();
+        for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
+            eclipsedSingleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>());
+    }
+    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+    {
+        eclipsedSingleScatteringPrograms_.clear();
+        for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
+            eclipsedSingleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>());
 
-                link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
-                ++loadingStepsDone_; return;
-            }
-        }
+        ++loadingStepsDone_; return;
     }
 
     if(countStepsOnly)
@@ -971,7 +1052,7 @@ void main()
     {
         ++totalLoadingStepsToDo_;
 
-        // Dummy value to avoid dereferencing null pointer in the loop below
+        // Dummy value to avoid dereferencing null pointer in loadScattererShaders()
         eclipsedSingleScatteringPrecomputationPrograms_=std::make_unique<ScatteringProgramsMap>();
     }
     else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
@@ -979,33 +1060,15 @@ void main()
         eclipsedSingleScatteringPrecomputationPrograms_=std::make_unique<ScatteringProgramsMap>();
         ++loadingStepsDone_; return;
     }
+    // Non-resident scatterers are loaded when enabled, see loadScatterers()
     for(const auto& scatterer : params_.scatterers)
     {
-        auto& programs=(*eclipsedSingleScatteringPrecomputationPrograms_)[scatterer.name];
-        for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
-        {
-            if(countStepsOnly)
-            {
-                ++totalLoadingStepsToDo_;
-                continue;
-            }
-            if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
-                continue;
-
-            const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/precomputation/%3/%4").arg(pathToData_)
-                                                                                                    .arg(wlSetIndex)
-                                                                                                    .arg(scatterer.name);
-            qDebug().nospace() << "Loading shaders from " << scatDir << "...";
-            auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
-
-            for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
-                addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
-
-            program.addShader(precomputationProgramsVertShader_.get());
-
-            link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
-            ++loadingStepsDone_; return;
-        }
+        if(!residentScatterers_.count(scatterer.name))
+            continue;
+        const auto stepsDoneBefore=loadingStepsDone_;
+        loadScattererShaders(scatterer, countStepsOnly);
+        if(loadingStepsDone_ != stepsDoneBefore)
+            return;
     }
 
     // Precomputed rendering (with approximate mixing, since textures contain only the data for fully-centered eclipse)
@@ -1252,6 +1315,70 @@ void main()
         ++loadingStepsDone_; return;
     }
 
+    if(countStepsOnly)
+    {
+        ++totalLoadingStepsToDo_;
+    }
+    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+    {
+        smoothLayersUpsamplingProgram_=std::make_unique<QOpenGLShaderProgram>();
+        auto& program=*smoothLayersUpsamplingProgram_;
+        program.addShader(viewDirFragShader_.get());
+        program.addShader(viewDirVertShader_.get());
+        for(const auto& b : viewDirBindAttribLocations_)
+            program.bindAttributeLocation(b.first.c_str(), b.second);
+        addShaderCode(program, QOpenGLShader::Fragment, QObject::tr("fragment shader for upsampling of reduced-resolution layers"), 1+R"(
+#version 330
+
+in vec3 position;
+layout(location=0) out vec4 luminance;
+layout(location=1) out vec4 radianceOutput;
+
+uniform sampler2DArray smoothLayers;
+uniform sampler2D smoothLayersViewDirs;
+uniform vec2 viewportSize;
+uniform int radianceLayer;
+uniform bool addLuminance;
+uniform float cosHorizonZenithAngle;
+
+vec3 calcViewDir();
+bool rayHitsGround(vec3 viewDir)
+{
+    return viewDir.z < cosHorizonZenithAngle;
+}
+
+void main()
+{
+    bool hitsGround=rayHitsGround(calcViewDir());
+    ivec2 size=textureSize(smoothLayersViewDirs,0);
+    vec2 pos=gl_FragCoord.xy/viewportSize*size-0.5;
+    ivec2 base=ivec2(floor(pos));
+    vec2 frac=pos-base;
+
+    vec4 luminanceSum=vec4(0), radianceSum=vec4(0);
+    float weightSum=0;
+    for(int j=0; j<2; ++j)
+    {
+        for(int i=0; i<2; ++i)
+        {
+            ivec2 texel=clamp(base+ivec2(i,j), ivec2(0), size-1);
+            float weight=(i==0 ? 1-frac.x : frac.x) * (j==0 ? 1-frac.y : frac.y);
+            // Texels across the horizon only matter if there are no texels on our side of it
+            if(rayHitsGround(texelFetch(smoothLayersViewDirs, texel, 0).xyz) != hitsGround)
+                weight*=1e-4;
+            luminanceSum += weight*texelFetch(smoothLayers, ivec3(texel,0), 0);
+            radianceSum += weight*texelFetch(smoothLayers, ivec3(texel,radianceLayer), 0);
+            weightSum += weight;
+        }
+    }
+    luminance = addLuminance ? luminanceSum/weightSum : vec4(0);
+    radianceOutput = radianceSum/weightSum;
+}
+)");
+        link(program, QObject::tr("upsampling shader program"));
+        ++loadingStepsDone_; return;
+    }
+
     if(countStepsOnly)
     {
         ++totalLoadingStepsToDo_;
@@ -1294,18 +1421,237 @@ void main()
         }
         else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
         {
-            auto& program=*lightPollutionPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
-            const auto wlDir=pathToData_+"/shaders/light-pollution/";
-            qDebug().nospace() << "Loading shaders from " << wlDir << "...";
-            for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
-                addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
-            program.addShader(viewDirFragShader_.get());
-            program.addShader(viewDirVertShader_.get());
-            for(const auto& b : viewDirBindAttribLocations_)
-                program.bindAttributeLocation(b.first.c_str(), b.second);
-            link(program, QObject::tr("light pollution shader program"));
-            ++loadingStepsDone_; return;
+            auto& program=*lightPollutionPrograms_.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+            const auto wlDir=pathToData_+"/shaders/light-pollution/";
+            qDebug().nospace() << "Loading shaders from " << wlDir << "...";
+            for(const auto& shaderFile : fs::directory_iterator(fs::u8path(wlDir.toStdString())))
+                addShaderFile(program, QOpenGLShader::Fragment, shaderFile.path());
+            program.addShader(viewDirFragShader_.get());
+            program.addShader(viewDirVertShader_.get());
+            for(const auto& b : viewDirBindAttribLocations_)
+                program.bindAttributeLocation(b.first.c_str(), b.second);
+            link(program, QObject::tr("light pollution shader program"));
+            ++loadingStepsDone_; return;
+        }
+    }
+}
+
+void AtmosphereRenderer::loadScattererShaders(AtmosphereParameters::Scatterer const& scatterer, const CountStepsOnly countStepsOnly)
+{
+    for(int renderMode=0; renderMode<SSRM_COUNT; ++renderMode)
+    {
+        auto& programs=(*singleScatteringPrograms_[renderMode])[scatterer.name];
+        if(scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY)
+        {
+            for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+            {
+                if(countStepsOnly)
+                {
+                    ++totalLoadingStepsToDo_;
+                    continue;
+                }
+                if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+                    continue;
+
+                const auto scatDir=QString("%1/shaders/single-scattering/%2/%3/%4").arg(pathToData_)
+                                                                                   .arg(singleScatteringRenderModeNames[renderMode])
+                                                                                   .arg(wlSetIndex)
+                                                                                   .arg(scatterer.name);
+                qDebug().nospace() << "Loading shaders from " << scatDir << "...";
+                auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+
+                for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
+                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+
+                program.addShader(viewDirFragShader_.get());
+                program.addShader(viewDirVertShader_.get());
+                for(const auto& b : viewDirBindAttribLocations_)
+                    program.bindAttributeLocation(b.first.c_str(), b.second);
+
+                link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                ++loadingStepsDone_; return;
+            }
+        }
+        else
+        {
+            if(countStepsOnly)
+            {
+                ++totalLoadingStepsToDo_;
+                continue;
+            }
+            if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+                continue;
+
+            const auto scatDir=QString("%1/shaders/single-scattering/%2/%3").arg(pathToData_)
+                                                                            .arg(singleScatteringRenderModeNames[renderMode])
+                                                                            .arg(scatterer.name);
+            qDebug().nospace() << "Loading shaders from " << scatDir << "...";
+            auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+            for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
+                addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+
+            program.addShader(viewDirFragShader_.get());
+            program.addShader(viewDirVertShader_.get());
+            for(const auto& b : viewDirBindAttribLocations_)
+                program.bindAttributeLocation(b.first.c_str(), b.second);
+
+            link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+            ++loadingStepsDone_; return;
+        }
+    }
+
+    for(int renderMode=SSRM_ON_THE_FLY; renderMode<SSRM_COUNT; ++renderMode)
+    {
+        auto& programs=(*eclipsedSingleScatteringPrograms_[renderMode])[scatterer.name];
+        if(scatterer.phaseFunctionType==PhaseFunctionType::General || renderMode==SSRM_ON_THE_FLY)
+        {
+            for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+            {
+                if(countStepsOnly)
+                {
+                    ++totalLoadingStepsToDo_;
+                    continue;
+                }
+                if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+                    continue;
+
+                const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/%2/%3/%4").arg(pathToData_)
+                                                                                            .arg(singleScatteringRenderModeNames[renderMode])
+                                                                                            .arg(wlSetIndex)
+                                                                                            .arg(scatterer.name);
+                qDebug().nospace() << "Loading shaders from " << scatDir << "...";
+                auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+
+                for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
+                    addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+
+                program.addShader(viewDirFragShader_.get());
+                program.addShader(viewDirVertShader_.get());
+                for(const auto& b : viewDirBindAttribLocations_)
+                    program.bindAttributeLocation(b.first.c_str(), b.second);
+
+                link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+                ++loadingStepsDone_; return;
+            }
+        }
+        else
+        {
+            if(countStepsOnly)
+            {
+                ++totalLoadingStepsToDo_;
+                continue;
+            }
+            if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+                continue;
+
+            const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/%2/%3").arg(pathToData_)
+                                                                                        .arg(singleScatteringRenderModeNames[renderMode])
+                                                                                        .arg(scatterer.name);
+            qDebug().nospace() << "Loading shaders from " << scatDir << "...";
+            auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+
+            for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
+                addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+
+            program.addShader(viewDirFragShader_.get());
+            program.addShader(viewDirVertShader_.get());
+            for(const auto& b : viewDirBindAttribLocations_)
+                program.bindAttributeLocation(b.first.c_str(), b.second);
+
+            link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+            ++loadingStepsDone_; return;
+        }
+    }
+
+    auto& programs=(*eclipsedSingleScatteringPrecomputationPrograms_)[scatterer.name];
+    for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+    {
+        if(countStepsOnly)
+        {
+            ++totalLoadingStepsToDo_;
+            continue;
+        }
+        if(++currentLoadingIterationStepCounter_ <= loadingStepsDone_)
+            continue;
+
+        const auto scatDir=QString("%1/shaders/single-scattering-eclipsed/precomputation/%3/%4").arg(pathToData_)
+                                                                                                .arg(wlSetIndex)
+                                                                                                .arg(scatterer.name);
+        qDebug().nospace() << "Loading shaders from " << scatDir << "...";
+        auto& program=*programs.emplace_back(std::make_unique<QOpenGLShaderProgram>());
+
+        for(const auto& shaderFile : fs::directory_iterator(fs::u8path(scatDir.toStdString())))
+            addShaderFile(program,QOpenGLShader::Fragment,shaderFile.path());
+
+        program.addShader(precomputationProgramsVertShader_.get());
+
+        link(program, QObject::tr("shader program for scatterer \"%1\"").arg(scatterer.name));
+        ++loadingStepsDone_; return;
+    }
+}
+
+void AtmosphereRenderer::loadScatterers(const CountStepsOnly countStepsOnly)
+{
+    OGL_TRACE();
+
+    if(countStepsOnly)
+    {
+        ++totalLoadingStepsToDo_;
+    }
+    else if(++currentLoadingIterationStepCounter_ > loadingStepsDone_)
+    {
+        // Drop whatever has been left by a loading that failed midway
+        for(const auto& name : scatterersToLoad_)
+            releaseScatterer(name);
+        ++loadingStepsDone_; return;
+    }
+
+    for(const auto& scatterer : params_.scatterers)
+    {
+        if(!scatterersToLoad_.count(scatterer.name))
+            continue;
+        const auto stepsDoneBefore=loadingStepsDone_;
+        loadScattererShaders(scatterer, countStepsOnly);
+        if(loadingStepsDone_ != stepsDoneBefore)
+            return;
+        loadScattererTextures(scatterer, countStepsOnly);
+        if(loadingStepsDone_ != stepsDoneBefore)
+            return;
+    }
+}
+
+void AtmosphereRenderer::releaseScatterer(ScattererName const& name)
+{
+    singleScatteringTextures_.erase(name);
+    singleScatteringInterpolationGuidesTextures01_.erase(name);
+    singleScatteringInterpolationGuidesTextures02_.erase(name);
+    for(const auto& map : singleScatteringPrograms_)
+        map->erase(name);
+    for(const auto& map : eclipsedSingleScatteringPrograms_)
+        map->erase(name);
+    if(eclipsedSingleScatteringPrecomputationPrograms_)
+        eclipsedSingleScatteringPrecomputationPrograms_->erase(name);
+    // The clones may refer to the released programs
+    skyProjectionPrograms_.clear();
+}
+
+void AtmosphereRenderer::unloadDisabledScatterers()
+{
+    if(disabledScattererUnloadDelay_ < 0) return;
+
+    const auto now=std::chrono::steady_clock::now();
+    for(auto it=scatterersDisabledTimes_.begin(); it!=scatterersDisabledTimes_.end();)
+    {
+        const auto& [name, disabledTime] = *it;
+        if(std::chrono::duration<double>(now-disabledTime).count() < disabledScattererUnloadDelay_)
+        {
+            ++it;
+            continue;
         }
+        qDebug().nospace() << "Unloading textures and shaders of disabled scatterer \"" << name << "\"";
+        releaseScatterer(name);
+        residentScatterers_.erase(name);
+        it=scatterersDisabledTimes_.erase(it);
     }
 }
 
@@ -1325,6 +1671,7 @@ void AtmosphereRenderer::setupBuffers()
          1,  1,
     };
     gl.glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
+    memory_->addBuffer(vbo_, GPUMemoryCategory::Geometry, sizeof vertices);
     constexpr GLuint attribIndex=0;
     constexpr int coordsPerVertex=2;
     gl.glVertexAttribPointer(attribIndex, coordsPerVertex, GL_FLOAT, false, 0, 0);
@@ -1489,10 +1836,10 @@ bool AtmosphereRenderer::canRenderPrecomputedEclipsedDoubleScattering() const
 void AtmosphereRenderer::renderZeroOrderScattering()
 {
     OGL_TRACE();
+    [[maybe_unused]] const auto stage=profiler_.stage("Zero-order scattering");
     for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
     {
-        if(!radianceRenderBuffers_.empty())
-            gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+        attachRadianceTarget(wlSetIndex);
         if(tools_->usingEclipseShader())
         {
             auto& prog=*eclipsedZeroOrderScatteringPrograms_[wlSetIndex];
@@ -1533,11 +1880,17 @@ void AtmosphereRenderer::renderZeroOrderScattering()
 void AtmosphereRenderer::precomputeEclipsedSingleScattering()
 {
     OGL_TRACE();
+    [[maybe_unused]] const auto stage=profiler_.stage("Eclipsed single scattering precomputation");
+
+    GLint origFBO=-1;
+    gl.glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFBO);
 
     gl.glBindVertexArray(vao_);
     // TODO: avoid redoing it if Sun elevation and Moon elevation and relative azimuth haven't changed
     for(const auto& scatterer : params_.scatterers)
     {
+        if(!scatterersEnabledStates_.at(scatterer.name) || !residentScatterers_.count(scatterer.name))
+            continue;
         auto& textures=eclipsedSingleScatteringPrecomputationTextures_[scatterer.name];
         const auto& programs=eclipsedSingleScatteringPrecomputationPrograms_->at(scatterer.name);
         gl.glDisablei(GL_BLEND, 0); // First wavelength set overwrites old contents, regardless of subsequent blending modes
@@ -1566,7 +1919,7 @@ void AtmosphereRenderer::precomputeEclipsedSingleScattering()
         }
     }
     gl.glBindVertexArray(0);
-    gl.glBindFramebuffer(GL_FRAMEBUFFER,luminanceRadianceFBO_);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,origFBO);
     gl.glEnablei(GL_BLEND, 0);
 }
 
@@ -1574,15 +1927,17 @@ void AtmosphereRenderer::renderSingleScattering()
 {
     OGL_TRACE();
 
-    if(tools_->usingEclipseShader())
+    // When rendering sky projection, the precomputation has already been done for this frame by the main render
+    if(tools_->usingEclipseShader() && !renderingSkyProjection_)
         precomputeEclipsedSingleScattering();
 
     const auto texFilter = tools_->textureFilteringEnabled() ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest;
     const auto renderMode = tools_->onTheFlySingleScatteringEnabled() ? SSRM_ON_THE_FLY : SSRM_PRECOMPUTED;
     for(const auto& scatterer : params_.scatterers)
     {
-        if(!scatterersEnabledStates_.at(scatterer.name))
+        if(!scatterersEnabledStates_.at(scatterer.name) || !residentScatterers_.count(scatterer.name))
             continue;
+        [[maybe_unused]] const auto stage=profiler_.stage("Single scattering", scatterer.name);
 
         if(renderMode==SSRM_ON_THE_FLY)
         {
@@ -1590,10 +1945,9 @@ void AtmosphereRenderer::renderSingleScattering()
             {
                 for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
                 {
-                    if(!radianceRenderBuffers_.empty())
-                        gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+                    attachRadianceTarget(wlSetIndex);
 
-                    auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
+                    auto& prog=renderProgram(*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex]);
                     prog.bind();
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("moonPosition", toQVector(moonPosition()));
@@ -1612,10 +1966,9 @@ void AtmosphereRenderer::renderSingleScattering()
             {
                 for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
                 {
-                    if(!radianceRenderBuffers_.empty())
-                        gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+                    attachRadianceTarget(wlSetIndex);
 
-                    auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
+                    auto& prog=renderProgram(*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex]);
                     prog.bind();
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1636,10 +1989,9 @@ void AtmosphereRenderer::renderSingleScattering()
             {
                 for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
                 {
-                    if(!radianceRenderBuffers_.empty())
-                        gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+                    attachRadianceTarget(wlSetIndex);
 
-                    auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
+                    auto& prog=renderProgram(*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex]);
                     prog.bind();
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1662,10 +2014,9 @@ void AtmosphereRenderer::renderSingleScattering()
             {
                 for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
                 {
-                    if(!radianceRenderBuffers_.empty())
-                        gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+                    attachRadianceTarget(wlSetIndex);
 
-                    auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex];
+                    auto& prog=renderProgram(*singleScatteringPrograms_[renderMode]->at(scatterer.name)[wlSetIndex]);
                     prog.bind();
                     prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
                     prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1711,7 +2062,7 @@ void AtmosphereRenderer::renderSingleScattering()
         }
         else if(!tools_->usingEclipseShader())
         {
-            auto& prog=*singleScatteringPrograms_[renderMode]->at(scatterer.name).front();
+            auto& prog=renderProgram(*singleScatteringPrograms_[renderMode]->at(scatterer.name).front());
             prog.bind();
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1752,7 +2103,7 @@ void AtmosphereRenderer::renderSingleScattering()
         }
         else
         {
-            auto& prog=*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name).front();
+            auto& prog=renderProgram(*eclipsedSingleScatteringPrograms_[renderMode]->at(scatterer.name).front());
             prog.bind();
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1774,6 +2125,10 @@ void AtmosphereRenderer::renderSingleScattering()
 void AtmosphereRenderer::precomputeEclipsedDoubleScattering()
 {
     // TODO: avoid redoing it if Sun elevation and Moon elevation and relative azimuth haven't changed
+    [[maybe_unused]] const auto stage=profiler_.stage("Eclipsed double scattering precomputation");
+
+    GLint origFBO=-1;
+    gl.glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFBO);
 
     gl.glBindFramebuffer(GL_FRAMEBUFFER, eclipseDoubleScatteringPrecomputationFBO_);
     gl.glDisablei(GL_BLEND, 0);
@@ -1821,10 +2176,12 @@ void AtmosphereRenderer::precomputeEclipsedDoubleScattering()
             gl.glTexImage3D(GL_TEXTURE_3D,0,GL_RGBA32F,
                             params_.eclipsedDoubleScatteringTextureSize[0], params_.eclipsedDoubleScatteringTextureSize[1], 1,
                             0,GL_RGBA,GL_FLOAT,generator.texture().data());
+            memory_->addBoundTexture(GL_TEXTURE_3D, GPUMemoryCategory::EclipsePrecomputation, GL_RGBA32F,
+                                     params_.eclipsedDoubleScatteringTextureSize[0], params_.eclipsedDoubleScatteringTextureSize[1], 1);
         }
     }
     gl.glBindVertexArray(0);
-    gl.glBindFramebuffer(GL_FRAMEBUFFER,luminanceRadianceFBO_);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER,origFBO);
     gl.glEnablei(GL_BLEND, 0);
 }
 
@@ -1835,14 +2192,14 @@ void AtmosphereRenderer::renderMultipleScattering()
     const auto texFilter = tools_->textureFilteringEnabled() ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest;
     if(tools_->usingEclipseShader())
     {
-        if(tools_->onTheFlyPrecompDoubleScatteringEnabled())
+        if(tools_->onTheFlyPrecompDoubleScatteringEnabled() && !renderingSkyProjection_)
             precomputeEclipsedDoubleScattering();
+        [[maybe_unused]] const auto stage=profiler_.stage("Multiple scattering");
         for(unsigned wlSetIndex=0; wlSetIndex < eclipsedDoubleScatteringPrecomputedPrograms_.size(); ++wlSetIndex)
         {
-            if(!radianceRenderBuffers_.empty())
-                gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+            attachRadianceTarget(wlSetIndex);
 
-            auto& prog=*eclipsedDoubleScatteringPrecomputedPrograms_[wlSetIndex];
+            auto& prog=renderProgram(*eclipsedDoubleScatteringPrecomputedPrograms_[wlSetIndex]);
             prog.bind();
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1879,12 +2236,12 @@ void AtmosphereRenderer::renderMultipleScattering()
     }
     else
     {
+        [[maybe_unused]] const auto stage=profiler_.stage("Multiple scattering");
         for(unsigned wlSetIndex = 0; wlSetIndex < multipleScatteringTextures_.size(); ++wlSetIndex)
         {
-            if(!radianceRenderBuffers_.empty())
-                gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+            attachRadianceTarget(wlSetIndex);
 
-            auto& prog=*multipleScatteringPrograms_[wlSetIndex];
+            auto& prog=renderProgram(*multipleScatteringPrograms_[wlSetIndex]);
             prog.bind();
             prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
             prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1906,15 +2263,15 @@ void AtmosphereRenderer::renderMultipleScattering()
 void AtmosphereRenderer::renderLightPollution()
 {
     OGL_TRACE();
+    [[maybe_unused]] const auto stage=profiler_.stage("Light pollution");
 
     const auto texFilter = tools_->textureFilteringEnabled() ? QOpenGLTexture::Linear : QOpenGLTexture::Nearest;
 
     for(unsigned wlSetIndex = 0; wlSetIndex < lightPollutionPrograms_.size(); ++wlSetIndex)
     {
-        if(!radianceRenderBuffers_.empty())
-            gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+        attachRadianceTarget(wlSetIndex);
 
-        auto& prog=*lightPollutionPrograms_[wlSetIndex];
+        auto& prog=renderProgram(*lightPollutionPrograms_[wlSetIndex]);
         prog.bind();
         prog.setUniformValue("cameraPosition", toQVector(cameraPosition()));
         prog.setUniformValue("sunDirection", toQVector(sunDirection()));
@@ -1933,18 +2290,395 @@ void AtmosphereRenderer::renderLightPollution()
     }
 }
 
+void AtmosphereRenderer::setupSmoothLayersTarget(QSize const& size)
+{
+    OGL_TRACE();
+
+    const int layerCount=1+radianceRenderBuffers_.size();
+    if(!smoothLayersFBO_)
+    {
+        gl.glGenFramebuffers(1,&smoothLayersFBO_);
+        gl.glGenFramebuffers(1,&smoothLayersViewDirFBO_);
+        smoothLayersTexture_=newTex(memory_, QOpenGLTexture::Target2DArray);
+        smoothLayersTexture_->create();
+        smoothLayersViewDirTexture_=newTex(memory_, QOpenGLTexture::Target2D);
+        smoothLayersViewDirTexture_->create();
+    }
+
+    smoothLayersTexture_->bind();
+    gl.glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA32F,size.width(),size.height(),layerCount,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    memory_->addTexture(smoothLayersTexture_->textureId(), GPUMemoryCategory::ReducedResolutionLayers, GL_RGBA32F,
+                        size.width(), size.height(), layerCount);
+    smoothLayersTexture_->setMinificationFilter(QOpenGLTexture::Nearest);
+    smoothLayersTexture_->setMagnificationFilter(QOpenGLTexture::Nearest);
+    smoothLayersViewDirTexture_->bind();
+    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,size.width(),size.height(),0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    memory_->addTexture(smoothLayersViewDirTexture_->textureId(), GPUMemoryCategory::ReducedResolutionLayers, GL_RGBA32F,
+                        size.width(), size.height());
+    smoothLayersViewDirTexture_->setMinificationFilter(QOpenGLTexture::Nearest);
+    smoothLayersViewDirTexture_->setMagnificationFilter(QOpenGLTexture::Nearest);
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, smoothLayersFBO_);
+    memory_->addFramebuffer(smoothLayersFBO_, GPUMemoryCategory::ReducedResolutionLayers);
+    gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, smoothLayersTexture_->textureId(), 0, 0);
+    if(layerCount>1)
+    {
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, smoothLayersTexture_->textureId(), 0, 1);
+        gl.glDrawBuffers(2, std::array<GLenum,2>{GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1}.data());
+    }
+    checkFramebufferStatus(gl, "Reduced-resolution layers FBO");
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, smoothLayersViewDirFBO_);
+    memory_->addFramebuffer(smoothLayersViewDirFBO_, GPUMemoryCategory::ReducedResolutionLayers);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, smoothLayersViewDirTexture_->textureId(), 0);
+    checkFramebufferStatus(gl, "Reduced-resolution view directions FBO");
+
+    smoothLayersSize_=size;
+}
+
+// Renders multiple scattering and light pollution into a reduced-resolution target, then upsamples them into the
+// full-resolution render targets, avoiding mixing of the sky with the ground across the horizon.
+void AtmosphereRenderer::renderSmoothLayersAtReducedResolution(const int divisor, const double brightness)
+{
+    const bool multipleScatteringEnabled=tools_->multipleScatteringEnabled();
+    const bool lightPollutionEnabled=tools_->lightPollutionGroundLuminance()!=0;
+    if(!multipleScatteringEnabled && !lightPollutionEnabled) return;
+
+    OGL_TRACE();
+
+    const QSize size((viewportSize_.width()+divisor-1)/divisor, (viewportSize_.height()+divisor-1)/divisor);
+    if(size!=smoothLayersSize_)
+        setupSmoothLayersTarget(size);
+
+    GLint origFBO=-1;
+    gl.glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFBO);
+    GLint origViewport[4];
+    gl.glGetIntegerv(GL_VIEWPORT, origViewport);
+    gl.glViewport(0,0,size.width(),size.height());
+
+    {
+        [[maybe_unused]] const auto stage=profiler_.stage("View directions for upsampling");
+        gl.glBindFramebuffer(GL_FRAMEBUFFER, smoothLayersViewDirFBO_);
+        gl.glDisablei(GL_BLEND, 0);
+        gl.glClearBufferfv(GL_COLOR, 0, std::array<GLfloat,4>{0,0,0,0}.data());
+        viewDirectionGetterProgram_->bind();
+        drawSurface(*viewDirectionGetterProgram_);
+    }
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, smoothLayersFBO_);
+    const int layerCount=1+radianceRenderBuffers_.size();
+    for(int layer=layerCount-1; layer>=0; --layer)
+    {
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, smoothLayersTexture_->textureId(), 0, layer);
+        gl.glClearBufferfv(GL_COLOR, 0, std::array<GLfloat,4>{0,0,0,0}.data());
+    }
+    // Layer 0 is now attached to the luminance attachment
+
+    gl.glEnablei(GL_BLEND, 0);
+    gl.glBlendColor(1,1,1,1); // brightness is applied when upsampling
+    intermediateTarget_=smoothLayersTexture_.get();
+    try
+    {
+        if(multipleScatteringEnabled)
+            renderMultipleScattering();
+        if(lightPollutionEnabled)
+            renderLightPollution();
+    }
+    catch(...)
+    {
+        intermediateTarget_=nullptr;
+        throw;
+    }
+    intermediateTarget_=nullptr;
+
+    gl.glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, origFBO);
+    gl.glBlendColor(brightness, brightness, brightness, brightness);
+
+    [[maybe_unused]] const auto stage=profiler_.stage("Upsampling");
+    auto& prog=*smoothLayersUpsamplingProgram_;
+    prog.bind();
+    smoothLayersTexture_->bind(0);
+    prog.setUniformValue("smoothLayers", 0);
+    smoothLayersViewDirTexture_->bind(1);
+    prog.setUniformValue("smoothLayersViewDirs", 1);
+    prog.setUniformValue("viewportSize", QVector2D(viewportSize_.width(), viewportSize_.height()));
+    const double earthRadius=params_.earthRadius;
+    const double horizonRatio=earthRadius/(earthRadius+std::max(0., tools_->altitude()));
+    prog.setUniformValue("cosHorizonZenithAngle", float(-std::sqrt(1-horizonRatio*horizonRatio)));
+    const unsigned passCount=std::max<unsigned>(1, radianceRenderBuffers_.size());
+    for(unsigned wlSetIndex=0; wlSetIndex<passCount; ++wlSetIndex)
+    {
+        attachRadianceTarget(wlSetIndex);
+        prog.setUniformValue("radianceLayer", radianceRenderBuffers_.empty() ? 0 : int(1+wlSetIndex));
+        prog.setUniformValue("addLuminance", wlSetIndex==0);
+        drawSurface(prog);
+    }
+}
+
+void AtmosphereRenderer::setSkyProjectionOrder(const int order)
+{
+    if(order<0 || order>skyProjectionMaxOrder)
+        qWarning().nospace() << "AtmosphereRenderer::setSkyProjectionOrder(" << order << "): order must be from 0 to " << skyProjectionMaxOrder;
+    skyProjectionOrder_=std::clamp(order, 0, skyProjectionMaxOrder);
+    sceneChangedSinceSkyProjection_=true;
+}
+
+void AtmosphereRenderer::setupSkyProjection()
+{
+    OGL_TRACE();
+
+    skyProjectionViewDirFragShader_.reset(new QOpenGLShader(QOpenGLShader::Fragment));
+    if(!skyProjectionViewDirFragShader_->compileSourceCode(skyProjectionViewDirFragShaderSrc))
+        throw DataLoadError{QObject::tr("Failed to compile view direction fragment shader for sky projection:\n%1")
+                                .arg(skyProjectionViewDirFragShader_->log())};
+
+    skyProjectionReductionProgram_=std::make_unique<QOpenGLShaderProgram>();
+    auto& prog=*skyProjectionReductionProgram_;
+    if(!prog.addShaderFromSourceCode(QOpenGLShader::Fragment, skyProjectionReductionFragShaderSrc))
+        throw DataLoadError{QObject::tr("Failed to compile sky projection reduction shader:\n%1").arg(prog.log())};
+    prog.addShader(precomputationProgramsVertShader_.get());
+    prog.bindAttributeLocation("vertex", 0);
+    link(prog, QObject::tr("sky projection reduction shader program"));
+
+    const int layerCount=1+radianceRenderBuffers_.size();
+
+    skyProjectionMapTexture_=newTex(memory_, QOpenGLTexture::Target2DArray);
+    skyProjectionMapTexture_->create();
+    skyProjectionMapTexture_->bind();
+    gl.glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA32F,skyProjectionMapWidth,skyProjectionMapHeight,layerCount,
+                    0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    memory_->addTexture(skyProjectionMapTexture_->textureId(), GPUMemoryCategory::SkyProjection, GL_RGBA32F,
+                        skyProjectionMapWidth, skyProjectionMapHeight, layerCount);
+    skyProjectionMapTexture_->setMinificationFilter(QOpenGLTexture::Nearest);
+    skyProjectionMapTexture_->setMagnificationFilter(QOpenGLTexture::Nearest);
+
+    skyProjectionCoefsTexture_=newTex(memory_, QOpenGLTexture::Target2D);
+    skyProjectionCoefsTexture_->create();
+    skyProjectionCoefsTexture_->bind();
+    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,skyProjectionMaxCoefCount+1,layerCount,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    memory_->addTexture(skyProjectionCoefsTexture_->textureId(), GPUMemoryCategory::SkyProjection, GL_RGBA32F,
+                        skyProjectionMaxCoefCount+1, layerCount);
+    skyProjectionCoefsTexture_->setMinificationFilter(QOpenGLTexture::Nearest);
+    skyProjectionCoefsTexture_->setMagnificationFilter(QOpenGLTexture::Nearest);
+
+    gl.glGenFramebuffers(1,&skyProjectionMapFBO_);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, skyProjectionMapFBO_);
+    memory_->addFramebuffer(skyProjectionMapFBO_, GPUMemoryCategory::SkyProjection);
+    gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, skyProjectionMapTexture_->textureId(), 0, 0);
+    if(layerCount>1)
+    {
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, skyProjectionMapTexture_->textureId(), 0, 1);
+        gl.glDrawBuffers(2, std::array<GLenum,2>{GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1}.data());
+    }
+    checkFramebufferStatus(gl, "Sky projection map FBO");
+
+    gl.glGenFramebuffers(1,&skyProjectionCoefsFBO_);
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, skyProjectionCoefsFBO_);
+    memory_->addFramebuffer(skyProjectionCoefsFBO_, GPUMemoryCategory::SkyProjection);
+    gl.glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, skyProjectionCoefsTexture_->textureId(), 0);
+    checkFramebufferStatus(gl, "Sky projection coefficients FBO");
+
+    gl.glGenBuffers(1, &skyProjectionPBO_);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, skyProjectionPBO_);
+    gl.glBufferData(GL_PIXEL_PACK_BUFFER, (skyProjectionMaxCoefCount+1)*layerCount*sizeof(glm::vec4), nullptr, GL_STREAM_READ);
+    memory_->addBuffer(skyProjectionPBO_, GPUMemoryCategory::SkyProjection, (skyProjectionMaxCoefCount+1)*layerCount*sizeof(glm::vec4));
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void AtmosphereRenderer::clearSkyProjection()
+{
+    if(skyProjectionFence_)
+    {
+        gl.glDeleteSync(skyProjectionFence_);
+        skyProjectionFence_=nullptr;
+    }
+    if(skyProjectionPBO_)
+    {
+        memory_->removeBuffer(skyProjectionPBO_);
+        gl.glDeleteBuffers(1, &skyProjectionPBO_);
+        skyProjectionPBO_=0;
+    }
+    if(skyProjectionMapFBO_)
+    {
+        memory_->removeFramebuffer(skyProjectionMapFBO_);
+        gl.glDeleteFramebuffers(1, &skyProjectionMapFBO_);
+        skyProjectionMapFBO_=0;
+    }
+    if(skyProjectionCoefsFBO_)
+    {
+        memory_->removeFramebuffer(skyProjectionCoefsFBO_);
+        gl.glDeleteFramebuffers(1, &skyProjectionCoefsFBO_);
+        skyProjectionCoefsFBO_=0;
+    }
+    skyProjectionMapTexture_.reset();
+    skyProjectionCoefsTexture_.reset();
+    skyProjectionPrograms_.clear();
+    skyProjectionReductionProgram_.reset();
+    skyProjectionViewDirFragShader_.reset();
+    skyProjection_={};
+}
+
+// Renders the sphere of view directions and projects it onto spherical harmonics, starting asynchronous readback of the
+// coefficients. The scene is rendered the same way as in draw(), except for zero-order scattering.
+void AtmosphereRenderer::updateSkyProjection()
+{
+    if(!skyProjectionOrder_ || skyProjectionFence_) return;
+
+    const auto now=std::chrono::steady_clock::now();
+    if(now-lastSkyProjectionStartTime_ < std::chrono::duration<double>(skyProjectionUpdateInterval_))
+        return;
+    lastSkyProjectionStartTime_=now;
+    sceneChangedSinceSkyProjection_=false;
+
+    OGL_TRACE();
+    // Stages of the render functions aren't measured separately here, being nested in this one
+    [[maybe_unused]] const auto stage=profiler_.stage("Sky projection");
+
+    if(!skyProjectionMapFBO_)
+        setupSkyProjection();
+
+    GLint origDrawFBO=-1, origReadFBO=-1;
+    gl.glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origDrawFBO);
+    gl.glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &origReadFBO);
+    GLint origViewport[4];
+    gl.glGetIntegerv(GL_VIEWPORT, origViewport);
+
+    const int coefCount=(skyProjectionOrder_+1)*(skyProjectionOrder_+1);
+    const int layerCount=1+radianceRenderBuffers_.size();
+
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, skyProjectionMapFBO_);
+    gl.glViewport(0,0,skyProjectionMapWidth,skyProjectionMapHeight);
+    for(int layer=layerCount-1; layer>=0; --layer)
+    {
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, skyProjectionMapTexture_->textureId(), 0, layer);
+        gl.glClearBufferfv(GL_COLOR, 0, std::array<GLfloat,4>{0,0,0,0}.data());
+    }
+    // Layer 0 is now attached to the luminance attachment
+
+    gl.glEnablei(GL_BLEND, 0);
+    if(layerCount>1)
+        gl.glEnablei(GL_BLEND, 1);
+    gl.glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
+    gl.glBlendColor(1,1,1,1);
+    renderingSkyProjection_=true;
+    intermediateTarget_=skyProjectionMapTexture_.get();
+    try
+    {
+        if(tools_->singleScatteringEnabled())
+            renderSingleScattering();
+        if(tools_->multipleScatteringEnabled())
+            renderMultipleScattering();
+        if(tools_->lightPollutionGroundLuminance())
+            renderLightPollution();
+    }
+    catch(...)
+    {
+        renderingSkyProjection_=false;
+        intermediateTarget_=nullptr;
+        throw;
+    }
+    renderingSkyProjection_=false;
+    intermediateTarget_=nullptr;
+    gl.glDisablei(GL_BLEND, 0);
+
+    // Reduction: each fragment sums the whole map with its weight
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, skyProjectionCoefsFBO_);
+    gl.glViewport(0,0,coefCount+1,layerCount);
+    auto& prog=*skyProjectionReductionProgram_;
+    prog.bind();
+    skyProjectionMapTexture_->bind(0);
+    prog.setUniformValue("skyMap", 0);
+    prog.setUniformValue("coefCount", coefCount);
+    gl.glBindVertexArray(vao_);
+    gl.glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl.glBindVertexArray(0);
+
+    gl.glReadBuffer(GL_COLOR_ATTACHMENT0);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, skyProjectionPBO_);
+    gl.glReadPixels(0,0,coefCount+1,layerCount,GL_RGBA,GL_FLOAT,nullptr);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    skyProjectionFence_=gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    auto& proj=pendingSkyProjection_;
+    proj.order=skyProjectionOrder_;
+    proj.wavelengths = layerCount>1 ? getWavelengths() : std::vector<float>{};
+    proj.altitude=tools_->altitude();
+    proj.sunAzimuth=tools_->sunAzimuth();
+    proj.sunZenithAngle=tools_->sunZenithAngle();
+
+    gl.glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
+    gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, origDrawFBO);
+    gl.glBindFramebuffer(GL_READ_FRAMEBUFFER, origReadFBO);
+}
+
+void AtmosphereRenderer::readBackSkyProjection()
+{
+    if(!skyProjectionFence_) return;
+
+    const auto status=gl.glClientWaitSync(skyProjectionFence_, 0, 0);
+    if(status==GL_TIMEOUT_EXPIRED) return;
+    gl.glDeleteSync(skyProjectionFence_);
+    skyProjectionFence_=nullptr;
+    if(status==GL_WAIT_FAILED)
+    {
+        qWarning() << "Failed to wait for sky projection readback:" << openglErrorString(gl.glGetError()).c_str();
+        return;
+    }
+
+    auto& proj=pendingSkyProjection_;
+    const int coefCount=(proj.order+1)*(proj.order+1);
+    const unsigned wavelengthSetCount=proj.wavelengths.size()/4;
+    const int rowLength=coefCount+1;
+
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, skyProjectionPBO_);
+    const auto data=static_cast<const glm::vec4*>(gl.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                                       rowLength*(1+wavelengthSetCount)*sizeof(glm::vec4),
+                                                                       GL_MAP_READ_BIT));
+    if(!data)
+    {
+        qWarning() << "Failed to map sky projection readback buffer:" << openglErrorString(gl.glGetError()).c_str();
+        gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+
+    proj.luminance.clear();
+    for(int n=0; n<coefCount; ++n)
+        proj.luminance.emplace_back(toQVector(data[n]));
+    proj.groundIlluminance=toQVector(data[coefCount]);
+
+    proj.radiance.assign(coefCount*proj.wavelengths.size(), 0.f);
+    proj.groundIrradiance.assign(proj.wavelengths.size(), 0.f);
+    for(unsigned wlSetIndex=0; wlSetIndex<wavelengthSetCount; ++wlSetIndex)
+    {
+        const auto row=data+rowLength*(1+wlSetIndex);
+        for(unsigned i=0; i<4; ++i)
+        {
+            for(int n=0; n<coefCount; ++n)
+                proj.radiance[n*proj.wavelengths.size()+4*wlSetIndex+i]=row[n][i];
+            proj.groundIrradiance[4*wlSetIndex+i]=row[coefCount][i];
+        }
+    }
+    gl.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    gl.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    skyProjection_=proj;
+}
+
 int AtmosphereRenderer::initPreparationToDraw()
 {
     OGL_TRACE();
 
-    if(state_ == State::ReloadingTextures)
+    if(state_ == State::ReloadingTextures || state_ == State::LoadingScatterers)
         return totalLoadingStepsToDo_;
     if(state_ != State::ReadyToRender) return -1;
 
+    unloadDisabledScatterers();
+
     const auto altCoord=altitudeUnitRangeTexCoord();
     if(altCoord != altCoordToLoad_)
     {
-        [[maybe_unused]] OGLTrace t("reloading textures");
+        [[maybe_unused]] OGLTrace t(trace_, "reloading textures");
 
         altCoordToLoad_ = altCoord;
         state_ = State::ReloadingTextures;
@@ -1953,6 +2687,22 @@ int AtmosphereRenderer::initPreparationToDraw()
         totalLoadingStepsToDo_=0;
         reloadScatteringTextures(CountStepsOnly{true});
     }
+    else
+    {
+        for(const auto& [name, enabled] : scatterersEnabledStates_)
+        {
+            if(enabled && !residentScatterers_.count(name))
+                scatterersToLoad_.insert(name);
+        }
+        if(!scatterersToLoad_.empty())
+        {
+            state_ = State::LoadingScatterers;
+            currentActivity_=QObject::tr("Loading enabled scatterers...");
+            loadingStepsDone_=0;
+            totalLoadingStepsToDo_=0;
+            loadScatterers(CountStepsOnly{true});
+        }
+    }
 
     return totalLoadingStepsToDo_;
 }
@@ -1961,6 +2711,28 @@ auto AtmosphereRenderer::stepPreparationToDraw() -> LoadingStatus
 {
     OGL_TRACE();
 
+    if(state_ == State::LoadingScatterers)
+    {
+        currentLoadingIterationStepCounter_=0;
+        loadScatterers(CountStepsOnly{false});
+
+        if(loadingStepsDone_ == totalLoadingStepsToDo_)
+        {
+            const auto now=std::chrono::steady_clock::now();
+            for(const auto& name : scatterersToLoad_)
+            {
+                residentScatterers_.insert(name);
+                // It might have been disabled while being loaded
+                if(!scatterersEnabledStates_.at(name))
+                    scatterersDisabledTimes_.emplace(name, now);
+            }
+            scatterersToLoad_.clear();
+            finalizeLoading();
+        }
+
+        return {loadingStepsDone_, totalLoadingStepsToDo_};
+    }
+
     if(state_ != State::ReloadingTextures)
         return {0, -1};
 
@@ -1996,6 +2768,19 @@ void AtmosphereRenderer::draw(const double brightness, const bool clear)
 
     if(state_ != State::ReadyToRender) return;
 
+    readBackSkyProjection();
+    trace_.collectGPUSpans();
+
+    auto sceneState=currentSceneState(brightness);
+    if(clear && frameUpToDate_ && sceneState==drawnSceneState_)
+    {
+        if(sceneChangedSinceSkyProjection_)
+            updateSkyProjection();
+        return;
+    }
+    frameUpToDate_=false;
+    profiler_.beginFrame();
+
     oglDebugMessageInsert("AtmosphereRenderer::draw() begins drawing");
 
     GLint targetFBO=-1;
@@ -2012,8 +2797,20 @@ void AtmosphereRenderer::draw(const double brightness, const bool clear)
         {
             gl.glClearColor(0,0,0,0);
             gl.glClear(GL_COLOR_BUFFER_BIT);
+            if(viewCount_>1)
+            {
+                // Only the layer of view 0 is attached
+                for(int view=1; view<viewCount_; ++view)
+                {
+                    attachLuminanceTarget(view);
+                    gl.glClearBufferfv(GL_COLOR, 0, std::array<GLfloat,4>{0,0,0,0}.data());
+                }
+                attachLuminanceTarget(0);
+            }
         }
         gl.glEnablei(GL_BLEND, 0);
+        renderingViews_=true;
+        try
         {
             gl.glBlendFunc(GL_CONSTANT_COLOR, GL_ONE);
             gl.glBlendColor(brightness, brightness, brightness, brightness);
@@ -2021,15 +2818,72 @@ void AtmosphereRenderer::draw(const double brightness, const bool clear)
                 renderZeroOrderScattering();
             if(tools_->singleScatteringEnabled())
                 renderSingleScattering();
-            if(tools_->multipleScatteringEnabled())
-                renderMultipleScattering();
-            if(tools_->lightPollutionGroundLuminance())
-                renderLightPollution();
+            // The reduced-resolution layers hold a single view
+            const int divisor = viewCount_>1 ? 1 : std::clamp(tools_->smoothLayersResolutionDivisor(), 1, 4);
+            if(divisor>1)
+            {
+                renderSmoothLayersAtReducedResolution(divisor, brightness);
+            }
+            else
+            {
+                if(tools_->multipleScatteringEnabled())
+                    renderMultipleScattering();
+                if(tools_->lightPollutionGroundLuminance())
+                    renderLightPollution();
+            }
+        }
+        catch(...)
+        {
+            renderingViews_=false;
+            throw;
         }
+        renderingViews_=false;
         gl.glDisablei(GL_BLEND, 0);
 
+        sceneChangedSinceSkyProjection_=true;
+        updateSkyProjection();
+
         gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER,targetFBO);
     }
+    profiler_.endFrame();
+
+    // Accumulated frames can't be reproduced, so only a cleared one can be reused
+    if(clear && viewHash_)
+    {
+        drawnSceneState_=std::move(sceneState);
+        frameUpToDate_=true;
+    }
+}
+
+auto AtmosphereRenderer::currentSceneState(const double brightness) const -> SceneState
+{
+    SceneState state;
+    state.settings =
+    {
+        brightness,
+        tools_->altitude(),
+        tools_->sunAzimuth(),
+        tools_->sunZenithAngle(),
+        tools_->sunAngularRadius(),
+        tools_->moonAzimuth(),
+        tools_->moonZenithAngle(),
+        tools_->earthMoonDistance(),
+        double(tools_->zeroOrderScatteringEnabled()),
+        double(tools_->singleScatteringEnabled()),
+        double(tools_->multipleScatteringEnabled()),
+        tools_->lightPollutionGroundLuminance(),
+        double(tools_->onTheFlySingleScatteringEnabled()),
+        double(tools_->onTheFlyPrecompDoubleScatteringEnabled()),
+        double(tools_->textureFilteringEnabled()),
+        double(tools_->smoothLayersResolutionDivisor()),
+        double(tools_->usingEclipseShader()),
+        double(tools_->pseudoMirrorEnabled()),
+    };
+    state.solarIrradianceFixup=solarIrradianceFixup_;
+    state.scatterersEnabled=scatterersEnabledStates_;
+    state.viewportSize=viewportSize_;
+    state.viewHash=viewHash_.value_or(0);
+    return state;
 }
 
 void AtmosphereRenderer::setupRenderTarget()
@@ -2053,6 +2907,7 @@ void AtmosphereRenderer::setupRenderTarget()
         gl.glGenFramebuffers(1, &viewDirectionFBO_);
         gl.glGenRenderbuffers(1, &viewDirectionRenderBuffer_);
         gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, viewDirectionFBO_);
+        memory_->addFramebuffer(viewDirectionFBO_, GPUMemoryCategory::RenderTargets);
         gl.glBindRenderbuffer(GL_RENDERBUFFER, viewDirectionRenderBuffer_);
         gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, 1, 1); // dummy size just to initialize the renderbuffer
         gl.glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, viewDirectionRenderBuffer_);
@@ -2061,13 +2916,14 @@ void AtmosphereRenderer::setupRenderTarget()
     }
 
     gl.glGenFramebuffers(1,&eclipseSingleScatteringPrecomputationFBO_);
+    memory_->addFramebuffer(eclipseSingleScatteringPrecomputationFBO_, GPUMemoryCategory::EclipsePrecomputation);
     eclipsedSingleScatteringPrecomputationTextures_.clear();
     for(const auto& scatterer : params_.scatterers)
     {
         auto& textures=eclipsedSingleScatteringPrecomputationTextures_[scatterer.name];
         for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
         {
-            auto& tex=*textures.emplace_back(newTex(QOpenGLTexture::Target2D));
+            auto& tex=*textures.emplace_back(newTex(memory_, QOpenGLTexture::Target2D));
             tex.setMinificationFilter(QOpenGLTexture::Linear);
             tex.setMagnificationFilter(QOpenGLTexture::Linear);
             // relative azimuth
@@ -2078,6 +2934,7 @@ void AtmosphereRenderer::setupRenderTarget()
             const auto width=params_.eclipsedSingleScatteringTextureSize[0];
             const auto height=params_.eclipsedSingleScatteringTextureSize[1];
             gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width,height,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+            memory_->addTexture(tex.textureId(), GPUMemoryCategory::EclipsePrecomputation, GL_RGBA32F, width, height);
 
             if(scatterer.phaseFunctionType!=PhaseFunctionType::General)
                 break;
@@ -2085,13 +2942,16 @@ void AtmosphereRenderer::setupRenderTarget()
     }
 
     gl.glGenFramebuffers(1,&eclipseDoubleScatteringPrecomputationFBO_);
-    eclipsedDoubleScatteringPrecomputationScratchTexture_=newTex(QOpenGLTexture::Target2D);
+    eclipsedDoubleScatteringPrecomputationScratchTexture_=newTex(memory_, QOpenGLTexture::Target2D);
     eclipsedDoubleScatteringPrecomputationScratchTexture_->create();
     eclipsedDoubleScatteringPrecomputationScratchTexture_->bind();
     gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,
                     params_.eclipseAngularIntegrationPoints, params_.radialIntegrationPoints,
                     0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+    memory_->addTexture(eclipsedDoubleScatteringPrecomputationScratchTexture_->textureId(), GPUMemoryCategory::EclipsePrecomputation,
+                        GL_RGBA32F, params_.eclipseAngularIntegrationPoints, params_.radialIntegrationPoints);
     gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, eclipseDoubleScatteringPrecomputationFBO_);
+    memory_->addFramebuffer(eclipseDoubleScatteringPrecomputationFBO_, GPUMemoryCategory::EclipsePrecomputation);
     gl.glFramebufferTexture(GL_DRAW_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,eclipsedDoubleScatteringPrecomputationScratchTexture_->textureId(),0);
     checkFramebufferStatus(gl, "Eclipsed double scattering precomputation FBO");
     gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, origFBO);
@@ -2109,6 +2969,9 @@ AtmosphereRenderer::AtmosphereRenderer(QOpenGLFunctions_3_3_Core& gl, QString co
     , drawSurfaceCallback(drawSurface)
     , pathToData_(pathToData)
     , luminanceRenderTargetTexture_(QOpenGLTexture::Target2D)
+    , trace_(gl)
+    , profiler_(gl, trace_)
+    , memory_(std::make_shared<GPUMemoryRegistry>(gl))
 {
     params_.parse(pathToData + "/params.atmo", AtmosphereParameters::ForceNoEDSTextures{false}, AtmosphereParameters::SkipSpectra{true});
 }
@@ -2116,6 +2979,7 @@ AtmosphereRenderer::AtmosphereRenderer(QOpenGLFunctions_3_3_Core& gl, QString co
 void AtmosphereRenderer::setDrawSurfaceCallback(std::function<void(QOpenGLShaderProgram& shprog)> const& drawSurface)
 {
     drawSurfaceCallback=drawSurface;
+    frameUpToDate_=false;
 }
 
 int AtmosphereRenderer::initDataLoading(QByteArray viewDirVertShaderSrc, QByteArray viewDirFragShaderSrc,
@@ -2134,11 +2998,34 @@ int AtmosphereRenderer::initDataLoading(QByteArray viewDirVertShaderSrc, QByteAr
         viewDirFragShaderSrc_=std::move(viewDirFragShaderSrc);
         viewDirBindAttribLocations_=std::move(viewDirBindAttribLocations);
 
+        residentScatterers_.clear();
+        scatterersToLoad_.clear();
+        scatterersDisabledTimes_.clear();
         for(const auto& scatterer : params_.scatterers)
-            scatterersEnabledStates_[scatterer.name]=true;
+        {
+            const bool enabled=tools_->scattererEnabled(scatterer.name);
+            scatterersEnabledStates_[scatterer.name]=enabled;
+            // The others are loaded on first enabling
+            if(enabled)
+                residentScatterers_.insert(scatterer.name);
+        }
+
+        if(modelResourcesToUse_ && !canUseModelResources(*modelResourcesToUse_))
+        {
+            qWarning() << "Model resources to use were loaded from another data directory or with other view direction shaders, "
+                          "loading the data anew";
+            modelResourcesToUse_.reset();
+        }
 
-        loadShaders(CountStepsOnly{true});
-        loadTextures(CountStepsOnly{true});
+        if(modelResourcesToUse_)
+        {
+            ++totalLoadingStepsToDo_;
+        }
+        else
+        {
+            loadShaders(CountStepsOnly{true});
+            loadTextures(CountStepsOnly{true});
+        }
     }
     catch(std::exception const& ex)
     {
@@ -2150,6 +3037,9 @@ int AtmosphereRenderer::initDataLoading(QByteArray viewDirVertShaderSrc, QByteAr
 void AtmosphereRenderer::setViewDirShaders(QByteArray viewDirVertShaderSrc, QByteArray viewDirFragShaderSrc,
                                            std::vector<std::pair<std::string,GLuint>> viewDirBindAttribLocations)
 {
+    if(programsShared())
+        throw DataLoadError{QObject::tr("Can't replace view direction shaders of the shader programs shared with other renderers")};
+
     viewDirVertShaderSrc_ = viewDirVertShaderSrc;
     viewDirFragShaderSrc_ = viewDirFragShaderSrc;
 
@@ -2195,11 +3085,12 @@ void AtmosphereRenderer::setViewDirShaders(QByteArray viewDirVertShaderSrc, QByt
         replaceShaders(*prog, QObject::tr("multiple scattering shader program"));
 
     replaceShaders(*viewDirectionGetterProgram_, QObject::tr("view direction getter shader program"));
+    replaceShaders(*smoothLayersUpsamplingProgram_, QObject::tr("upsampling shader program"));
 
     viewDirVertShader_ = std::move(newVertShader);
     viewDirFragShader_ = std::move(newFragShader);
     viewDirBindAttribLocations_ = std::move(viewDirBindAttribLocations);
-
+    frameUpToDate_=false;
 }
 
 auto AtmosphereRenderer::stepDataLoading() -> LoadingStatus
@@ -2213,10 +3104,19 @@ auto AtmosphereRenderer::stepDataLoading() -> LoadingStatus
     {
         currentLoadingIterationStepCounter_=0;
 
-        const auto stepsDoneBeforeShaders = loadingStepsDone_;
-        loadShaders(CountStepsOnly{false});
-        if(loadingStepsDone_ == stepsDoneBeforeShaders) // proceed only if previous function has nothing left to do
-            loadTextures(CountStepsOnly{false});
+        if(modelResourcesToUse_)
+        {
+            useModelResources(*modelResourcesToUse_);
+            modelResourcesToUse_.reset();
+            ++loadingStepsDone_;
+        }
+        else
+        {
+            const auto stepsDoneBeforeShaders = loadingStepsDone_;
+            loadShaders(CountStepsOnly{false});
+            if(loadingStepsDone_ == stepsDoneBeforeShaders) // proceed only if previous function has nothing left to do
+                loadTextures(CountStepsOnly{false});
+        }
 
         if(loadingStepsDone_ < totalLoadingStepsToDo_)
             return {loadingStepsDone_, totalLoadingStepsToDo_};
@@ -2240,12 +3140,141 @@ auto AtmosphereRenderer::stepDataLoading() -> LoadingStatus
     return {loadingStepsDone_, totalLoadingStepsToDo_};
 }
 
+auto AtmosphereRenderer::getModelResources() -> std::shared_ptr<ModelResources>
+{
+    if(state_ != State::ReadyToRender)
+        return nullptr;
+
+    const auto resources=std::make_shared<ModelResources>();
+    auto& res=*resources;
+    res.pathToData=pathToData_;
+    res.viewDirVertShaderSrc=viewDirVertShaderSrc_;
+    res.viewDirFragShaderSrc=viewDirFragShaderSrc_;
+    res.viewDirBindAttribLocations=viewDirBindAttribLocations_;
+
+    res.residentScatterers=residentScatterers_;
+    res.altCoord=altCoordToLoad_;
+    res.numAltIntervalsIn4DTexture=numAltIntervalsIn4DTexture_;
+    res.transmittanceTextures=transmittanceTextures_;
+    res.irradianceTextures=irradianceTextures_;
+    res.multipleScatteringTextures=multipleScatteringTextures_;
+    res.singleScatteringTextures=singleScatteringTextures_;
+    res.singleScatteringInterpolationGuidesTextures01=singleScatteringInterpolationGuidesTextures01_;
+    res.singleScatteringInterpolationGuidesTextures02=singleScatteringInterpolationGuidesTextures02_;
+    res.eclipsedDoubleScatteringTextures=eclipsedDoubleScatteringTextures_;
+    res.lightPollutionTextures=lightPollutionTextures_;
+    const auto recordMemory=[&](std::vector<TexturePtr> const& textures)
+    {
+        for(const auto& tex : textures)
+        {
+            if(const auto entry=memory_->findTexture(tex->textureId()))
+                res.textureMemory.emplace(tex->textureId(), *entry);
+        }
+    };
+    for(const auto* textures : {&transmittanceTextures_, &irradianceTextures_, &multipleScatteringTextures_,
+                                &eclipsedDoubleScatteringTextures_, &lightPollutionTextures_})
+        recordMemory(*textures);
+    for(const auto* texturesMap : {&singleScatteringTextures_, &singleScatteringInterpolationGuidesTextures01_,
+                                   &singleScatteringInterpolationGuidesTextures02_})
+    {
+        for(const auto& [name, textures] : *texturesMap)
+            recordMemory(textures);
+    }
+
+    res.precomputationProgramsVertShader=precomputationProgramsVertShader_;
+    res.viewDirVertShader=viewDirVertShader_;
+    res.viewDirFragShader=viewDirFragShader_;
+    res.lightPollutionPrograms=lightPollutionPrograms_;
+    res.zeroOrderScatteringPrograms=zeroOrderScatteringPrograms_;
+    res.eclipsedZeroOrderScatteringPrograms=eclipsedZeroOrderScatteringPrograms_;
+    res.multipleScatteringPrograms=multipleScatteringPrograms_;
+    for(const auto& map : singleScatteringPrograms_)
+        res.singleScatteringPrograms.push_back(*map);
+    for(const auto& map : eclipsedSingleScatteringPrograms_)
+        res.eclipsedSingleScatteringPrograms.push_back(*map);
+    res.eclipsedDoubleScatteringPrecomputedPrograms=eclipsedDoubleScatteringPrecomputedPrograms_;
+    res.eclipsedDoubleScatteringPrecomputationPrograms=eclipsedDoubleScatteringPrecomputationPrograms_;
+    res.eclipsedSingleScatteringPrecomputationPrograms=*eclipsedSingleScatteringPrecomputationPrograms_;
+    res.viewDirectionGetterProgram=viewDirectionGetterProgram_;
+    res.smoothLayersUpsamplingProgram=smoothLayersUpsamplingProgram_;
+
+    return resources;
+}
+
+bool AtmosphereRenderer::canUseModelResources(ModelResources const& resources) const
+{
+    return resources.pathToData == pathToData_ &&
+           resources.viewDirVertShaderSrc == viewDirVertShaderSrc_ &&
+           resources.viewDirFragShaderSrc == viewDirFragShaderSrc_ &&
+           resources.viewDirBindAttribLocations == viewDirBindAttribLocations_;
+}
+
+bool AtmosphereRenderer::programsShared() const
+{
+    // Any program would do: they are all shared together
+    return viewDirectionGetterProgram_.use_count() > 1;
+}
+
+void AtmosphereRenderer::useModelResources(ModelResources const& res)
+{
+    OGL_TRACE();
+
+    residentScatterers_=res.residentScatterers;
+    const auto now=std::chrono::steady_clock::now();
+    for(const auto& name : residentScatterers_)
+    {
+        if(!scatterersEnabledStates_.at(name))
+            scatterersDisabledTimes_.emplace(name, now);
+    }
+    altCoordToLoad_=res.altCoord;
+    numAltIntervalsIn4DTexture_=res.numAltIntervalsIn4DTexture;
+    adoptTextures(transmittanceTextures_, res.transmittanceTextures, memory_, res.textureMemory);
+    adoptTextures(irradianceTextures_, res.irradianceTextures, memory_, res.textureMemory);
+    adoptTextures(multipleScatteringTextures_, res.multipleScatteringTextures, memory_, res.textureMemory);
+    adoptTextures(singleScatteringTextures_, res.singleScatteringTextures, memory_, res.textureMemory);
+    adoptTextures(singleScatteringInterpolationGuidesTextures01_, res.singleScatteringInterpolationGuidesTextures01,
+                  memory_, res.textureMemory);
+    adoptTextures(singleScatteringInterpolationGuidesTextures02_, res.singleScatteringInterpolationGuidesTextures02,
+                  memory_, res.textureMemory);
+    adoptTextures(eclipsedDoubleScatteringTextures_, res.eclipsedDoubleScatteringTextures, memory_, res.textureMemory);
+    adoptTextures(lightPollutionTextures_, res.lightPollutionTextures, memory_, res.textureMemory);
+
+    // The precomputation renders into these on each frame, so they can't be shared
+    eclipsedDoubleScatteringPrecomputationTargetTextures_.clear();
+    for(unsigned wlSetIndex=0; wlSetIndex<params_.allWavelengths.size(); ++wlSetIndex)
+        eclipsedDoubleScatteringPrecomputationTargetTextures_.emplace_back(newEclipsedDoubleScatteringPrecomputationTargetTexture(memory_));
+
+    // The clones refer to the programs that are going to be replaced
+    skyProjectionPrograms_.clear();
+
+    precomputationProgramsVertShader_=res.precomputationProgramsVertShader;
+    viewDirVertShader_=res.viewDirVertShader;
+    viewDirFragShader_=res.viewDirFragShader;
+    lightPollutionPrograms_=res.lightPollutionPrograms;
+    zeroOrderScatteringPrograms_=res.zeroOrderScatteringPrograms;
+    eclipsedZeroOrderScatteringPrograms_=res.eclipsedZeroOrderScatteringPrograms;
+    multipleScatteringPrograms_=res.multipleScatteringPrograms;
+    singleScatteringPrograms_.clear();
+    for(const auto& map : res.singleScatteringPrograms)
+        singleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>(map));
+    eclipsedSingleScatteringPrograms_.clear();
+    for(const auto& map : res.eclipsedSingleScatteringPrograms)
+        eclipsedSingleScatteringPrograms_.emplace_back(std::make_unique<ScatteringProgramsMap>(map));
+    eclipsedDoubleScatteringPrecomputedPrograms_=res.eclipsedDoubleScatteringPrecomputedPrograms;
+    eclipsedDoubleScatteringPrecomputationPrograms_=res.eclipsedDoubleScatteringPrecomputationPrograms;
+    eclipsedSingleScatteringPrecomputationPrograms_=std::make_unique<ScatteringProgramsMap>(res.eclipsedSingleScatteringPrecomputationPrograms);
+    viewDirectionGetterProgram_=res.viewDirectionGetterProgram;
+    smoothLayersUpsamplingProgram_=res.smoothLayersUpsamplingProgram;
+}
+
 void AtmosphereRenderer::finalizeLoading()
 {
+    frameUpToDate_=false;
     currentActivity_.clear();
     totalLoadingStepsToDo_=0;
     loadingStepsDone_=0;
     state_ = State::ReadyToRender;
+    qDebug().nospace() << "GPU memory taken by the renderer: " << memory_->totalBytes()/double(1<<20) << " MiB";
 }
 
 AtmosphereRenderer::~AtmosphereRenderer()
@@ -2257,6 +3286,7 @@ void AtmosphereRenderer::clearResources()
 {
     if(vbo_)
     {
+        memory_->removeBuffer(vbo_);
         gl.glDeleteBuffers(1, &vbo_);
         vbo_=0;
     }
@@ -2267,24 +3297,153 @@ void AtmosphereRenderer::clearResources()
     }
     if(luminanceRadianceFBO_)
     {
+        memory_->removeFramebuffer(luminanceRadianceFBO_);
         gl.glDeleteFramebuffers(1, &luminanceRadianceFBO_);
         luminanceRadianceFBO_=0;
     }
     if(eclipseSingleScatteringPrecomputationFBO_)
     {
+        memory_->removeFramebuffer(eclipseSingleScatteringPrecomputationFBO_);
         gl.glDeleteFramebuffers(1, &eclipseSingleScatteringPrecomputationFBO_);
         eclipseSingleScatteringPrecomputationFBO_=0;
     }
     if(!radianceRenderBuffers_.empty())
+    {
+        for(const auto renderBuffer : radianceRenderBuffers_)
+            memory_->removeRenderbuffer(renderBuffer);
         gl.glDeleteRenderbuffers(radianceRenderBuffers_.size(), radianceRenderBuffers_.data());
+        radianceRenderBuffers_.clear();
+    }
+    if(viewDirectionFBO_)
+    {
+        memory_->removeFramebuffer(viewDirectionFBO_);
+        gl.glDeleteFramebuffers(1, &viewDirectionFBO_);
+        viewDirectionFBO_=0;
+    }
+    if(viewDirectionRenderBuffer_)
+    {
+        memory_->removeRenderbuffer(viewDirectionRenderBuffer_);
+        gl.glDeleteRenderbuffers(1, &viewDirectionRenderBuffer_);
+        viewDirectionRenderBuffer_=0;
+    }
+    if(eclipseDoubleScatteringPrecomputationFBO_)
+    {
+        memory_->removeFramebuffer(eclipseDoubleScatteringPrecomputationFBO_);
+        gl.glDeleteFramebuffers(1, &eclipseDoubleScatteringPrecomputationFBO_);
+        eclipseDoubleScatteringPrecomputationFBO_=0;
+    }
+    if(smoothLayersFBO_)
+    {
+        memory_->removeFramebuffer(smoothLayersFBO_);
+        memory_->removeFramebuffer(smoothLayersViewDirFBO_);
+        gl.glDeleteFramebuffers(1, &smoothLayersFBO_);
+        gl.glDeleteFramebuffers(1, &smoothLayersViewDirFBO_);
+        smoothLayersFBO_=0;
+        smoothLayersViewDirFBO_=0;
+    }
+    smoothLayersTexture_.reset();
+    smoothLayersViewDirTexture_.reset();
+    smoothLayersSize_=QSize();
+    luminanceRenderTargetArrayTexture_.reset();
+    clearSkyProjection();
+    profiler_.clear();
+    trace_.clear();
 }
 
 void AtmosphereRenderer::drawSurface(QOpenGLShaderProgram& prog)
 {
     OGL_TRACE();
+    if(renderingSkyProjection_)
+    {
+        // The whole viewport is covered by the sphere of view directions
+        gl.glBindVertexArray(vao_);
+        gl.glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        gl.glBindVertexArray(0);
+        return;
+    }
+    if(renderingViews_ && viewCount_>1 && !intermediateTarget_)
+    {
+        // The program and its textures have been set up by the caller, so only the target layer changes between views
+        const int viewIndexLocation=prog.uniformLocation("viewIndex");
+        for(int view=0; view<viewCount_; ++view)
+        {
+            attachLuminanceTarget(view);
+            // Radiance is only rendered for view 0
+            if(view==1 && !radianceRenderBuffers_.empty())
+                gl.glDrawBuffers(1, std::array<GLenum,1>{GL_COLOR_ATTACHMENT0}.data());
+            prog.setUniformValue(viewIndexLocation, view);
+            drawSurfaceCallback(prog);
+        }
+        prog.setUniformValue(viewIndexLocation, 0);
+        attachLuminanceTarget(0);
+        if(!radianceRenderBuffers_.empty())
+            gl.glDrawBuffers(2, std::array<GLenum,2>{GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1}.data());
+        return;
+    }
     drawSurfaceCallback(prog);
 }
 
+QOpenGLShaderProgram& AtmosphereRenderer::renderProgram(QOpenGLShaderProgram& prog)
+{
+    if(!renderingSkyProjection_)
+        return prog;
+
+    auto& clone=skyProjectionPrograms_[&prog];
+    if(!clone)
+    {
+        auto program=std::make_unique<QOpenGLShaderProgram>();
+        for(const auto shader : prog.shaders())
+        {
+            if(shader!=viewDirVertShader_.get() && shader!=viewDirFragShader_.get())
+                program->addShader(shader);
+        }
+        program->addShader(precomputationProgramsVertShader_.get());
+        program->addShader(skyProjectionViewDirFragShader_.get());
+        program->bindAttributeLocation("vertex", 0);
+        link(*program, QObject::tr("sky projection shader program"));
+        clone=std::move(program);
+    }
+    return *clone;
+}
+
+void AtmosphereRenderer::attachRadianceTarget(const unsigned wlSetIndex)
+{
+    if(radianceRenderBuffers_.empty()) return;
+
+    if(intermediateTarget_)
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, intermediateTarget_->textureId(), 0, 1+wlSetIndex);
+    else
+        gl.glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
+}
+
+void AtmosphereRenderer::attachLuminanceTarget(const int viewIndex)
+{
+    if(luminanceRenderTargetArrayTexture_)
+        gl.glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, luminanceRenderTargetArrayTexture_->textureId(), 0, viewIndex);
+    else
+        gl.glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, luminanceRenderTargetTexture_.textureId(), 0);
+}
+
+GLuint AtmosphereRenderer::getLuminanceTexture()
+{
+    return luminanceRenderTargetArrayTexture_ ? luminanceRenderTargetArrayTexture_->textureId()
+                                              : luminanceRenderTargetTexture_.textureId();
+}
+
+void AtmosphereRenderer::setViewCount(const int count)
+{
+    GLint maxLayers=1;
+    gl.glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    const int newCount=std::clamp(count, 1, int(maxLayers));
+    if(newCount==viewCount_) return;
+
+    viewCount_=newCount;
+    frameUpToDate_=false;
+    // Reallocate the luminance render target
+    if(luminanceRadianceFBO_)
+        resizeEvent(viewportSize_.width(), viewportSize_.height());
+}
+
 void AtmosphereRenderer::resizeEvent(int width, int height)
 {
     OGL_TRACE();
@@ -2297,18 +3456,46 @@ void AtmosphereRenderer::resizeEvent(int width, int height)
     }
 
     viewportSize_=QSize(width,height);
+    frameUpToDate_=false; // the render targets are reallocated
     if(!luminanceRadianceFBO_) return;
 
     GLint origFBO=-1;
     gl.glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &origFBO);
     gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER,luminanceRadianceFBO_);
+    memory_->addFramebuffer(luminanceRadianceFBO_, GPUMemoryCategory::RenderTargets);
 
     GLint origTex=-1;
     gl.glGetIntegerv(GL_TEXTURE_BINDING_2D, &origTex);
     luminanceRenderTargetTexture_.bind();
 
-    gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width,height,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
-    gl.glFramebufferTexture(GL_DRAW_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,luminanceRenderTargetTexture_.textureId(),0);
+    if(viewCount_>1)
+    {
+        // The array texture is the target meanwhile, so don't waste memory on this one
+        gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,1,1,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+        memory_->addTexture(luminanceRenderTargetTexture_.textureId(), GPUMemoryCategory::RenderTargets, GL_RGBA32F, 1, 1);
+
+        if(!luminanceRenderTargetArrayTexture_)
+        {
+            luminanceRenderTargetArrayTexture_=newTex(memory_, QOpenGLTexture::Target2DArray);
+            luminanceRenderTargetArrayTexture_->setMinificationFilter(QOpenGLTexture::Nearest);
+            luminanceRenderTargetArrayTexture_->setMagnificationFilter(QOpenGLTexture::Nearest);
+            luminanceRenderTargetArrayTexture_->setWrapMode(QOpenGLTexture::ClampToEdge);
+        }
+        GLint origArrayTex=-1;
+        gl.glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &origArrayTex);
+        luminanceRenderTargetArrayTexture_->bind();
+        gl.glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA32F,width,height,viewCount_,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+        memory_->addTexture(luminanceRenderTargetArrayTexture_->textureId(), GPUMemoryCategory::RenderTargets, GL_RGBA32F,
+                            width, height, viewCount_);
+        gl.glBindTexture(GL_TEXTURE_2D_ARRAY, origArrayTex);
+    }
+    else
+    {
+        gl.glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width,height,0,GL_RGBA,GL_UNSIGNED_BYTE,nullptr);
+        memory_->addTexture(luminanceRenderTargetTexture_.textureId(), GPUMemoryCategory::RenderTargets, GL_RGBA32F, width, height);
+        luminanceRenderTargetArrayTexture_.reset();
+    }
+    attachLuminanceTarget(0);
     checkFramebufferStatus(gl, "Atmosphere renderer FBO");
 
     gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, origFBO);
@@ -2320,15 +3507,21 @@ void AtmosphereRenderer::resizeEvent(int width, int height)
         {
             gl.glBindRenderbuffer(GL_RENDERBUFFER, radianceRenderBuffers_[wlSetIndex]);
             gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+            memory_->addRenderbuffer(radianceRenderBuffers_[wlSetIndex], GPUMemoryCategory::RenderTargets, GL_RGBA32F, width, height);
         }
         gl.glBindRenderbuffer(GL_RENDERBUFFER, viewDirectionRenderBuffer_);
         gl.glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+        memory_->addRenderbuffer(viewDirectionRenderBuffer_, GPUMemoryCategory::RenderTargets, GL_RGBA32F, width, height);
     }
 }
 
 void AtmosphereRenderer::setScattererEnabled(QString const& name, const bool enable)
 {
     scatterersEnabledStates_[name]=enable;
+    if(enable)
+        scatterersDisabledTimes_.erase(name);
+    else if(residentScatterers_.count(name))
+        scatterersDisabledTimes_.emplace(name, std::chrono::steady_clock::now());
 }
 
 int AtmosphereRenderer::initShaderReloading()
@@ -2,9 +2,13 @@
 #define INCLUDE_ONCE_5DB905D2_61C0_44DB_8F35_67B31BD78315
 
 #include <cmath>
+#include <set>
 #include <array>
 #include <deque>
+#include <chrono>
 #include <memory>
+#include <tuple>
+#include <optional>
 #include <glm/glm.hpp>
 #include <QObject>
 #include <QOpenGLTexture>
@@ -13,13 +17,17 @@
 #include "../common/types.hpp"
 #include "../common/AtmosphereParameters.hpp"
 #include "api/ShowMySky/AtmosphereRenderer.hpp"
+#include "GPUProfiler.hpp"
+#include "GPUMemoryRegistry.hpp"
 
 class AtmosphereRenderer : public ShowMySky::AtmosphereRenderer
 {
-    using ShaderProgPtr=std::unique_ptr<QOpenGLShaderProgram>;
-    using TexturePtr=std::unique_ptr<QOpenGLTexture>;
+    // Shared to let other renderers use the same objects, see getModelResources()
+    using ShaderProgPtr=std::shared_ptr<QOpenGLShaderProgram>;
+    using TexturePtr=std::shared_ptr<QOpenGLTexture>;
     using ScattererName=QString;
     QOpenGLFunctions_3_3_Core& gl;
+    friend struct ShowMySky::AtmosphereRenderer::ModelResources;
 public:
 
     /**
@@ -59,7 +67,7 @@ public:
     bool canGrabRadiance() const override;
     bool canSetSolarSpectrum() const override;
     bool canRenderPrecomputedEclipsedDoubleScattering() const override;
-    GLuint getLuminanceTexture() override { return luminanceRenderTargetTexture_.textureId(); };
+    GLuint getLuminanceTexture() override;
 
     void draw(double brightness, bool clear) override;
     void resizeEvent(int width, int height) override;
@@ -69,8 +77,23 @@ public:
     void setSolarSpectrum(std::vector<float> const& solarIrradianceAtTOA) override;
     void resetSolarSpectrum() override;
     Direction getViewDirection(QPoint const& pixelPos) override;
+    void setSkyProjectionOrder(int order) override;
+    void setSkyProjectionUpdateInterval(double seconds) override { skyProjectionUpdateInterval_=seconds; }
+    SkyProjection getSkyProjection() override { return skyProjection_; }
+    void setViewHash(quint64 hash) override { viewHash_=hash; }
+    void invalidateFrame() override { frameUpToDate_=false; }
+    void setViewCount(int count) override;
+    void setGPUProfilingEnabled(bool enable) override { profiler_.setEnabled(enable); }
+    std::vector<StageTime> getGPUStageTimes() override { return profiler_.lastFrameTimes(); }
+    void setTraceRecordingEnabled(bool enable) override { trace_.setEnabled(enable); }
+    QByteArray getRecordedTrace() override { return trace_.toJSON(); }
+    std::vector<GPUMemoryUsage> getGPUMemoryUsage() override { return memory_->usage(); }
+    void setGPUMemoryBudget(qint64 bytes, bool allowReducedPrecision) override { memory_->setBudget(bytes, allowReducedPrecision); }
+    std::shared_ptr<ModelResources> getModelResources() override;
+    void setModelResources(std::shared_ptr<ModelResources> resources) override { modelResourcesToUse_=std::move(resources); }
 
     void setScattererEnabled(QString const& name, bool enable) override;
+    void setDisabledScattererUnloadDelay(double seconds) override { disabledScattererUnloadDelay_=seconds; }
     int initShaderReloading() override;
     LoadingStatus stepShaderReloading() override;
     AtmosphereParameters const& atmosphereParameters() const { return params_; }
@@ -105,6 +128,10 @@ private: // variables
     TexturePtr eclipsedDoubleScatteringPrecomputationScratchTexture_;
     std::vector<TexturePtr> eclipsedDoubleScatteringPrecomputationTargetTextures_;
     QOpenGLTexture luminanceRenderTargetTexture_;
+    // Replaces luminanceRenderTargetTexture_ when there's more than one view, with a layer per view
+    TexturePtr luminanceRenderTargetArrayTexture_;
+    int viewCount_=1;
+    bool renderingViews_=false; //!< Whether drawSurface() should draw all the views into the luminance and radiance targets
     QSize viewportSize_;
     double altCoordToLoad_=0; //!< Used to load textures for a single altitude slice, even if input altitude changes during the load
 
@@ -120,12 +147,71 @@ private: // variables
     std::vector<ShaderProgPtr> eclipsedDoubleScatteringPrecomputationPrograms_;
     // Indexed as eclipsedSingleScatteringPrecomputationPrograms_[scattererName][wavelengthSetIndex]
     std::unique_ptr<ScatteringProgramsMap> eclipsedSingleScatteringPrecomputationPrograms_;
-    std::unique_ptr<QOpenGLShader> precomputationProgramsVertShader_;
-    std::unique_ptr<QOpenGLShader> viewDirVertShader_, viewDirFragShader_;
+    std::shared_ptr<QOpenGLShader> precomputationProgramsVertShader_;
+    std::shared_ptr<QOpenGLShader> viewDirVertShader_, viewDirFragShader_;
     ShaderProgPtr viewDirectionGetterProgram_;
     std::map<ScattererName,bool> scatterersEnabledStates_;
+    // Scatterers whose single scattering textures and programs are loaded. Others are loaded when enabled.
+    std::set<ScattererName> residentScatterers_;
+    std::set<ScattererName> scatterersToLoad_; //!< Being loaded by loadScatterers()
+    // Resident scatterers that are disabled, to be unloaded when disabledScattererUnloadDelay_ passes
+    std::map<ScattererName,std::chrono::steady_clock::time_point> scatterersDisabledTimes_;
+    double disabledScattererUnloadDelay_=60;
+    std::shared_ptr<ModelResources> modelResourcesToUse_; //!< Set by setModelResources() for the next initDataLoading()
 
     std::vector<QVector4D> solarIrradianceFixup_;
+    TraceRecorder trace_;
+    GPUProfiler profiler_;
+    // Referenced weakly by deleters of the textures, which may outlive the renderer when shared via ModelResources
+    std::shared_ptr<GPUMemoryRegistry> memory_;
+
+    // Layered texture that the render functions draw into instead of luminance and radiance render targets:
+    // layer 0 is luminance, the rest is radiance for each wavelength set
+    QOpenGLTexture* intermediateTarget_=nullptr;
+
+    // Multiple scattering and light pollution rendered at reduced resolution
+    GLuint smoothLayersFBO_=0, smoothLayersViewDirFBO_=0;
+    TexturePtr smoothLayersTexture_; // layered as intermediateTarget_
+    TexturePtr smoothLayersViewDirTexture_; // guides the upsampling
+    QSize smoothLayersSize_;
+    ShaderProgPtr smoothLayersUpsamplingProgram_;
+
+    // Everything that affects the contents of the render targets, to skip drawing if nothing has changed
+    struct SceneState
+    {
+        std::vector<double> settings;
+        std::vector<QVector4D> solarIrradianceFixup;
+        std::map<ScattererName,bool> scatterersEnabled;
+        QSize viewportSize;
+        quint64 viewHash;
+
+        bool operator==(SceneState const& rhs) const
+        {
+            return std::tie(settings, solarIrradianceFixup, scatterersEnabled, viewportSize, viewHash) ==
+                   std::tie(rhs.settings, rhs.solarIrradianceFixup, rhs.scatterersEnabled, rhs.viewportSize, rhs.viewHash);
+        }
+    };
+    std::optional<quint64> viewHash_; //!< Frame caching is disabled until the application sets the hash
+    SceneState drawnSceneState_;
+    bool frameUpToDate_=false;
+
+    int skyProjectionOrder_=0;
+    bool sceneChangedSinceSkyProjection_=true;
+    double skyProjectionUpdateInterval_=0;
+    bool renderingSkyProjection_=false;
+    std::chrono::steady_clock::time_point lastSkyProjectionStartTime_;
+    GLuint skyProjectionMapFBO_=0, skyProjectionCoefsFBO_=0, skyProjectionPBO_=0;
+    GLsync skyProjectionFence_=nullptr;
+    // Layer 0 is luminance, the rest is radiance for each wavelength set
+    TexturePtr skyProjectionMapTexture_;
+    // Row per layer of the map, column per coefficient, plus a column for irradiance of horizontal surface
+    TexturePtr skyProjectionCoefsTexture_;
+    std::unique_ptr<QOpenGLShader> skyProjectionViewDirFragShader_;
+    ShaderProgPtr skyProjectionReductionProgram_;
+    // Clones of the rendering programs with view direction shaders replaced to render the whole sphere
+    std::map<QOpenGLShaderProgram const*, ShaderProgPtr> skyProjectionPrograms_;
+    SkyProjection pendingSkyProjection_; // Scene parameters of the projection being read back
+    SkyProjection skyProjection_;
 
     int numAltIntervalsIn4DTexture_;
 
@@ -135,6 +221,7 @@ private: // variables
         LoadingData,        //!< After initDataLoading() and until loading completes
         ReloadingShaders,   //!< After initShaderReloading() and until shaders reloading completes
         ReloadingTextures,  //!< After initPreparationToDraw() and until textures reloading completes
+        LoadingScatterers,  //!< After initPreparationToDraw() and until loading of newly enabled scatterers completes
         ReadyToRender,
     } state_ = State::NotReady;
 
@@ -144,10 +231,21 @@ private: // methods
     void reloadScatteringTextures(CountStepsOnly countStepsOnly);
     void setupRenderTarget();
     void loadShaders(CountStepsOnly countStepsOnly);
+    void loadScattererShaders(AtmosphereParameters::Scatterer const& scatterer, CountStepsOnly countStepsOnly);
+    void loadScattererTextures(AtmosphereParameters::Scatterer const& scatterer, CountStepsOnly countStepsOnly);
+    void loadScatterers(CountStepsOnly countStepsOnly);
+    void releaseScatterer(ScattererName const& name);
+    void unloadDisabledScatterers();
     void setupBuffers();
+    bool canUseModelResources(ModelResources const& resources) const;
+    void useModelResources(ModelResources const& resources);
+    bool programsShared() const;
     void clearResources();
     void finalizeLoading();
     void drawSurface(QOpenGLShaderProgram& prog);
+    QOpenGLShaderProgram& renderProgram(QOpenGLShaderProgram& prog);
+    void attachRadianceTarget(unsigned wlSetIndex);
+    void attachLuminanceTarget(int viewIndex);
 
     double altitudeUnitRangeTexCoord() const;
     double cameraMoonDistance() const;
@@ -155,13 +253,15 @@ private: // methods
     glm::dvec3 moonPosition() const;
     glm::dvec3 moonPositionRelativeToSunAzimuth() const;
     glm::dvec3 cameraPosition() const;
-    glm::ivec2 loadTexture2D(QString const& path);
+    using GPUMemoryCategory=GPUMemoryRegistry::Category;
+    glm::ivec2 loadTexture2D(QString const& path, GPUMemoryCategory category);
     enum class Texture4DType
     {
         ScatteringTexture,
         InterpolationGuides,
     };
-    void loadTexture4D(QString const& path, float altitudeCoord, Texture4DType texType = Texture4DType::ScatteringTexture);
+    void loadTexture4D(QString const& path, float altitudeCoord, GPUMemoryCategory category,
+                       Texture4DType texType = Texture4DType::ScatteringTexture);
     void loadEclipsedDoubleScatteringTexture(QString const& path, float altitudeCoord);
 
     void precomputeEclipsedSingleScattering();
@@ -170,7 +270,14 @@ private: // methods
     void renderSingleScattering();
     void renderMultipleScattering();
     void renderLightPollution();
+    void setupSmoothLayersTarget(QSize const& size);
+    void renderSmoothLayersAtReducedResolution(int divisor, double brightness);
     void prepareRadianceFrames(bool clear);
+    SceneState currentSceneState(double brightness) const;
+    void setupSkyProjection();
+    void clearSkyProjection();
+    void updateSkyProjection();
+    void readBackSkyProjection();
 };
 
 #endif
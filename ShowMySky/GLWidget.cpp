@@ -1,7 +1,9 @@
 #include "GLWidget.hpp"
 #include <chrono>
+#include <iostream>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QHash>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QSurfaceFormat>
@@ -40,6 +42,13 @@ GLWidget::~GLWidget()
     // We also want to do our own cleanup.
     makeCurrent();
 
+    if(renderer && !traceFilePath_.isEmpty())
+    {
+        QFile file(traceFilePath_);
+        if(!file.open(QFile::WriteOnly) || file.write(renderer->getRecordedTrace())<0)
+            std::cerr << "Failed to save trace to \"" << traceFilePath_.toStdString() << "\": " << file.errorString().toStdString() << "\n";
+    }
+
     if(vbo_)
     {
         glDeleteBuffers(1, &vbo_);
@@ -189,6 +198,10 @@ void GLWidget::initializeGL()
             glBindVertexArray(0);
         };
         renderer.reset(ShowMySky_AtmosphereRenderer_create(this,&pathToData,tools,&drawSurface));
+        if(!traceFilePath_.isEmpty())
+            renderer->setTraceRecordingEnabled(true);
+        if(gpuMemoryBudget_)
+            renderer->setGPUMemoryBudget(gpuMemoryBudget_, true);
         tools->updateParameters(static_cast<AtmosphereRenderer*>(renderer.get())->atmosphereParameters());
         connect(tools, &ToolsWidget::settingChanged, this, qOverload<>(&GLWidget::update));
         connect(tools, &ToolsWidget::projectionChanged, this, [this](const Projection newProjection)
@@ -200,6 +213,8 @@ void GLWidget::initializeGL()
         connect(tools, &ToolsWidget::setScattererEnabled, this, [this,renderer=renderer.get()](QString const& name, const bool enable)
                 { renderer->setScattererEnabled(name, enable); update(); });
         connect(tools, &ToolsWidget::reloadShadersClicked, this, &GLWidget::reloadShaders);
+        connect(tools, &ToolsWidget::gpuProfilingToggled, this, [this,renderer=renderer.get()](const bool enable)
+                { renderer->setGPUProfilingEnabled(enable); update(); });
         connect(tools, &ToolsWidget::resetSolarSpectrum, this, &GLWidget::resetSolarSpectrum);
         connect(tools, &ToolsWidget::setFlatSolarSpectrum, this, &GLWidget::setFlatSolarSpectrum);
         connect(tools, &ToolsWidget::setBlackBodySolarSpectrum, this, &GLWidget::setBlackBodySolarSpectrum);
@@ -571,6 +586,23 @@ void GLWidget::paintGL()
 
     if(!renderer->isReadyToRender()) return;
 
+    {
+        // Everything the draw surface callback uses, except for the viewport size that the renderer tracks itself
+        const float view[]={tools->zoomFactor(), tools->cameraYaw(), tools->cameraPitch(), float(currentProjection())};
+        renderer->setViewHash(qHash(QByteArray::fromRawData(reinterpret_cast<const char*>(view), sizeof view)));
+    }
+
+    if(benchmarkViews_)
+    {
+        benchmarkViews_=false;
+        benchmarkViews();
+    }
+
+    // Query results lag behind by a few frames, so keep drawing to have them collected
+    const bool profiling=tools->gpuProfilingEnabled();
+    if(profiling)
+        renderer->invalidateFrame();
+
     glFinish();
     const auto t0=std::chrono::steady_clock::now();
     renderer->draw(1, true);
@@ -629,6 +661,12 @@ void GLWidget::paintGL()
     const auto t1=std::chrono::steady_clock::now();
     emit frameFinished(std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count());
 
+    if(profiling)
+    {
+        tools->showGPUStageTimes(renderer->getGPUStageTimes());
+        update();
+    }
+
     if(lastRadianceCapturePosition.x()>=0 && lastRadianceCapturePosition.y()>=0)
         updateSpectralRadiance(lastRadianceCapturePosition);
 }
@@ -651,6 +689,77 @@ void GLWidget::updateSpectralRadiance(QPoint const& pixelPos)
     }
 }
 
+void GLWidget::benchmarkViews()
+{
+    // The draw surface callback ignores the view index, so all the views are the same, but this doesn't affect their cost
+    constexpr int framesPerViewCount=20;
+    std::cerr << "Time of draw() by number of views, averaged over " << framesPerViewCount << " frames:\n";
+    double singleViewFrameTime=0;
+    for(const int viewCount : {1,2,4,6})
+    {
+        renderer->setViewCount(viewCount);
+        // The first frame after the render targets have been reallocated isn't representative
+        renderer->invalidateFrame();
+        renderer->draw(1, true);
+        glFinish();
+
+        const auto t0=std::chrono::steady_clock::now();
+        for(int frame=0; frame<framesPerViewCount; ++frame)
+        {
+            renderer->invalidateFrame();
+            renderer->draw(1, true);
+        }
+        glFinish();
+        const auto t1=std::chrono::steady_clock::now();
+
+        const double frameTime=std::chrono::duration<double>(t1-t0).count()/framesPerViewCount;
+        const double viewTime=frameTime/viewCount;
+        if(viewCount==1)
+            singleViewFrameTime=frameTime;
+        std::cerr << "  " << viewCount << " views: " << frameTime*1e3 << " ms per frame, " << viewTime*1e3 << " ms per view";
+        if(viewCount>1)
+            std::cerr << ", " << 100*(1-viewTime/singleViewFrameTime) << "% less than a draw() per view";
+        std::cerr << "\n";
+    }
+    renderer->setViewCount(1);
+    renderer->invalidateFrame();
+}
+
+void GLWidget::enableSkyQueryCheck()
+{
+    skyQuery_ = std::make_unique<ShowMySky::SkyQuery>(pathToData);
+}
+
+void GLWidget::checkSkyQuery(QPoint const& pixelPos)
+{
+    if(!skyQuery_ || !renderer || !renderer->isReadyToRender()) return;
+    makeCurrent();
+
+    constexpr double degree = M_PI/180;
+    const auto dir = renderer->getViewDirection(pixelPos);
+    const double azimuth = degree*dir.azimuth, elevation = degree*dir.elevation;
+    ShowMySky::SkyQuery::Query query;
+    query.altitude = tools->altitude();
+    query.viewDir = QVector3D(std::cos(elevation)*std::cos(azimuth), std::cos(elevation)*std::sin(azimuth), std::sin(elevation));
+    query.sunDir = QVector3D(std::cos(tools->sunAzimuth())*std::sin(tools->sunZenithAngle()),
+                             std::sin(tools->sunAzimuth())*std::sin(tools->sunZenithAngle()),
+                             std::cos(tools->sunZenithAngle()));
+    skyQuery_->setSingleScatteringEnabled(tools->singleScatteringEnabled());
+    skyQuery_->setMultipleScatteringEnabled(tools->multipleScatteringEnabled());
+    skyQuery_->setLightPollutionGroundLuminance(tools->lightPollutionGroundLuminance());
+    ShowMySky::SkyQuery::Result result;
+    skyQuery_->evaluate(&query, 1, &result);
+
+    const auto gpu = renderer->getPixelLuminance(pixelPos);
+    const auto cpu = result.luminance;
+    std::cerr << "Luminance at azimuth " << dir.azimuth << "°, elevation " << dir.elevation << "°: GPU ("
+              << gpu.x() << ", " << gpu.y() << ", " << gpu.z() << ", " << gpu.w() << "), CPU ("
+              << cpu.x() << ", " << cpu.y() << ", " << cpu.z() << ", " << cpu.w() << "), relative difference "
+              << (cpu-gpu).length()/gpu.length() << "\n";
+    if(tools->zeroOrderScatteringEnabled() || tools->usingEclipseShader())
+        std::cerr << "  NOTE: zero-order scattering and eclipses aren't evaluated by SkyQuery, disable them for a like-for-like comparison\n";
+}
+
 void GLWidget::setFlatSolarSpectrum()
 {
     const auto numWavelengths=renderer->getWavelengths().size();
@@ -697,6 +806,7 @@ void GLWidget::mouseMoveEvent(QMouseEvent* event)
     if(event->buttons()==Qt::LeftButton && !(event->modifiers() & (Qt::ControlModifier|Qt::ShiftModifier)))
     {
         updateSpectralRadiance(event->pos());
+        checkSkyQuery(event->pos());
         return;
     }
 
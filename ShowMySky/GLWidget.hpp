@@ -6,6 +6,7 @@
 #include <QOpenGLTexture>
 #include <QOpenGLFunctions_3_3_Core>
 #include "AtmosphereRenderer.hpp"
+#include "ShowMySky/SkyQuery.hpp"
 #include "../common/AtmosphereParameters.hpp"
 
 class ToolsWidget;
@@ -32,6 +33,10 @@ public:
 
 private:
     std::unique_ptr<ShowMySky::AtmosphereRenderer> renderer;
+    std::unique_ptr<ShowMySky::SkyQuery> skyQuery_;
+    QString traceFilePath_;
+    qint64 gpuMemoryBudget_=0;
+    bool benchmarkViews_=false;
     std::unique_ptr<QOpenGLShaderProgram> luminanceToScreenRGB_;
     std::unique_ptr<QOpenGLShaderProgram> glareProgram_;
     QOpenGLTexture ditherPatternTexture_;
@@ -70,6 +75,14 @@ public:
 public:
     explicit GLWidget(QString const& pathToData, ToolsWidget* tools, QWidget* parent=nullptr);
     ~GLWidget();
+    // Makes clicks on the sky print luminance evaluated by SkyQuery along with that rendered on the GPU
+    void enableSkyQueryCheck();
+    // Makes the renderer record a trace from the start of loading, to be saved to the file on exit
+    void enableTraceRecording(QString const& filePath) { traceFilePath_=filePath; }
+    // Applied to the renderer when it's created
+    void setGPUMemoryBudget(qint64 bytes) { gpuMemoryBudget_=bytes; }
+    // Makes the first frame measure the cost of rendering several views in one draw call and print it
+    void enableViewsBenchmark() { benchmarkViews_=true; }
 
 protected:
     void initializeGL() override;
@@ -92,6 +105,8 @@ private:
     void makeGlareRenderTarget();
     void makeDitherPatternTexture();
     void updateSpectralRadiance(QPoint const& pixelPos);
+    void checkSkyQuery(QPoint const& pixelPos);
+    void benchmarkViews();
     void setDragMode(DragMode mode, int x=0, int y=0) { dragMode_=mode; prevMouseX_=x; prevMouseY_=y; }
     void setFlatSolarSpectrum();
     void resetSolarSpectrum();
@@ -0,0 +1,230 @@
+#include "GPUMemoryRegistry.hpp"
+#include <cassert>
+#include <algorithm>
+#include <QDebug>
+#include <QOpenGLFunctions_3_3_Core>
+
+namespace
+{
+double toMiB(const qint64 bytes)
+{
+    return bytes/double(1<<20);
+}
+}
+
+GPUMemoryRegistry::GPUMemoryRegistry(QOpenGLFunctions_3_3_Core& gl)
+    : gl(gl)
+{
+}
+
+qint64 GPUMemoryRegistry::bytesPerTexel(const GLenum internalFormat)
+{
+    switch(internalFormat)
+    {
+    case GL_R8:       case GL_R8_SNORM:    case GL_R8I:     case GL_R8UI:
+        return 1;
+    case GL_R16:      case GL_R16_SNORM:   case GL_R16F:    case GL_R16I:    case GL_R16UI:
+    case GL_RG8:      case GL_RG8_SNORM:   case GL_RG8I:    case GL_RG8UI:
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RGB8:     case GL_RGB8_SNORM:  case GL_RGB8I:   case GL_RGB8UI:  case GL_SRGB8:
+    case GL_DEPTH_COMPONENT24:
+        return 3;
+    case GL_R32F:     case GL_R32I:        case GL_R32UI:
+    case GL_RG16:     case GL_RG16_SNORM:  case GL_RG16F:   case GL_RG16I:   case GL_RG16UI:
+    case GL_RGBA8:    case GL_RGBA8_SNORM: case GL_RGBA8I:  case GL_RGBA8UI: case GL_SRGB8_ALPHA8:
+    case GL_RGB10_A2: case GL_RGB10_A2UI:  case GL_R11F_G11F_B10F:           case GL_RGB9_E5:
+    case GL_DEPTH_COMPONENT32F:            case GL_DEPTH24_STENCIL8:
+        return 4;
+    case GL_RGB16:    case GL_RGB16_SNORM: case GL_RGB16F:  case GL_RGB16I:  case GL_RGB16UI:
+        return 6;
+    case GL_RG32F:    case GL_RG32I:       case GL_RG32UI:
+    case GL_RGBA16:   case GL_RGBA16_SNORM: case GL_RGBA16F: case GL_RGBA16I: case GL_RGBA16UI:
+    case GL_DEPTH32F_STENCIL8:
+        return 8;
+    case GL_RGB32F:   case GL_RGB32I:      case GL_RGB32UI:
+        return 12;
+    case GL_RGBA32F:  case GL_RGBA32I:     case GL_RGBA32UI:
+        return 16;
+    }
+    throw OpenGLError{QObject::tr("Unsupported internal format 0x%1 of GPU object").arg(internalFormat, 0, 16)};
+}
+
+QString GPUMemoryRegistry::categoryName(const Category category)
+{
+    switch(category)
+    {
+    case Category::Transmittance:            return "Transmittance";
+    case Category::Irradiance:               return "Irradiance";
+    case Category::SingleScattering:         return "Single scattering";
+    case Category::InterpolationGuides:      return "Single scattering interpolation guides";
+    case Category::MultipleScattering:       return "Multiple scattering";
+    case Category::EclipsedDoubleScattering: return "Eclipsed double scattering";
+    case Category::LightPollution:           return "Light pollution";
+    case Category::EclipsePrecomputation:    return "Eclipse precomputation";
+    case Category::RenderTargets:            return "Render targets";
+    case Category::ReducedResolutionLayers:  return "Reduced-resolution layers";
+    case Category::SkyProjection:            return "Sky projection";
+    case Category::Geometry:                 return "Geometry";
+    }
+    return "Unknown";
+}
+
+void GPUMemoryRegistry::add(const ObjectType type, const GLuint name, const Category category, const qint64 bytes)
+{
+    objects_[{type,name}]={category, bytes};
+}
+
+void GPUMemoryRegistry::addTexture(const GLuint name, const Category category, const GLenum internalFormat,
+                                   const GLsizei width, const GLsizei height, const GLsizei depth)
+{
+    add(ObjectType::Texture, name, category, bytesPerTexel(internalFormat)*width*height*depth);
+}
+
+void GPUMemoryRegistry::addBoundTexture(const GLenum target, const Category category, const GLenum internalFormat,
+                                        const GLsizei width, const GLsizei height, const GLsizei depth)
+{
+    GLenum binding=0;
+    switch(target)
+    {
+    case GL_TEXTURE_2D:       binding=GL_TEXTURE_BINDING_2D;       break;
+    case GL_TEXTURE_3D:       binding=GL_TEXTURE_BINDING_3D;       break;
+    case GL_TEXTURE_2D_ARRAY: binding=GL_TEXTURE_BINDING_2D_ARRAY; break;
+    default:
+        assert(!"Unexpected texture target");
+        return;
+    }
+    GLint name=0;
+    gl.glGetIntegerv(binding, &name);
+    addTexture(name, category, internalFormat, width, height, depth);
+}
+
+void GPUMemoryRegistry::addRenderbuffer(const GLuint name, const Category category, const GLenum internalFormat,
+                                        const GLsizei width, const GLsizei height)
+{
+    add(ObjectType::Renderbuffer, name, category, bytesPerTexel(internalFormat)*width*height);
+}
+
+void GPUMemoryRegistry::addBuffer(const GLuint name, const Category category, const qint64 bytes)
+{
+    add(ObjectType::Buffer, name, category, bytes);
+}
+
+void GPUMemoryRegistry::addFramebuffer(const GLuint name, const Category category)
+{
+    add(ObjectType::Framebuffer, name, category, 0);
+}
+
+void GPUMemoryRegistry::addSharedTexture(const GLuint name, Entry const& entry)
+{
+    sharedTextures_[name]=entry;
+}
+
+void GPUMemoryRegistry::remove(const ObjectType type, const GLuint name)
+{
+    objects_.erase({type,name});
+}
+
+void GPUMemoryRegistry::removeTexture(const GLuint name)
+{
+    remove(ObjectType::Texture, name);
+}
+
+void GPUMemoryRegistry::removeRenderbuffer(const GLuint name)
+{
+    remove(ObjectType::Renderbuffer, name);
+}
+
+void GPUMemoryRegistry::removeBuffer(const GLuint name)
+{
+    remove(ObjectType::Buffer, name);
+}
+
+void GPUMemoryRegistry::removeFramebuffer(const GLuint name)
+{
+    remove(ObjectType::Framebuffer, name);
+}
+
+void GPUMemoryRegistry::removeSharedTexture(const GLuint name)
+{
+    sharedTextures_.erase(name);
+}
+
+auto GPUMemoryRegistry::findTexture(const GLuint name) const -> std::optional<Entry>
+{
+    if(const auto it=objects_.find({ObjectType::Texture,name}); it!=objects_.end())
+        return it->second;
+    if(const auto it=sharedTextures_.find(name); it!=sharedTextures_.end())
+        return it->second;
+    return std::nullopt;
+}
+
+qint64 GPUMemoryRegistry::totalBytes() const
+{
+    qint64 total=0;
+    for(const auto& [object, entry] : objects_)
+        total += entry.bytes;
+    for(const auto& [name, entry] : sharedTextures_)
+        total += entry.bytes;
+    return total;
+}
+
+auto GPUMemoryRegistry::usage() const -> std::vector<Usage>
+{
+    std::map<Category, Usage> usagePerCategory, sharedUsagePerCategory;
+    for(const auto& [object, entry] : objects_)
+    {
+        auto& usage=usagePerCategory[entry.category];
+        usage.bytes += entry.bytes;
+        ++usage.objectCount;
+    }
+    for(const auto& [name, entry] : sharedTextures_)
+    {
+        auto& usage=sharedUsagePerCategory[entry.category];
+        usage.bytes += entry.bytes;
+        ++usage.objectCount;
+        usage.shared=true;
+    }
+
+    std::vector<Usage> result;
+    for(auto* perCategory : {&usagePerCategory, &sharedUsagePerCategory})
+    {
+        for(auto& [category, usage] : *perCategory)
+        {
+            usage.category=categoryName(category);
+            result.emplace_back(std::move(usage));
+        }
+    }
+    return result;
+}
+
+void GPUMemoryRegistry::setBudget(const qint64 bytes, const bool allowReducedPrecision)
+{
+    budget_=std::max(qint64(0), bytes);
+    allowReducedPrecision_=allowReducedPrecision;
+}
+
+GLenum GPUMemoryRegistry::formatWithinBudget(QString const& what, const GLenum internalFormat, const qint64 texelCount,
+                                             const CanReducePrecision canReduce)
+{
+    if(!budget_) return internalFormat;
+
+    const auto used=totalBytes();
+    const auto needed=bytesPerTexel(internalFormat)*texelCount;
+    if(used+needed <= budget_)
+        return internalFormat;
+
+    if(allowReducedPrecision_ && canReduce && internalFormat==GL_RGBA32F)
+    {
+        constexpr GLenum reducedFormat=GL_RGBA16F;
+        if(used+bytesPerTexel(reducedFormat)*texelCount <= budget_)
+        {
+            qWarning().nospace() << "Loading " << what << " in half precision to stay within GPU memory budget of "
+                                 << toMiB(budget_) << " MiB";
+            return reducedFormat;
+        }
+    }
+
+    throw DataLoadError{QObject::tr("Loading %1 would exceed GPU memory budget: %2 MiB more is needed, while %3 MiB of %4 MiB is used")
+                        .arg(what).arg(toMiB(needed)).arg(toMiB(used)).arg(toMiB(budget_))};
+}
@@ -0,0 +1,107 @@
+#ifndef INCLUDE_ONCE_668F6758_9F24_4DD6_BBE4_8816C57343DE
+#define INCLUDE_ONCE_668F6758_9F24_4DD6_BBE4_8816C57343DE
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <QString>
+#include <qopengl.h>
+#include "api/ShowMySky/AtmosphereRenderer.hpp"
+#include "../common/util.hpp"
+
+class QOpenGLFunctions_3_3_Core;
+
+/*
+ * Keeps account of the GPU memory taken by the renderer's textures, renderbuffers and buffers, and of its framebuffers.
+ *
+ * Objects are registered when their storage is (re)allocated, keyed by their names, so reallocation replaces the old
+ * entry. Deletions must be reported before the names are released: the context may be shared with the host or with
+ * other renderers, so a name may be reused for an object that isn't ours right after deletion.
+ *
+ * Textures adopted from another renderer are registered as shared. They are reported separately, but count towards the
+ * budget, since they stay allocated as long as this renderer holds them.
+ */
+class GPUMemoryRegistry
+{
+public:
+    using Usage=ShowMySky::AtmosphereRenderer::GPUMemoryUsage;
+
+    enum class Category
+    {
+        Transmittance,
+        Irradiance,
+        SingleScattering,
+        InterpolationGuides,
+        MultipleScattering,
+        EclipsedDoubleScattering,
+        LightPollution,
+        EclipsePrecomputation,
+        RenderTargets,
+        ReducedResolutionLayers,
+        SkyProjection,
+        Geometry,
+    };
+
+    struct Entry
+    {
+        Category category;
+        qint64 bytes;
+    };
+
+    explicit GPUMemoryRegistry(QOpenGLFunctions_3_3_Core& gl);
+
+    void addTexture(GLuint name, Category category, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth=1);
+    // Same as addTexture, for the texture bound to the target of the active texture unit
+    void addBoundTexture(GLenum target, Category category, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth=1);
+    void addRenderbuffer(GLuint name, Category category, GLenum internalFormat, GLsizei width, GLsizei height);
+    void addBuffer(GLuint name, Category category, qint64 bytes);
+    void addFramebuffer(GLuint name, Category category);
+    void addSharedTexture(GLuint name, Entry const& entry);
+
+    void removeTexture(GLuint name);
+    void removeRenderbuffer(GLuint name);
+    void removeBuffer(GLuint name);
+    void removeFramebuffer(GLuint name);
+    void removeSharedTexture(GLuint name);
+
+    // Entry of a texture registered either as our own or as shared
+    std::optional<Entry> findTexture(GLuint name) const;
+
+    // Zero budget means no limit
+    void setBudget(qint64 bytes, bool allowReducedPrecision);
+    DEFINE_EXPLICIT_BOOL(CanReducePrecision);
+    /*
+     * Returns the internal format to allocate a texture with so that the budget isn't exceeded. If the format can't be
+     * reduced, or the texture doesn't fit even in reduced format, throws DataLoadError.
+     */
+    GLenum formatWithinBudget(QString const& what, GLenum internalFormat, qint64 texelCount, CanReducePrecision canReduce);
+
+    qint64 totalBytes() const;
+    // Usage per category, in the order of the categories, own objects first, then the shared ones
+    std::vector<Usage> usage() const;
+
+    // Throws OpenGLError if the format isn't a known sized format
+    static qint64 bytesPerTexel(GLenum internalFormat);
+    static QString categoryName(Category category);
+
+private:
+    enum class ObjectType
+    {
+        Texture,
+        Renderbuffer,
+        Buffer,
+        Framebuffer,
+    };
+
+    QOpenGLFunctions_3_3_Core& gl;
+    std::map<std::pair<ObjectType,GLuint>, Entry> objects_;
+    std::map<GLuint, Entry> sharedTextures_;
+    qint64 budget_=0;
+    bool allowReducedPrecision_=true;
+
+    void add(ObjectType type, GLuint name, Category category, qint64 bytes);
+    void remove(ObjectType type, GLuint name);
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "GPUProfiler.hpp"
+#include <QOpenGLFunctions_3_3_Core>
+
+GPUProfiler::Stage::Stage(GPUProfiler& profiler, const char*const name, QString const& detail)
+    : traceSpan(profiler.trace_, name, detail, TraceRecorder::Timing::CPUAndGPU)
+    , profiler(profiler.beginStage(name, detail) ? &profiler : nullptr)
+{
+}
+
+GPUProfiler::Stage::~Stage()
+{
+    if(profiler)
+        profiler->endStage();
+}
+
+GPUProfiler::GPUProfiler(QOpenGLFunctions_3_3_Core& gl, TraceRecorder& trace)
+    : gl(gl)
+    , trace_(trace)
+{
+}
+
+GPUProfiler::~GPUProfiler()
+{
+    // Query objects are released by clear(), since the context may be gone by now
+}
+
+void GPUProfiler::setEnabled(const bool enable)
+{
+    enabled_=enable;
+    if(!enable)
+        lastFrameTimes_.clear();
+}
+
+void GPUProfiler::clear()
+{
+    for(auto& frame : frames_)
+    {
+        if(!frame.queries.empty())
+            gl.glDeleteQueries(frame.queries.size(), frame.queries.data());
+        frame=Frame{};
+    }
+    lastFrameTimes_.clear();
+    currentFrame_=nullptr;
+    stageActive_=false;
+}
+
+void GPUProfiler::collectResults()
+{
+    for(auto& frame : frames_)
+    {
+        if(!frame.pending) continue;
+
+        const auto stageCount=frame.stageNames.size();
+        bool available=true;
+        for(unsigned n=0; n<stageCount && available; ++n)
+        {
+            GLuint queryAvailable=GL_FALSE;
+            gl.glGetQueryObjectuiv(frame.queries[n], GL_QUERY_RESULT_AVAILABLE, &queryAvailable);
+            available = queryAvailable==GL_TRUE;
+        }
+        if(!available) continue;
+
+        frame.pending=false;
+        // Frames in the ring can complete out of order of our checks, don't let an older one override a newer
+        if(frame.number < lastCollectedFrameNumber_) continue;
+        lastCollectedFrameNumber_=frame.number;
+
+        lastFrameTimes_.clear();
+        for(unsigned n=0; n<stageCount; ++n)
+        {
+            GLuint64 nanoseconds=0;
+            gl.glGetQueryObjectui64v(frame.queries[n], GL_QUERY_RESULT, &nanoseconds);
+            lastFrameTimes_.push_back({frame.stageNames[n], nanoseconds*1e-6});
+        }
+    }
+}
+
+void GPUProfiler::beginFrame()
+{
+    currentFrame_=nullptr;
+    if(!enabled_) return;
+
+    collectResults();
+
+    for(auto& frame : frames_)
+    {
+        if(frame.pending) continue;
+        frame.stageNames.clear();
+        frame.number=++frameCounter_;
+        currentFrame_=&frame;
+        break;
+    }
+}
+
+void GPUProfiler::endFrame()
+{
+    if(!currentFrame_) return;
+    currentFrame_->pending = !currentFrame_->stageNames.empty();
+    currentFrame_=nullptr;
+}
+
+bool GPUProfiler::beginStage(const char*const name, QString const& detail)
+{
+    if(!currentFrame_ || stageActive_) return false;
+
+    auto& frame=*currentFrame_;
+    const auto index=frame.stageNames.size();
+    if(index==frame.queries.size())
+    {
+        GLuint query=0;
+        gl.glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    frame.stageNames.push_back(detail.isEmpty() ? QString(name) : QString("%1: %2").arg(name).arg(detail));
+    gl.glBeginQuery(GL_TIME_ELAPSED, frame.queries[index]);
+    stageActive_=true;
+    return true;
+}
+
+void GPUProfiler::endStage()
+{
+    gl.glEndQuery(GL_TIME_ELAPSED);
+    stageActive_=false;
+}
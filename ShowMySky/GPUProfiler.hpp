@@ -0,0 +1,79 @@
+#ifndef INCLUDE_ONCE_9A8C27CD_D49B_4C8F_B814_6EB97F376ADA
+#define INCLUDE_ONCE_9A8C27CD_D49B_4C8F_B814_6EB97F376ADA
+
+#include <array>
+#include <vector>
+#include <QString>
+#include <qopengl.h>
+#include "api/ShowMySky/AtmosphereRenderer.hpp"
+#include "TraceRecorder.hpp"
+
+class QOpenGLFunctions_3_3_Core;
+
+/*
+ * Measures GPU time of the stages of a frame with GL_TIME_ELAPSED queries. Queries of several frames are kept in
+ * flight, and results are only read when they are available, so the measurements never stall the pipeline. If all the
+ * frames in the ring are still pending, the current frame is simply not measured.
+ *
+ * Stages can't overlap: a stage started while another one is active is not measured, its time being included in the
+ * enclosing stage.
+ *
+ * Each stage is also recorded as a CPU and GPU span by the trace recorder, nesting included.
+ */
+class GPUProfiler
+{
+public:
+    using StageTime=ShowMySky::AtmosphereRenderer::StageTime;
+
+    class Stage
+    {
+        TraceRecorder::Span traceSpan;
+        GPUProfiler* profiler;
+    public:
+        Stage(GPUProfiler& profiler, const char* name, QString const& detail);
+        Stage(Stage const&)=delete;
+        Stage& operator=(Stage const&)=delete;
+        ~Stage();
+    };
+
+    GPUProfiler(QOpenGLFunctions_3_3_Core& gl, TraceRecorder& trace);
+    GPUProfiler(GPUProfiler const&)=delete;
+    ~GPUProfiler();
+
+    void setEnabled(bool enable);
+    bool enabled() const { return enabled_; }
+    void beginFrame();
+    void endFrame();
+    // Measures the stage until the returned object is destroyed. The name is "name" or "name: detail".
+    Stage stage(const char* name, QString const& detail=QString()) { return Stage(*this, name, detail); }
+    // Stage times of the latest frame whose results have become available
+    std::vector<StageTime> const& lastFrameTimes() const { return lastFrameTimes_; }
+    // Releases the query objects. Must be called with the OpenGL context current.
+    void clear();
+
+private:
+    struct Frame
+    {
+        std::vector<GLuint> queries; // pool that only grows
+        std::vector<QString> stageNames;
+        bool pending=false;
+        unsigned long long number=0;
+    };
+    static constexpr unsigned framesInFlight=4;
+
+    QOpenGLFunctions_3_3_Core& gl;
+    TraceRecorder& trace_;
+    std::array<Frame,framesInFlight> frames_;
+    std::vector<StageTime> lastFrameTimes_;
+    unsigned long long lastCollectedFrameNumber_=0;
+    unsigned long long frameCounter_=0;
+    Frame* currentFrame_=nullptr;
+    bool stageActive_=false;
+    bool enabled_=false;
+
+    void collectResults();
+    bool beginStage(const char* name, QString const& detail);
+    void endStage();
+};
+
+#endif
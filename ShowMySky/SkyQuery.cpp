@@ -0,0 +1,503 @@
+#include "ShowMySky/SkyQuery.hpp"
+
+#include <cmath>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <QFile>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "../common/AtmosphereParameters.hpp"
+#include "../common/util.hpp"
+
+#if defined __SSE__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define SKY_QUERY_USE_SSE 1
+#endif
+
+namespace ShowMySky
+{
+
+namespace
+{
+
+struct MappedTexture
+{
+    std::unique_ptr<QFile> file;
+    float const* texels = nullptr; // RGBA texels, with the first dimension varying fastest
+};
+
+MappedTexture mapTexture(QString const& path, std::vector<int> const& expectedSizes)
+{
+    MappedTexture texture;
+    texture.file = std::make_unique<QFile>(path);
+    auto& file = *texture.file;
+    if(!file.open(QFile::ReadOnly))
+        throw DataLoadError{QObject::tr("Failed to open file \"%1\": %2").arg(path).arg(file.errorString())};
+
+    std::vector<uint16_t> sizes(expectedSizes.size());
+    const qint64 headerSize = sizes.size()*sizeof sizes[0];
+    if(file.read(reinterpret_cast<char*>(sizes.data()), headerSize) != headerSize)
+    {
+        throw DataLoadError{QObject::tr("Failed to read header from file \"%1\": %2")
+                            .arg(path).arg(file.errorString())};
+    }
+    if(!std::equal(sizes.begin(), sizes.end(), expectedSizes.begin()))
+    {
+        throw DataLoadError{QObject::tr("Dimensions of texture in file \"%1\" don't match those in the model description")
+                            .arg(path)};
+    }
+
+    const auto texelCount = std::accumulate(sizes.begin(), sizes.end(), uint64_t(1), std::multiplies<uint64_t>{});
+    const qint64 expectedFileSize = headerSize + 4*sizeof(float)*texelCount;
+    if(expectedFileSize != file.size())
+    {
+        throw DataLoadError{QObject::tr("Size of file \"%1\" (%2 bytes) doesn't match image dimensions from file header.\nThe expected size is %3 bytes.")
+                            .arg(path).arg(file.size()).arg(expectedFileSize)};
+    }
+
+    const auto data = file.map(0, file.size());
+    if(!data)
+    {
+        throw DataLoadError{QObject::tr("Failed to map file \"%1\" into memory: %2")
+                            .arg(path).arg(file.errorString())};
+    }
+    texture.texels = reinterpret_cast<float const*>(data + headerSize);
+    return texture;
+}
+
+// Either a single XYZW texture, or a radiance texture for each wavelength set
+struct SpectralTextures
+{
+    bool luminance = false;
+    std::vector<MappedTexture> textures;
+
+    bool empty() const { return textures.empty(); }
+};
+
+// Texel offsets (in floats) and weights of a multilinear interpolation
+template<int N>
+struct Taps
+{
+    size_t offsets[N];
+    float weights[N];
+};
+
+// Linear interpolation along one dimension, the same as GL_LINEAR filtering with GL_CLAMP_TO_EDGE wrapping
+struct LinearTap
+{
+    int index0, index1;
+    float alpha1;
+};
+
+LinearTap linearTap(const float texCoord, const int texSize)
+{
+    const float index = texSize*std::clamp(texCoord, 0.f, 1.f) - 0.5f;
+    const float floorIndex = std::floor(index);
+    const int i = floorIndex;
+    return {std::clamp(i, 0, texSize-1), std::clamp(i+1, 0, texSize-1), index-floorIndex};
+}
+
+template<int N>
+glm::vec4 sample(float const*const texels, Taps<N> const& taps)
+{
+#ifdef SKY_QUERY_USE_SSE
+    __m128 sum = _mm_setzero_ps();
+    for(int n = 0; n < N; ++n)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texels+taps.offsets[n]), _mm_set1_ps(taps.weights[n])));
+    glm::vec4 result;
+    _mm_storeu_ps(glm::value_ptr(result), sum);
+    return result;
+#else
+    glm::vec4 sum(0);
+    for(int n = 0; n < N; ++n)
+        sum += taps.weights[n] * glm::make_vec4(texels+taps.offsets[n]);
+    return sum;
+#endif
+}
+
+// XXX: keep in sync with the same function in texture-coordinates.frag
+double cosSZAToUnitRangeTexCoord(const double cosSunZenithAngle, AtmosphereParameters const& params)
+{
+    const double R = params.earthRadius;
+    const double H = params.atmosphereHeight;
+    const double lengthOfHorizRayFromGroundToTOA = std::sqrt(H*(H+2*R));
+    // distanceToAtmosphereBorder(cosSunZenithAngle, 0) in common-functions.frag
+    const double discriminant = sqr(R+H)-sqr(R)*(1-sqr(cosSunZenithAngle));
+    const double distFromGroundToTopAtmoBorder = std::max(0., std::sqrt(std::max(0., discriminant))-R*cosSunZenithAngle);
+    const double distMin = H;
+    const double distMax = lengthOfHorizRayFromGroundToTOA;
+    const double a = (distFromGroundToTopAtmoBorder-distMin)/(distMax-distMin);
+    const double A = 2*R/(distMax-distMin);
+    return std::max(0., 1-a/A)/(a+1);
+}
+
+// XXX: keep in sync with the same function in texture-coordinates.frag
+// Returns the unit range coordinate of cos(viewZenithAngle) and the one of altitude
+std::pair<double,double> viewRayTexVarsTo2DCoords(const double cosViewZenithAngle, const double altitude,
+                                                  const bool viewRayIntersectsGround, AtmosphereParameters const& params)
+{
+    const double R = params.earthRadius;
+    const double H = params.atmosphereHeight;
+    const double lengthOfHorizRayFromGroundToTOA = std::sqrt(H*(H+2*R));
+    const double r = R+altitude;
+    const double distToHorizon = std::sqrt(sqr(altitude)+2*altitude*R);
+    const double altCoord = distToHorizon / lengthOfHorizRayFromGroundToTOA;
+
+    const double rCvza = r*cosViewZenithAngle;
+    const double discriminant = sqr(rCvza)-sqr(r)+sqr(R);
+    if(viewRayIntersectsGround)
+    {
+        const double distToGround = -rCvza-std::sqrt(std::max(0., discriminant));
+        const double distMin = altitude;
+        const double distMax = distToHorizon;
+        return {distMax==distMin ? 0. : (distToGround-distMin)/(distMax-distMin), altCoord};
+    }
+    const double distToTopAtmoBorder = -rCvza+std::sqrt(std::max(0., discriminant+sqr(lengthOfHorizRayFromGroundToTOA)));
+    const double distMin = H-altitude;
+    const double distMax = distToHorizon+lengthOfHorizRayFromGroundToTOA;
+    return {distMax==distMin ? 0. : (distToTopAtmoBorder-distMin)/(distMax-distMin), altCoord};
+}
+
+// XXX: keep in sync with the texture coordinate of cos(viewZenithAngle) in texture-coordinates.frag
+float cosVZATexCoord(const float cosVZACoord, const bool viewRayIntersectsGround, const int texSize)
+{
+    return viewRayIntersectsGround ? 0.5f-0.5f*unitRangeToTexCoord(cosVZACoord, texSize/2)
+                                   : 0.5f+0.5f*unitRangeToTexCoord(cosVZACoord, texSize/2);
+}
+
+/*
+ * The GL renderer interpolates linearly between altitude layers when it uploads the 3D slice for the current altitude,
+ * and then samples this slice with trilinear filtering, as in sample3DTexture(). Here all four dimensions are
+ * interpolated at once, which gives the same result.
+ */
+Taps<16> scatteringTaps(const double cosSunZenithAngle, const double cosViewZenithAngle, const float dotViewSun,
+                        const double altitude, const bool viewRayIntersectsGround, AtmosphereParameters const& params)
+{
+    const auto& size = params.scatteringTextureSize;
+    const auto [cosVZACoord, altCoord] = viewRayTexVarsTo2DCoords(cosViewZenithAngle, altitude,
+                                                                  viewRayIntersectsGround, params);
+    const LinearTap taps1D[4] = {
+        linearTap(cosVZATexCoord(cosVZACoord, viewRayIntersectsGround, size[0]), size[0]),
+        linearTap(unitRangeToTexCoord((dotViewSun+1)/2, size[1]), size[1]),
+        linearTap(unitRangeToTexCoord(cosSZAToUnitRangeTexCoord(cosSunZenithAngle, params), size[2]), size[2]),
+        linearTap(unitRangeToTexCoord(altCoord, size[3]), size[3]),
+    };
+    const size_t strides[4] = {4, 4*size_t(size[0]), 4*size_t(size[0])*size[1], 4*size_t(size[0])*size[1]*size[2]};
+
+    Taps<16> taps;
+    for(int n = 0; n < 16; ++n)
+    {
+        taps.offsets[n] = 0;
+        taps.weights[n] = 1;
+        for(int dim = 0; dim < 4; ++dim)
+        {
+            const bool upper = n>>dim & 1;
+            const auto& tap = taps1D[dim];
+            taps.offsets[n] += strides[dim] * (upper ? tap.index1 : tap.index0);
+            taps.weights[n] *= upper ? tap.alpha1 : 1-tap.alpha1;
+        }
+    }
+    return taps;
+}
+
+// XXX: keep in sync with lightPollutionTexVarsToTexCoords() in texture-coordinates.frag
+Taps<4> lightPollutionTaps(const double cosViewZenithAngle, const double altitude, const bool viewRayIntersectsGround,
+                           AtmosphereParameters const& params)
+{
+    const auto& size = params.lightPollutionTextureSize;
+    const auto [cosVZACoord, altCoord] = viewRayTexVarsTo2DCoords(cosViewZenithAngle, altitude,
+                                                                  viewRayIntersectsGround, params);
+    const auto tapVZA = linearTap(cosVZATexCoord(cosVZACoord, viewRayIntersectsGround, size[0]), size[0]);
+    const auto tapAlt = linearTap(unitRangeToTexCoord(altCoord, size[1]), size[1]);
+    const size_t rowStride = 4*size_t(size[0]);
+
+    Taps<4> taps;
+    taps.offsets[0] = 4*tapVZA.index0 + rowStride*tapAlt.index0;
+    taps.offsets[1] = 4*tapVZA.index1 + rowStride*tapAlt.index0;
+    taps.offsets[2] = 4*tapVZA.index0 + rowStride*tapAlt.index1;
+    taps.offsets[3] = 4*tapVZA.index1 + rowStride*tapAlt.index1;
+    taps.weights[0] = (1-tapVZA.alpha1)*(1-tapAlt.alpha1);
+    taps.weights[1] =    tapVZA.alpha1 *(1-tapAlt.alpha1);
+    taps.weights[2] = (1-tapVZA.alpha1)*   tapAlt.alpha1;
+    taps.weights[3] =    tapVZA.alpha1 *   tapAlt.alpha1;
+    return taps;
+}
+
+}
+
+struct SkyQuery::Model
+{
+    struct SingleScattering
+    {
+        QString scattererName;
+        PhaseFunctionType phaseFunctionType;
+        SpectralTextures textures;
+        PhaseFunction phaseFunction;
+    };
+
+    AtmosphereParameters params;
+    std::vector<glm::mat4> radianceToLuminance; // for each wavelength set
+    SpectralTextures multipleScattering;
+    std::vector<SingleScattering> singleScattering;
+    SpectralTextures lightPollution;
+
+    bool singleScatteringEnabled = true;
+    bool multipleScatteringEnabled = true;
+    float lightPollutionGroundLuminance = 0;
+    unsigned maxThreadCount = 0;
+
+    template<int N, typename Weight>
+    void accumulate(SpectralTextures const& textures, Taps<N> const& taps, Weight const& weight,
+                    glm::vec4& luminance, glm::vec4* radiances) const
+    {
+        if(textures.luminance)
+        {
+            luminance += weight(0) * sample(textures.textures[0].texels, taps);
+            return;
+        }
+        for(unsigned wlSetIndex = 0; wlSetIndex < textures.textures.size(); ++wlSetIndex)
+        {
+            const auto radiance = weight(wlSetIndex) * sample(textures.textures[wlSetIndex].texels, taps);
+            if(radiances)
+                radiances[wlSetIndex] += radiance;
+            luminance += radianceToLuminance[wlSetIndex] * radiance;
+        }
+    }
+
+    glm::vec4 evaluate(Query const& query, glm::vec4* radiances) const;
+
+    template<typename Func>
+    void forEachChunkInParallel(const size_t count, Func const& func) const
+    {
+        constexpr size_t minChunkSize = 1024;
+        const size_t hardwareThreads = maxThreadCount ? maxThreadCount : std::thread::hardware_concurrency();
+        const auto threadCount = std::max(size_t(1), std::min(hardwareThreads, (count+minChunkSize-1)/minChunkSize));
+        if(threadCount == 1)
+        {
+            func(0, count);
+            return;
+        }
+
+        const auto chunkSize = (count+threadCount-1)/threadCount;
+        std::vector<std::thread> threads;
+        for(size_t n = 0; n < threadCount; ++n)
+        {
+            const auto begin = std::min(count, n*chunkSize);
+            const auto end = std::min(count, begin+chunkSize);
+            threads.emplace_back([=,&func]{ func(begin, end); });
+        }
+        for(auto& thread : threads)
+            thread.join();
+    }
+};
+
+// XXX: keep in sync with main() in render.frag
+glm::vec4 SkyQuery::Model::evaluate(Query const& query, glm::vec4*const radiances) const
+{
+    using glm::dvec3;
+    const double R = params.earthRadius;
+    const double H = params.atmosphereHeight;
+    const dvec3 earthCenter(0,0,-R);
+    const dvec3 viewDir(query.viewDir.x(), query.viewDir.y(), query.viewDir.z());
+    const dvec3 sunDir(query.sunDir.x(), query.sunDir.y(), query.sunDir.z());
+
+    // Negative altitudes are clamped to zero, see the comment in render.frag
+    double altitude = std::max(0.f, query.altitude);
+    dvec3 cameraPosition(0,0,altitude);
+    if(altitude > H)
+    {
+        const auto p = cameraPosition - earthCenter;
+        const auto p_dot_v = dot(p, viewDir);
+        const auto squaredDistBetweenViewRayAndEarthCenter = dot(p, p) - sqr(p_dot_v);
+        const auto distanceToTOA = -p_dot_v - std::sqrt(sqr(R+H) - squaredDistBetweenViewRayAndEarthCenter);
+        if(!(distanceToTOA >= 0))
+            return glm::vec4(0);
+        cameraPosition += viewDir*distanceToTOA;
+        altitude = H;
+    }
+
+    const auto zenith = normalize(cameraPosition - earthCenter);
+    const auto cosViewZenithAngle = dot(zenith, viewDir);
+    bool viewRayIntersectsGround = false;
+    {
+        const auto p = cameraPosition - earthCenter;
+        const auto p_dot_v = dot(p, viewDir);
+        const auto squaredDistBetweenViewRayAndEarthCenter = dot(p, p) - sqr(p_dot_v);
+        const auto distanceToIntersection = -p_dot_v - std::sqrt(sqr(R) - squaredDistBetweenViewRayAndEarthCenter);
+        if(distanceToIntersection>0 || (altitude==0 && cosViewZenithAngle<0))
+            viewRayIntersectsGround = true;
+    }
+    const auto cosSunZenithAngle = dot(zenith, sunDir);
+    const float dotViewSun = dot(viewDir, sunDir);
+
+    glm::vec4 luminance(0);
+    const auto one = [](unsigned) { return glm::vec4(1); };
+    if(multipleScatteringEnabled || singleScatteringEnabled)
+    {
+        const auto taps = scatteringTaps(cosSunZenithAngle, cosViewZenithAngle, dotViewSun, altitude,
+                                         viewRayIntersectsGround, params);
+        if(multipleScatteringEnabled)
+            accumulate(multipleScattering, taps, one, luminance, radiances);
+        if(singleScatteringEnabled)
+        {
+            for(const auto& scattering : singleScattering)
+            {
+                if(scattering.phaseFunctionType == PhaseFunctionType::Smooth && scattering.textures.luminance)
+                {
+                    accumulate(scattering.textures, taps, one, luminance, radiances);
+                    continue;
+                }
+                if(!scattering.phaseFunction)
+                    continue;
+                const auto phaseFunction = [&](const unsigned wlSetIndex)
+                {
+                    const auto& wavelengths = params.allWavelengths[wlSetIndex];
+                    const auto value = scattering.phaseFunction(dotViewSun, toQVector(wavelengths));
+                    return glm::vec4(value.x(), value.y(), value.z(), value.w());
+                };
+                accumulate(scattering.textures, taps, phaseFunction, luminance, radiances);
+            }
+        }
+    }
+    if(lightPollutionGroundLuminance && !lightPollution.empty())
+    {
+        const auto taps = lightPollutionTaps(cosViewZenithAngle, altitude, viewRayIntersectsGround, params);
+        const auto groundLuminance = [this](unsigned) { return glm::vec4(lightPollutionGroundLuminance); };
+        accumulate(lightPollution, taps, groundLuminance, luminance, radiances);
+    }
+    return luminance;
+}
+
+SkyQuery::SkyQuery(QString const& pathToData)
+    : model_(std::make_unique<Model>())
+{
+    auto& params = model_->params;
+    params.parse(pathToData + "/params.atmo", AtmosphereParameters::ForceNoEDSTextures{true},
+                 AtmosphereParameters::SkipSpectra{true});
+
+    const auto wlSetCount = params.allWavelengths.size();
+    for(unsigned wlSetIndex = 0; wlSetIndex < wlSetCount; ++wlSetIndex)
+        model_->radianceToLuminance.emplace_back(::radianceToLuminance(wlSetIndex, params.allWavelengths));
+
+    const std::vector<int> scatTexSizes{params.scatteringTextureSize[0], params.scatteringTextureSize[1],
+                                        params.scatteringTextureSize[2], params.scatteringTextureSize[3]};
+    // Same choice of files as in AtmosphereRenderer::loadTextures()
+    const auto loadSpectralTextures = [&](QString const& xyzwPath, QString const& wlSetPathPattern,
+                                          std::vector<int> const& sizes)
+    {
+        SpectralTextures textures;
+        if(QFile::exists(xyzwPath))
+        {
+            textures.luminance = true;
+            textures.textures.emplace_back(mapTexture(xyzwPath, sizes));
+            return textures;
+        }
+        for(unsigned wlSetIndex = 0; wlSetIndex < wlSetCount; ++wlSetIndex)
+            textures.textures.emplace_back(mapTexture(wlSetPathPattern.arg(wlSetIndex), sizes));
+        return textures;
+    };
+
+    model_->multipleScattering = loadSpectralTextures(pathToData+"/multiple-scattering-xyzw.f32",
+                                                      pathToData+"/multiple-scattering-wlset%1.f32", scatTexSizes);
+
+    for(const auto& scatterer : params.scatterers)
+    {
+        auto& scattering = model_->singleScattering.emplace_back();
+        scattering.scattererName = scatterer.name;
+        scattering.phaseFunctionType = scatterer.phaseFunctionType;
+        if(scatterer.phaseFunctionType == PhaseFunctionType::General)
+        {
+            scattering.textures = loadSpectralTextures({}, pathToData+"/single-scattering/%1/"+scatterer.name+".f32",
+                                                       scatTexSizes);
+        }
+        else
+        {
+            scattering.textures = loadSpectralTextures(QString("%1/single-scattering/%2-xyzw.f32")
+                                                            .arg(pathToData).arg(scatterer.name),
+                                                       {}, scatTexSizes);
+        }
+    }
+
+    // Models computed by old versions of calcmysky have no light pollution textures
+    if(QFile::exists(pathToData+"/light-pollution-xyzw.f32") || QFile::exists(pathToData+"/light-pollution-wlset0.f32"))
+    {
+        model_->lightPollution = loadSpectralTextures(pathToData+"/light-pollution-xyzw.f32",
+                                                      pathToData+"/light-pollution-wlset%1.f32",
+                                                      {params.lightPollutionTextureSize[0],
+                                                       params.lightPollutionTextureSize[1]});
+    }
+}
+
+SkyQuery::~SkyQuery() = default;
+
+void SkyQuery::setPhaseFunction(QString const& scattererName, PhaseFunction const& phaseFunction)
+{
+    for(auto& scattering : model_->singleScattering)
+        if(scattering.scattererName == scattererName)
+            scattering.phaseFunction = phaseFunction;
+}
+
+void SkyQuery::setSingleScatteringEnabled(const bool enable)
+{
+    model_->singleScatteringEnabled = enable;
+}
+
+void SkyQuery::setMultipleScatteringEnabled(const bool enable)
+{
+    model_->multipleScatteringEnabled = enable;
+}
+
+void SkyQuery::setLightPollutionGroundLuminance(const float luminance)
+{
+    model_->lightPollutionGroundLuminance = luminance;
+}
+
+void SkyQuery::setMaxThreadCount(const unsigned count)
+{
+    model_->maxThreadCount = count;
+}
+
+bool SkyQuery::canEvaluateRadiance() const
+{
+    return model_->params.allTexturesAreRadiance;
+}
+
+std::vector<float> SkyQuery::wavelengths() const
+{
+    std::vector<float> wavelengths;
+    for(const auto& wlSet : model_->params.allWavelengths)
+        for(unsigned i = 0; i < AtmosphereParameters::pointsPerWavelengthItem; ++i)
+            wavelengths.emplace_back(wlSet[i]);
+    return wavelengths;
+}
+
+void SkyQuery::evaluate(Query const*const queries, const size_t count, Result*const results) const
+{
+    model_->forEachChunkInParallel(count, [&](const size_t begin, const size_t end)
+    {
+        for(size_t n = begin; n < end; ++n)
+            results[n].luminance = toQVector(model_->evaluate(queries[n], nullptr));
+    });
+}
+
+bool SkyQuery::evaluateSpectralRadiance(Query const*const queries, const size_t count, float*const radiances) const
+{
+    if(!canEvaluateRadiance()) return false;
+
+    const auto wlSetCount = model_->params.allWavelengths.size();
+    model_->forEachChunkInParallel(count, [&](const size_t begin, const size_t end)
+    {
+        std::vector<glm::vec4> spectrum(wlSetCount);
+        for(size_t n = begin; n < end; ++n)
+        {
+            std::fill(spectrum.begin(), spectrum.end(), glm::vec4(0));
+            model_->evaluate(queries[n], spectrum.data());
+            std::copy_n(glm::value_ptr(spectrum[0]), 4*wlSetCount, radiances + 4*wlSetCount*n);
+        }
+    });
+    return true;
+}
+
+}
@@ -191,6 +191,20 @@ ToolsWidget::ToolsWidget(QWidget*const parent)
     textureFilteringEnabled_=addCheckBox(layout, this, tr("&Texture filtering"), true);
     onTheFlySingleScatteringEnabled_=addCheckBox(layout, this, tr("Compute single scattering on the &fly"), false);
     onTheFlyPrecompDoubleScatteringEnabled_=addCheckBox(layout, this, tr("Precompute double(-only) scattering on the fly"), true);
+    {
+        // Item index is log2 of the divisor
+        smoothLayersResolution_->addItem(tr("Full"));
+        smoothLayersResolution_->addItem(tr("1/2"));
+        smoothLayersResolution_->addItem(tr("1/4"));
+        connect(smoothLayersResolution_, qOverload<int>(&QComboBox::currentIndexChanged), this, &ToolsWidget::settingChanged);
+        const auto hbox=new QHBoxLayout;
+        const auto label=new QLabel(tr("Multiple scattering && light pollution resolution"));
+        label->setBuddy(smoothLayersResolution_);
+        hbox->addWidget(label);
+        hbox->addWidget(smoothLayersResolution_);
+        smoothLayersResolution_->setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Fixed);
+        layout->addLayout(hbox);
+    }
 
     usingEclipseShader_=addCheckBox(layout, this, tr("Use e&clipse-mode shaders"), false);
     connect(usingEclipseShader_, &QCheckBox::stateChanged, this, [this](const int state)
@@ -202,6 +216,20 @@ ToolsWidget::ToolsWidget(QWidget*const parent)
             });
     triggerStateChanged(usingEclipseShader_);
     pseudoMirrorEnabled_=addCheckBox(layout, this, tr("Pseudo-mirror sky in the ground"), false);
+    {
+        gpuProfilingEnabled_=new QCheckBox(tr("GPU profiling (redraws continuously)"));
+        layout->addWidget(gpuProfilingEnabled_);
+        gpuStageTimes_=new QLabel;
+        gpuStageTimes_->setTextInteractionFlags(Qt::TextSelectableByMouse);
+        gpuStageTimes_->hide();
+        layout->addWidget(gpuStageTimes_);
+        connect(gpuProfilingEnabled_, &QCheckBox::stateChanged, this, [this](const bool enabled)
+                {
+                    gpuStageTimes_->clear();
+                    gpuStageTimes_->setVisible(enabled);
+                    emit gpuProfilingToggled(enabled);
+                });
+    }
 
     {
         const auto button=new QPushButton(tr("&Reload shaders"));
@@ -257,6 +285,20 @@ bool ToolsWidget::handleSpectralRadiance(ShowMySky::AtmosphereRenderer::Spectral
     return true;
 }
 
+void ToolsWidget::showGPUStageTimes(std::vector<ShowMySky::AtmosphereRenderer::StageTime> const& times)
+{
+    QString text;
+    double total=0;
+    for(const auto& stage : times)
+    {
+        text += tr("%1: %2 ms\n").arg(stage.name).arg(stage.milliseconds, 0, 'f', 3);
+        total += stage.milliseconds;
+    }
+    if(!times.empty())
+        text += tr("Total: %1 ms").arg(total, 0, 'f', 3);
+    gpuStageTimes_->setText(text);
+}
+
 void ToolsWidget::setCanGrabRadiance(const bool can)
 {
     showRadiancePlot_->setEnabled(can);
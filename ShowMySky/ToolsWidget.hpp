@@ -6,6 +6,7 @@
 #include <QPushButton>
 #include <QComboBox>
 #include <QCheckBox>
+#include <QLabel>
 #include "Manipulator.hpp"
 #include "RadiancePlot.hpp"
 #include "GLWidget.hpp"
@@ -25,6 +26,7 @@ class ToolsWidget : public QDockWidget, public ShowMySky::Settings
     QComboBox* solarSpectrumMode_=new QComboBox;
     QComboBox* projection_=new QComboBox;
     QComboBox* colorMode_=new QComboBox;
+    QComboBox* smoothLayersResolution_=new QComboBox;
     QDoubleSpinBox* solarSpectrumTemperature_=new QDoubleSpinBox;
     Manipulator* altitude_=nullptr;
     Manipulator* exposure_=nullptr;
@@ -48,6 +50,8 @@ class ToolsWidget : public QDockWidget, public ShowMySky::Settings
     QCheckBox* pseudoMirrorEnabled_=nullptr;
     QCheckBox* gradualClippingEnabled_=nullptr;
     QCheckBox* glareEnabled_=nullptr;
+    QCheckBox* gpuProfilingEnabled_=nullptr;
+    QLabel* gpuStageTimes_=nullptr;
     QPushButton* showRadiancePlot_=nullptr;
     std::unique_ptr<QWidget> radiancePlotWindow_;
     RadiancePlot* radiancePlot_=nullptr;
@@ -73,10 +77,12 @@ public:
     bool singleScatteringEnabled() override { return singleScatteringEnabled_->isChecked(); }
     bool multipleScatteringEnabled() override { return multipleScatteringEnabled_->isChecked(); }
     bool textureFilteringEnabled() override { return textureFilteringEnabled_->isChecked(); }
+    int smoothLayersResolutionDivisor() override { return 1 << smoothLayersResolution_->currentIndex(); }
     bool usingEclipseShader() override { return usingEclipseShader_->isChecked(); }
     bool pseudoMirrorEnabled() override { return pseudoMirrorEnabled_->isChecked(); }
     bool gradualClippingEnabled() const { return gradualClippingEnabled_->isChecked(); }
     bool glareEnabled() const { return glareEnabled_->isChecked(); }
+    bool gpuProfilingEnabled() const { return gpuProfilingEnabled_->isChecked(); }
     float exposure() const { return std::pow(10., exposure_->value()); }
     GLWidget::DitheringMode ditheringMode() const { return static_cast<GLWidget::DitheringMode>(ditheringMode_->currentIndex()); }
     GLWidget::DitheringMethod ditheringMethod() const { return static_cast<GLWidget::DitheringMethod>(ditheringMethod_->currentIndex()); }
@@ -91,6 +97,7 @@ public:
     void setSunZenithAngle(double elevation);
     void updateParameters(AtmosphereParameters const& params);
     void setWindowDecorationEnabled(bool enabled);
+    void showGPUStageTimes(std::vector<ShowMySky::AtmosphereRenderer::StageTime> const& times);
 
 private:
     void showRadiancePlot();
@@ -105,6 +112,7 @@ signals:
     void resetSolarSpectrum();
     void setBlackBodySolarSpectrum(double temperature);
     void windowDecorationToggled(bool enabled);
+    void gpuProfilingToggled(bool enabled);
     void projectionChanged(GLWidget::Projection);
     void colorModeChanged(GLWidget::ColorMode);
 };
@@ -0,0 +1,178 @@
+#include "TraceRecorder.hpp"
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <QOpenGLFunctions_3_3_Core>
+
+namespace
+{
+// Thread ids of the tracks in the trace
+constexpr int cpuTrackId=1, gpuTrackId=2;
+
+QJsonObject trackNameEvent(const int trackId, QString const& name)
+{
+    return QJsonObject{{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", trackId},
+                       {"args", QJsonObject{{"name", name}}}};
+}
+}
+
+TraceRecorder::TraceRecorder(QOpenGLFunctions_3_3_Core& gl)
+    : gl(gl)
+{
+}
+
+QString TraceRecorder::spanName(const char*const name, QString const& detail)
+{
+    return detail.isEmpty() ? QString(name) : QString("%1: %2").arg(name).arg(detail);
+}
+
+double TraceRecorder::microsecondsSinceEpoch(const std::chrono::steady_clock::time_point time) const
+{
+    return std::chrono::duration<double, std::micro>(time-epoch_).count();
+}
+
+void TraceRecorder::setEnabled(const bool enable)
+{
+    if(enable && !enabled_)
+    {
+        events_.clear();
+        // Their results would land before the new epoch, or would be taken for those of new spans
+        for(const auto& span : pendingGPUSpans_)
+        {
+            freeQueries_.push_back(span.beginQuery);
+            freeQueries_.push_back(span.endQuery);
+        }
+        pendingGPUSpans_.clear();
+        epoch_=std::chrono::steady_clock::now();
+        calibrateGPUClock();
+    }
+    enabled_=enable;
+}
+
+void TraceRecorder::calibrateGPUClock()
+{
+    GLint64 gpuNanoseconds=0;
+    gl.glGetInteger64v(GL_TIMESTAMP, &gpuNanoseconds);
+    gpuToCPUMicroseconds_ = microsecondsSinceEpoch(std::chrono::steady_clock::now()) - gpuNanoseconds*1e-3;
+}
+
+GLuint TraceRecorder::newQuery()
+{
+    if(!freeQueries_.empty())
+    {
+        const auto query=freeQueries_.back();
+        freeQueries_.pop_back();
+        return query;
+    }
+    GLuint query=0;
+    gl.glGenQueries(1, &query);
+    allQueries_.push_back(query);
+    return query;
+}
+
+void TraceRecorder::beginSpan(Span& span, QString const& detail, const Timing timing)
+{
+    span.recorder=this;
+    span.detail=detail;
+    if(timing==Timing::CPUAndGPU)
+    {
+        span.gpuBeginQuery=newQuery();
+        gl.glQueryCounter(span.gpuBeginQuery, GL_TIMESTAMP);
+    }
+    span.begin=std::chrono::steady_clock::now();
+}
+
+void TraceRecorder::endSpan(Span& span)
+{
+    const auto end=std::chrono::steady_clock::now();
+    // Recording might have been restarted inside the span, making its beginning precede the epoch
+    if(!enabled_ || span.begin<epoch_)
+    {
+        if(span.gpuBeginQuery)
+            freeQueries_.push_back(span.gpuBeginQuery);
+        return;
+    }
+
+    auto name=spanName(span.name, span.detail);
+    if(span.gpuBeginQuery)
+    {
+        const auto endQuery=newQuery();
+        gl.glQueryCounter(endQuery, GL_TIMESTAMP);
+        pendingGPUSpans_.push_back({name, span.gpuBeginQuery, endQuery, gpuToCPUMicroseconds_});
+    }
+    addEvent({std::move(name), microsecondsSinceEpoch(span.begin), microsecondsSinceEpoch(end)-microsecondsSinceEpoch(span.begin), false});
+}
+
+void TraceRecorder::addEvent(Event&& event)
+{
+    if(events_.size()>=maxEventCount)
+    {
+        if(enabled_)
+            qWarning().nospace() << "Trace has reached " << maxEventCount << " events, stopping recording";
+        enabled_=false;
+        return;
+    }
+    events_.emplace_back(std::move(event));
+}
+
+void TraceRecorder::collectGPUSpans()
+{
+    if(pendingGPUSpans_.empty()) return;
+
+    // Queries complete in the order of submission, so the first unavailable result ends the collection
+    while(!pendingGPUSpans_.empty())
+    {
+        auto& span=pendingGPUSpans_.front();
+        GLuint available=GL_FALSE;
+        gl.glGetQueryObjectuiv(span.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available!=GL_TRUE) break;
+
+        GLuint64 beginNanoseconds=0, endNanoseconds=0;
+        gl.glGetQueryObjectui64v(span.beginQuery, GL_QUERY_RESULT, &beginNanoseconds);
+        gl.glGetQueryObjectui64v(span.endQuery, GL_QUERY_RESULT, &endNanoseconds);
+        freeQueries_.push_back(span.beginQuery);
+        freeQueries_.push_back(span.endQuery);
+        // The span has ended while recording, so it belongs to the trace even if recording has been stopped since
+        addEvent({std::move(span.name), beginNanoseconds*1e-3+span.gpuToCPUMicroseconds,
+                  (endNanoseconds-beginNanoseconds)*1e-3, true});
+        pendingGPUSpans_.pop_front();
+    }
+
+    // The clocks may drift apart, so keep the mapping fresh
+    if(enabled_)
+        calibrateGPUClock();
+}
+
+QByteArray TraceRecorder::toJSON()
+{
+    collectGPUSpans();
+
+    QJsonArray traceEvents;
+    traceEvents.append(QJsonObject{{"name", "process_name"}, {"ph", "M"}, {"pid", 1},
+                                   {"args", QJsonObject{{"name", QCoreApplication::applicationName()}}}});
+    traceEvents.append(trackNameEvent(cpuTrackId, "CPU"));
+    traceEvents.append(trackNameEvent(gpuTrackId, "GPU"));
+    for(const auto& event : events_)
+    {
+        traceEvents.append(QJsonObject{{"name", event.name},
+                                       {"cat", event.onGPU ? "gpu" : "cpu"},
+                                       {"ph", "X"},
+                                       {"ts", event.beginMicroseconds},
+                                       {"dur", event.durationMicroseconds},
+                                       {"pid", 1},
+                                       {"tid", event.onGPU ? gpuTrackId : cpuTrackId}});
+    }
+    return QJsonDocument(QJsonObject{{"traceEvents", traceEvents}, {"displayTimeUnit", "ms"}})
+                .toJson(QJsonDocument::Compact);
+}
+
+void TraceRecorder::clear()
+{
+    if(!allQueries_.empty())
+        gl.glDeleteQueries(allQueries_.size(), allQueries_.data());
+    allQueries_.clear();
+    freeQueries_.clear();
+    pendingGPUSpans_.clear();
+}
@@ -0,0 +1,107 @@
+#ifndef INCLUDE_ONCE_955A454B_0581_4585_9D1E_5D397189D60B
+#define INCLUDE_ONCE_955A454B_0581_4585_9D1E_5D397189D60B
+
+#include <deque>
+#include <chrono>
+#include <vector>
+#include <QString>
+#include <QByteArray>
+#include <qopengl.h>
+
+class QOpenGLFunctions_3_3_Core;
+
+/*
+ * Records spans of CPU work, and optionally of the GPU work issued during them, for viewing in chrome://tracing or
+ * Perfetto. While recording is disabled, a span costs a single check of a flag.
+ *
+ * GPU spans are measured by GL_TIMESTAMP queries, whose results are collected only when they are available, so
+ * recording doesn't stall the pipeline. GPU time is mapped to the CPU timeline by sampling both clocks at each
+ * collection.
+ */
+class TraceRecorder
+{
+public:
+    enum class Timing
+    {
+        CPU,
+        CPUAndGPU,
+    };
+
+    class Span
+    {
+        TraceRecorder* recorder=nullptr;
+        const char* name;
+        QString detail;
+        std::chrono::steady_clock::time_point begin;
+        GLuint gpuBeginQuery=0;
+    public:
+        Span(TraceRecorder& recorder, const char*const name, QString const& detail=QString(), const Timing timing=Timing::CPU)
+            : name(name)
+        {
+            if(recorder.enabled_)
+                recorder.beginSpan(*this, detail, timing);
+        }
+        Span(Span const&)=delete;
+        Span& operator=(Span const&)=delete;
+        ~Span()
+        {
+            if(recorder)
+                recorder->endSpan(*this);
+        }
+
+        friend class TraceRecorder;
+    };
+
+    explicit TraceRecorder(QOpenGLFunctions_3_3_Core& gl);
+    TraceRecorder(TraceRecorder const&)=delete;
+
+    // Enabling starts a new recording, discarding the events recorded previously
+    void setEnabled(bool enable);
+    bool enabled() const { return enabled_; }
+    // Records the span until the returned object is destroyed. The name is "name" or "name: detail".
+    Span span(const char* name, QString const& detail=QString(), Timing timing=Timing::CPU)
+    { return Span(*this, name, detail, timing); }
+    // Moves the GPU spans whose results have become available to the recorded events
+    void collectGPUSpans();
+    // Recorded events in Chrome trace event format. GPU spans whose results aren't available yet are omitted.
+    QByteArray toJSON();
+    // Releases the query objects, dropping pending GPU spans. Must be called with the OpenGL context current, while no
+    // span is open.
+    void clear();
+
+private:
+    struct Event
+    {
+        QString name;
+        double beginMicroseconds;
+        double durationMicroseconds;
+        bool onGPU;
+    };
+    struct PendingGPUSpan
+    {
+        QString name;
+        GLuint beginQuery, endQuery;
+        double gpuToCPUMicroseconds;
+    };
+    // Guards against running out of memory when recording is left enabled for a long time
+    static constexpr size_t maxEventCount=1u<<20;
+
+    QOpenGLFunctions_3_3_Core& gl;
+    std::vector<Event> events_;
+    std::deque<PendingGPUSpan> pendingGPUSpans_;
+    std::vector<GLuint> freeQueries_;
+    std::vector<GLuint> allQueries_;
+    std::chrono::steady_clock::time_point epoch_;
+    double gpuToCPUMicroseconds_=0;
+    bool enabled_=false;
+
+    void beginSpan(Span& span, QString const& detail, Timing timing);
+    void endSpan(Span& span);
+    GLuint newQuery();
+    void calibrateGPUClock();
+    double microsecondsSinceEpoch(std::chrono::steady_clock::time_point time) const;
+    void addEvent(Event&& event);
+    static QString spanName(const char* name, QString const& detail);
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <functional>
 
 #include <QObject>
+#include <QString>
+#include <QByteArray>
 #include <QVector4D>
 #include <qopengl.h>
 
@@ -60,6 +62,58 @@ public:
         float elevation; //!< View elevation angle, in degrees
     };
 
+    /**
+     * \brief Projection of the sky onto spherical harmonics.
+     *
+     * Coefficients are given for the real spherical harmonics \f$Y_l^m\f$ in the order of increasing \f$l\f$, and for each \f$l\f$ in the order of increasing \f$m\f$ from \f$-l\f$ to \f$l\f$. With \f$(x,y,z)\f$ being the unit direction vector in the coordinate system where \f$z\f$ points to the zenith and azimuth \f$\varphi\f$ is measured from \f$x\f$ to \f$y\f$, the first harmonics are \f$Y_0^0=0.282095\f$, \f$Y_1^{-1}=0.488603\,y\f$, \f$Y_1^0=0.488603\,z\f$, \f$Y_1^1=0.488603\,x\f$, and so on, following the usual convention of P.-P. Sloan's "Stupid Spherical Harmonics Tricks", without the Condon-Shortley phase.
+     *
+     * Zero-order scattering (the Sun and the ground) is not included in the projection: the Sun is not representable by low-order harmonics and is expected to be handled as a directional light.
+     */
+    struct SkyProjection
+    {
+        int order=0; //!< Order \f$L\f$ of the harmonics: there are \f$(L+1)^2\f$ coefficients per channel. Zero if no projection is available.
+        std::vector<QVector4D> luminance; //!< Coefficients for luminance, each in the same format as the return value of #getPixelLuminance
+        QVector4D groundIlluminance; //!< Luminance integrated over the upper hemisphere with cosine weight, i.e. illuminance of a horizontal surface facing the zenith
+
+        std::vector<float> wavelengths; //!< Wavelengths in nanometers. Empty if #canGrabRadiance returns \c false.
+        std::vector<float> radiance; //!< Coefficients for spectral radiance in \f$\mathrm{\frac{W}{m^2\,sr\,nm}}\f$, `radiance[coefIndex*wavelengths.size()+wavelengthIndex]`
+        std::vector<float> groundIrradiance; //!< Spectral irradiance of a horizontal surface facing the zenith, in \f$\mathrm{\frac{W}{m^2\,nm}}\f$
+
+        float altitude;       //!< Camera altitude at which the projection was computed, in meters
+        float sunAzimuth;     //!< Azimuth of the Sun at which the projection was computed, in radians
+        float sunZenithAngle; //!< Zenith angle of the Sun at which the projection was computed, in radians
+
+        //! \c true if no projection is available.
+        bool empty() const { return luminance.empty(); }
+    };
+
+    /**
+     * \brief GPU time spent on a stage of rendering.
+     */
+    struct StageTime
+    {
+        QString name;        //!< Name of the stage, e.g. "Single scattering: molecules"
+        double milliseconds; //!< GPU time spent on the stage, in milliseconds
+    };
+
+    /**
+     * \brief GPU memory taken by a category of the renderer's resources.
+     */
+    struct GPUMemoryUsage
+    {
+        QString category;  //!< Name of the category, e.g. "Single scattering" or "Render targets"
+        qint64 bytes=0;    //!< Memory taken by textures, renderbuffers and buffers of the category, in bytes
+        int objectCount=0; //!< Number of OpenGL objects of the category, including framebuffers, which take no memory of their own
+        bool shared=false; //!< Whether the objects are textures taken from another renderer via #setModelResources, so their memory is taken only once for all the renderers using them
+    };
+
+    /**
+     * \brief Textures and shader programs of the atmosphere model, shareable between renderers.
+     *
+     * This is an opaque handle obtained from #getModelResources and passed to #setModelResources.
+     */
+    struct ModelResources;
+
     /**
      * \brief Status of data loading process
      */
@@ -174,6 +228,8 @@ public:
      *
      * This method returns the OpenGL name suitable for use with \c glBindTexture for the render target containing photopic and scotopic luminance values packed into \c vec4 pixels (see #getPixelLuminance for details). This is the main output of #draw that can be used to finally render the data to screen in the desired color space.
      *
+     * The target is a \c GL_TEXTURE_2D, or a \c GL_TEXTURE_2D_ARRAY with a layer per view if more than one view has been set via #setViewCount.
+     *
      * \return OpenGL name of the luminance render target.
      */
     virtual GLuint getLuminanceTexture() = 0;
@@ -246,6 +302,123 @@ public:
      * \return View direction of the pixel specified.
      */
     virtual Direction getViewDirection(QPoint const& pixelPos) = 0;
+    /**
+     * \brief Enable or disable projection of the sky onto spherical harmonics.
+     *
+     * When enabled, #draw additionally renders the whole sphere of view directions at a low resolution, and projects the result onto spherical harmonics on the GPU. The coefficients are read back asynchronously and can be obtained by #getSkyProjection a few frames later, so that #draw never waits for the GPU.
+     *
+     * \param order order of the harmonics, from 1 to 3. Zero disables the projection.
+     */
+    virtual void setSkyProjectionOrder(int order) = 0;
+    /**
+     * \brief Set how often the sky projection is updated.
+     *
+     * A new projection is started by #draw only if at least \p seconds have passed since the previous one was started, and the previous one has been read back.
+     *
+     * \param seconds minimum time between updates of the projection. Zero means updating on each #draw call.
+     */
+    virtual void setSkyProjectionUpdateInterval(double seconds) = 0;
+    /**
+     * \brief Get the latest available projection of the sky onto spherical harmonics.
+     *
+     * See #setSkyProjectionOrder for details.
+     *
+     * \return The latest projection that has been read back from the GPU, or an empty one if none is available yet.
+     */
+    virtual SkyProjection getSkyProjection() = 0;
+    /**
+     * \brief Set the hash of view parameters and enable frame caching.
+     *
+     * Repeated rendering of the same scene can be skipped: after the first call of this method, #draw with \p clear being \c true leaves the render targets as they are if the scene hasn't changed since the previous such call. The scene is considered unchanged if brightness, all values returned by ShowMySky::Settings, the solar spectrum, enabled scatterers, render target size and \p hash are the same.
+     *
+     * The renderer doesn't know the parameters that the application uses in the draw surface callback (e.g. camera orientation or projection), so the application must summarize them in \p hash and call this method each time they change.
+     *
+     * \param hash a value that changes whenever the view directions computed by \c calcViewDir change.
+     */
+    virtual void setViewHash(quint64 hash) = 0;
+    /**
+     * \brief Make the next #draw call render the scene even if it hasn't changed.
+     *
+     * This is needed if something that isn't covered by the view hash passed to #setViewHash has changed.
+     */
+    virtual void invalidateFrame() = 0;
+    /**
+     * \brief Set the number of views rendered by each #draw call.
+     *
+     * This lets stereo and multi-projector applications render all their views in one #draw call. When \p count is greater than 1, the luminance render target becomes an array texture with a layer per view (see #getLuminanceTexture). Each rendering pass then sets up its shader program and textures once, and calls the draw surface callback once per view, with the \c int uniform \c viewIndex of the program set to the index of the view. The view direction shaders should declare this uniform and compute the direction for the view it denotes, e.g. by choosing a matrix from a uniform array.
+     *
+     * Radiance render targets, as well as #getPixelLuminance, #getPixelSpectralRadiance and #getViewDirection, refer to view 0. While there are several views, multiple scattering and light pollution are rendered at full resolution regardless of ShowMySky::Settings::smoothLayersResolutionDivisor.
+     *
+     * \param count number of views, 1 by default.
+     */
+    virtual void setViewCount(int count) = 0;
+    /**
+     * \brief Enable or disable measurement of GPU time of rendering stages.
+     *
+     * When enabled, each stage of #draw (zero-order scattering, single scattering for each scatterer, eclipse precomputations, multiple scattering, light pollution etc.) is wrapped in a \c GL_TIME_ELAPSED query. The results are collected in subsequent frames without waiting for the GPU, see #getGPUStageTimes.
+     *
+     * \param enable whether to measure the times.
+     */
+    virtual void setGPUProfilingEnabled(bool enable) = 0;
+    /**
+     * \brief Get GPU times of rendering stages.
+     *
+     * \return Times of the stages of the latest frame for which the measurements have become available, in the order of execution. Empty if profiling is disabled or no results are available yet.
+     */
+    virtual std::vector<StageTime> getGPUStageTimes() = 0;
+    /**
+     * \brief Start or stop recording a trace of loading and rendering.
+     *
+     * The trace contains CPU spans of data loading steps (loading of shaders and textures) and of rendering stages, as well as GPU spans of the rendering stages. While recording is disabled, its overhead is negligible. Starting a new recording discards the previously recorded trace.
+     *
+     * \param enable whether to record the trace.
+     */
+    virtual void setTraceRecordingEnabled(bool enable) = 0;
+    /**
+     * \brief Get the recorded trace.
+     *
+     * The trace can be viewed in \c chrome://tracing or in Perfetto UI. GPU spans whose timer results haven't become available yet are omitted: the renderer never waits for them.
+     *
+     * \return The trace in JSON-based Chrome trace event format.
+     */
+    virtual QByteArray getRecordedTrace() = 0;
+    /**
+     * \brief Get GPU memory taken by the renderer.
+     *
+     * Every texture, renderbuffer, buffer and framebuffer allocated by the renderer is accounted for. Textures shared with other renderers are reported in separate entries marked as GPUMemoryUsage::shared. The sizes are computed from dimensions and internal formats, so the actual consumption may be somewhat larger due to alignment and driver overhead.
+     *
+     * \return Usage of each category of resources that currently has any objects.
+     */
+    virtual std::vector<GPUMemoryUsage> getGPUMemoryUsage() = 0;
+    /**
+     * \brief Set a soft limit on GPU memory taken by the renderer.
+     *
+     * The budget is checked when textures of the atmosphere model are loaded, including reloading on altitude changes. If a texture doesn't fit, it's loaded in half precision when \p allowReducedPrecision is \c true and this makes it fit. Otherwise loading fails with ShowMySky::Error. Render targets are never refused, but their memory counts towards the budget for subsequent loads, as does the memory of the textures shared with other renderers.
+     *
+     * \param bytes the budget in bytes, zero meaning no limit (the default);
+     * \param allowReducedPrecision whether scattering textures may be loaded in half precision to fit the budget.
+     */
+    virtual void setGPUMemoryBudget(qint64 bytes, bool allowReducedPrecision) = 0;
+    /**
+     * \brief Get the textures and shader programs of the atmosphere model for use by other renderers.
+     *
+     * An application that renders several views (e.g. for multiple projectors) can create a renderer per view, load the data in one of them, and pass the returned handle to #setModelResources of the others, so that the model is loaded, compiled and stored only once. The resources are kept alive as long as any renderer or handle refers to them. They must be released while an OpenGL context that shares objects with the one they were created in is current.
+     *
+     * \return The handle, or \c nullptr if the renderer isn't ready to render.
+     */
+    virtual std::shared_ptr<ModelResources> getModelResources() = 0;
+    /**
+     * \brief Use the model resources loaded by another renderer.
+     *
+     * This method makes the next #initDataLoading take the textures and shader programs from \p resources instead of loading them. The OpenGL context of this renderer must share objects with the one the resources were created in. The resources are only used if they were loaded from the same data directory with the same view direction shaders and attribute locations; otherwise the data are loaded as usual. Then the loading only takes a step to set up the render targets of this renderer.
+     *
+     * Per-view state, i.e. render targets, eclipse precomputation textures and sky projection, stays with each renderer. Scattering textures remain shared until a renderer reloads them for another altitude. GPU memory of the shared textures is reported by each renderer using them as shared, see #getGPUMemoryUsage.
+     *
+     * While the programs are shared, #setViewDirShaders fails with ShowMySky::Error, since it would relink the programs of other renderers. Data loading with the new shaders should be initialized instead.
+     *
+     * \param resources the handle obtained from #getModelResources of another renderer, or \c nullptr to load the data as usual.
+     */
+    virtual void setModelResources(std::shared_ptr<ModelResources> resources) = 0;
 
     virtual ~AtmosphereRenderer() = default;
 
@@ -270,10 +443,20 @@ public:
      *
      * This option doesn't affect transmittance of air, it only controls whether first-order inscattered light from the species specified is included in the render.
      *
+     * Single scattering textures and shader programs of a species are only loaded while it's enabled: the species disabled by ShowMySky::Settings::scattererEnabled at #initDataLoading are loaded by the preparation to draw (see #initPreparationToDraw) after they are enabled, and the data of a species are released after it stays disabled for the time set by #setDisabledScattererUnloadDelay.
+     *
      * \param name name of the species, as given in the `Scatterer` section of the model description file;
      * \param enable whether first-order inscattered light from this species should be rendered.
      */
     virtual void setScattererEnabled(QString const& name, bool enable) = 0;
+    /**
+     * \brief Set how long a disabled single-scattering layer keeps its data loaded.
+     *
+     * Textures and shader programs of a scattering species are released when it has been disabled via #setScattererEnabled for this time, and loaded again when it's enabled. Releasing is done by the preparation to draw (see #initPreparationToDraw).
+     *
+     * \param seconds the delay in seconds, 60 by default. Negative value means that the data are never released.
+     */
+    virtual void setDisabledScattererUnloadDelay(double seconds) = 0;
 };
 
 }
@@ -299,7 +482,7 @@ SHOWMYSKY_DLL_PUBLIC ShowMySky::AtmosphereRenderer*
  *
  * If the value of the symbol doesn't match the value of this constant, the library loaded is incompatible with the header against which the binary was compiled. Mixing incompatible header and library leads to undefined behavior.
  */
-#define ShowMySky_ABI_version 15
+#define ShowMySky_ABI_version 16
 
 /**
  * \brief Name of library to be dlopen()-ed
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <QString>
+
 namespace ShowMySky
 {
 
@@ -106,6 +108,19 @@ public:
      */
     virtual bool onTheFlyPrecompDoubleScatteringEnabled() = 0;
 
+    /**
+     * \brief Resolution divisor for multiple scattering and light pollution.
+     *
+     * This is a performance-quality tradeoff setting.
+     *
+     * Multiple scattering and light pollution change slowly across the view, so they can be rendered at a reduced resolution and then upsampled, saving much of the fill cost at high resolutions. Upsampling doesn't mix the sky with the ground across the horizon. Zero-order and single scattering are always rendered at full resolution.
+     *
+     * Reduced resolution relies on the draw surface callback (see AtmosphereRenderer::setDrawSurfaceCallback) covering the current viewport, without changing the viewport itself.
+     *
+     * \returns How many times the resolution is reduced along each axis: 1 (no reduction), 2 or 4.
+     */
+    virtual int smoothLayersResolutionDivisor() { return 1; }
+
     /**
      * \brief Whether to enable texture filtering.
      *
@@ -131,6 +146,16 @@ public:
      */
     virtual bool pseudoMirrorEnabled() = 0;
 
+    /**
+     * \brief Whether a scattering species is initially enabled.
+     *
+     * This is queried for each species of the model when data loading is initialized (see AtmosphereRenderer::initDataLoading). Single scattering textures and shader programs are only loaded for the species that are enabled; the others are loaded when enabled via AtmosphereRenderer::setScattererEnabled.
+     *
+     * \param name name of the species, as given in the `Scatterer` section of the model description file.
+     * \returns Whether first-order inscattered light from the species is rendered from the start.
+     */
+    virtual bool scattererEnabled([[maybe_unused]] QString const& name) { return true; }
+
     virtual ~Settings() = default;
 };
 
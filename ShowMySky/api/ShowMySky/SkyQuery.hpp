@@ -0,0 +1,142 @@
+#ifndef INCLUDE_ONCE_450FEC13_C271_40A3_886E_9FA949B8D3FF
+#define INCLUDE_ONCE_450FEC13_C271_40A3_886E_9FA949B8D3FF
+
+/** \file ShowMySky/api/ShowMySky/SkyQuery.hpp */
+
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include <QString>
+#include <QVector3D>
+#include <QVector4D>
+
+#include "Exception.hpp"
+
+/** \cond HIDDEN_SYMBOLS */
+#ifdef SHOWMYSKY_COMPILING_QUERY_LIB
+# define SHOWMYSKY_QUERY_DLL_PUBLIC Q_DECL_EXPORT
+#else
+# define SHOWMYSKY_QUERY_DLL_PUBLIC Q_DECL_IMPORT
+#endif
+/** \endcond */
+
+namespace ShowMySky
+{
+
+/**
+ * \brief Evaluator of sky luminance and radiance on the CPU.
+ *
+ * This class samples the textures generated by \c calcmysky utility without the need for an OpenGL context. The
+ * textures are memory-mapped, and the same texture coordinate mappings as in the GLSL code of ::AtmosphereRenderer are
+ * used, so the results match what #AtmosphereRenderer::getPixelLuminance returns for the same scene, up to the
+ * precision of GPU texture filtering.
+ *
+ * Only multiple scattering, single scattering and light pollution are evaluated: zero-order scattering (the Sun and
+ * the ground) and eclipsed atmosphere are outside of the scope of this class. Single scattering is sampled without
+ * interpolation guides.
+ *
+ * All the \c const methods are thread-safe.
+ */
+class SHOWMYSKY_QUERY_DLL_PUBLIC SkyQuery
+{
+public:
+    /**
+     * \brief Parameters of a single query.
+     *
+     * The coordinate system is the same as that of ::AtmosphereRenderer: the \f$z\f$ axis points to the zenith of the
+     * observer.
+     */
+    struct Query
+    {
+        float altitude;    //!< Altitude of the observer, in meters
+        QVector3D viewDir; //!< View direction, a unit vector
+        QVector3D sunDir;  //!< Direction to the Sun, a unit vector
+    };
+    /**
+     * \brief Result of a single query.
+     */
+    struct Result
+    {
+        QVector4D luminance; //!< CIE 1931 tristimulus values and scotopic luminance, as in #AtmosphereRenderer::getPixelLuminance
+    };
+    /**
+     * \brief Phase function of a scatterer.
+     *
+     * The function receives cosine of the scattering angle and the four wavelengths (in nanometers) for which it should
+     * return the values. For achromatic phase functions the wavelengths are those of the first wavelength set, and all
+     * four components of the result are expected to be equal.
+     *
+     * The function is called concurrently from several threads.
+     */
+    using PhaseFunction = std::function<QVector4D(float dotViewSun, QVector4D const& wavelengths)>;
+
+    /**
+     * \brief Load the atmosphere model.
+     *
+     * \param pathToData path to the directory with the output of \c calcmysky utility.
+     * \throws ShowMySky::Error if the model can't be loaded.
+     */
+    explicit SkyQuery(QString const& pathToData);
+    ~SkyQuery();
+
+    /**
+     * \brief Set the phase function of a scatterer.
+     *
+     * Phase functions in the model description are GLSL code, which can't be evaluated here. Single scattering by
+     * scatterers whose phase function isn't embedded in the textures (i.e. those with \c general or \c achromatic phase
+     * function type) is included in the results only after their phase function has been set by this method.
+     *
+     * \param scattererName name of the species, as given in the `Scatterer` section of the model description file;
+     * \param phaseFunction the phase function, or an empty function to exclude the scatterer.
+     */
+    void setPhaseFunction(QString const& scattererName, PhaseFunction const& phaseFunction);
+    //! \brief Enable or disable single scattering in the results.
+    void setSingleScatteringEnabled(bool enable);
+    //! \brief Enable or disable multiple scattering in the results.
+    void setMultipleScatteringEnabled(bool enable);
+    //! \brief Set luminance of the ground that scatters light pollution, in \f$\mathrm{cd/m^2}\f$. Zero by default.
+    void setLightPollutionGroundLuminance(float luminance);
+    //! \brief Set maximum number of threads that #evaluate may use. Zero means the number of hardware threads.
+    void setMaxThreadCount(unsigned count);
+
+    /**
+     * \brief Whether the model contains spectral radiance.
+     *
+     * \returns \c true if the model was computed with \c --radiance option of \c calcmysky, so that
+     *          #evaluateSpectralRadiance can be used.
+     */
+    bool canEvaluateRadiance() const;
+    /**
+     * \brief Get the wavelengths used in computations.
+     * \returns All the wavelengths used in computations, in nanometers.
+     */
+    std::vector<float> wavelengths() const;
+
+    /**
+     * \brief Evaluate luminance for a batch of queries.
+     *
+     * \param queries array of \p count queries;
+     * \param count number of queries;
+     * \param results array of \p count results to fill.
+     */
+    void evaluate(Query const* queries, size_t count, Result* results) const;
+    /**
+     * \brief Evaluate spectral radiance for a batch of queries.
+     *
+     * \param queries array of \p count queries;
+     * \param count number of queries;
+     * \param radiances array of \p count times `wavelengths().size()` spectral radiances in
+     *                  \f$\mathrm{\frac{W}{m^2\,sr\,nm}}\f$ to fill, the spectrum of each query being contiguous.
+     * \returns \c false without writing anything if #canEvaluateRadiance returns \c false.
+     */
+    bool evaluateSpectralRadiance(Query const* queries, size_t count, float* radiances) const;
+
+private:
+    struct Model;
+    std::unique_ptr<Model> model_;
+};
+
+}
+
+#endif
@@ -22,6 +22,10 @@ QString pathToData;
 QSize windowSize;
 bool detachedTools=false;
 bool frameless=false;
+bool checkSkyQuery=false;
+QString traceFilePath;
+qint64 gpuMemoryBudget=0;
+bool benchmarkViews=false;
 void handleCmdLine()
 {
     QCommandLineParser parser;
@@ -34,6 +38,14 @@ void handleCmdLine()
     parser.addOption(detachedToolsOpt);
     QCommandLineOption framelessOpt("frameless", "Make main window frameless and hide status bar");
     parser.addOption(framelessOpt);
+    QCommandLineOption checkSkyQueryOpt("check-sky-query", "On clicks on the sky, compare luminance evaluated on the CPU by SkyQuery with that rendered on the GPU");
+    parser.addOption(checkSkyQueryOpt);
+    QCommandLineOption traceOpt("trace", "Record a trace of loading and rendering, and save it in Chrome trace event format on exit", "FILE");
+    parser.addOption(traceOpt);
+    QCommandLineOption gpuMemoryBudgetOpt("gpu-memory-budget", "Limit GPU memory taken by the renderer, reducing precision of textures if needed", "MiB");
+    parser.addOption(gpuMemoryBudgetOpt);
+    QCommandLineOption benchmarkViewsOpt("benchmark-views", "After loading, print the time of rendering 1, 2, 4 and 6 views in one draw call");
+    parser.addOption(benchmarkViewsOpt);
 
     parser.process(*qApp);
 
@@ -64,6 +76,25 @@ void handleCmdLine()
     if(parser.isSet(framelessOpt))
         frameless=true;
 
+    if(parser.isSet(checkSkyQueryOpt))
+        checkSkyQuery=true;
+
+    if(parser.isSet(traceOpt))
+        traceFilePath=parser.value(traceOpt);
+
+    if(parser.isSet(benchmarkViewsOpt))
+        benchmarkViews=true;
+
+    if(parser.isSet(gpuMemoryBudgetOpt))
+    {
+        const auto value=parser.value(gpuMemoryBudgetOpt);
+        bool ok=false;
+        const auto mebibytes=value.toUInt(&ok);
+        if(!ok || mebibytes==0)
+            throw BadCommandLine{QObject::tr("Can't parse GPU memory budget \"%1\"").arg(value)};
+        gpuMemoryBudget=qint64(mebibytes)<<20;
+    }
+
     if(posArgs.isEmpty())
     {
         while(true)
@@ -125,6 +156,14 @@ int main(int argc, char** argv)
 
         const auto tools=new ToolsWidget;
         const auto glWidget=new GLWidget(pathToData, tools);
+        if(checkSkyQuery)
+            glWidget->enableSkyQueryCheck();
+        if(!traceFilePath.isEmpty())
+            glWidget->enableTraceRecording(traceFilePath);
+        if(gpuMemoryBudget)
+            glWidget->setGPUMemoryBudget(gpuMemoryBudget);
+        if(benchmarkViews)
+            glWidget->enableViewsBenchmark();
         const auto mainWin=new MainWindow(pathToData, tools);
 
         mainWin->setAttribute(Qt::WA_DeleteOnClose);
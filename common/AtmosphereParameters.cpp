@@ -170,6 +170,21 @@ QString readGLSLFunctionBody(QTextStream& stream, const QString filename, int& l
     return function;
 }
 
+// Maps the file into memory to let the parser work without copying the data, falls back to reading if mapping fails
+Spectrum parseSpectrumFile(QFile& file, QString const& path)
+{
+    if(const auto size=file.size(); size>0)
+    {
+        if(const auto data=file.map(0, size))
+        {
+            auto spectrum=Spectrum::parseFromCSV(reinterpret_cast<const char*>(data), size, path, 1);
+            file.unmap(data);
+            return spectrum;
+        }
+    }
+    return Spectrum::parseFromCSV(file.readAll(), path, 1);
+}
+
 void getSpectrum(std::vector<glm::vec4> const& allWavelengths, QString const& line, const GLfloat min, const GLfloat max,
                  QString const& filename, const int lineNumber, std::vector<glm::vec4>& output)
 {
@@ -186,7 +201,7 @@ void getSpectrum(std::vector<glm::vec4> const& allWavelengths, QString const& li
         QFile file(path);
         if(!file.open(QFile::ReadOnly))
             throw ParsingError{filename,lineNumber,QString("failed to open the file \"%1\": %2").arg(path).arg(file.errorString())};
-        const auto spectrum=Spectrum::parseFromCSV(file.readAll(),path,1)
+        const auto spectrum=parseSpectrumFile(file,path)
                                             .resample(allWavelengths.front()[0],
                                                       allWavelengths.back()[AtmosphereParameters::pointsPerWavelengthItem-1],
                                                       allWavelengths.size()*AtmosphereParameters::pointsPerWavelengthItem);
@@ -213,7 +228,7 @@ void getSpectrum(std::vector<glm::vec4> const& allWavelengths, QString const& li
         QFile file(path);
         if(!file.open(QFile::ReadOnly))
             throw ParsingError{filename,lineNumber,QString("failed to open the file \"%1\": %2").arg(path).arg(file.errorString())};
-        const auto spectrum=Spectrum::parseFromCSV(file.readAll(),path,1)
+        const auto spectrum=parseSpectrumFile(file,path)
                                             .resample(allWavelengths.front()[0],
                                                       allWavelengths.back()[AtmosphereParameters::pointsPerWavelengthItem-1],
                                                       allWavelengths.size()*AtmosphereParameters::pointsPerWavelengthItem);
@@ -1,62 +1,37 @@
 #include "Spectrum.hpp"
 #include <cassert>
+#include <algorithm>
+#include <charconv>
+#include <string_view>
 
 namespace
 {
 
-int posOfLargestWavelengthLessThan(const double targetWL, Spectrum const& spectrum)
+// Value of the linear interpolant on the segment [wavelengths[seg], wavelengths[seg+1]] at wavelength wl
+double interpolateInSegment(Spectrum const& spectrum, const std::size_t seg, const double wl)
 {
-    for(int pos=0; pos<int(spectrum.size()); ++pos)
-        if(spectrum.wavelengths[pos] >= targetWL)
-            return pos-1; // if first is already larger than targetWL, return -1
-    return spectrum.size()-1;
-}
-
-int posOfSmallestWavelengthGreaterThan(const double targetWL, Spectrum const& spectrum)
-{
-    for(int pos=0; pos<int(spectrum.size()); ++pos)
-        if(spectrum.wavelengths[pos] >= targetWL)
-            return pos;
-    return spectrum.size(); // if all are smaller than targetWL, return one past the last
+    const auto smallerWL=spectrum.wavelengths[seg];
+    const auto largerWL =spectrum.wavelengths[seg+1];
+    const auto alpha=(wl-smallerWL)/(largerWL-smallerWL);
+    return spectrum.values[seg]*(1-alpha)+spectrum.values[seg+1]*alpha;
 }
 
-double trapezoidArea(Spectrum const& spectrum, const int posLeft, const int posRight)
+// Integral of the linear interpolant over [wlLeft, wlRight], both lying in the segment seg
+double partialTrapezoidArea(Spectrum const& spectrum, const std::size_t seg, const double wlLeft, const double wlRight)
 {
-    const auto valueAtIntervalCenter = 0.5*(spectrum.values[posLeft]+spectrum.values[posRight]);
-    const auto dlambda = spectrum.wavelengths[posRight]-spectrum.wavelengths[posLeft];
-    return valueAtIntervalCenter*dlambda;
-}
-
-double integrate(Spectrum const& spectrum, const double minWL, const double maxWL)
-{
-    const auto leftPos=std::min(int(spectrum.size()-1), posOfSmallestWavelengthGreaterThan(minWL, spectrum));
-    const auto rightPos=std::max(0, posOfLargestWavelengthLessThan(maxWL, spectrum));
-
-    double integral=0;
-
-    if(leftPos<=rightPos)
-    {
-        // Use trapezoidal rule to integrate between internal sampling points in [centerWL-wlStep/2, centerWL+wlStep/2]
-        for(auto i=leftPos; i<rightPos; ++i)
-            integral += trapezoidArea(spectrum, i, i+1);
-
-        // Add the parts between the interval borders and closest internal sampling points on the left...
-        if(spectrum.wavelengths[leftPos]-minWL != 0)
-            integral += 0.5*(spectrum.value(minWL)+spectrum.values[leftPos])*(spectrum.wavelengths[leftPos]-minWL);
-        // ... and on the right
-        if(maxWL-spectrum.wavelengths[rightPos] != 0)
-            integral += 0.5*(spectrum.value(maxWL)+spectrum.values[rightPos])*(maxWL-spectrum.wavelengths[rightPos]);
-    }
-    else // this is the case when there's no sampling point between minWL and maxWL
-    {
-        integral = 0.5*(spectrum.value(maxWL)+spectrum.value(minWL))*(maxWL-minWL);
-    }
-
-    return integral;
+    if(wlRight-wlLeft == 0) return 0;
+    const auto valueLeft  = wlLeft ==spectrum.wavelengths[seg  ] ? spectrum.values[seg  ] : interpolateInSegment(spectrum, seg, wlLeft);
+    const auto valueRight = wlRight==spectrum.wavelengths[seg+1] ? spectrum.values[seg+1] : interpolateInSegment(spectrum, seg, wlRight);
+    return 0.5*(valueLeft+valueRight)*(wlRight-wlLeft);
 }
 
 }
 
+/*
+ * The output bins are consecutive and sorted, so instead of searching the input for each bin anew, we sweep
+ * through the input segments once, keeping the segment where the current bin starts as the cursor. This makes
+ * resampling O(n+m) instead of O(n*m), which matters for measured spectra with tens of thousands of points.
+ */
 Spectrum Spectrum::resample(const double wlMin, const double wlMax, const int pointCount) const
 {
     assert(!empty());
@@ -66,48 +41,124 @@ Spectrum Spectrum::resample(const double wlMin, const double wlMax, const int po
                                       " Input range: [%1, %2]; output range: [%3, %4].")
                                 .arg(wavelengths.front()).arg(wavelengths.back()).arg(wlMin).arg(wlMax)};
     }
+    if(size() < 2)
+        throw ResamplingError{QString("Input spectrum must have at least two points to be resampled, but it has %1.").arg(size())};
+
+    const auto lastSegment=size()-2;
     const double wlStep=(wlMax-wlMin)/(pointCount-1);
     Spectrum output;
+    output.wavelengths.reserve(pointCount);
+    output.values.reserve(pointCount);
+    std::size_t firstSegmentOfBin=0;
     for(int p=0; p<pointCount; ++p)
     {
         const auto centerWL = wlMin+wlStep*p;
         const auto leftWL = std::max(minWL(), centerWL-wlStep/2);
         const auto rightWL = std::min(maxWL(), centerWL+wlStep/2);
-        const auto integral = integrate(*this, leftWL, rightWL);
+
+        while(firstSegmentOfBin<lastSegment && wavelengths[firstSegmentOfBin+1] <= leftWL)
+            ++firstSegmentOfBin;
+
+        double integral=0;
+        auto wl=leftWL;
+        for(auto seg=firstSegmentOfBin; ; ++seg)
+        {
+            const auto segmentEnd=wavelengths[seg+1];
+            if(rightWL <= segmentEnd || seg==lastSegment)
+            {
+                integral += partialTrapezoidArea(*this, seg, wl, rightWL);
+                break;
+            }
+            integral += partialTrapezoidArea(*this, seg, wl, segmentEnd);
+            wl=segmentEnd;
+        }
         output.append(centerWL, integral/(rightWL-leftWL));
     }
     return output;
 }
 
-Spectrum Spectrum::parseFromCSV(QByteArray const& data, QString const& filename, int lineNumber)
+namespace
+{
+
+bool isSpace(const char c)
+{
+    // Same set as QByteArray::trimmed() uses
+    return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+}
+
+std::string_view trimmed(std::string_view str)
 {
-    std::vector<double> wavelengths, values;
-    auto lines=data.split('\n');
-    if(!lines.isEmpty() && lines.back()=="")
-        lines.pop_back();
-    for(int i=0; i<lines.size(); ++i, ++lineNumber)
+    while(!str.empty() && isSpace(str.front())) str.remove_prefix(1);
+    while(!str.empty() && isSpace(str.back())) str.remove_suffix(1);
+    return str;
+}
+
+QString toQString(const std::string_view str)
+{
+    return QString::fromUtf8(str.data(), int(str.size()));
+}
+
+bool parseDouble(std::string_view str, double& value)
+{
+    str=trimmed(str);
+    // QByteArray::toDouble, which was used previously, accepts explicit plus sign, std::from_chars doesn't
+    if(str.size()>1 && str.front()=='+' && str[1]!='-' && str[1]!='+')
+        str.remove_prefix(1);
+    if(str.empty()) return false;
+#ifdef __cpp_lib_to_chars
+    const auto end=str.data()+str.size();
+    const auto [ptr, ec]=std::from_chars(str.data(), end, value);
+    return ec==std::errc{} && ptr==end;
+#else
+    // No floating-point std::from_chars in this standard library, use locale-independent Qt conversion
+    bool ok=false;
+    value=QByteArray::fromRawData(str.data(), int(str.size())).toDouble(&ok);
+    return ok;
+#endif
+}
+
+}
+
+/*
+ * The data are scanned in place: lines and fields are represented by views into the input buffer, and
+ * numbers are converted without intermediate allocations. This lets the data come from a memory-mapped file.
+ */
+Spectrum Spectrum::parseFromCSV(const char*const data, const std::size_t size, QString const& filename, int lineNumber)
+{
+    Spectrum spectrum;
+    const std::string_view input(data, size);
+    for(std::size_t lineStart=0; lineStart<input.size(); ++lineNumber)
     {
-        const auto trimmed = lines[i].trimmed();
-        if(trimmed.isEmpty() || trimmed.startsWith('#'))
+        auto lineEnd=input.find('\n', lineStart);
+        if(lineEnd==input.npos) lineEnd=input.size();
+        const auto line=input.substr(lineStart, lineEnd-lineStart);
+        lineStart=lineEnd+1;
+
+        const auto trimmedLine = trimmed(line);
+        if(trimmedLine.empty() || trimmedLine.front()=='#')
             continue;
-        const auto keyval=lines[i].split(',');
-        if(keyval.size()!=2)
-            throw ParsingError{filename,lineNumber,QString("bad spectrum line: expected \"key,value\" pair, got \"%1\"").arg(lines[i].constData())};
-        bool okWL=false, okVal=false;
-        const auto wavelength=keyval[0].trimmed().toDouble(&okWL);
-        const auto value=keyval[1].trimmed().toDouble(&okVal);
-        if(!okWL)
-            throw ParsingError{filename,lineNumber,"failed to parse wavelength string \""+keyval[0]+"\""};
-        if(!okVal)
-            throw ParsingError{filename,lineNumber,"failed to parse spectrum value string \""+keyval[1]+"\""};
-        if(!(wavelengths.empty() || wavelengths.back() < wavelength))
+        const auto commaPos=line.find(',');
+        if(commaPos==line.npos || line.find(',', commaPos+1)!=line.npos)
+            throw ParsingError{filename,lineNumber,QString("bad spectrum line: expected \"key,value\" pair, got \"%1\"").arg(toQString(line))};
+        const auto wlStr=line.substr(0, commaPos);
+        const auto valStr=line.substr(commaPos+1);
+        double wavelength, value;
+        if(!parseDouble(wlStr, wavelength))
+            throw ParsingError{filename,lineNumber,"failed to parse wavelength string \""+toQString(wlStr)+"\""};
+        if(!parseDouble(valStr, value))
+            throw ParsingError{filename,lineNumber,"failed to parse spectrum value string \""+toQString(valStr)+"\""};
+        if(!(spectrum.wavelengths.empty() || spectrum.wavelengths.back() < wavelength))
             throw ParsingError{filename,lineNumber,"wavelengths don't grow monotonically as they should"};
-        wavelengths.push_back(wavelength);
-        values.push_back(value);
+        spectrum.append(wavelength, value);
     }
-    if(values.empty())
+    if(spectrum.values.empty())
         throw ParsingError{filename,lineNumber,"Read empty spectrum"};
-    return {std::move(wavelengths), std::move(values)};
+    return spectrum;
+}
+
+Spectrum Spectrum::parseFromCSV(QByteArray const& data, QString const& filename, const int firstLineNum)
+{
+    return parseFromCSV(data.constData(), data.size(), filename, firstLineNum);
 }
 
 void Spectrum::append(const double wl, const double v)
@@ -120,13 +171,40 @@ double Spectrum::value(const double wl) const
 {
     if(size()<2 || wl<wavelengths.front() || wl>wavelengths.back())
         throw std::out_of_range("Spectrum::value");
-    unsigned pos;
-    for(pos=0; pos<size(); ++pos)
-        if(wavelengths[pos]>=wl)
-            break;
-    // pos now points to the first wavelength that's greater than the desired one
-    const auto smallerWL=wavelengths[pos-1];
-    const auto largerWL =wavelengths[pos];
-    const auto alpha=(wl-smallerWL)/(largerWL-smallerWL);
-    return values[pos-1]*(1-alpha)+values[pos]*alpha;
+    // Find the first wavelength that's not less than the desired one
+    const std::size_t pos=std::lower_bound(wavelengths.begin(), wavelengths.end(), wl)-wavelengths.begin();
+    if(pos==0) return values.front();
+    return interpolateInSegment(*this, pos-1, wl);
+}
+
+std::vector<double> Spectrum::valuesAt(double const*const wls, const std::size_t n) const
+{
+    std::vector<double> output(n);
+    if(n==0) return output;
+    if(size()<2)
+        throw std::out_of_range("Spectrum::valuesAt");
+
+    // Sorted queries (the usual case) are served by a single forward sweep. A query smaller than the previous one restarts the sweep.
+    std::size_t seg=0;
+    for(std::size_t i=0; i<n; ++i)
+    {
+        const auto wl=wls[i];
+        if(wl<wavelengths.front() || wl>wavelengths.back())
+            throw std::out_of_range("Spectrum::valuesAt");
+        if(i>0 && wl<wls[i-1])
+            seg=0;
+        // Advance a few segments linearly, then fall back to binary search if the query jumped far ahead
+        constexpr std::size_t maxLinearSteps=8;
+        for(std::size_t steps=0; seg+2<size() && wavelengths[seg+1]<wl; ++steps)
+        {
+            if(steps==maxLinearSteps)
+            {
+                seg=std::lower_bound(wavelengths.begin()+seg+1, wavelengths.end(), wl)-wavelengths.begin()-1;
+                break;
+            }
+            ++seg;
+        }
+        output[i]=wl==wavelengths[seg] ? values[seg] : interpolateInSegment(*this, seg, wl);
+    }
+    return output;
 }
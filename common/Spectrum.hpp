@@ -28,8 +28,12 @@ public:
     auto size() const { return wavelengths.size(); }
     void append(const double wl, const double v);
     double value(const double wl) const;
+    //! Interpolated values at n wavelengths; sorted input is handled in a single sweep over the spectrum
+    std::vector<double> valuesAt(double const* wls, std::size_t n) const;
     Spectrum resample(const double wlMin, const double wlMax, const int pointCount) const;
     static Spectrum parseFromCSV(QByteArray const& data, QString const& filename, int firstLineNum);
+    //! Parses the data in place, without copying, so that it can be e.g. a memory-mapped file
+    static Spectrum parseFromCSV(const char* data, std::size_t size, QString const& filename, int firstLineNum);
 };
 
 #endif
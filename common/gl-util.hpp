@@ -0,0 +1,15 @@
+#ifndef INCLUDE_ONCE_E20E4012_7D54_428E_B2AC_EC1DB48F5DC6
+#define INCLUDE_ONCE_E20E4012_7D54_428E_B2AC_EC1DB48F5DC6
+
+#include <string>
+#include <QOpenGLFunctions_3_3_Core>
+#include "util.hpp"
+
+void checkFramebufferStatus(QOpenGLFunctions_3_3_Core& gl, const char* fboDescription);
+
+// Function useful only for debugging
+void dumpActiveUniforms(QOpenGLFunctions_3_3_Core& gl, GLuint program);
+
+std::string openglErrorString(GLenum error);
+
+#endif
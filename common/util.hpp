@@ -1,13 +1,18 @@
 #ifndef INCLUDE_ONCE_E28E88C6_7992_4205_828C_8E04CC339B83
 #define INCLUDE_ONCE_E28E88C6_7992_4205_828C_8E04CC339B83
 
+#include <vector>
+#include <string>
 #include <iostream>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <QString>
 #include <QVector3D>
 #include <QVector4D>
 #include <QGenericMatrix>
-#include <QOpenGLFunctions_3_3_Core>
+#ifdef Q_OS_WIN
+# include <qt_windows.h>
+#endif
 #include "../ShowMySky/api/ShowMySky/Exception.hpp"
 
 #define DEFINE_EXPLICIT_BOOL(Type)          \
@@ -82,13 +87,6 @@ inline std::ostream& operator<<(std::ostream& os, QString const& s)
     return os;
 }
 
-void checkFramebufferStatus(QOpenGLFunctions_3_3_Core& gl, const char* fboDescription);
-
-// Function useful only for debugging
-void dumpActiveUniforms(QOpenGLFunctions_3_3_Core& gl, GLuint program);
-
-std::string openglErrorString(GLenum error);
-
 class UTF8Console
 {
 #ifdef Q_OS_WIN
@@ -134,7 +132,7 @@ Number clampCosine(const Number x)
 glm::mat4 radianceToLuminance(unsigned texIndex, std::vector<glm::vec4> const& allWavelengths);
 
 // Rounds each float to \p precision bits.
-void roundTexData(GLfloat* data, size_t size, int precision);
+void roundTexData(float* data, size_t size, int precision);
 
 inline int roundDownToClosestPowerOfTwo(const int x)
 {
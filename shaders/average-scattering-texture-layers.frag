@@ -0,0 +1,25 @@
+#version 330
+#include "version.h.glsl"
+#include "phase-functions.h.glsl"
+#include "texture-coordinates.h.glsl"
+uniform sampler3D tex;
+// Single scattering textures are stored without the phase function
+uniform bool applyPhaseFunction;
+out vec4 average;
+
+void main()
+{
+    CONST int depth=textureSize(tex,0).z;
+    vec4 sum=vec4(0);
+    for(int layer=0; layer<depth; ++layer)
+    {
+        vec4 texel=texelFetch(tex, ivec3(gl_FragCoord.xy, layer), 0);
+        if(applyPhaseFunction)
+        {
+            CONST ScatteringTexVars vars=scatteringTexIndicesToTexVars(vec3(gl_FragCoord.xy-vec2(0.5),layer));
+            texel *= currentPhaseFunction(vars.dotViewSun);
+        }
+        sum+=texel;
+    }
+    average=sum/depth;
+}
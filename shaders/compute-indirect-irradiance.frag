@@ -6,6 +6,8 @@
 #include "texture-coordinates.h.glsl"
 
 in vec3 position;
+// Order of scattering being computed; the irradiance comes from the radiance of the previous order
+uniform int scatteringOrder;
 layout(location=0) out vec4 deltaIrradianceOutput;
 layout(location=1) out vec4 irradianceOutput;
 
@@ -33,7 +35,7 @@ void main()
 {
     CONST vec2 texCoord=0.5*position.xy+vec2(0.5);
     CONST IrradianceTexVars vars=irradianceTexCoordToTexVars(texCoord);
-    CONST vec4 color=computeIndirectGroundIrradiance(vars.cosSunZenithAngle, vars.altitude, SCATTERING_ORDER);
+    CONST vec4 color=computeIndirectGroundIrradiance(vars.cosSunZenithAngle, vars.altitude, scatteringOrder-1);
     deltaIrradianceOutput=color;
     irradianceOutput=color;
 }
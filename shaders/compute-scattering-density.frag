@@ -5,13 +5,14 @@
 #include "texture-coordinates.h.glsl"
 #include "common-functions.h.glsl"
 
-uniform int layer;
+flat in int layer;
+uniform int scatteringOrder;
 layout(location=0) out vec4 scatteringDensity;
 
 void main()
 {
     CONST ScatteringTexVars vars=scatteringTexIndicesToTexVars(vec3(gl_FragCoord.xy-vec2(0.5),layer));
     scatteringDensity=computeScatteringDensity(vars.cosSunZenithAngle,vars.cosViewZenithAngle,vars.dotViewSun,
-                                               vars.altitude,SCATTERING_ORDER,RADIATION_IS_FROM_GROUND_ONLY);
+                                               vars.altitude,scatteringOrder,RADIATION_IS_FROM_GROUND_ONLY);
     if(debugDataPresent()) scatteringDensity=debugData();
 }
@@ -1,6 +1,5 @@
 #version 330
 #include "version.h.glsl"
-uniform int layer;
 uniform sampler2D tex;
 out vec4 copy;
 
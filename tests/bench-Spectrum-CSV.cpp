@@ -0,0 +1,33 @@
+#include "../common/Spectrum.hpp"
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <iostream>
+
+int main()
+try
+{
+    constexpr int pointCount=1'000'000;
+    std::string csv="# Synthetic spectrum for parse throughput measurement\n";
+    for(int i=0; i<pointCount; ++i)
+        csv += std::to_string(200+0.001*i)+","+std::to_string(0.5+0.25*std::sin(0.01*i))+"\n";
+
+    const auto t0=std::chrono::steady_clock::now();
+    const auto spectrum=Spectrum::parseFromCSV(csv.data(), csv.size(), "benchmark.csv", 1);
+    const auto t1=std::chrono::steady_clock::now();
+
+    if(spectrum.size()!=pointCount)
+    {
+        std::cerr << "Parsed " << spectrum.size() << " points instead of " << pointCount << "\n";
+        return 1;
+    }
+    const auto seconds=std::chrono::duration<double>(t1-t0).count();
+    std::cerr << "Parsed " << pointCount << " points (" << csv.size()/1e6 << " MB) in " << seconds*1e3 << " ms: "
+              << csv.size()/1e6/seconds << " MB/s, " << pointCount/seconds/1e6 << " Mpoints/s\n";
+    return 0;
+}
+catch(ShowMySky::Error const& ex)
+{
+    std::cerr << ex.errorType().toStdString() << ": " << ex.what().toStdString() << "\n";
+    return 1;
+}
@@ -0,0 +1,227 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <QFile>
+#include <QTemporaryDir>
+#include "../ShowMySky/api/ShowMySky/SkyQuery.hpp"
+
+constexpr float indexTolerance=1e-4;
+#define FAIL(details) { std::cerr << __FILE__ << ":" << __LINE__  << ": test failed: " << details << "\n"; return 1; }
+
+/*
+ * The synthetic model stores texel indices in the texels: texel (i0,i1,i2,i3) of the scattering texture is
+ * (i0,i1,i2,i3), and texel (i0,i1) of the light pollution texture is (i0,i1,1,0). Quadrilinear interpolation of such
+ * data is exact, so the luminance returned by SkyQuery is the fractional texel position it has sampled.
+ */
+constexpr int scatTexSize[4]={8,6,5,4}; // VZA, dot(view,sun), SZA, altitude
+constexpr int lightPollutionTexSize[2]={10,5}; // VZA, altitude
+constexpr double earthRadius=6371e3, atmosphereHeight=120e3; // keep in sync with writeModel()
+const double lengthOfHorizRayFromGroundToTOA=std::sqrt(atmosphereHeight*(atmosphereHeight+2*earthRadius));
+
+bool writeTexture(QString const& path, std::vector<int> const& sizes, std::vector<float> const& texels)
+{
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly))
+        return false;
+    for(const auto size : sizes)
+    {
+        const uint16_t size16=size;
+        file.write(reinterpret_cast<const char*>(&size16), sizeof size16);
+    }
+    const qint64 dataSize=texels.size()*sizeof texels[0];
+    return file.write(reinterpret_cast<const char*>(texels.data()), dataSize)==dataSize;
+}
+
+bool writeModel(QString const& dir)
+{
+    QFile params(dir+"/params.atmo");
+    if(!params.open(QFile::WriteOnly))
+        return false;
+    params.write(QString(R"(version: 6
+scattering texture size for VZA: %1
+scattering texture size for dot(view,sun): %2
+scattering texture size for SZA: %3
+scattering texture size for altitude: %4
+light pollution texture size for VZA: %5
+light pollution texture size for altitude: %6
+Earth radius: 6371 km
+atmosphere height: 120 km
+wavelengths: min=360nm,max=830nm,count=4
+)").arg(scatTexSize[0]).arg(scatTexSize[1]).arg(scatTexSize[2]).arg(scatTexSize[3])
+   .arg(lightPollutionTexSize[0]).arg(lightPollutionTexSize[1]).toUtf8());
+    params.close();
+
+    std::vector<float> scattering;
+    for(int i3=0; i3<scatTexSize[3]; ++i3)
+        for(int i2=0; i2<scatTexSize[2]; ++i2)
+            for(int i1=0; i1<scatTexSize[1]; ++i1)
+                for(int i0=0; i0<scatTexSize[0]; ++i0)
+                    scattering.insert(scattering.end(), {float(i0), float(i1), float(i2), float(i3)});
+    if(!writeTexture(dir+"/multiple-scattering-xyzw.f32", std::vector<int>(scatTexSize, scatTexSize+4), scattering))
+        return false;
+
+    std::vector<float> lightPollution;
+    for(int i1=0; i1<lightPollutionTexSize[1]; ++i1)
+        for(int i0=0; i0<lightPollutionTexSize[0]; ++i0)
+            lightPollution.insert(lightPollution.end(), {float(i0), float(i1), 1.f, 0.f});
+    return writeTexture(dir+"/light-pollution-xyzw.f32", std::vector<int>(lightPollutionTexSize, lightPollutionTexSize+2),
+                        lightPollution);
+}
+
+// Fractional texel index of the altitude coordinate in a texture with `size` altitude layers
+double altitudeIndex(const double altitude, const int size)
+{
+    return (size-1)*std::sqrt(altitude*altitude+2*altitude*earthRadius)/lengthOfHorizRayFromGroundToTOA;
+}
+
+// Fractional texel index of the SZA coordinate, per the parametrization of E. Bruneton's model
+double szaIndex(const double cosSZA)
+{
+    const double R=earthRadius, H=atmosphereHeight, L=lengthOfHorizRayFromGroundToTOA;
+    const double distToTOA=-R*cosSZA+std::sqrt(R*R*(cosSZA*cosSZA-1)+(R+H)*(R+H));
+    const double a=(distToTOA-H)/(L-H);
+    const double A=2*R/(L-H);
+    return (scatTexSize[2]-1)*std::max(0., 1-a/A)/(1+a);
+}
+
+struct Case
+{
+    float altitude;
+    QVector3D viewDir, sunDir;
+    QVector4D expected;
+};
+
+int checkCases(ShowMySky::SkyQuery const& query, std::vector<Case> const& cases)
+{
+    for(unsigned n=0; n<cases.size(); ++n)
+    {
+        const auto& c=cases[n];
+        const ShowMySky::SkyQuery::Query q{c.altitude, c.viewDir, c.sunDir};
+        ShowMySky::SkyQuery::Result result;
+        query.evaluate(&q, 1, &result);
+        for(int i=0; i<4; ++i)
+        {
+            if(!(std::abs(result.luminance[i]-c.expected[i]) <= indexTolerance))
+            {
+                FAIL("case #" << n << ", component " << i << ": expected " << c.expected[i]
+                     << ", actual " << result.luminance[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+int testScatteringTexCoords(QString const& modelDir)
+{
+    ShowMySky::SkyQuery query(modelDir);
+    const float H=atmosphereHeight;
+    const QVector3D up(0,0,1), down(0,0,-1), horizontal(1,0,0), sun60deg(std::sqrt(0.75f),0,0.5f);
+    const float vzaUp=scatTexSize[0]/2, vzaDown=scatTexSize[0]/2-1, vzaHorizontal=scatTexSize[0]-1;
+    const float dotVSMax=scatTexSize[1]-1, dotVSMid=(scatTexSize[1]-1)/2.f;
+    const float szaZenith=scatTexSize[2]-1;
+    const float altTOA=scatTexSize[3]-1;
+    return checkCases(query, {
+        {0, up,         up,         QVector4D(vzaUp,         dotVSMax,  szaZenith,   0)},
+        {H, horizontal, up,         QVector4D(vzaUp,         dotVSMid,  szaZenith,   altTOA)},
+        {0, up,         horizontal, QVector4D(vzaUp,         dotVSMid,  szaIndex(0), 0)},
+        {0, horizontal, up,         QVector4D(vzaHorizontal, dotVSMid,  szaZenith,   0)},
+        {H/2, down, sun60deg, QVector4D(vzaDown, dotVSMax/4, szaIndex(0.5), altitudeIndex(H/2, scatTexSize[3]))},
+        // Observers above the atmosphere see it from its top boundary...
+        {2*H, down,     up,         QVector4D(vzaDown,       0,         szaZenith,   altTOA)},
+        // ...or nothing, if the view ray misses it
+        {2*H, up,       up,         QVector4D(0,0,0,0)},
+    });
+}
+
+int testLightPollutionTexCoords(QString const& modelDir)
+{
+    ShowMySky::SkyQuery query(modelDir);
+    query.setMultipleScatteringEnabled(false);
+    query.setSingleScatteringEnabled(false);
+    constexpr float groundLuminance=2;
+    query.setLightPollutionGroundLuminance(groundLuminance);
+    const float H=atmosphereHeight;
+    const QVector3D up(0,0,1), down(0,0,-1);
+    const float vzaUp=lightPollutionTexSize[0]/2, vzaDown=lightPollutionTexSize[0]/2-1;
+    return checkCases(query, {
+        {0,   up,   up, groundLuminance*QVector4D(vzaUp,   0, 1, 0)},
+        {H/2, down, up, groundLuminance*QVector4D(vzaDown, altitudeIndex(H/2, lightPollutionTexSize[1]), 1, 0)},
+    });
+}
+
+int testBatchedEvaluation(QString const& modelDir)
+{
+    ShowMySky::SkyQuery query(modelDir);
+    query.setLightPollutionGroundLuminance(1);
+
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> altitudeDist(0, 1.5*atmosphereHeight);
+    std::normal_distribution<float> normalDist;
+    const auto randomDir=[&]{ return QVector3D(normalDist(gen), normalDist(gen), normalDist(gen)).normalized(); };
+    std::vector<ShowMySky::SkyQuery::Query> queries(10000);
+    for(auto& q : queries)
+        q={altitudeDist(gen), randomDir(), randomDir()};
+
+    std::vector<ShowMySky::SkyQuery::Result> reference(queries.size());
+    for(unsigned n=0; n<queries.size(); ++n)
+        query.evaluate(&queries[n], 1, &reference[n]);
+
+    for(const unsigned threadCount : {1u, 4u, 0u})
+    {
+        query.setMaxThreadCount(threadCount);
+        std::vector<ShowMySky::SkyQuery::Result> results(queries.size());
+        query.evaluate(queries.data(), queries.size(), results.data());
+        for(unsigned n=0; n<queries.size(); ++n)
+        {
+            if(results[n].luminance!=reference[n].luminance)
+            {
+                FAIL("batch with at most " << threadCount << " threads differs from single query #" << n << ": expected ("
+                     << reference[n].luminance.x() << "," << reference[n].luminance.y() << ","
+                     << reference[n].luminance.z() << "," << reference[n].luminance.w() << "), actual ("
+                     << results[n].luminance.x() << "," << results[n].luminance.y() << ","
+                     << results[n].luminance.z() << "," << results[n].luminance.w() << ")");
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+try
+{
+    std::cerr.precision(std::numeric_limits<float>::max_digits10);
+
+    if(argc!=2)
+    {
+        std::cerr << "Which test to run?\n";
+        return 1;
+    }
+
+    QTemporaryDir modelDir;
+    if(!modelDir.isValid() || !writeModel(modelDir.path()))
+    {
+        std::cerr << "Failed to write the synthetic model\n";
+        return 1;
+    }
+
+    const std::string arg=argv[1];
+    if(arg=="scattering texture coordinates")
+        return testScatteringTexCoords(modelDir.path());
+    if(arg=="light pollution texture coordinates")
+        return testLightPollutionTexCoords(modelDir.path());
+    if(arg=="batched evaluation")
+        return testBatchedEvaluation(modelDir.path());
+
+    std::cerr << "Unknown test " << arg << "\n";
+    return 1;
+}
+catch(ShowMySky::Error const& ex)
+{
+    std::cerr << ex.errorType().toStdString() << ": " << ex.what().toStdString() << "\n";
+    return 1;
+}
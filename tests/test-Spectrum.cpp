@@ -1,6 +1,9 @@
 #include "../common/Spectrum.hpp"
 #include <cmath>
 #include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 #include <iostream>
 
 constexpr auto resampleWavelengthTolerance=1e-14;
@@ -31,6 +34,90 @@ int test1(Spectrum const& spectrum, Spectrum const& reference, const double minW
     return 0;
 }
 
+int testBatchedLookup(Spectrum const& spectrum)
+{
+    std::vector<double> wls;
+    for(double wl=spectrum.minWL(); wl<=spectrum.maxWL(); wl+=0.37)
+        wls.push_back(wl);
+    wls.push_back(spectrum.maxWL());
+    // Unsorted tail to exercise the restart of the sweep
+    wls.push_back(spectrum.minWL());
+    wls.push_back(1500.5);
+    wls.push_back(400);
+
+    const auto values=spectrum.valuesAt(wls.data(), wls.size());
+    if(values.size()!=wls.size())
+        FAIL("batched lookup returned " << values.size() << " values instead of " << wls.size());
+    for(unsigned i=0; i<wls.size(); ++i)
+    {
+        const auto reference=spectrum.value(wls[i]);
+        if(std::abs(values[i]-reference) > integrationTolerance*std::abs(reference))
+            FAIL("batched value #" << i << " at " << wls[i] << "nm doesn't match reference: expected " << reference << ", actual " << values[i]);
+    }
+    return 0;
+}
+
+int testDenseLinearResampling()
+{
+    // Average of a linear function over a bin is its value at the bin center, so the result is known exactly
+    const auto linear=[](double wl){ return 0.25+1e-3*wl; };
+    Spectrum dense;
+    for(int i=0; i<=50000; ++i)
+    {
+        const auto wl=300+0.04*i;
+        dense.append(wl, linear(wl));
+    }
+    const double minWL=360, maxWL=830;
+    const int pointCount=301;
+    const auto resampled=dense.resample(minWL,maxWL,pointCount);
+    if(int(resampled.size())!=pointCount)
+        FAIL("resampled size doesn't match requested point count");
+    for(unsigned i=0; i<resampled.size(); ++i)
+    {
+        const auto expected=linear(resampled.wavelengths[i]);
+        if(std::abs(resampled.values[i]-expected)/expected > integrationTolerance)
+            FAIL("resampled value #" << i << " doesn't match linear function: expected " << expected << ", actual " << resampled.values[i]);
+    }
+    return 0;
+}
+
+int testCSVParsing()
+{
+    const QByteArray csv="# wavelength,value\n"
+                         "302,0.5\n"
+                         "\n"
+                         " 304 , 0.625\r\n"
+                         "+306,7e-1\n";
+    const auto spectrum=Spectrum::parseFromCSV(csv, "good.csv", 1);
+    const Spectrum reference{{302,304,306},{0.5,0.625,0.7}};
+    if(spectrum.wavelengths!=reference.wavelengths || spectrum.values!=reference.values)
+        FAIL("parsed spectrum doesn't match reference");
+
+    const std::pair<QByteArray, QString> badInputs[]=
+    {
+        {"302,0.5\n# comment\n304,0.6,1\n",  "bad.csv:3: bad spectrum line: expected \"key,value\" pair, got \"304,0.6,1\""},
+        {"302,0.5\n304\n",                    "bad.csv:2: bad spectrum line: expected \"key,value\" pair, got \"304\""},
+        {"302,0.5\n30x4,0.6\n",               "bad.csv:2: failed to parse wavelength string \"30x4\""},
+        {"302,0.5\n\n304, \n",               "bad.csv:3: failed to parse spectrum value string \" \""},
+        {"302,0.5\n304,0.6\n303,0.7\n",      "bad.csv:3: wavelengths don't grow monotonically as they should"},
+        {"# nothing here\n\n",                "bad.csv:3: Read empty spectrum"},
+    };
+    for(const auto& [input, expectedError] : badInputs)
+    {
+        try
+        {
+            Spectrum::parseFromCSV(input, "bad.csv", 1);
+            FAIL("no error reported for bad input \"" << input.constData() << "\"");
+        }
+        catch(ParsingError const& ex)
+        {
+            if(ex.what()!=expectedError)
+                FAIL("wrong error: expected \"" << expectedError.toStdString() << "\", got \"" << ex.what().toStdString() << "\"");
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 try
 {
@@ -279,6 +366,12 @@ try
               360,830,16);
         break;
     }
+    case 5:
+        return testBatchedLookup(spect1);
+    case 6:
+        return testDenseLinearResampling();
+    case 7:
+        return testCSVParsing();
     default:
         std::cerr << "Bad test number " << whichTest << "\n";
         return 1;